@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+#include <vector>
+
+#include "bench/util.h"
+#include "eval/node.h"
+#include "parse/parse.h"
+
+namespace bench {
+
+namespace {
+
+// Defines |definitions| in a fresh environment, then evaluates |expr|
+// |iterations| times with |engine|.
+void RunProgram(const char* definitions,
+                const char* expr,
+                size_t iterations,
+                eval::Engine engine = eval::Engine::TREE_WALKER) {
+  auto prev_engine = eval::GetEngine();
+  eval::SetEngine(engine);
+  auto env = eval::GetDefaultEnv();
+  EvalStr(definitions, env.get());
+  auto exprs = parse::Read(expr);
+  ResetTimer();
+  for (size_t i = 0; i < iterations; ++i) {
+    DoNotOptimize(eval::Eval(exprs[0].get(), env.get()));
+  }
+  eval::SetEngine(prev_engine);
+}
+
+const char kFib[] =
+    "(define fib"
+    "  (lambda (n) (if (< n 2) 1 (+ (fib (- n 1)) (fib (- n 2))))))";
+
+// Exercises let, cond, and, or and set! in a loop.
+const char kSpecialForms[] =
+    "(define count-matches"
+    "  (lambda (n)"
+    "    (let ((total 0))"
+    "      (letrec ((loop"
+    "                (lambda (i)"
+    "                  (cond ((= i n) total)"
+    "                        ((and (odd? i) (or (< i 10) (> i 20)))"
+    "                         (set! total (+ total 1))"
+    "                         (loop (+ i 1)))"
+    "                        (else (loop (+ i 1)))))))"
+    "        (loop 0)))))";
+
+// A loop of tail calls, which runs in constant stack.
+const char kLoop[] =
+    "(define loop"
+    "  (lambda (n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1)))))";
+
+// The same loop as a do, which rebinds a single frame.
+const char kDoLoop[] =
+    "(define do-loop"
+    "  (lambda (n)"
+    "    (do ((n n (- n 1)) (acc 0 (+ acc 1))) ((= n 0) acc))))";
+
+// Searches a list with for-each, leaving through a continuation.
+const char kEarlyExit[] =
+    "(define (find-first pred l)"
+    "  (call/cc"
+    "    (lambda (return)"
+    "      (for-each (lambda (x) (if (pred x) (return x))) l)"
+    "      #f)))"
+    "(define nums"
+    "  (do ((i 0 (+ i 1)) (l '() (cons i l))) ((= i 1000) l)))";
+
+// A helper returning two results, as values and as a list.
+const char kDivMod[] =
+    "(define (div-mod a b) (values (quotient a b) (remainder a b)))"
+    "(define (sum-div-mods n)"
+    "  (do ((i 0 (+ i 1))"
+    "       (acc 0 (receive (q r) (div-mod i 7) (+ acc q r))))"
+    "      ((= i n) acc)))";
+
+const char kDivModList[] =
+    "(define (div-mod a b) (list (quotient a b) (remainder a b)))"
+    "(define (sum-div-mods n)"
+    "  (do ((i 0 (+ i 1))"
+    "       (acc 0 (let ((l (div-mod i 7))) (+ acc (car l) (cadr l)))))"
+    "      ((= i n) acc)))";
+
+// Generates code from a template, most of which is literal.
+const char kTemplate[] =
+    "(define (gen n)"
+    "  `(define (f x)"
+    "     (let ((y (* x ,n)))"
+    "       (if (> y 100) (list 'big y) (list 'small y ,@(list n n))))))"
+    "(define (gen-all n)"
+    "  (do ((i 0 (+ i 1)) (acc '() (gen i))) ((= i n) acc)))";
+
+// An infinite stream and a consumer which drops its elements.
+const char kStream[] =
+    "(define (from n) (stream-cons n (from (+ n 1))))"
+    "(define (square x) (* x x))"
+    "(define (drop s n) (if (= n 0) s (drop (stream-cdr s) (- n 1))))";
+
+// Macros used by every procedure of MacroProgram().
+const char kMacros[] =
+    "(define-syntax swap!"
+    "  (syntax-rules ()"
+    "    ((_ a b) (let ((tmp a)) (set! a b) (set! b tmp)))))"
+    "(define-syntax my-or"
+    "  (syntax-rules ()"
+    "    ((_) #f)"
+    "    ((_ e) e)"
+    "    ((_ e r ...) (let ((t e)) (if t t (my-or r ...))))))"
+    "(define-syntax while"
+    "  (syntax-rules ()"
+    "    ((_ test body ...) (let lp () (if test (begin body ... (lp)) #f)))))"
+    "(define-syntax my-cond"
+    "  (syntax-rules (else)"
+    "    ((_ (else e ...)) (begin e ...))"
+    "    ((_ (c e ...) clause ...) (if c (begin e ...) (my-cond clause ...)))))";
+
+// A large file of procedures which use the macros of kMacros.
+std::string MacroProgram() {
+  std::string program;
+  for (int i = 0; i < 500; ++i) {
+    auto name = "proc" + std::to_string(i);
+    program +=
+        "(define (" + name + " a b n)"
+        "  (while (> n 0)"
+        "    (swap! a b)"
+        "    (my-cond ((my-or (= n 1) (= n 2) (= n 3)) (set! n 0))"
+        "             ((my-or (< a b) (> a 100)) (set! n (- n 1)))"
+        "             (else (set! n (- n 2)))))"
+        "  (my-or (and (> a b) a) b))";
+  }
+  return program;
+}
+
+// Analyzes every form of MacroProgram() |iterations| times. With |cached|, the
+// macros are defined once, so later analyses reuse the first expansions.
+void RunExpansion(size_t iterations, bool cached) {
+  auto env = eval::GetDefaultEnv();
+  auto macros = parse::Read(kMacros);
+  auto forms = parse::Read(MacroProgram());
+  for (const auto& macro : macros) {
+    eval::Analyze(macro.get(), env.get());
+  }
+  ResetTimer();
+  for (size_t i = 0; i < iterations; ++i) {
+    if (!cached) {
+      for (const auto& macro : macros) {
+        eval::Analyze(macro.get(), env.get());
+      }
+    }
+    for (const auto& form : forms) {
+      DoNotOptimize(eval::Analyze(form.get(), env.get()));
+    }
+  }
+}
+
+}  // namespace
+
+BENCHMARK(Fib20) {
+  RunProgram(kFib, "(fib 20)", iterations);
+}
+
+BENCHMARK(SpecialForms) {
+  RunProgram(kSpecialForms, "(count-matches 1000)", iterations);
+}
+
+BENCHMARK(TailLoop100k) {
+  RunProgram(kLoop, "(loop 100000 0)", iterations);
+}
+
+BENCHMARK(DoLoop100k) {
+  RunProgram(kDoLoop, "(do-loop 100000)", iterations);
+}
+
+BENCHMARK(EarlyExit) {
+  RunProgram(kEarlyExit, "(find-first (lambda (x) (< x 500)) nums)",
+             iterations);
+}
+
+BENCHMARK(DivMod10k) {
+  RunProgram(kDivMod, "(sum-div-mods 10000)", iterations);
+}
+
+BENCHMARK(DivModList10k) {
+  RunProgram(kDivModList, "(sum-div-mods 10000)", iterations);
+}
+
+BENCHMARK(Quasiquote10k) {
+  RunProgram(kTemplate, "(gen-all 10000)", iterations);
+}
+
+// Consumes a stream of 100000 elements, sampling the heap every 1000.
+// Nothing holds the head of the stream, so the heap stays the same size however
+// long it is.
+BENCHMARK(Stream100k) {
+  auto env = eval::GetDefaultEnv();
+  EvalStr(kStream, env.get());
+  ResetTimer();
+  for (size_t i = 0; i < iterations; ++i) {
+    EvalStr("(define s (stream-map square (stream-filter odd? (from 0))))",
+            env.get());
+    for (int chunk = 0; chunk < 100; ++chunk) {
+      EvalStr("(set! s (drop s 1000))", env.get());
+      RecordHeapSize();
+    }
+    DoNotOptimize(EvalStr("(stream-car s)", env.get()));
+  }
+}
+
+BENCHMARK(MacroExpand) {
+  RunExpansion(iterations, false /* cached */);
+}
+
+BENCHMARK(MacroExpandCached) {
+  RunExpansion(iterations, true /* cached */);
+}
+
+BENCHMARK(Fib20Vm) {
+  RunProgram(kFib, "(fib 20)", iterations, eval::Engine::VM);
+}
+
+BENCHMARK(SpecialFormsVm) {
+  RunProgram(kSpecialForms, "(count-matches 1000)", iterations,
+             eval::Engine::VM);
+}
+
+BENCHMARK(TailLoop100kVm) {
+  RunProgram(kLoop, "(loop 100000 0)", iterations, eval::Engine::VM);
+}
+
+BENCHMARK(DoLoop100kVm) {
+  RunProgram(kDoLoop, "(do-loop 100000)", iterations, eval::Engine::VM);
+}
+
+BENCHMARK(EarlyExitVm) {
+  RunProgram(kEarlyExit, "(find-first (lambda (x) (< x 500)) nums)",
+             iterations, eval::Engine::VM);
+}
+
+BENCHMARK(DivMod10kVm) {
+  RunProgram(kDivMod, "(sum-div-mods 10000)", iterations, eval::Engine::VM);
+}
+
+BENCHMARK(DivModList10kVm) {
+  RunProgram(kDivModList, "(sum-div-mods 10000)", iterations,
+             eval::Engine::VM);
+}
+
+// The tree walker with every lambda compiled to native code on its first call.
+BENCHMARK(Fib20Jit) {
+  eval::SetJitThreshold(1);
+  RunProgram(kFib, "(fib 20)", iterations);
+  eval::SetJitThreshold(0);
+}
+
+BENCHMARK(SpecialFormsJit) {
+  eval::SetJitThreshold(1);
+  RunProgram(kSpecialForms, "(count-matches 1000)", iterations);
+  eval::SetJitThreshold(0);
+}
+
+BENCHMARK(TailLoop100kJit) {
+  eval::SetJitThreshold(1);
+  RunProgram(kLoop, "(loop 100000 0)", iterations);
+  eval::SetJitThreshold(0);
+}
+
+BENCHMARK(DoLoop100kJit) {
+  eval::SetJitThreshold(1);
+  RunProgram(kDoLoop, "(do-loop 100000)", iterations);
+  eval::SetJitThreshold(0);
+}
+
+BENCHMARK(EarlyExitJit) {
+  eval::SetJitThreshold(1);
+  RunProgram(kEarlyExit, "(find-first (lambda (x) (< x 500)) nums)",
+             iterations);
+  eval::SetJitThreshold(0);
+}
+
+BENCHMARK(DivMod10kJit) {
+  eval::SetJitThreshold(1);
+  RunProgram(kDivMod, "(sum-div-mods 10000)", iterations);
+  eval::SetJitThreshold(0);
+}
+
+}  // namespace bench
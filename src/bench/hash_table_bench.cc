@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+
+#include "bench/util.h"
+#include "expr/hash_table.h"
+#include "expr/number.h"
+#include "parse/parse.h"
+
+namespace bench {
+
+namespace {
+
+using expr::Expr;
+
+// Returns an environment with |size| integer keys in both an association list
+// |alist| and an equal? hash table |table|. |keys| is a vector holding those
+// keys followed by |extra| keys which are in neither.
+gc::Lock<expr::Env> MakeEnv(size_t size, size_t extra) {
+  auto env = eval::GetDefaultEnv();
+  auto keys = gc::make_locked<expr::Vector>(
+      std::vector<Expr*>(size + extra, expr::Nil()));
+  env->DefineVar(expr::Symbol::New("keys"), keys.get());
+  for (size_t i = 0; i < size + extra; ++i) {
+    keys->vals()[i] = new expr::Int(i);
+  }
+
+  auto table = gc::make_locked<expr::HashTable>(expr::HashTable::Kind::EQUAL);
+  env->DefineVar(expr::Symbol::New("table"), table.get());
+  gc::Lock<Expr> alist(expr::Nil());
+  for (size_t i = 0; i < size; ++i) {
+    auto* key = keys->vals()[i];
+    table->Set(key, key);
+    auto entry = gc::make_locked<expr::Pair>(key, key);
+    alist.reset(new expr::Pair(entry.get(), alist.get()));
+  }
+  env->DefineVar(expr::Symbol::New("alist"), alist.get());
+
+  return env;
+}
+
+// Evaluates |str| |iterations| times with |j| bound to |index(i)| on the ith
+// iteration.
+template <typename IndexFunc>
+void RunWithIndex(expr::Env* env,
+                  const char* str,
+                  size_t iterations,
+                  IndexFunc index) {
+  auto exprs = parse::Read(str);
+  auto* j = expr::Symbol::New("j");
+  ResetTimer();
+  for (size_t i = 0; i < iterations; ++i) {
+    auto idx = gc::make_locked<expr::Int>(index(i));
+    env->DefineVar(j, idx.get());
+    DoNotOptimize(eval::Eval(exprs[0].get(), env));
+  }
+}
+
+// Looks up a pseudo random existing key each iteration.
+void RunLookup(const char* str, size_t size, size_t iterations) {
+  auto env = MakeEnv(size, 0);
+  RunWithIndex(env.get(), str, iterations,
+               [size](size_t i) { return (i * 2654435761u) % size; });
+}
+
+// Inserts a new key each iteration.
+void RunInsert(const char* str, size_t size, size_t iterations) {
+  auto env = MakeEnv(size, iterations);
+  RunWithIndex(env.get(), str, iterations,
+               [size](size_t i) { return size + i; });
+}
+
+constexpr char kHashLookup[] =
+    "(hash-table-ref/default table (vector-ref keys j) #f)";
+constexpr char kAssocLookup[] = "(assoc (vector-ref keys j) alist)";
+constexpr char kHashInsert[] = "(hash-table-set! table (vector-ref keys j) j)";
+constexpr char kAssocInsert[] =
+    "(if (not (assoc (vector-ref keys j) alist))"
+    "  (set! alist (cons (cons (vector-ref keys j) j) alist)))";
+
+}  // namespace
+
+BENCHMARK(HashTableLookup10) {
+  RunLookup(kHashLookup, 10, iterations);
+}
+
+BENCHMARK(AssocLookup10) {
+  RunLookup(kAssocLookup, 10, iterations);
+}
+
+BENCHMARK(HashTableLookup1K) {
+  RunLookup(kHashLookup, 1000, iterations);
+}
+
+BENCHMARK(AssocLookup1K) {
+  RunLookup(kAssocLookup, 1000, iterations);
+}
+
+BENCHMARK(HashTableLookup1M) {
+  RunLookup(kHashLookup, 1000000, iterations);
+}
+
+BENCHMARK(AssocLookup1M) {
+  RunLookup(kAssocLookup, 1000000, iterations);
+}
+
+BENCHMARK(HashTableInsert10) {
+  RunInsert(kHashInsert, 10, iterations);
+}
+
+BENCHMARK(AssocInsert10) {
+  RunInsert(kAssocInsert, 10, iterations);
+}
+
+BENCHMARK(HashTableInsert1K) {
+  RunInsert(kHashInsert, 1000, iterations);
+}
+
+BENCHMARK(AssocInsert1K) {
+  RunInsert(kAssocInsert, 1000, iterations);
+}
+
+BENCHMARK(HashTableInsert1M) {
+  RunInsert(kHashInsert, 1000000, iterations);
+}
+
+BENCHMARK(AssocInsert1M) {
+  RunInsert(kAssocInsert, 1000000, iterations);
+}
+
+}  // namespace bench
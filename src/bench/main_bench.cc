@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bench/util.h"
+#include "gc/gc.h"
+#include "util/flags.h"
+
+namespace bench {
+
+size_t g_num_allocs = 0;
+
+namespace {
+
+size_t g_peak_objects = 0;
+
+// Minimum duration of a timed run.
+constexpr double kMinSeconds = 0.5;
+
+std::vector<std::pair<const char*, BenchmarkFunc>>& Benchmarks() {
+  static std::vector<std::pair<const char*, BenchmarkFunc>> benchmarks;
+  return benchmarks;
+}
+
+std::chrono::steady_clock::time_point g_start;
+
+double TimeRun(BenchmarkFunc func, size_t iterations) {
+  g_start = std::chrono::steady_clock::now();
+  g_num_allocs = 0;
+  g_peak_objects = 0;
+  func(iterations);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - g_start;
+  return elapsed.count();
+}
+
+}  // namespace
+
+void ResetTimer() {
+  g_start = std::chrono::steady_clock::now();
+  g_num_allocs = 0;
+}
+
+void RecordHeapSize() {
+  g_peak_objects = std::max(g_peak_objects, gc::Gc::Get().NumObjects());
+}
+
+Registration::Registration(const char* name, BenchmarkFunc func) {
+  Benchmarks().emplace_back(name, func);
+}
+
+void RunAll(const std::string& filter) {
+  std::printf("%-40s %15s %12s %14s %12s\n", "Benchmark", "ns/iter",
+              "iterations", "allocs/iter", "peak objs");
+  for (const auto& benchmark : Benchmarks()) {
+    if (std::string(benchmark.first).find(filter) == std::string::npos) {
+      continue;
+    }
+
+    size_t iterations = 1;
+    double seconds = TimeRun(benchmark.second, iterations);
+    while (seconds < kMinSeconds) {
+      iterations *= seconds > 0.0 && kMinSeconds / seconds < 10.0 ? 2 : 10;
+      seconds = TimeRun(benchmark.second, iterations);
+    }
+
+    std::printf("%-40s %15.1f %12zu %14.1f", benchmark.first,
+                seconds * 1e9 / iterations, iterations,
+                static_cast<double>(g_num_allocs) / iterations);
+    if (g_peak_objects) {
+      std::printf(" %12zu", g_peak_objects);
+    }
+    std::printf("\n");
+  }
+}
+
+}  // namespace bench
+
+// Count heap allocations made by benchmarks.
+void* operator new(std::size_t size) {
+  ++bench::g_num_allocs;
+  if (void* ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t /* size */) noexcept {
+  std::free(ptr);
+}
+
+int main(int argc, char** argv) {
+  util::Flags::Init(argc, argv, true /* test_mode */);
+
+  // The first non flag argument filters which benchmarks are run.
+  std::string filter;
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] != '-') {
+      filter = argv[i];
+      break;
+    }
+  }
+
+  bench::RunAll(filter);
+  return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+
+#include "bench/util.h"
+#include "util/simd.h"
+
+namespace bench {
+
+namespace {
+
+constexpr size_t kKernelSize = 1 << 20;
+
+const std::vector<double>& KernelInput() {
+  static const std::vector<double> input = [] {
+    std::vector<double> ret(kKernelSize);
+    for (size_t i = 0; i < ret.size(); ++i) {
+      ret[i] = static_cast<double>(i % 1000) * 0.5;
+    }
+    return ret;
+  }();
+  return input;
+}
+
+void RunSum(util::simd::Isa isa, size_t iterations) {
+  auto& kernels = *util::simd::GetForIsa(isa);
+  auto& x = KernelInput();
+  for (size_t i = 0; i < iterations; ++i) {
+    DoNotOptimize(kernels.sum(x.data(), x.size()));
+  }
+}
+
+void RunDot(util::simd::Isa isa, size_t iterations) {
+  auto& kernels = *util::simd::GetForIsa(isa);
+  auto& x = KernelInput();
+  for (size_t i = 0; i < iterations; ++i) {
+    DoNotOptimize(kernels.dot(x.data(), x.data(), x.size()));
+  }
+}
+
+void RunAxpy(util::simd::Isa isa, size_t iterations) {
+  auto& kernels = *util::simd::GetForIsa(isa);
+  auto& x = KernelInput();
+  std::vector<double> y(x.size());
+  for (size_t i = 0; i < iterations; ++i) {
+    kernels.axpy(1.0001, x.data(), y.data(), x.size());
+    DoNotOptimize(y);
+  }
+}
+
+// Runs |expr| |iterations| times in an environment where |v| is an f64vector
+// of 10000 elements.
+void RunScheme(const char* expr, size_t iterations) {
+  auto env = eval::GetDefaultEnv();
+  EvalStr("(define v (make-f64vector 10000 1.5))", env.get());
+  for (size_t i = 0; i < iterations; ++i) {
+    DoNotOptimize(EvalStr(expr, env.get()));
+  }
+}
+
+}  // namespace
+
+BENCHMARK(SumScalar1M) {
+  RunSum(util::simd::Isa::SCALAR, iterations);
+}
+
+BENCHMARK(SumBest1M) {
+  RunSum(util::simd::BestIsa(), iterations);
+}
+
+BENCHMARK(DotScalar1M) {
+  RunDot(util::simd::Isa::SCALAR, iterations);
+}
+
+BENCHMARK(DotBest1M) {
+  RunDot(util::simd::BestIsa(), iterations);
+}
+
+BENCHMARK(AxpyScalar1M) {
+  RunAxpy(util::simd::Isa::SCALAR, iterations);
+}
+
+BENCHMARK(AxpyBest1M) {
+  RunAxpy(util::simd::BestIsa(), iterations);
+}
+
+// The previous way to sum numbers: boxing every element and folding it through
+// the generic arithmetic primitive.
+BENCHMARK(SchemeApplyPlus10K) {
+  RunScheme("(apply + (f64vector->list v))", iterations);
+}
+
+BENCHMARK(SchemeVectorSum10K) {
+  RunScheme("(vector-sum v)", iterations);
+}
+
+}  // namespace bench
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BENCH_UTIL_H_
+#define BENCH_UTIL_H_
+
+#include <cstddef>
+#include <string>
+
+#include "eval/eval.h"
+#include "expr/expr.h"
+#include "gc/lock.h"
+
+namespace bench {
+
+using BenchmarkFunc = void (*)(size_t iterations);
+
+// Registers |func| to be run by the benchmark binary. Use BENCHMARK instead.
+class Registration {
+ public:
+  Registration(const char* name, BenchmarkFunc func);
+};
+
+// Runs every registered benchmark whose name contains |filter|. Each one is
+// run with increasing iteration counts until a run takes long enough to time
+// reliably, then its time per iteration is reported.
+void RunAll(const std::string& filter);
+
+// Restarts timing and allocation counting of the current run. Call after setup
+// which shouldn't be measured.
+void ResetTimer();
+
+// Number of heap allocations made in the current run.
+extern size_t g_num_allocs;
+
+// Samples the number of objects in the garbage collected heap. The largest
+// sample of a run is reported for benchmarks which call this.
+void RecordHeapSize();
+
+// Prevents the compiler from optimizing away the computation of |val|.
+template <typename T>
+inline void DoNotOptimize(const T& val) {
+  asm volatile("" : : "g"(&val) : "memory");
+}
+
+// Evaluates every expression in |str| in |env|, returning the last result.
+inline gc::Lock<expr::Expr> EvalStr(const std::string& str, expr::Env* env) {
+  auto results = eval::EvalString(str, env, "bench");
+  return results.empty() ? gc::Lock<expr::Expr>() : results.back();
+}
+
+}  // namespace bench
+
+// Defines a benchmark. The body is run with |iterations| set by the harness.
+#define BENCHMARK(name)                                                 \
+  void Benchmark##name(size_t iterations);                              \
+  static ::bench::Registration benchmark_##name##_registration(         \
+      #name, Benchmark##name);                                          \
+  void Benchmark##name(size_t iterations)
+
+#endif  // BENCH_UTIL_H_
@@ -0,0 +1,1165 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "eval/eval.h"
+#include "eval/macro.h"
+#include "eval/node.h"
+#include "util/exceptions.h"
+
+using expr::Env;
+using expr::Expr;
+using expr::Nil;
+using expr::Pair;
+using expr::Symbol;
+using expr::Syntax;
+using util::RuntimeException;
+
+namespace eval {
+
+namespace {
+
+// The variables of a frame being analyzed. Each scope is a frame at runtime,
+// and local variables and keywords shadow keywords and top level variables.
+class Scope {
+ public:
+  explicit Scope(const Scope* parent) : parent_(parent) {}
+
+  // Adds a slot for |var|, returning its index. Later slots shadow earlier ones
+  // of the same name.
+  size_t Add(Symbol* var) {
+    vars_.push_back(var);
+    return vars_.size() - 1;
+  }
+  size_t num_slots() const { return vars_.size(); }
+
+  // Binds |name| to |macro| from let-syntax, letrec-syntax or an internal
+  // define-syntax. Keywords take no slot.
+  void AddKeyword(Symbol* name, Macro* macro) {
+    keywords_.emplace_back(name, macro);
+  }
+
+  // Returns true if |var| is a local variable, setting |depth| and |index| to
+  // its frame and slot.
+  static bool Resolve(const Scope* scope,
+                      Symbol* var,
+                      size_t* depth,
+                      size_t* index) {
+    for (*depth = 0; scope != nullptr; scope = scope->parent_, ++*depth) {
+      auto it = std::find(scope->vars_.rbegin(), scope->vars_.rend(), var);
+      if (it != scope->vars_.rend()) {
+        *index = scope->vars_.rend() - it - 1;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Returns the keyword |name| is bound to in |scope| or those enclosing it,
+  // or null if it's bound to a variable first or not at all.
+  static Macro* FindKeyword(const Scope* scope, Symbol* name) {
+    for (; scope != nullptr; scope = scope->parent_) {
+      if (std::find(scope->vars_.begin(), scope->vars_.end(), name) !=
+          scope->vars_.end()) {
+        return nullptr;
+      }
+      for (auto it = scope->keywords_.rbegin(); it != scope->keywords_.rend();
+           ++it) {
+        if (it->first == name) {
+          return it->second;
+        }
+      }
+    }
+    return nullptr;
+  }
+
+  bool HasKeyword(Symbol* name) const {
+    for (const auto& keyword : keywords_) {
+      if (keyword.first == name) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // The number of frames between |scope| and |ancestor|, which encloses it.
+  static size_t Distance(const Scope* scope, const Scope* ancestor) {
+    size_t distance = 0;
+    for (; scope != ancestor; scope = scope->parent_) {
+      assert(scope);
+      ++distance;
+    }
+    return distance;
+  }
+
+  // The number of frames between |scope| and the top level.
+  static size_t Depth(const Scope* scope) {
+    size_t depth = 0;
+    for (; scope != nullptr; scope = scope->parent_) {
+      ++depth;
+    }
+    return depth;
+  }
+
+  // Records that a closure or promise made in |scope| keeps its frame and
+  // those enclosing it alive.
+  static void Capture(const Scope* scope) {
+    for (; scope != nullptr && !scope->captured_; scope = scope->parent_) {
+      scope->captured_ = true;
+    }
+  }
+
+  // True if the frame may outlive the code which made it.
+  bool captured() const { return captured_; }
+
+ private:
+  const Scope* const parent_;
+  std::vector<Symbol*> vars_;
+  std::vector<std::pair<Symbol*, Macro*>> keywords_;
+  mutable bool captured_ = false;
+};
+
+const size_t kUnlimited = static_cast<size_t>(-1);
+
+// Checks that keyword |name| was given between |min| and |max| forms.
+void ExpectNumForms(const char* name,
+                    size_t num_args,
+                    size_t min,
+                    size_t max = kUnlimited) {
+  if (num_args >= min && num_args <= max) {
+    return;
+  }
+
+  std::ostringstream os;
+  os << name << ": bad syntax. Expected ";
+  if (min == max) {
+    os << min;
+  } else if (num_args < min) {
+    os << "at least " << min;
+  } else {
+    os << "at most " << max;
+  }
+  os << " forms. Got " << num_args;
+  throw RuntimeException(os.str(), nullptr);
+}
+
+class Analyzer {
+ public:
+  explicit Analyzer(Env* env) : env_(env) {}
+
+  // |scope| is null at top level.
+  Node* Analyze(Expr* expr, Scope* scope);
+
+ private:
+  using SyntaxFunc = Node* (Analyzer::*)(Scope* scope,
+                                         Expr** args,
+                                         size_t num_args);
+
+#define X(name, str) Node* name(Scope* scope, Expr** args, size_t num_args);
+#include "expr/syntax.inc"  // NOLINT(build/include)
+#undef X
+
+  static const SyntaxFunc kSyntaxFuncs[];
+
+  template <typename T, typename... Args>
+  T* New(Args&&... args) {
+    T* node = new T(std::forward<Args>(args)...);
+    nodes_.emplace_back(node);
+    return node;
+  }
+
+  // What an identifier refers to where it's used.
+  struct Meaning {
+    // The keyword, or null if it's a variable.
+    Syntax* syntax = nullptr;
+    bool is_local = false;
+    // The frame and slot of a local variable.
+    size_t depth = 0;
+    size_t index = 0;
+    // The symbol the variable is bound by. A free alias of a top level macro
+    // is replaced by the symbol it renames.
+    gc::Lock<Symbol> var;
+  };
+  Meaning Resolve(Symbol* sym, const Scope* scope);
+
+  // Returns the keyword |expr| refers to, or null if it isn't one.
+  Syntax* TryGetSyntax(Expr* expr, const Scope* scope);
+  // True if |expr| is the auxiliary keyword |name|, e.g. else.
+  bool IsAuxKeyword(Expr* expr, Scope* scope, const char* name);
+
+  // Returns the expansion of |form|, a use of |macro| in |scope|, and records
+  // where the aliases it introduced were defined.
+  Expr* Expand(Macro* macro, Pair* form, const Scope* scope);
+  // Makes the macro of the syntax-rules form |spec|. Its free symbols refer
+  // to their bindings in |scope|.
+  Macro* MakeMacro(Expr* spec, const Scope* scope);
+  // Binds keyword |args[0]| in |scope| from an internal define-syntax.
+  void DefineLocalSyntax(Scope* scope, Expr** args, size_t num_args);
+  Node* AnalyzeLetSyntax(const char* name,
+                         bool is_rec,
+                         Scope* scope,
+                         Expr** args,
+                         size_t num_args);
+
+  // A lambda or let body. Internal definitions are added to |scope|.
+  Node* AnalyzeBody(Scope* scope, Expr** exprs, size_t num_exprs);
+  Node* AnalyzeSequence(Scope* scope, Expr** exprs, size_t num_exprs);
+  Node* AnalyzeSequence(Scope* scope, Expr* list);
+  void ScanDefinitions(Scope* scope, Expr* expr);
+  void ParseBindings(const char* name,
+                     Expr* bindings,
+                     std::vector<Symbol*>* vars,
+                     std::vector<Expr*>* inits);
+  // Adds the variables of the formals of a lambda or receive to |scope|.
+  void ParseFormals(const char* name,
+                    Expr* formals,
+                    Scope* scope,
+                    std::vector<Symbol*>* required,
+                    Symbol** variable);
+
+  // Returns the node building quasiquote template |tmpl| nested in |depth|
+  // quasiquotes, or null if nothing in it is unquoted, so it's a literal.
+  Node* AnalyzeTemplate(Scope* scope, Expr* tmpl, size_t depth);
+  Node* AnalyzeTemplateList(Scope* scope, Pair* tmpl, size_t depth);
+  // True if |expr| is (|name| arg).
+  bool IsTemplateForm(Expr* expr, Scope* scope, const char* name, Expr** arg);
+  bool IsNestedQuasiquote(Expr* expr, Scope* scope, Expr** arg);
+  // A quoted |datum|.
+  Node* Literal(Expr* datum);
+  // A call of |primitive|, whatever its name is bound to.
+  Node* PrimitiveCall(expr::Primitive primitive, std::vector<Node*> args);
+
+  // A named let of |name|, binding |vars| to |inits| analyzed in |scope|.
+  // |analyze_body| analyzes the body in the scope of the variables, where
+  // |name| is bound one frame up.
+  template <typename F>
+  Node* NamedLet(Scope* scope,
+                 Symbol* name,
+                 std::vector<Symbol*> vars,
+                 const std::vector<Expr*>& inits,
+                 F analyze_body);
+
+  Env* const env_;
+  // Every node created, so partially built trees aren't collected.
+  std::vector<gc::Lock<Node>> nodes_;
+
+  // An alias an expansion introduced.
+  struct Alias {
+    Symbol* original;
+    // Where the macro was defined, null for top level.
+    const Scope* scope;
+  };
+  std::unordered_map<Symbol*, Alias> aliases_;
+  // Where each local macro was defined.
+  std::unordered_map<Macro*, const Scope*> macro_scopes_;
+  // Local macros and expansions being analyzed, which may be dropped from
+  // the cache of their macro before analysis is done.
+  std::vector<gc::Lock<Macro>> macros_;
+  std::vector<gc::Lock<Expr>> expansions_;
+  // The procedures quasiquotes call, made once per analysis.
+  std::unordered_map<int, gc::Lock<Expr>> primitives_;
+};
+
+const Analyzer::SyntaxFunc Analyzer::kSyntaxFuncs[] = {
+#define X(name, str) &Analyzer::name,
+#include "expr/syntax.inc"  // NOLINT(build/include)
+#undef X
+};
+
+Node* Analyzer::Analyze(Expr* expr, Scope* scope) {
+  switch (expr->type()) {
+    case Expr::Type::SYMBOL: {
+      auto meaning = Resolve(expr->AsSymbol(), scope);
+      if (meaning.syntax) {
+        throw RuntimeException(
+            Unalias(expr->AsSymbol())->val() +
+                ": bad syntax (keyword as variable)",
+            nullptr);
+      }
+      if (meaning.is_local) {
+        return New<LocalRef>(meaning.var.get(), meaning.depth, meaning.index);
+      }
+      return New<GlobalRef>(meaning.var.get(), Scope::Depth(scope));
+    }
+
+    case Expr::Type::PAIR: {
+      auto* pair = expr->AsPair();
+      auto* syntax = TryGetSyntax(pair->car(), scope);
+      if (syntax && syntax->kind() == Syntax::Kind::MACRO) {
+        auto* expansion = Expand(static_cast<Macro*>(syntax), pair, scope);
+        return Analyze(expansion, scope);
+      }
+      auto args = ExprVecFromList(pair->cdr());
+      if (syntax) {
+        auto func = kSyntaxFuncs[static_cast<size_t>(syntax->kind())];
+        return (this->*func)(scope, args.data(), args.size());
+      }
+
+      auto* op = Analyze(pair->car(), scope);
+      std::vector<Node*> arg_nodes;
+      arg_nodes.reserve(args.size());
+      for (auto* arg : args) {
+        arg_nodes.push_back(Analyze(arg, scope));
+      }
+      if (op->node_type() == NodeType::GlobalRef) {
+        // The variable's current value, which may change before the call
+        // runs.
+        auto* ref = static_cast<GlobalRef*>(op);
+        auto* val = env_->TryLookup(ref->var());
+        expr::Primitive primitive;
+        if (val && expr::GetPrimitive(val, &primitive) &&
+            expr::IsOpenCoded(primitive, arg_nodes.size())) {
+          return New<PrimApply>(ref, std::move(arg_nodes), primitive, val);
+        }
+      }
+      return New<Apply>(op, std::move(arg_nodes));
+    }
+
+    default:
+      return New<Constant>(expr);
+  }
+}
+
+// A symbol bound in |scope| refers to that binding, even if it's an alias
+// bound by an expansion. A free alias refers to what the symbol it renames
+// meant where its macro was defined.
+Analyzer::Meaning Analyzer::Resolve(Symbol* sym, const Scope* scope) {
+  Meaning meaning;
+  if (Scope::Resolve(scope, sym, &meaning.depth, &meaning.index)) {
+    // A keyword in an inner scope shadows the variable.
+    meaning.syntax = Scope::FindKeyword(scope, sym);
+    meaning.is_local = !meaning.syntax;
+    meaning.var.reset(sym);
+    return meaning;
+  }
+  if ((meaning.syntax = Scope::FindKeyword(scope, sym))) {
+    meaning.var.reset(sym);
+    return meaning;
+  }
+
+  auto it = aliases_.find(sym);
+  if (it != aliases_.end()) {
+    auto* def_scope = it->second.scope;
+    meaning = Resolve(it->second.original, def_scope);
+    if (meaning.is_local) {
+      meaning.depth += Scope::Distance(scope, def_scope);
+    }
+    return meaning;
+  }
+
+  meaning.var = Unalias(sym);
+  auto* val = env_->TryLookup(meaning.var.get());
+  meaning.syntax = val ? val->AsSyntax() : nullptr;
+  return meaning;
+}
+
+Syntax* Analyzer::TryGetSyntax(Expr* expr, const Scope* scope) {
+  auto* sym = expr->AsSymbol();
+  return sym ? Resolve(sym, scope).syntax : nullptr;
+}
+
+bool Analyzer::IsAuxKeyword(Expr* expr, Scope* scope, const char* name) {
+  auto* sym = expr->AsSymbol();
+  if (!sym) {
+    return false;
+  }
+  auto meaning = Resolve(sym, scope);
+  return !meaning.is_local && !meaning.syntax && meaning.var->val() == name &&
+         env_->TryLookup(meaning.var.get()) == nullptr;
+}
+
+Expr* Analyzer::Expand(Macro* macro, Pair* form, const Scope* scope) {
+  auto it = macro_scopes_.find(macro);
+  const Scope* def_scope = it == macro_scopes_.end() ? nullptr : it->second;
+  // A literal of the macro is matched by an identifier which refers to the
+  // same binding as the literal does where the macro was defined.
+  const auto& expansion =
+      macro->Expand(form, [&](Symbol* input, Symbol* literal) {
+        auto use = Resolve(input, scope);
+        auto def = Resolve(literal, def_scope);
+        if (use.syntax || def.syntax) {
+          return use.syntax == def.syntax;
+        }
+        if (use.is_local || def.is_local) {
+          // Frames are compared by their distance from the top level, as
+          // |def_scope| encloses |scope|.
+          return use.is_local && def.is_local && use.index == def.index &&
+                 Scope::Depth(scope) - use.depth ==
+                     Scope::Depth(def_scope) - def.depth;
+        }
+        return use.var.get() == def.var.get();
+      });
+  expansions_.emplace_back(expansion.expr);
+  for (const auto& alias : expansion.aliases) {
+    aliases_[alias.first] = {alias.second, def_scope};
+  }
+  return expansion.expr;
+}
+
+Macro* Analyzer::MakeMacro(Expr* spec, const Scope* scope) {
+  auto* pair = spec->AsPair();
+  auto* syntax = pair ? TryGetSyntax(pair->car(), scope) : nullptr;
+  if (!syntax || syntax->kind() != Syntax::Kind::SyntaxRules) {
+    throw RuntimeException("Expected syntax-rules", spec);
+  }
+  auto args = ExprVecFromList(pair->cdr());
+  auto macro = Macro::New(args.data(), args.size());
+  macros_.push_back(macro);
+  if (scope) {
+    macro_scopes_[macro.get()] = scope;
+  }
+  return macro.get();
+}
+
+Node* Analyzer::AnalyzeBody(Scope* scope, Expr** exprs, size_t num_exprs) {
+  for (size_t i = 0; i < num_exprs; ++i) {
+    ScanDefinitions(scope, exprs[i]);
+  }
+  return AnalyzeSequence(scope, exprs, num_exprs);
+}
+
+Node* Analyzer::AnalyzeSequence(Scope* scope, Expr** exprs, size_t num_exprs) {
+  if (num_exprs == 0) {
+    throw RuntimeException("Unexpected empty sequence", nullptr);
+  }
+  if (num_exprs == 1) {
+    return Analyze(exprs[0], scope);
+  }
+
+  std::vector<Node*> body;
+  body.reserve(num_exprs);
+  for (size_t i = 0; i < num_exprs; ++i) {
+    body.push_back(Analyze(exprs[i], scope));
+  }
+  return New<Sequence>(std::move(body));
+}
+
+Node* Analyzer::AnalyzeSequence(Scope* scope, Expr* list) {
+  auto exprs = ExprVecFromList(list);
+  return AnalyzeSequence(scope, exprs.data(), exprs.size());
+}
+
+// Adds variables defined by |expr| to |scope| so references which precede the
+// definition resolve to it.
+void Analyzer::ScanDefinitions(Scope* scope, Expr* expr) {
+  auto* pair = expr->AsPair();
+  if (!pair) {
+    return;
+  }
+
+  auto* syntax = TryGetSyntax(pair->car(), scope);
+  if (!syntax) {
+    return;
+  }
+
+  // The expansion is cached, so analyzing the form later expands it to the
+  // same definitions.
+  if (syntax->kind() == Syntax::Kind::MACRO) {
+    auto* expansion = Expand(static_cast<Macro*>(syntax), pair, scope);
+    ScanDefinitions(scope, expansion);
+    return;
+  }
+
+  if (syntax->kind() == Syntax::Kind::DefineSyntax) {
+    auto args = ExprVecFromList(pair->cdr());
+    DefineLocalSyntax(scope, args.data(), args.size());
+    return;
+  }
+
+  if (syntax->kind() == Syntax::Kind::Begin) {
+    for (auto* form : ExprVecFromList(pair->cdr())) {
+      ScanDefinitions(scope, form);
+    }
+    return;
+  }
+
+  if (syntax->kind() != Syntax::Kind::Define) {
+    return;
+  }
+
+  auto* target = pair->Cr("ad");
+  if (target && target->AsPair()) {
+    target = target->AsPair()->car();
+  }
+  if (target && target->AsSymbol()) {
+    scope->Add(target->AsSymbol());
+  }
+}
+
+void Analyzer::ParseBindings(const char* name,
+                             Expr* bindings,
+                             std::vector<Symbol*>* vars,
+                             std::vector<Expr*>* inits) {
+  Expr* cur = bindings;
+  for (; auto* pair = cur->AsPair(); cur = pair->cdr()) {
+    auto* binding = pair->car()->AsPair();
+    auto* second_link = binding ? binding->cdr()->AsPair() : nullptr;
+    if (!second_link || second_link->cdr() != Nil()) {
+      throw RuntimeException(
+          std::string(name) + ": Expected binding: (var val)",
+          pair->car());
+    }
+    auto* var = binding->car()->AsSymbol();
+    if (!var) {
+      throw RuntimeException(
+          std::string(name) + ": Expected symbol for binding",
+          binding->car());
+    }
+    vars->push_back(var);
+    inits->push_back(second_link->car());
+  }
+  if (cur != Nil()) {
+    throw RuntimeException(
+        std::string(name) + ": Malformed binding list", cur);
+  }
+}
+
+void Analyzer::ParseFormals(const char* name,
+                            Expr* formals,
+                            Scope* scope,
+                            std::vector<Symbol*>* required,
+                            Symbol** variable) {
+  Expr* cur = formals;
+  for (; auto* pair = cur->AsPair(); cur = pair->cdr()) {
+    auto* var = pair->car()->AsSymbol();
+    if (!var) {
+      throw RuntimeException(
+          std::string(name) + ": Expected symbol for argument", pair->car());
+    }
+    required->push_back(var);
+    scope->Add(var);
+  }
+  *variable = nullptr;
+  if (cur != Nil()) {
+    *variable = cur->AsSymbol();
+    if (!*variable) {
+      throw RuntimeException(std::string(name) + ": Expected arguments", cur);
+    }
+    scope->Add(*variable);
+  }
+}
+
+Node* Analyzer::Quote(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("quote", num_args, 1, 1);
+  auto datum = UnaliasDatum(args[0]);
+  return New<Constant>(datum.get());
+}
+
+Node* Analyzer::Lambda(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("lambda", num_args, 2);
+
+  Scope::Capture(scope);
+  Scope inner(scope);
+  std::vector<Symbol*> req_args;
+  Symbol* var_arg;
+  ParseFormals("lambda", args[0], &inner, &req_args, &var_arg);
+
+  auto* body = AnalyzeBody(&inner, args + 1, num_args - 1);
+  body->MarkTail();
+  req_args.shrink_to_fit();
+  return New<eval::Lambda>(std::move(req_args), var_arg, inner.num_slots(),
+                           body, inner.captured());
+}
+
+Node* Analyzer::If(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("if", num_args, 2, 3);
+
+  return New<eval::If>(Analyze(args[0], scope), Analyze(args[1], scope),
+                       num_args == 3 ? Analyze(args[2], scope) : nullptr);
+}
+
+Node* Analyzer::Set(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("set!", num_args, 2, 2);
+  auto meaning = Resolve(TrySymbol(args[0]), scope);
+  auto* val = Analyze(args[1], scope);
+  if (meaning.is_local) {
+    return New<LocalSet>(meaning.var.get(), meaning.depth, meaning.index, val,
+                         false /* is_define */);
+  }
+  return New<GlobalSet>(meaning.var.get(), Scope::Depth(scope), val);
+}
+
+Node* Analyzer::Cond(Scope* scope, Expr** args, size_t num_args) {
+  std::vector<eval::Cond::Clause> clauses;
+  Node* else_body = nullptr;
+  for (size_t i = 0; i < num_args; ++i) {
+    auto* pair = args[i]->AsPair();
+    if (!pair) {
+      throw RuntimeException(
+          "cond: bad syntax (clause is not a test-value pair)", args[i]);
+    }
+
+    if (IsAuxKeyword(pair->car(), scope, "else")) {
+      if (i != num_args - 1) {
+        throw RuntimeException("cond: bad syntax (else clause must be last)",
+                               args[i]);
+      }
+      else_body = AnalyzeSequence(scope, pair->cdr());
+      break;
+    }
+
+    eval::Cond::Clause clause = {Analyze(pair->car(), scope), nullptr, false};
+    auto* second = pair->Cr("ad");
+    if (second && IsAuxKeyword(second, scope, "=>")) {
+      auto* trailing = pair->Cr("ddd");
+      if (!trailing || trailing != Nil()) {
+        throw RuntimeException("cond: bad syntax (malformed => clause)",
+                               args[i]);
+      }
+      clause.body = Analyze(pair->Cr("add"), scope);
+      clause.is_arrow = true;
+    } else if (pair->cdr() != Nil()) {
+      clause.body = AnalyzeSequence(scope, pair->cdr());
+    }
+    clauses.push_back(clause);
+  }
+
+  return New<eval::Cond>(std::move(clauses), else_body);
+}
+
+Node* Analyzer::Case(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("case", num_args, 1);
+
+  auto* key = Analyze(args[0], scope);
+  std::vector<eval::Case::Clause> clauses;
+  // The datums, as they aren't rooted until the node is made.
+  std::vector<gc::Lock<Expr>> datums;
+  Node* else_body = nullptr;
+  for (size_t i = 1; i < num_args; ++i) {
+    auto* clause = args[i]->AsPair();
+    if (!clause) {
+      throw RuntimeException("case: bad syntax, expected clause", args[i]);
+    }
+
+    if (IsAuxKeyword(clause->car(), scope, "else")) {
+      if (i != num_args - 1) {
+        throw RuntimeException("case: bad syntax (else clause must be last)",
+                               args[i]);
+      }
+      else_body = AnalyzeSequence(scope, clause->cdr());
+      break;
+    }
+
+    if (!clause->car()->AsPair()) {
+      throw RuntimeException("case: bad syntax (not a datum sequence)",
+                             args[i]);
+    }
+    datums.push_back(UnaliasDatum(clause->car()));
+    clauses.push_back({ExprVecFromList(datums.back().get()),
+                       AnalyzeSequence(scope, clause->cdr())});
+  }
+
+  return New<eval::Case>(key, std::move(clauses), else_body);
+}
+
+Node* Analyzer::And(Scope* scope, Expr** args, size_t num_args) {
+  std::vector<Node*> tests;
+  for (size_t i = 0; i < num_args; ++i) {
+    tests.push_back(Analyze(args[i], scope));
+  }
+  return New<eval::And>(std::move(tests));
+}
+
+Node* Analyzer::Or(Scope* scope, Expr** args, size_t num_args) {
+  std::vector<Node*> tests;
+  for (size_t i = 0; i < num_args; ++i) {
+    tests.push_back(Analyze(args[i], scope));
+  }
+  return New<eval::Or>(std::move(tests));
+}
+
+// A named let is analyzed as ((letrec ((name (lambda vars body))) name)
+// inits), which Optimize() turns into a Loop when it can.
+template <typename F>
+Node* Analyzer::NamedLet(Scope* scope,
+                         Symbol* name,
+                         std::vector<Symbol*> vars,
+                         const std::vector<Expr*>& inits,
+                         F analyze_body) {
+  std::vector<Node*> init_nodes;
+  for (auto* init : inits) {
+    init_nodes.push_back(Analyze(init, scope));
+  }
+
+  Scope rec(scope);
+  rec.Add(name);
+  Scope::Capture(&rec);
+  Scope inner(&rec);
+  for (auto* var : vars) {
+    inner.Add(var);
+  }
+  Node* body = analyze_body(&inner);
+  body->MarkTail();
+  auto* proc = New<eval::Lambda>(std::move(vars), nullptr, inner.num_slots(),
+                                 body, inner.captured());
+  auto* letrec = New<eval::Let>(eval::Let::Kind::LETREC,
+                                std::vector<Symbol*>{name},
+                                std::vector<Node*>{proc}, rec.num_slots(),
+                                New<LocalRef>(name, 0, 0), rec.captured());
+  return New<Apply>(letrec, std::move(init_nodes));
+}
+
+Node* Analyzer::Let(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("let", num_args, 2);
+  if (auto* name = args[0]->AsSymbol()) {
+    ExpectNumForms("let", num_args, 3);
+    std::vector<Symbol*> vars;
+    std::vector<Expr*> init_exprs;
+    ParseBindings("let", args[1], &vars, &init_exprs);
+    return NamedLet(scope, name, std::move(vars), init_exprs,
+                    [&](Scope* inner) {
+                      return AnalyzeBody(inner, args + 2, num_args - 2);
+                    });
+  }
+
+  std::vector<Symbol*> vars;
+  std::vector<Expr*> init_exprs;
+  ParseBindings("let", args[0], &vars, &init_exprs);
+
+  std::vector<Node*> inits;
+  for (auto* init : init_exprs) {
+    inits.push_back(Analyze(init, scope));
+  }
+
+  Scope inner(scope);
+  for (auto* var : vars) {
+    inner.Add(var);
+  }
+  auto* body = AnalyzeBody(&inner, args + 1, num_args - 1);
+  return New<eval::Let>(eval::Let::Kind::LET, std::move(vars),
+                        std::move(inits), inner.num_slots(), body,
+                        inner.captured());
+}
+
+// Each init sees the bindings before it. Every binding gets its own slot, so
+// closures capture the binding in scope where they were created.
+Node* Analyzer::LetStar(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("let*", num_args, 2);
+  std::vector<Symbol*> vars;
+  std::vector<Expr*> init_exprs;
+  ParseBindings("let*", args[0], &vars, &init_exprs);
+
+  Scope inner(scope);
+  std::vector<Node*> inits;
+  for (size_t i = 0; i < vars.size(); ++i) {
+    inits.push_back(Analyze(init_exprs[i], &inner));
+    inner.Add(vars[i]);
+  }
+
+  auto* body = AnalyzeBody(&inner, args + 1, num_args - 1);
+  return New<eval::Let>(eval::Let::Kind::LET_STAR, std::move(vars),
+                        std::move(inits), inner.num_slots(), body,
+                        inner.captured());
+}
+
+Node* Analyzer::LetRec(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("letrec", num_args, 2);
+  std::vector<Symbol*> vars;
+  std::vector<Expr*> init_exprs;
+  ParseBindings("letrec", args[0], &vars, &init_exprs);
+
+  Scope inner(scope);
+  for (auto* var : vars) {
+    inner.Add(var);
+  }
+  std::vector<Node*> inits;
+  for (auto* init : init_exprs) {
+    inits.push_back(Analyze(init, &inner));
+  }
+
+  auto* body = AnalyzeBody(&inner, args + 1, num_args - 1);
+  return New<eval::Let>(eval::Let::Kind::LETREC, std::move(vars),
+                        std::move(inits), inner.num_slots(), body,
+                        inner.captured());
+}
+
+Node* Analyzer::Begin(Scope* scope, Expr** args, size_t num_args) {
+  if (num_args == 0) {
+    return New<Constant>(Nil());
+  }
+  return AnalyzeSequence(scope, args, num_args);
+}
+
+// (do ((var init step)...) (test expr...) command...) is a named let:
+// (let loop ((var init)...)
+//   (if test (begin expr...) (begin command... (loop step...))))
+// A variable without a step keeps its value.
+Node* Analyzer::Do(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("do", num_args, 2);
+  std::vector<Symbol*> vars;
+  std::vector<Expr*> inits;
+  std::vector<Expr*> steps;
+  Expr* cur = args[0];
+  for (; auto* pair = cur->AsPair(); cur = pair->cdr()) {
+    auto spec = ExprVecFromList(pair->car());
+    auto* var = spec.empty() ? nullptr : spec[0]->AsSymbol();
+    if (!var || spec.size() < 2 || spec.size() > 3) {
+      throw RuntimeException("do: Expected (var init [step])", pair->car());
+    }
+    vars.push_back(var);
+    inits.push_back(spec[1]);
+    steps.push_back(spec.size() == 3 ? spec[2] : var);
+  }
+  if (cur != Nil()) {
+    throw RuntimeException("do: Malformed binding list", cur);
+  }
+  auto* test_clause = args[1]->AsPair();
+  if (!test_clause) {
+    throw RuntimeException("do: Expected (test expr...)", args[1]);
+  }
+
+  // The reader can't make this symbol, so the body can't refer to it.
+  auto name = Symbol::NewLock("#do-loop");
+  return NamedLet(scope, name.get(), vars, inits, [&](Scope* inner) -> Node* {
+    auto* test = Analyze(test_clause->car(), inner);
+    Node* result = test_clause->cdr() == Nil()
+                       ? New<Constant>(Nil())
+                       : AnalyzeSequence(inner, test_clause->cdr());
+    std::vector<Node*> step_nodes;
+    for (auto* step : steps) {
+      step_nodes.push_back(Analyze(step, inner));
+    }
+    std::vector<Node*> body;
+    for (size_t i = 2; i < num_args; ++i) {
+      body.push_back(Analyze(args[i], inner));
+    }
+    body.push_back(
+        New<Apply>(New<LocalRef>(name.get(), 1, 0), std::move(step_nodes)));
+    Node* iterate =
+        body.size() == 1 ? body[0] : New<Sequence>(std::move(body));
+    return New<eval::If>(test, result, iterate);
+  });
+}
+
+Node* Analyzer::Delay(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("delay", num_args, 1, 1);
+  // The promise holds a thunk, so Optimize() can flatten it like any other
+  // closure.
+  Expr* thunk_args[] = {Nil(), args[0]};
+  auto* thunk = Lambda(scope, thunk_args, 2);
+  return New<eval::Delay>(static_cast<eval::Lambda*>(thunk), false);
+}
+
+// (delay-force expr) from R7RS, where expr's value is a promise. Forcing the
+// result forces that promise in its place, without growing the stack.
+Node* Analyzer::DelayForce(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("delay-force", num_args, 1, 1);
+  Expr* thunk_args[] = {Nil(), args[0]};
+  auto* thunk = Lambda(scope, thunk_args, 2);
+  return New<eval::Delay>(static_cast<eval::Lambda*>(thunk), true);
+}
+
+// (stream-cons obj stream) is (make-promise (cons obj (delay-force stream))).
+// Unlike SRFI 41, obj is evaluated eagerly, as in SICP's cons-stream.
+Node* Analyzer::StreamCons(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("stream-cons", num_args, 2, 2);
+  auto* pair = PrimitiveCall(expr::Primitive::Cons,
+                             {Analyze(args[0], scope),
+                              DelayForce(scope, args + 1, 1)});
+  return PrimitiveCall(expr::Primitive::MakePromise, {pair});
+}
+
+// (receive formals expr body...) from SRFI 8. The values of expr are bound
+// like arguments of (lambda formals body...), without making the procedure.
+Node* Analyzer::Receive(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("receive", num_args, 3);
+  auto* producer = Analyze(args[1], scope);
+  Scope inner(scope);
+  std::vector<Symbol*> required;
+  Symbol* variable;
+  ParseFormals("receive", args[0], &inner, &required, &variable);
+  auto* body = AnalyzeBody(&inner, args + 2, num_args - 2);
+  return New<eval::Receive>(std::move(required), variable, inner.num_slots(),
+                            producer, body, inner.captured());
+}
+
+// A quasiquote becomes calls of cons, list, append and list->vector which
+// build only the parts of the template containing unquotes. The rest, such as
+// the tail of a list after its last unquote, is shared as a literal.
+Node* Analyzer::Quasiquote(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("quasiquote", num_args, 1, 1);
+  auto* node = AnalyzeTemplate(scope, args[0], 0);
+  return node ? node : Literal(args[0]);
+}
+
+Node* Analyzer::AnalyzeTemplate(Scope* scope, Expr* tmpl, size_t depth) {
+  if (auto* vec = tmpl->AsVector()) {
+    gc::Lock<Expr> list(Nil());
+    for (auto it = vec->vals().rbegin(); it != vec->vals().rend(); ++it) {
+      list.reset(new Pair(*it, list.get()));
+    }
+    auto* pair = list->AsPair();
+    auto* node = pair ? AnalyzeTemplateList(scope, pair, depth) : nullptr;
+    return node ? PrimitiveCall(expr::Primitive::ListToVector, {node})
+                : nullptr;
+  }
+
+  auto* pair = tmpl->AsPair();
+  if (!pair) {
+    return nullptr;
+  }
+
+  // Unquotes inside nested quasiquotes belong to them, and are kept along
+  // with the keywords.
+  Expr* arg;
+  size_t inner_depth;
+  if (IsTemplateForm(pair, scope, "unquote", &arg)) {
+    if (depth == 0) {
+      return Analyze(arg, scope);
+    }
+    inner_depth = depth - 1;
+  } else if (IsTemplateForm(pair, scope, "unquote-splicing", &arg)) {
+    if (depth == 0) {
+      throw RuntimeException("unquote-splicing: bad syntax (not in a list)",
+                             tmpl);
+    }
+    inner_depth = depth - 1;
+  } else if (IsNestedQuasiquote(pair, scope, &arg)) {
+    inner_depth = depth + 1;
+  } else {
+    return AnalyzeTemplateList(scope, pair, depth);
+  }
+
+  auto* inner = AnalyzeTemplate(scope, arg, inner_depth);
+  if (!inner) {
+    return nullptr;
+  }
+  return PrimitiveCall(expr::Primitive::List, {Literal(pair->car()), inner});
+}
+
+Node* Analyzer::AnalyzeTemplateList(Scope* scope, Pair* tmpl, size_t depth) {
+  // The links of the list, and for each the node building its element, null
+  // if it's a literal.
+  std::vector<Pair*> links;
+  std::vector<Node*> elems;
+  std::vector<bool> splices;
+  Expr* cur = tmpl;
+  while (auto* link = cur->AsPair()) {
+    // (a . ,b) is (a unquote b).
+    Expr* arg;
+    if (link != tmpl &&
+        (IsTemplateForm(link, scope, "unquote", &arg) ||
+         IsTemplateForm(link, scope, "unquote-splicing", &arg) ||
+         IsNestedQuasiquote(link, scope, &arg))) {
+      break;
+    }
+    links.push_back(link);
+    if (depth == 0 &&
+        IsTemplateForm(link->car(), scope, "unquote-splicing", &arg)) {
+      elems.push_back(Analyze(arg, scope));
+      splices.push_back(true);
+    } else {
+      elems.push_back(AnalyzeTemplate(scope, link->car(), depth));
+      splices.push_back(false);
+    }
+    cur = link->cdr();
+  }
+  Node* rest = AnalyzeTemplate(scope, cur, depth);
+
+  // The longest literal tail is shared.
+  auto end = links.size();
+  if (!rest) {
+    while (end > 0 && !elems[end - 1]) {
+      --end;
+    }
+    if (end == 0) {
+      return nullptr;
+    }
+    auto* tail = end < links.size() ? links[end] : cur;
+    if (tail != Nil()) {
+      rest = Literal(tail);
+    }
+  }
+
+  // Built back to front. A run of elements before '() is a call of list,
+  // otherwise each is consed on.
+  while (end > 0) {
+    if (splices[end - 1]) {
+      auto* spliced = elems[--end];
+      rest = rest ? PrimitiveCall(expr::Primitive::Append, {spliced, rest})
+                  : spliced;
+      continue;
+    }
+    auto begin = end;
+    while (begin > 0 && !splices[begin - 1]) {
+      --begin;
+    }
+    std::vector<Node*> run;
+    for (auto i = begin; i < end; ++i) {
+      run.push_back(elems[i] ? elems[i] : Literal(links[i]->car()));
+    }
+    if (!rest) {
+      rest = PrimitiveCall(expr::Primitive::List, std::move(run));
+    } else {
+      for (auto it = run.rbegin(); it != run.rend(); ++it) {
+        rest = PrimitiveCall(expr::Primitive::Cons, {*it, rest});
+      }
+    }
+    end = begin;
+  }
+  return rest;
+}
+
+bool Analyzer::IsTemplateForm(Expr* expr,
+                              Scope* scope,
+                              const char* name,
+                              Expr** arg) {
+  auto* pair = expr->AsPair();
+  if (!pair || (name && !IsAuxKeyword(pair->car(), scope, name))) {
+    return false;
+  }
+  auto* rest = pair->cdr()->AsPair();
+  if (!rest || rest->cdr() != Nil()) {
+    return false;
+  }
+  *arg = rest->car();
+  return true;
+}
+
+bool Analyzer::IsNestedQuasiquote(Expr* expr, Scope* scope, Expr** arg) {
+  auto* pair = expr->AsPair();
+  auto* syntax = pair ? TryGetSyntax(pair->car(), scope) : nullptr;
+  return syntax && syntax->kind() == Syntax::Kind::Quasiquote &&
+         IsTemplateForm(pair, scope, nullptr, arg);
+}
+
+Node* Analyzer::Literal(Expr* datum) {
+  auto unaliased = UnaliasDatum(datum);
+  return New<Constant>(unaliased.get());
+}
+
+Node* Analyzer::PrimitiveCall(expr::Primitive primitive,
+                              std::vector<Node*> args) {
+  auto& proc = primitives_[static_cast<int>(primitive)];
+  if (!proc) {
+    proc = expr::NewPrimitive(primitive);
+  }
+  return New<Apply>(New<Constant>(proc.get()), std::move(args));
+}
+
+// The body is analyzed like a let body, in a scope holding only keywords.
+// The macros of let-syntax see the enclosing scope, and those of
+// letrec-syntax see each other.
+Node* Analyzer::AnalyzeLetSyntax(const char* name,
+                                 bool is_rec,
+                                 Scope* scope,
+                                 Expr** args,
+                                 size_t num_args) {
+  ExpectNumForms(name, num_args, 2);
+  std::vector<Symbol*> keywords;
+  std::vector<Expr*> specs;
+  ParseBindings(name, args[0], &keywords, &specs);
+
+  Scope inner(scope);
+  for (size_t i = 0; i < keywords.size(); ++i) {
+    inner.AddKeyword(keywords[i], MakeMacro(specs[i], is_rec ? &inner : scope));
+  }
+  auto* body = AnalyzeBody(&inner, args + 1, num_args - 1);
+  return New<eval::Let>(eval::Let::Kind::LET, std::vector<Symbol*>(),
+                        std::vector<Node*>(), inner.num_slots(), body,
+                        inner.captured());
+}
+
+Node* Analyzer::LetSyntax(Scope* scope, Expr** args, size_t num_args) {
+  return AnalyzeLetSyntax("let-syntax", false, scope, args, num_args);
+}
+
+Node* Analyzer::LetRecSyntax(Scope* scope, Expr** args, size_t num_args) {
+  return AnalyzeLetSyntax("letrec-syntax", true, scope, args, num_args);
+}
+
+Node* Analyzer::SyntaxRules(Scope* scope, Expr** args, size_t num_args) {
+  throw RuntimeException("syntax-rules: bad syntax (not in a keyword binding)",
+                         nullptr);
+}
+
+// (define var expr) or (define (var . formals) body ...). Top level
+// definitions bind in the environment, internal ones assign a slot of the
+// enclosing frame.
+Node* Analyzer::Define(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("define", num_args, 2);
+  Symbol* var = nullptr;
+  std::vector<Expr*> lambda_args;
+  if (auto* formals = args[0]->AsPair()) {
+    var = TrySymbol(formals->car());
+    // Reuse the lambda path with the formals in place of the variable.
+    lambda_args.assign(args, args + num_args);
+    lambda_args[0] = formals->cdr();
+  } else {
+    ExpectNumForms("define", num_args, 2, 2);
+    var = TrySymbol(args[0]);
+  }
+
+  // A top level definition an expansion introduced defines the symbol the
+  // alias renames.
+  auto global = Unalias(var);
+  size_t index = 0;
+  if (scope) {
+    // Definitions in a body were added by ScanDefinitions.
+    size_t depth;
+    if (!Scope::Resolve(scope, var, &depth, &index) || depth != 0) {
+      index = scope->Add(var);
+    }
+  }
+
+  auto* val = lambda_args.empty()
+                  ? Analyze(args[1], scope)
+                  : Lambda(scope, lambda_args.data(), lambda_args.size());
+  if (!scope) {
+    return New<eval::Define>(global.get(), val);
+  }
+  return New<LocalSet>(var, 0, index, val, true /* is_define */);
+}
+
+// (define-syntax keyword (syntax-rules ...)). The keyword is bound while
+// analyzing, so the forms which follow can use it, and nothing is left to run.
+Node* Analyzer::DefineSyntax(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("define-syntax", num_args, 2, 2);
+  auto* name = TrySymbol(args[0]);
+  if (!scope) {
+    auto global = Unalias(name);
+    env_->DefineVar(global.get(), MakeMacro(args[1], nullptr));
+  } else if (!scope->HasKeyword(name)) {
+    // Not in a body, so ScanDefinitions didn't see it.
+    DefineLocalSyntax(scope, args, num_args);
+  }
+  return New<Constant>(Nil());
+}
+
+void Analyzer::DefineLocalSyntax(Scope* scope, Expr** args, size_t num_args) {
+  ExpectNumForms("define-syntax", num_args, 2, 2);
+  auto* name = TrySymbol(args[0]);
+  scope->AddKeyword(name, MakeMacro(args[1], scope));
+}
+
+}  // namespace
+
+gc::Lock<Node> Analyze(Expr* expr, Env* env) {
+  Analyzer analyzer(env);
+  return gc::Lock<Node>(analyzer.Analyze(expr, nullptr));
+}
+
+}  // namespace eval
@@ -0,0 +1,560 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "eval/call_stack.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include "eval/eval.h"
+#include "eval/value_stack.h"
+#include "eval/vm.h"
+#include "util/exceptions.h"
+
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/asan_interface.h>
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+using expr::Env;
+using expr::Evals;
+using expr::Expr;
+
+namespace eval {
+
+namespace {
+
+// Bytes in each segment. Pages are committed only once they're used.
+constexpr size_t kSegmentSize = 8 << 20;
+
+// Bytes at the bottom of each segment, and of the thread's stack, below
+// |g_stack_limit|. The lowest page of a segment is a guard.
+constexpr size_t kReserve = 256 << 10;
+
+constexpr size_t kDefaultMaxStack = size_t{1} << 30;
+
+size_t g_max_stack = kDefaultMaxStack;
+
+// Bytes of the segments in use.
+size_t g_segment_bytes = 0;
+
+// A segment kept once its call returns, so recursion going back and forth
+// across the end of a segment doesn't map and unmap one on every call.
+char* g_spare = nullptr;
+
+// A call being made on a new segment.
+struct SegmentCall {
+  Evals* proc;
+  Env* env;
+  Expr** args;
+  size_t num_args;
+
+  gc::Lock<Expr> ret;
+  std::exception_ptr error;
+  ucontext_t caller;
+#ifdef __SANITIZE_ADDRESS__
+  const void* caller_bottom;
+  size_t caller_size;
+#endif
+};
+
+// The call Start() makes. makecontext() can only pass ints.
+SegmentCall* g_starting = nullptr;
+
+// A top level evaluation, made on |g_prompt_stack|.
+struct Prompt {
+  Evals* proc;
+  Env* env;
+
+  gc::Lock<Expr> ret;
+  std::exception_ptr error;
+  // Set once the stacks have unwound to resume a continuation.
+  StackCapture* resume = nullptr;
+  gc::Lock<Expr> resume_owner;
+
+  // Where each stack started.
+  Expr** values;
+  char* frames;
+  size_t vm_frames;
+
+  ucontext_t caller;
+#ifdef __SANITIZE_ADDRESS__
+  void* fake_stack;
+  const void* caller_bottom;
+  size_t caller_size;
+#endif
+};
+
+Prompt* g_prompt = nullptr;
+
+// Every prompt runs on this segment, so stacks copied by one can be copied
+// back for another.
+char* g_prompt_stack = nullptr;
+
+// The innermost call to call/cc which may be resumed, in the current
+// prompt.
+StackCapture* g_capture_top = nullptr;
+
+// Thrown to unwind the stacks to the prompt for |Prompt::resume|.
+struct PromptUnwind {};
+
+const char kEndedError[] = "Continuation called after its extent ended";
+
+uintptr_t ThreadStackLimit() {
+  pthread_attr_t attr;
+  if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+    return 0;
+  }
+  void* base;
+  size_t size;
+  int error = pthread_attr_getstack(&attr, &base, &size);
+  pthread_attr_destroy(&attr);
+  if (error || size < 2 * kReserve) {
+    return 0;
+  }
+  return reinterpret_cast<uintptr_t>(base) + kReserve;
+}
+
+char* NewSegment() {
+  if (g_spare) {
+    return std::exchange(g_spare, nullptr);
+  }
+  void* mem = mmap(nullptr, kSegmentSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+                   -1, 0);
+  if (mem == MAP_FAILED) {
+    throw util::RuntimeException("Stack overflow", nullptr);
+  }
+  mprotect(mem, sysconf(_SC_PAGESIZE), PROT_NONE);
+  return static_cast<char*>(mem);
+}
+
+void FreeSegment(char* segment) {
+  if (!g_spare) {
+    g_spare = segment;
+  } else {
+    munmap(segment, kSegmentSize);
+  }
+}
+
+// Runs on the new segment, returning to the caller's context when done.
+void Start() {
+  auto* call = g_starting;
+#ifdef __SANITIZE_ADDRESS__
+  __sanitizer_finish_switch_fiber(nullptr, &call->caller_bottom,
+                                  &call->caller_size);
+#endif
+  // Exceptions can't unwind past the start of the segment.
+  try {
+    call->ret = call->proc->DoEval(call->env, call->args, call->num_args);
+  } catch (...) {
+    call->error = std::current_exception();
+  }
+#ifdef __SANITIZE_ADDRESS__
+  __sanitizer_start_switch_fiber(nullptr, call->caller_bottom,
+                                 call->caller_size);
+#endif
+}
+
+// Makes |call| on |segment|. Not inlined, so the caller's variables needn't
+// survive swapcontext(), which returns twice as far as the compiler knows.
+__attribute__((noinline)) void RunOn(char* segment, SegmentCall* call) {
+  ucontext_t context;
+  getcontext(&context);
+  context.uc_stack.ss_sp = segment;
+  context.uc_stack.ss_size = kSegmentSize;
+  context.uc_link = &call->caller;
+  makecontext(&context, Start, 0);
+
+  g_starting = call;
+#ifdef __SANITIZE_ADDRESS__
+  void* fake_stack;
+  __sanitizer_start_switch_fiber(&fake_stack, segment, kSegmentSize);
+#endif
+  swapcontext(&call->caller, &context);
+#ifdef __SANITIZE_ADDRESS__
+  __sanitizer_finish_switch_fiber(fake_stack, nullptr, nullptr);
+#endif
+}
+
+// Runs the prompt's evaluation at the base of the prompt segment, switching
+// back to the caller when done. Frames resumed by a continuation may belong to
+// an earlier prompt, so the current one is only found through |g_prompt|.
+void PromptStart() {
+#ifdef __SANITIZE_ADDRESS__
+  __sanitizer_finish_switch_fiber(nullptr, &g_prompt->caller_bottom,
+                                  &g_prompt->caller_size);
+#endif
+  {
+    // Copies of the stacks keep the evaluation alive through these.
+    StackSlots roots(2);
+    roots[0] = g_prompt->proc;
+    roots[1] = g_prompt->env;
+    try {
+      auto ret = static_cast<Evals*>(roots[0])->DoEval(
+          static_cast<Env*>(roots[1]), nullptr, 0);
+      g_prompt->ret = std::move(ret);
+      g_prompt->resume = nullptr;
+    } catch (const PromptUnwind&) {
+    } catch (...) {
+      g_prompt->error = std::current_exception();
+      g_prompt->resume = nullptr;
+    }
+  }
+#ifdef __SANITIZE_ADDRESS__
+  __sanitizer_start_switch_fiber(nullptr, g_prompt->caller_bottom,
+                                 g_prompt->caller_size);
+#endif
+  setcontext(&g_prompt->caller);
+}
+
+// Starts |prompt|'s evaluation on |g_prompt_stack|. Not inlined, like RunOn().
+__attribute__((noinline)) void EnterPrompt(Prompt* prompt) {
+  ucontext_t context;
+  getcontext(&context);
+  context.uc_stack.ss_sp = g_prompt_stack;
+  context.uc_stack.ss_size = kSegmentSize;
+  context.uc_link = nullptr;
+  makecontext(&context, PromptStart, 0);
+
+#ifdef __SANITIZE_ADDRESS__
+  __sanitizer_start_switch_fiber(&prompt->fake_stack, g_prompt_stack,
+                                 kSegmentSize);
+#endif
+  swapcontext(&prompt->caller, &context);
+#ifdef __SANITIZE_ADDRESS__
+  __sanitizer_finish_switch_fiber(prompt->fake_stack, nullptr, nullptr);
+#endif
+}
+
+// Resumes |Prompt::resume|, which switches back here once the prompt's
+// evaluation is done.
+__attribute__((noinline)) void ResumeAtPrompt() {
+  volatile bool resumed = false;
+  getcontext(&g_prompt->caller);
+  if (resumed) {
+#ifdef __SANITIZE_ADDRESS__
+    __sanitizer_finish_switch_fiber(g_prompt->fake_stack, nullptr, nullptr);
+#endif
+    return;
+  }
+  resumed = true;
+  std::exchange(g_prompt->resume, nullptr)->Restore();
+}
+
+// Copies the words of the C stack in [|begin|, |end|) to |out|. Frames have
+// poisoned redzones, so this isn't instrumented, and the compiler mustn't
+// turn it into a call to memcpy().
+__attribute__((no_sanitize_address)) void CopyStack(const uintptr_t* begin,
+                                                    const uintptr_t* end,
+                                                    uintptr_t* out) {
+  for (auto* word = begin; word < end; ++word) {
+    *out++ = *static_cast<const volatile uintptr_t*>(word);
+  }
+}
+
+}  // namespace
+
+// Parts of each stack, from their |*_begin| up.
+struct StackCapture::Chunk {
+  const uintptr_t* stack_begin;
+  std::vector<uintptr_t> stack;
+  Expr** values_begin;
+  std::vector<Expr*> values;
+  char* frames_begin;
+  std::vector<char> frames;
+  size_t vm_begin;
+  std::vector<VmFrame> vm_frames;
+
+  Chunk(uintptr_t stack_begin,
+        uintptr_t stack_end,
+        Expr** values_begin,
+        Expr** values_end,
+        char* frames_begin,
+        char* frames_end,
+        size_t vm_begin,
+        size_t vm_end)
+      : stack_begin(reinterpret_cast<const uintptr_t*>(stack_begin)),
+        stack((stack_end - stack_begin) / sizeof(uintptr_t)),
+        values_begin(values_begin),
+        values(values_begin, values_end),
+        frames_begin(frames_begin),
+        frames(frames_begin, frames_end),
+        vm_begin(vm_begin),
+        vm_frames(VmFrames().begin() + vm_begin,
+                  VmFrames().begin() + vm_end) {
+    CopyStack(this->stack_begin, this->stack_begin + stack.size(),
+              stack.data());
+  }
+
+  void Restore() {
+    auto* stack_dst = const_cast<uintptr_t*>(stack_begin);
+#ifdef __SANITIZE_ADDRESS__
+    // The frames' prologues, which poison their redzones, have already run.
+    // Leave them unchecked.
+    __asan_unpoison_memory_region(stack_dst, stack.size() * sizeof(uintptr_t));
+#endif
+    std::memcpy(stack_dst, stack.data(), stack.size() * sizeof(uintptr_t));
+    std::copy(values.begin(), values.end(), values_begin);
+    std::copy(frames.begin(), frames.end(), frames_begin);
+    auto& vm = VmFrames();
+    vm.resize(vm_begin);
+    vm.insert(vm.end(), vm_frames.begin(), vm_frames.end());
+  }
+
+  // The copied frames aren't constructed, so mark their slots directly.
+  // Pointers into the frame stack are frames copied here or live ones.
+  void MarkReferences() {
+    auto& frame_stack = FrameStack::Get();
+    for (auto* val : values) {
+      if (val && !frame_stack.Contains(val)) {
+        val->GcMark();
+      }
+    }
+    for (size_t pos = 0; pos < frames.size();) {
+      auto* frame = reinterpret_cast<Env*>(&frames[pos]);
+      pos += Env::FrameSize(frame->num_slots());
+      if (frame->enclosing() && !frame_stack.Contains(frame->enclosing())) {
+        frame->enclosing()->GcMark();
+      }
+      for (size_t i = 0; i < frame->num_slots(); ++i) {
+        if (frame->slot(i)) {
+          frame->slot(i)->GcMark();
+        }
+      }
+    }
+  }
+};
+
+StackCapture::StackCapture(Expr* owner) : owner_(owner) {}
+
+StackCapture::~StackCapture() = default;
+
+bool StackCapture::Enter(void* frame) {
+  live_ = true;
+#if defined(__x86_64__) && defined(__linux__)
+  auto* stack = reinterpret_cast<char*>(frame);
+  if (!g_prompt || g_capture_barriers || stack < g_prompt_stack ||
+      stack >= g_prompt_stack + kSegmentSize) {
+    return false;
+  }
+#ifdef __SANITIZE_ADDRESS__
+  // Locals moved to the heap to detect use after return couldn't be copied.
+  if (__asan_get_current_fake_stack()) {
+    return false;
+  }
+#endif
+  capturable_ = true;
+  parent_ = g_capture_top;
+  g_capture_top = this;
+  // Above the frame pointer are the saved frame pointer and return address.
+  frame_end_ = reinterpret_cast<uintptr_t>(frame) + 2 * sizeof(void*);
+  values_ = ValueStack::Get().top();
+  frames_ = FrameStack::Get().top();
+  vm_frames_ = VmFrames().size();
+  return true;
+#else
+  return false;
+#endif
+}
+
+// static
+void StackCapture::FinishResume() {
+#ifdef __SANITIZE_ADDRESS__
+  __sanitizer_finish_switch_fiber(nullptr, &g_prompt->caller_bottom,
+                                  &g_prompt->caller_size);
+#endif
+}
+
+// Not inlined into the call, so this frame is below the call's.
+__attribute__((noinline)) void StackCapture::Exit() {
+  live_ = false;
+  if (!capturable_) {
+    return;
+  }
+  g_capture_top = parent_;
+  // A resumed call returns to the same stacks, which were already copied.
+  if (own_) {
+    return;
+  }
+
+  auto* values_end = ValueStack::Get().top();
+  auto* frames_end = FrameStack::Get().top();
+  auto vm_end = VmFrames().size();
+  auto stack_begin =
+      reinterpret_cast<uintptr_t>(__builtin_frame_address(0)) &
+      ~(sizeof(uintptr_t) - 1);
+  own_.reset(new Chunk(stack_begin, frame_end_, values_, values_end, frames_,
+                       frames_end, vm_frames_, vm_end));
+  if (parent_) {
+    outer_.reset(new Chunk(frame_end_, parent_->frame_end_, parent_->values_,
+                           values_, parent_->frames_, frames_,
+                           parent_->vm_frames_, vm_frames_));
+  } else {
+    outer_.reset(new Chunk(
+        frame_end_, reinterpret_cast<uintptr_t>(g_prompt_stack + kSegmentSize),
+        g_prompt->values, values_, g_prompt->frames, frames_,
+        g_prompt->vm_frames, vm_frames_));
+  }
+}
+
+bool StackCapture::resumable() const {
+  if (!own_ || !g_prompt) {
+    return false;
+  }
+  // Enclosing calls copy their part of the stacks as the stacks unwind. Only
+  // a prompt with the same stacks below it can take the outermost part.
+  auto* root = this;
+  while (root->parent_) {
+    root = root->parent_;
+  }
+  if (root->live_) {
+    return true;
+  }
+  const auto& base = *root->outer_;
+  return base.values_begin == g_prompt->values &&
+         base.frames_begin == g_prompt->frames &&
+         base.vm_begin == g_prompt->vm_frames;
+}
+
+void StackCapture::Resume() {
+  if (!resumable()) {
+    throw util::RuntimeException(kEndedError, owner_);
+  }
+  g_prompt->resume = this;
+  g_prompt->resume_owner.reset(owner_);
+  throw PromptUnwind();
+}
+
+void StackCapture::RestoreOuter() {
+  if (parent_) {
+    parent_->RestoreOuter();
+  }
+  outer_->Restore();
+}
+
+void StackCapture::Restore() {
+  RestoreOuter();
+  own_->Restore();
+  ValueStack::Get().SetTop(own_->values_begin + own_->values.size());
+  FrameStack::Get().RestoreTop(own_->frames_begin + own_->frames.size());
+  // The enclosing calls are running again.
+  for (auto* capture = parent_; capture; capture = capture->parent_) {
+    capture->live_ = true;
+  }
+  g_capture_top = parent_;
+#ifdef __SANITIZE_ADDRESS__
+  __sanitizer_start_switch_fiber(&g_prompt->fake_stack, g_prompt_stack,
+                                 kSegmentSize);
+#endif
+  __builtin_longjmp(jump_buffer_, 1);
+}
+
+void StackCapture::MarkReferences() {
+  if (parent_) {
+    parent_->owner_->GcMark();
+  }
+  if (own_) {
+    own_->MarkReferences();
+    outer_->MarkReferences();
+  }
+}
+
+size_t g_capture_barriers = 0;
+
+gc::Lock<Expr> RunAtPrompt(Evals* proc, Env* env) {
+  if (g_prompt || g_capture_barriers) {
+    return proc->DoEval(env, nullptr, 0);
+  }
+  if (!g_prompt_stack) {
+    g_prompt_stack = NewSegment();
+  }
+  auto prev_limit = g_stack_limit;
+  g_stack_limit = reinterpret_cast<uintptr_t>(g_prompt_stack) + kReserve;
+
+  Prompt prompt;
+  prompt.proc = proc;
+  prompt.env = env;
+  prompt.values = ValueStack::Get().top();
+  prompt.frames = FrameStack::Get().top();
+  prompt.vm_frames = VmFrames().size();
+  g_prompt = &prompt;
+  EnterPrompt(&prompt);
+  while (prompt.resume) {
+    ResumeAtPrompt();
+  }
+  g_prompt = nullptr;
+  g_capture_top = nullptr;
+  g_stack_limit = prev_limit;
+
+  if (prompt.error) {
+    std::rethrow_exception(prompt.error);
+  }
+  return std::move(prompt.ret);
+}
+
+uintptr_t g_stack_limit = ThreadStackLimit();
+
+void SetMaxStack(size_t bytes) {
+  g_max_stack = bytes;
+}
+
+size_t GetMaxStack() {
+  return g_max_stack;
+}
+
+gc::Lock<Expr> CallOnNewSegment(Evals* proc,
+                                Env* env,
+                                Expr** args,
+                                size_t num_args) {
+  // The stacks would have to be copied from each segment.
+  CaptureBarrier barrier;
+  if (g_segment_bytes + kSegmentSize > g_max_stack) {
+    throw util::RuntimeException("Stack overflow", nullptr);
+  }
+  auto* segment = NewSegment();
+  auto prev_limit = g_stack_limit;
+  g_stack_limit = reinterpret_cast<uintptr_t>(segment) + kReserve;
+  g_segment_bytes += kSegmentSize;
+
+  SegmentCall call;
+  call.proc = proc;
+  call.env = env;
+  call.args = args;
+  call.num_args = num_args;
+  RunOn(segment, &call);
+
+  g_stack_limit = prev_limit;
+  g_segment_bytes -= kSegmentSize;
+  FreeSegment(segment);
+  if (call.error) {
+    std::rethrow_exception(call.error);
+  }
+  return std::move(call.ret);
+}
+
+}  // namespace eval
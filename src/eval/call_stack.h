@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVAL_CALL_STACK_H_
+#define EVAL_CALL_STACK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "expr/expr.h"
+#include "gc/lock.h"
+#include "util/macros.h"
+
+namespace eval {
+
+// Calls which don't return before making another, i.e. non-tail recursion,
+// nest on the C stack. Each engine's call driver checks the space left first
+// and continues on a new segment allocated from the heap once it runs low, so
+// recursion depth is limited by SetMaxStack() rather than the thread's stack.
+
+// Lowest address a call driver may start on in the current segment. Space
+// below it is left for code which recurses without checking, e.g. the
+// analyzer and printer. Zero if the thread's stack is unknown.
+extern uintptr_t g_stack_limit;
+
+// Returns true if a call made now should move to a new segment.
+inline bool StackIsLow() {
+  return reinterpret_cast<uintptr_t>(__builtin_frame_address(0)) <
+         g_stack_limit;
+}
+
+// Returns |proc| called with |args| on a new segment of the C stack. Throws
+// util::RuntimeException if that would exceed the maximum. Exceptions thrown
+// by the call are rethrown on the caller's segment.
+gc::Lock<expr::Expr> CallOnNewSegment(expr::Evals* proc,
+                                      expr::Env* env,
+                                      expr::Expr** args,
+                                      size_t num_args);
+
+// Continuations which outlive their call to call/cc are resumed by copying
+// the stacks back: the C stack, the value stack, the frame stack and the VM's
+// frames. Each top level evaluation runs at a prompt, the base of the copies,
+// on a segment of its own which stays at the same address. A continuation can
+// then be resumed by any later evaluation, finishing the one it was captured
+// in and returning that result instead. Frames are copied by value, so
+// Optimize() boxes variables which are set!.
+//
+// Frames which hold locks or other state which can't be copied raise a
+// CaptureBarrier. Continuations captured under one only escape.
+
+// Returns |proc| called with no arguments at a new prompt. If there already is
+// one, or a barrier, it's simply called.
+gc::Lock<expr::Expr> RunAtPrompt(expr::Evals* proc, expr::Env* env);
+
+// Number of live CaptureBarriers.
+extern size_t g_capture_barriers;
+
+class CaptureBarrier {
+ public:
+  CaptureBarrier() { ++g_capture_barriers; }
+  ~CaptureBarrier() { --g_capture_barriers; }
+
+ private:
+  DISALLOW_MOVE_COPY_AND_ASSIGN(CaptureBarrier);
+};
+
+// The stacks of a call to call/cc, copied once it returns: its own frames and
+// those up to the nearest enclosing call/cc, or the prompt. The rest is shared
+// with the enclosing call's copy, so unwinding nested calls copies each frame
+// once.
+class StackCapture {
+ public:
+  // |owner| is the continuation, which keeps the enclosing call's copies.
+  explicit StackCapture(expr::Expr* owner);
+  ~StackCapture();
+
+  // Called as the call starts, with its __builtin_frame_address(0). Returns
+  // true if the call may be resumed, in which case it must pass
+  // jump_buffer() to __builtin_setjmp() before running any Scheme, and call
+  // FinishResume() first when that returns nonzero.
+  bool Enter(void* frame);
+  void** jump_buffer() { return jump_buffer_; }
+  static void FinishResume();
+
+  // Called as the call returns, by returning or unwinding.
+  void Exit();
+
+  // True between Enter() and Exit(), including in resumed calls enclosing
+  // the one resumed.
+  bool live() const { return live_; }
+  // True if Resume() may be called: the call has returned, and was made at
+  // the base of the current prompt.
+  bool resumable() const;
+
+  // Unwinds the stacks to the prompt, then copies them back and returns from
+  // the call again.
+  [[noreturn]] void Resume();
+  // Called at the prompt once the stacks have unwound for Resume(). Copies
+  // them back and jumps into the call.
+  [[noreturn]] void Restore();
+
+  void MarkReferences();
+
+ private:
+  struct Chunk;
+
+  void RestoreOuter();
+
+  expr::Expr* const owner_;
+  StackCapture* parent_ = nullptr;
+  bool live_ = false;
+  bool capturable_ = false;
+
+  // Where the call's frame and its part of each stack start.
+  uintptr_t frame_end_ = 0;
+  expr::Expr** values_ = nullptr;
+  char* frames_ = nullptr;
+  size_t vm_frames_ = 0;
+
+  // The call's own part of the stacks and that up to the enclosing call.
+  std::unique_ptr<Chunk> own_;
+  std::unique_ptr<Chunk> outer_;
+
+  void* jump_buffer_[5];
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(StackCapture);
+};
+
+}  // namespace eval
+
+#endif  // EVAL_CALL_STACK_H_
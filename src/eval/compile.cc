@@ -0,0 +1,572 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <initializer_list>
+#include <unordered_map>
+#include <vector>
+
+#include "eval/node.h"
+#include "eval/vm.h"
+
+using expr::Expr;
+using expr::Nil;
+
+namespace eval {
+
+// Compiles a node tree into the bytecode of one Code object. Registers are
+// allocated as a stack: each node is compiled into a destination register,
+// using registers above it for temporaries.
+class Compiler {
+ public:
+  explicit Compiler(Code* code) : code_(code) {}
+
+  // Compiles |body| to return its value.
+  void CompileBody(Node* body) { Compile(body, AllocReg(), true); }
+
+  // Boxes slot |index| of the innermost frame.
+  void EmitBox(size_t index) {
+    Emit(Opcode::Box, {static_cast<uint32_t>(index)});
+  }
+
+ private:
+  // Compiles |node| to leave its value in |dst|. If |tail|, the generated code
+  // returns the value instead, so control never falls through.
+  void Compile(Node* node, uint32_t dst, bool tail);
+
+  void CompileConstant(Expr* val, uint32_t dst, bool tail);
+  void CompileApply(Apply* apply, uint32_t dst, bool tail);
+  void CompileFolded(Folded* folded, uint32_t dst, bool tail);
+  void CompileIf(If* node, uint32_t dst, bool tail);
+  void CompileAndOr(const std::vector<Node*>& tests,
+                    Opcode short_circuit,
+                    Expr* empty_val,
+                    uint32_t dst,
+                    bool tail);
+  void CompileCond(Cond* cond, uint32_t dst, bool tail);
+  void CompileCase(Case* node, uint32_t dst, bool tail);
+  void CompileLet(Let* let, uint32_t dst, bool tail);
+  void CompileLoop(Loop* loop, uint32_t dst, bool tail);
+  void CompileRecur(Recur* recur);
+  void CompileReceive(Receive* receive, uint32_t dst, bool tail);
+  void CompileLambda(Lambda* lambda, uint32_t dst);
+
+  void Emit(Opcode op, std::initializer_list<uint32_t> operands) {
+    code_->code_.push_back(static_cast<uint32_t>(op));
+    code_->code_.insert(code_->code_.end(), operands);
+  }
+
+  // Emits a jump whose target is the last operand, to be set by Patch().
+  size_t EmitJump(Opcode op, std::initializer_list<uint32_t> operands) {
+    Emit(op, operands);
+    code_->code_.push_back(0);
+    return code_->code_.size() - 1;
+  }
+
+  // Points the jump at |pos| to the next instruction.
+  void Patch(size_t pos) { code_->code_[pos] = code_->code_.size(); }
+
+  void Return(uint32_t src, bool tail) {
+    if (tail) {
+      Emit(Opcode::Return, {src});
+    }
+  }
+
+  uint32_t AddConst(Expr* expr) {
+    auto res = const_index_.emplace(expr, code_->consts_.size());
+    if (res.second) {
+      code_->consts_.push_back(expr);
+    }
+    return res.first->second;
+  }
+
+  // Each reference to a top level variable gets its own cache.
+  uint32_t AddCell() {
+    code_->cells_.emplace_back();
+    return code_->cells_.size() - 1;
+  }
+
+  uint32_t AllocReg() {
+    code_->num_regs_ = std::max(code_->num_regs_, next_reg_ + 1);
+    return next_reg_++;
+  }
+
+  // Frees |reg| and every register allocated after it.
+  void FreeRegs(uint32_t reg) { next_reg_ = reg; }
+
+  Code* const code_;
+  uint32_t next_reg_ = 0;
+  std::unordered_map<Expr*, uint32_t> const_index_;
+  // Where each enclosing Loop's iterations start.
+  std::vector<uint32_t> loop_starts_;
+};
+
+void Compiler::Compile(Node* node, uint32_t dst, bool tail) {
+  switch (node->node_type()) {
+    case NodeType::Constant:
+      CompileConstant(static_cast<Constant*>(node)->val(), dst, tail);
+      return;
+
+    case NodeType::LocalRef: {
+      auto* ref = static_cast<LocalRef*>(node);
+      uint32_t var = AddConst(ref->var());
+      if (ref->boxed()) {
+        Emit(Opcode::BoxRef, {dst, static_cast<uint32_t>(ref->depth()),
+                              static_cast<uint32_t>(ref->index()), var});
+      } else if (ref->depth() == 0) {
+        Emit(Opcode::LocalRef0,
+             {dst, static_cast<uint32_t>(ref->index()), var});
+      } else {
+        Emit(Opcode::LocalRef, {dst, static_cast<uint32_t>(ref->depth()),
+                                static_cast<uint32_t>(ref->index()), var});
+      }
+      break;
+    }
+
+    case NodeType::GlobalRef: {
+      auto* ref = static_cast<GlobalRef*>(node);
+      Emit(Opcode::GlobalRef, {dst, static_cast<uint32_t>(ref->depth()),
+                               AddConst(ref->var()), AddCell()});
+      break;
+    }
+
+    case NodeType::Apply:
+    case NodeType::PrimApply:
+      CompileApply(static_cast<Apply*>(node), dst, tail);
+      return;
+
+    case NodeType::Folded:
+      CompileFolded(static_cast<Folded*>(node), dst, tail);
+      return;
+
+    case NodeType::If:
+      CompileIf(static_cast<If*>(node), dst, tail);
+      return;
+
+    case NodeType::Sequence: {
+      const auto& body = static_cast<Sequence*>(node)->body();
+      for (size_t i = 0; i < body.size() - 1; ++i) {
+        Compile(body[i], dst, false);
+      }
+      Compile(body.back(), dst, tail);
+      return;
+    }
+
+    case NodeType::And:
+      CompileAndOr(static_cast<And*>(node)->tests(), Opcode::JumpIfFalse,
+                   expr::True(), dst, tail);
+      return;
+
+    case NodeType::Or:
+      CompileAndOr(static_cast<Or*>(node)->tests(), Opcode::JumpIfTrue,
+                   expr::False(), dst, tail);
+      return;
+
+    case NodeType::Cond:
+      CompileCond(static_cast<Cond*>(node), dst, tail);
+      return;
+
+    case NodeType::Case:
+      CompileCase(static_cast<Case*>(node), dst, tail);
+      return;
+
+    case NodeType::LocalSet: {
+      auto* set = static_cast<LocalSet*>(node);
+      Compile(set->val(), dst, false);
+      Emit(set->boxed() ? Opcode::BoxSet : Opcode::LocalSet,
+           {dst, static_cast<uint32_t>(set->depth()),
+            static_cast<uint32_t>(set->index())});
+      CompileConstant(Nil(), dst, tail);
+      return;
+    }
+
+    case NodeType::GlobalSet: {
+      auto* set = static_cast<GlobalSet*>(node);
+      Compile(set->val(), dst, false);
+      Emit(Opcode::GlobalSet, {dst, static_cast<uint32_t>(set->depth()),
+                               AddConst(set->var()), AddCell()});
+      CompileConstant(Nil(), dst, tail);
+      return;
+    }
+
+    case NodeType::Define: {
+      auto* define = static_cast<Define*>(node);
+      Compile(define->val(), dst, false);
+      Emit(Opcode::Define, {dst, AddConst(define->var())});
+      CompileConstant(Nil(), dst, tail);
+      return;
+    }
+
+    case NodeType::Lambda:
+      CompileLambda(static_cast<Lambda*>(node), dst);
+      break;
+
+    case NodeType::Let:
+      CompileLet(static_cast<Let*>(node), dst, tail);
+      return;
+
+    case NodeType::Loop:
+      CompileLoop(static_cast<Loop*>(node), dst, tail);
+      return;
+
+    case NodeType::Recur:
+      CompileRecur(static_cast<Recur*>(node));
+      return;
+
+    case NodeType::Receive:
+      CompileReceive(static_cast<Receive*>(node), dst, tail);
+      return;
+
+    case NodeType::Delay: {
+      auto* delay = static_cast<Delay*>(node);
+      CompileLambda(delay->thunk(), dst);
+      Emit(Opcode::MakePromise, {dst, delay->is_lazy()});
+      break;
+    }
+  }
+
+  Return(dst, tail);
+}
+
+void Compiler::CompileConstant(Expr* val, uint32_t dst, bool tail) {
+  Emit(Opcode::Const, {dst, AddConst(val)});
+  Return(dst, tail);
+}
+
+void Compiler::CompileApply(Apply* apply, uint32_t dst, bool tail) {
+  uint32_t proc = AllocReg();
+  for (size_t i = 0; i < apply->args().size(); ++i) {
+    AllocReg();
+  }
+
+  Compile(apply->op(), proc, false);
+  for (size_t i = 0; i < apply->args().size(); ++i) {
+    Compile(apply->args()[i], proc + 1 + i, false);
+  }
+
+  auto num_args = static_cast<uint32_t>(apply->args().size());
+  bool open_coded = apply->node_type() == NodeType::PrimApply;
+  if (open_coded) {
+    Emit(Opcode::OpenCall, {dst, proc, num_args, AddConst(apply)});
+  }
+  if (tail) {
+    Emit(Opcode::TailCall, {proc, num_args});
+    // Where an open coded call continues.
+    if (open_coded) {
+      Emit(Opcode::Return, {dst});
+    }
+  } else {
+    Emit(Opcode::Call, {dst, proc, num_args});
+  }
+  FreeRegs(proc);
+}
+
+void Compiler::CompileFolded(Folded* folded, uint32_t dst, bool tail) {
+  // Each guard which holds jumps over the jump to the original code.
+  std::vector<size_t> to_original;
+  for (const auto& guard : folded->guards()) {
+    Compile(guard.ref, dst, false);
+    size_t holds =
+        EmitJump(Opcode::JumpIfEqv, {dst, AddConst(guard.expected)});
+    to_original.push_back(EmitJump(Opcode::Jump, {}));
+    Patch(holds);
+  }
+  Compile(folded->folded(), dst, tail);
+  size_t to_end = tail ? 0 : EmitJump(Opcode::Jump, {});
+
+  for (auto pos : to_original) {
+    Patch(pos);
+  }
+  Compile(folded->original(), dst, tail);
+  if (!tail) {
+    Patch(to_end);
+  }
+}
+
+void Compiler::CompileIf(If* node, uint32_t dst, bool tail) {
+  Compile(node->test(), dst, false);
+  size_t to_alternate = EmitJump(Opcode::JumpIfFalse, {dst});
+  Compile(node->consequent(), dst, tail);
+  size_t to_end = tail ? 0 : EmitJump(Opcode::Jump, {});
+
+  Patch(to_alternate);
+  if (node->alternate()) {
+    Compile(node->alternate(), dst, tail);
+  } else {
+    CompileConstant(Nil(), dst, tail);
+  }
+  if (!tail) {
+    Patch(to_end);
+  }
+}
+
+void Compiler::CompileAndOr(const std::vector<Node*>& tests,
+                            Opcode short_circuit,
+                            Expr* empty_val,
+                            uint32_t dst,
+                            bool tail) {
+  if (tests.empty()) {
+    CompileConstant(empty_val, dst, tail);
+    return;
+  }
+
+  std::vector<size_t> to_end;
+  for (size_t i = 0; i < tests.size() - 1; ++i) {
+    Compile(tests[i], dst, false);
+    to_end.push_back(EmitJump(short_circuit, {dst}));
+  }
+  Compile(tests.back(), dst, tail);
+
+  for (auto pos : to_end) {
+    Patch(pos);
+  }
+  if (!to_end.empty()) {
+    Return(dst, tail);
+  }
+}
+
+void Compiler::CompileCond(Cond* cond, uint32_t dst, bool tail) {
+  std::vector<size_t> to_end;
+  for (const auto& clause : cond->clauses()) {
+    Compile(clause.test, dst, false);
+    if (!clause.body) {
+      if (tail) {
+        size_t to_next = EmitJump(Opcode::JumpIfFalse, {dst});
+        Return(dst, tail);
+        Patch(to_next);
+      } else {
+        to_end.push_back(EmitJump(Opcode::JumpIfTrue, {dst}));
+      }
+      continue;
+    }
+
+    size_t to_next = EmitJump(Opcode::JumpIfFalse, {dst});
+    if (clause.is_arrow) {
+      uint32_t proc = AllocReg();
+      AllocReg();
+      Compile(clause.body, proc, false);
+      Emit(Opcode::Move, {proc + 1, dst});
+      if (tail) {
+        Emit(Opcode::TailCall, {proc, 1});
+      } else {
+        Emit(Opcode::Call, {dst, proc, 1});
+      }
+      FreeRegs(proc);
+    } else {
+      Compile(clause.body, dst, tail);
+    }
+    if (!tail) {
+      to_end.push_back(EmitJump(Opcode::Jump, {}));
+    }
+    Patch(to_next);
+  }
+
+  if (cond->else_body()) {
+    Compile(cond->else_body(), dst, tail);
+  } else {
+    CompileConstant(Nil(), dst, tail);
+  }
+  for (auto pos : to_end) {
+    Patch(pos);
+  }
+}
+
+void Compiler::CompileCase(Case* node, uint32_t dst, bool tail) {
+  uint32_t key = AllocReg();
+  Compile(node->key(), key, false);
+
+  std::vector<size_t> to_end;
+  for (const auto& clause : node->clauses()) {
+    std::vector<size_t> to_body;
+    for (auto* datum : clause.data) {
+      to_body.push_back(EmitJump(Opcode::JumpIfEqv, {key, AddConst(datum)}));
+    }
+    size_t to_next = EmitJump(Opcode::Jump, {});
+
+    for (auto pos : to_body) {
+      Patch(pos);
+    }
+    Compile(clause.body, dst, tail);
+    if (!tail) {
+      to_end.push_back(EmitJump(Opcode::Jump, {}));
+    }
+    Patch(to_next);
+  }
+
+  if (node->else_body()) {
+    Compile(node->else_body(), dst, tail);
+  } else {
+    CompileConstant(Nil(), dst, tail);
+  }
+  for (auto pos : to_end) {
+    Patch(pos);
+  }
+  FreeRegs(key);
+}
+
+void Compiler::CompileLet(Let* let, uint32_t dst, bool tail) {
+  const auto& inits = let->inits();
+  const auto& boxed = let->boxed();
+  auto num_slots = static_cast<uint32_t>(let->num_slots());
+  auto push_env = [&]() {
+    Emit(Opcode::PushEnv, {num_slots});
+    for (auto index : boxed) {
+      EmitBox(index);
+    }
+  };
+  auto set_slot = [&](uint32_t src, uint32_t index) {
+    bool is_boxed =
+        std::find(boxed.begin(), boxed.end(), index) != boxed.end();
+    Emit(is_boxed ? Opcode::BoxSet : Opcode::LocalSet, {src, 0, index});
+  };
+  if (let->kind() == Let::Kind::LET) {
+    // Inits are evaluated before entering the new frame.
+    uint32_t first = next_reg_;
+    for (size_t i = 0; i < inits.size(); ++i) {
+      AllocReg();
+    }
+    for (uint32_t i = 0; i < inits.size(); ++i) {
+      Compile(inits[i], first + i, false);
+    }
+    push_env();
+    for (uint32_t i = 0; i < inits.size(); ++i) {
+      set_slot(first + i, i);
+    }
+    FreeRegs(first);
+  } else {
+    push_env();
+    for (uint32_t i = 0; i < inits.size(); ++i) {
+      Compile(inits[i], dst, false);
+      set_slot(dst, i);
+    }
+  }
+
+  Compile(let->body(), dst, tail);
+  if (!tail) {
+    Emit(Opcode::PopEnv, {});
+  }
+}
+
+// The loop's frame is entered once. Each iteration starts by boxing the
+// variables which need it, and Recur jumps back there.
+void Compiler::CompileLoop(Loop* loop, uint32_t dst, bool tail) {
+  const auto& inits = loop->inits();
+  auto num_vars = static_cast<uint32_t>(inits.size());
+  uint32_t first = next_reg_;
+  for (size_t i = 0; i < inits.size(); ++i) {
+    AllocReg();
+  }
+  for (uint32_t i = 0; i < num_vars; ++i) {
+    Compile(inits[i], first + i, false);
+  }
+  Emit(Opcode::PushEnv, {num_vars});
+  for (uint32_t i = 0; i < num_vars; ++i) {
+    Emit(Opcode::LocalSet, {first + i, 0, i});
+  }
+  FreeRegs(first);
+
+  loop_starts_.push_back(static_cast<uint32_t>(code_->code_.size()));
+  for (auto index : loop->boxed()) {
+    EmitBox(index);
+  }
+  Compile(loop->body(), dst, tail);
+  loop_starts_.pop_back();
+  if (!tail) {
+    Emit(Opcode::PopEnv, {});
+  }
+}
+
+// Leaves the frames of lets within the loop's body before rebinding the
+// variables.
+void Compiler::CompileRecur(Recur* recur) {
+  const auto& args = recur->args();
+  uint32_t first = next_reg_;
+  for (size_t i = 0; i < args.size(); ++i) {
+    AllocReg();
+  }
+  for (uint32_t i = 0; i < args.size(); ++i) {
+    Compile(args[i], first + i, false);
+  }
+  for (size_t i = 0; i < recur->depth(); ++i) {
+    Emit(Opcode::PopEnv, {});
+  }
+  for (uint32_t i = 0; i < args.size(); ++i) {
+    Emit(Opcode::LocalSet, {first + i, 0, i});
+  }
+  FreeRegs(first);
+  Emit(Opcode::Jump, {loop_starts_.back()});
+}
+
+// The producer's values are bound straight from MultipleValues.
+void Compiler::CompileReceive(Receive* receive, uint32_t dst, bool tail) {
+  Compile(receive->producer(), dst, false);
+  Emit(Opcode::PushEnv, {static_cast<uint32_t>(receive->num_slots())});
+  Emit(Opcode::BindValues,
+       {dst, static_cast<uint32_t>(receive->required_vars().size()),
+        receive->variable_var() ? 1u : 0u});
+  for (auto index : receive->boxed()) {
+    EmitBox(index);
+  }
+  Compile(receive->body(), dst, tail);
+  if (!tail) {
+    Emit(Opcode::PopEnv, {});
+  }
+}
+
+// Only flat closures are compiled, so the captured values are copied into
+// registers for MakeClosure.
+void Compiler::CompileLambda(Lambda* lambda, uint32_t dst) {
+  assert(lambda->is_flat());
+  const auto& flat = lambda->flat();
+  auto code = eval::CompileLambda(lambda);
+  uint32_t src = next_reg_;
+  for (size_t i = 0; i < flat.captures.size(); ++i) {
+    AllocReg();
+  }
+  for (uint32_t i = 0; i < flat.captures.size(); ++i) {
+    Compile(flat.captures[i], src + i, false);
+  }
+  Emit(Opcode::MakeClosure,
+       {dst, AddConst(code.get()), src,
+        static_cast<uint32_t>(flat.captures.size()),
+        static_cast<uint32_t>(flat.top_depth)});
+  FreeRegs(src);
+}
+
+gc::Lock<Code> CompileLambda(Lambda* lambda) {
+  gc::Lock<Code> code(new Code(lambda));
+  code->num_required_ = static_cast<uint32_t>(lambda->required_args().size());
+  code->has_rest_ = lambda->variable_arg() != nullptr;
+  code->num_slots_ = static_cast<uint32_t>(lambda->num_slots());
+  Compiler compiler(code.get());
+  for (auto index : lambda->flat().boxed) {
+    compiler.EmitBox(index);
+  }
+  compiler.CompileBody(lambda->body());
+  return code;
+}
+
+gc::Lock<Code> Compile(Node* node) {
+  gc::Lock<Code> code(new Code(node));
+  Compiler(code.get()).CompileBody(node);
+  return code;
+}
+
+}  // namespace eval
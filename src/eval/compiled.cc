@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "eval/compiled.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "eval/call_stack.h"
+#include "eval/eval.h"
+#include "eval/value_stack.h"
+#include "util/flags.h"
+
+using expr::Env;
+using expr::Expr;
+using expr::Nil;
+using util::RuntimeException;
+
+namespace eval {
+namespace compiled {
+
+namespace {
+
+// Makes the pending call if |ret| is TailCallMarker(), for code run outside of
+// a Proc.
+gc::Lock<Expr> FinishTailCall(gc::Lock<Expr> ret, Env* env) {
+  if (ret.get() != TailCallMarker()) {
+    return ret;
+  }
+
+  auto& call = eval::TailCall::Get();
+  auto num_args = call.num_args();
+  StackSlots proc(1 + num_args);
+  proc[0] = call.proc();
+  std::copy(call.args(), call.args() + num_args, proc.get() + 1);
+  call.Clear();
+  return expr::TryEvals(proc[0])->DoEval(env, proc.get() + 1, num_args);
+}
+
+}  // namespace
+
+gc::Lock<Expr> Run(const Code* code, Env* env) {
+  StackSlots window(1 + code->num_regs);
+  window[0] = env;
+  return gc::Lock<Expr>(code->function(window.get()));
+}
+
+gc::Lock<Expr> Proc::DoEval(Env* env, Expr** args, size_t num_args) {
+  if (StackIsLow()) {
+    return CallOnNewSegment(this, env, args, num_args);
+  }
+  auto& call = eval::TailCall::Get();
+  // Holds the procedure being run once tail calls replace this one.
+  StackSlots proc(1);
+  auto* closure = this;
+  while (true) {
+    Step();
+    auto frame = closure->BindArgs(args, num_args);
+    // The arguments are in the frame now, so the call can be reused.
+    call.Clear();
+    auto ret = Run(closure->code_, frame.get());
+    if (ret.get() != TailCallMarker()) {
+      return ret;
+    }
+
+    proc[0] = call.proc();
+    args = call.args();
+    num_args = call.num_args();
+    closure = dynamic_cast<Proc*>(proc[0]);
+    if (!closure) {
+      return FinishTailCall(std::move(ret), env);
+    }
+  }
+}
+
+gc::Lock<Env> Proc::BindArgs(Expr** args, size_t num_args) {
+  if (num_args < code_->num_required ||
+      (num_args > code_->num_required && !code_->has_rest)) {
+    // The arguments may be those of a pending tail call.
+    eval::TailCall::Get().Clear();
+    ThrowArgCountError(code_->num_required, code_->has_rest, num_args);
+  }
+
+  auto frame = Env::NewFrame(env_, code_->num_slots);
+  size_t slot = 0;
+  for (; slot < code_->num_required; ++slot) {
+    frame->slot(slot) = args[slot];
+  }
+  if (code_->has_rest) {
+    gc::Lock<Expr> rest(Nil());
+    for (size_t i = num_args; i > slot; --i) {
+      rest.reset(new expr::Pair(args[i - 1], rest.get()));
+    }
+    frame->slot(slot) = rest.get();
+  }
+
+  return frame;
+}
+
+Program::Program(size_t num_consts, size_t num_cells)
+    : consts_(num_consts), cells_(num_cells) {
+  gc::Gc::Get().AddRootSet(this);
+}
+
+Program::~Program() {
+  gc::Gc::Get().RemoveRootSet(this);
+}
+
+std::vector<gc::Lock<Expr>> Program::Run(const Code* const* forms,
+                                         size_t num_forms,
+                                         Env* env) {
+  std::vector<gc::Lock<Expr>> vals;
+  for (size_t i = 0; i < num_forms; ++i) {
+    LimitScope limits;
+    vals.push_back(FinishTailCall(compiled::Run(forms[i], env), env));
+  }
+  return vals;
+}
+
+void Program::MarkRoots() {
+  for (auto* val : consts_) {
+    if (val) {
+      val->GcMark();
+    }
+  }
+  for (auto& cell : cells_) {
+    cell.MarkReferences();
+  }
+}
+
+int Main(int argc,
+         char** argv,
+         std::vector<gc::Lock<Expr>> (*run)(Env* env)) {
+  util::Flags::Init(argc, argv);
+  auto env = GetDefaultEnv();
+  try {
+    run(env.get());
+  } catch (std::exception& e) {
+    std::cerr << e.what() << "\n";
+  }
+  return EXIT_SUCCESS;
+}
+
+}  // namespace compiled
+}  // namespace eval
@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVAL_COMPILED_H_
+#define EVAL_COMPILED_H_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "eval/limits.h"
+#include "eval/node.h"
+#include "expr/expr.h"
+#include "expr/primitive.h"
+#include "gc/gc.h"
+#include "gc/lock.h"
+#include "util/exceptions.h"
+
+// Runtime for the C++ written by EmitCxx(). Generated programs include this
+// header and link against the rest of the interpreter.
+namespace eval {
+namespace compiled {
+
+// A function generated from the bytecode of a lambda body or top level
+// expression. Its window of the value stack holds the current frame followed
+// by the registers.
+struct Code {
+  using Function = expr::Expr* (*)(expr::Expr** window);
+
+  Function function;
+  uint32_t num_regs;
+
+  // Arguments and frame size of a lambda body.
+  uint32_t num_required;
+  bool has_rest;
+  uint32_t num_slots;
+
+  // Printed for procedures made from the code.
+  const char* source;
+};
+
+// Runs |code| in |env|. May return TailCallMarker().
+gc::Lock<expr::Expr> Run(const Code* code, expr::Env* env);
+
+// A procedure made from compiled code. DoEval() is the driver for tail calls,
+// as LambdaImpl::DoEval is for the tree walker.
+class Proc final : public expr::Evals {
+ public:
+  Proc(const Code* code, expr::Env* env) : code_(code), env_(env) {
+    assert(env);
+  }
+
+  // Evals implementation:
+  gc::Lock<expr::Expr> DoEval(expr::Env* env,
+                              expr::Expr** args,
+                              size_t num_args) override;
+  std::ostream& AppendStream(std::ostream& stream) const override {
+    return stream << code_->source;
+  }
+  void MarkReferences() override { env_->GcMark(); }
+
+ private:
+  ~Proc() override = default;
+
+  // Checks the number of arguments and returns a new frame holding them.
+  gc::Lock<expr::Env> BindArgs(expr::Expr** args, size_t num_args);
+
+  const Code* const code_;
+  expr::Env* const env_;
+};
+
+// The constants and global variable caches of a compiled program. Procedures
+// made by the program refer to them, so it lives until exit.
+class Program : public gc::RootSet {
+ public:
+  Program(size_t num_consts, size_t num_cells);
+  ~Program();
+
+  // Constants are filled in by the generated code, each after those it
+  // refers to.
+  expr::Expr** consts() { return consts_.data(); }
+  GlobalCell* cells() { return cells_.data(); }
+
+  // Runs |forms| in order in |env|, returning the value of each.
+  std::vector<gc::Lock<expr::Expr>> Run(const Code* const* forms,
+                                        size_t num_forms,
+                                        expr::Env* env);
+
+  // RootSet implementation:
+  void MarkRoots() override;
+
+ private:
+  std::vector<expr::Expr*> consts_;
+  std::vector<GlobalCell> cells_;
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(Program);
+};
+
+// Defined by the generated code. Runs the program in |env|, returning the
+// value of each top level form.
+std::vector<gc::Lock<expr::Expr>> RunProgram(expr::Env* env);
+
+// The main() of a generated program. Runs |run| in a default environment the
+// way parp runs a file, reporting errors on standard error.
+int Main(int argc,
+         char** argv,
+         std::vector<gc::Lock<expr::Expr>> (*run)(expr::Env* env));
+
+// Operations of the generated code, one for each opcode which isn't a plain
+// C++ statement.
+
+inline double DoubleFromBits(uint64_t bits) {
+  double val;
+  memcpy(&val, &bits, sizeof(val));
+  return val;
+}
+
+inline expr::Env* CurrentEnv(expr::Expr** window) {
+  return static_cast<expr::Env*>(window[0]);
+}
+
+inline expr::Expr* LocalRef(expr::Expr** window,
+                            size_t depth,
+                            size_t index,
+                            expr::Expr* var) {
+  auto* val = FrameAt(CurrentEnv(window), depth)->slot(index);
+  if (!val) {
+    throw util::RuntimeException("Attempt to reference unassigned variable",
+                                 var);
+  }
+  return val;
+}
+
+inline expr::Expr* GlobalRef(expr::Expr** window,
+                             size_t depth,
+                             expr::Expr* var,
+                             GlobalCell* cell) {
+  auto* sym = static_cast<expr::Symbol*>(var);
+  auto* top = FrameAt(CurrentEnv(window), depth);
+  auto** loc = cell->Get(top, sym);
+  return loc ? *loc : top->Lookup(sym);
+}
+
+inline void LocalSet(expr::Expr** window,
+                     size_t depth,
+                     size_t index,
+                     expr::Expr* val) {
+  FrameAt(CurrentEnv(window), depth)->slot(index) = val;
+}
+
+inline void GlobalSet(expr::Expr** window,
+                      size_t depth,
+                      expr::Expr* var,
+                      GlobalCell* cell,
+                      expr::Expr* val) {
+  auto* sym = static_cast<expr::Symbol*>(var);
+  auto* top = FrameAt(CurrentEnv(window), depth);
+  if (auto** loc = cell->Get(top, sym)) {
+    *loc = val;
+  } else {
+    top->SetVar(sym, val);
+  }
+}
+
+inline void Define(expr::Expr** window, expr::Expr* var, expr::Expr* val) {
+  CurrentEnv(window)->DefineVar(static_cast<expr::Symbol*>(var), val);
+}
+
+inline void PushEnv(expr::Expr** window, size_t num_slots) {
+  window[0] = expr::Env::NewFrame(CurrentEnv(window), num_slots).get();
+}
+
+inline void PopEnv(expr::Expr** window) {
+  window[0] = CurrentEnv(window)->enclosing();
+}
+
+inline void BindValues(expr::Expr** window,
+                       expr::Expr* val,
+                       size_t num_required,
+                       bool has_rest) {
+  eval::BindValues(val, num_required, has_rest, CurrentEnv(window));
+}
+
+// |captures| are the |num_captures| values the closure copies.
+inline expr::Expr* MakeProc(const Code* code,
+                            expr::Expr** window,
+                            expr::Expr** captures,
+                            size_t num_captures,
+                            size_t top_depth) {
+  auto frame = NewClosureFrame(FrameAt(CurrentEnv(window), top_depth),
+                               captures, num_captures);
+  return new Proc(code, frame.get());
+}
+
+// A delay is compiled to a thunk, which the promise calls once.
+inline expr::Expr* MakePromise(expr::Expr* thunk, bool is_lazy) {
+  return new eval::Promise(thunk, is_lazy);
+}
+
+inline void Box(expr::Expr** window, size_t index) {
+  auto& slot = CurrentEnv(window)->slot(index);
+  slot = NewBox(slot).get();
+}
+
+inline expr::Expr* BoxRef(expr::Expr** window,
+                          size_t depth,
+                          size_t index,
+                          expr::Expr* var) {
+  auto* val = Unbox(FrameAt(CurrentEnv(window), depth)->slot(index));
+  if (!val) {
+    throw util::RuntimeException("Attempt to reference unassigned variable",
+                                 var);
+  }
+  return val;
+}
+
+inline void BoxSet(expr::Expr** window,
+                   size_t depth,
+                   size_t index,
+                   expr::Expr* val) {
+  Unbox(FrameAt(CurrentEnv(window), depth)->slot(index)) = val;
+}
+
+// |proc| is followed by the arguments.
+inline expr::Expr* Call(expr::Expr** window,
+                        expr::Expr** proc,
+                        size_t num_args) {
+  return expr::TryEvals(*proc)
+      ->DoEval(CurrentEnv(window), proc + 1, num_args)
+      .get();
+}
+
+// Sets |dst| to the result of calling |proc| with the arguments following it
+// and returns true if |proc| is |primitive| and expr::OpenCode() computes the
+// result. Otherwise the call is made normally.
+inline bool OpenCall(expr::Primitive primitive,
+                     expr::Expr** proc,
+                     size_t num_args,
+                     expr::Expr** dst) {
+  expr::Primitive actual;
+  if (!expr::GetPrimitive(*proc, &actual) || actual != primitive) {
+    return false;
+  }
+  auto* val = expr::OpenCode(primitive, proc + 1, num_args);
+  if (!val) {
+    return false;
+  }
+  *dst = val;
+  return true;
+}
+
+// Called before each jump back, which loops.
+inline void Step() {
+  eval::Step();
+}
+
+inline expr::Expr* TailCall(expr::Expr** proc, size_t num_args) {
+  expr::TryEvals(*proc);
+  return MakeTailCall(*proc, proc + 1, num_args);
+}
+
+}  // namespace compiled
+}  // namespace eval
+
+#endif  // EVAL_COMPILED_H_
@@ -0,0 +1,488 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "eval/emit_cxx.h"
+
+#include <cassert>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "eval/vm.h"
+#include "expr/bytevector.h"
+#include "expr/number.h"
+#include "util/exceptions.h"
+
+using expr::Expr;
+using util::RuntimeException;
+
+namespace eval {
+
+namespace {
+
+// A C++ string literal holding |str|. Octal escapes are used since they end
+// after three digits.
+std::string Quote(const std::string& str) {
+  std::ostringstream os;
+  os << '"';
+  for (unsigned char c : str) {
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (c >= 0x20 && c < 0x7f && c != '?') {
+      os << c;
+    } else {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\%03o", c);
+      os << buf;
+    }
+  }
+  os << '"';
+  return os.str();
+}
+
+// Doubles are written as their bits, so they are exact.
+std::string DoubleLiteral(double val) {
+  uint64_t bits;
+  memcpy(&bits, &val, sizeof(bits));
+  char buf[64];
+  snprintf(buf, sizeof(buf), "rt::DoubleFromBits(UINT64_C(0x%016" PRIx64 "))",
+           bits);
+  return buf;
+}
+
+std::string IntLiteral(int64_t val) {
+  if (val == INT64_MIN) {
+    return "INT64_MIN";
+  }
+  char buf[32];
+  snprintf(buf, sizeof(buf), "INT64_C(%" PRId64 ")", val);
+  return buf;
+}
+
+const size_t kNumOperands[] = {
+#define X(name, num_operands) num_operands,
+#include "eval/opcodes.inc"  // NOLINT(build/include)
+#undef X
+};
+
+// The enumerator and variable of each primitive.
+const struct {
+  const char* name;
+  const char* var;
+} kPrimitiveNames[] = {
+#define X(name, str) {#name, #str},
+#include "expr/primitives.inc"  // NOLINT(build/include)
+#undef X
+};
+
+// Where the OpenCall at |pc| continues if it computes the call.
+size_t SkipCall(const std::vector<uint32_t>& insts, size_t pc) {
+  pc += 1 + kNumOperands[insts[pc]];
+  return pc + 1 + kNumOperands[insts[pc]];
+}
+
+}  // namespace
+
+// Translates bytecode into C++ functions, gathering the constants and caches
+// they share into tables which the program fills in at startup.
+class CxxEmitter {
+ public:
+  explicit CxxEmitter(std::ostream& out) : out_(out) {}
+
+  void Emit(const std::vector<Node*>& forms);
+
+ private:
+  // Adds |code| and the code nested in it, returning its index.
+  size_t AddCode(gc::Lock<Code> code);
+
+  // Returns the index of |val| in the constant table, adding it and the
+  // values it refers to if needed.
+  size_t AddConst(Expr* val);
+
+  // Writes the function for the code at |index| to |os|.
+  void EmitFunction(size_t index, std::ostream& os);
+
+  std::ostream& out_;
+  std::vector<gc::Lock<Code>> codes_;
+  // The first entry of each code's caches in the cache table.
+  std::vector<size_t> cell_bases_;
+  size_t num_cells_ = 0;
+  // Index of the code made for each lambda's Code and each delay's Node.
+  std::unordered_map<Expr*, size_t> nested_;
+
+  // Statements filling in the constant table.
+  std::ostringstream consts_;
+  std::unordered_map<Expr*, size_t> const_index_;
+};
+
+void CxxEmitter::Emit(const std::vector<Node*>& forms) {
+  std::vector<size_t> form_codes;
+  for (auto* form : forms) {
+    form_codes.push_back(AddCode(Compile(form)));
+  }
+  std::ostringstream functions;
+  for (size_t i = 0; i < codes_.size(); ++i) {
+    EmitFunction(i, functions);
+  }
+
+  out_ << "// Generated by parp --emit-cxx.\n\n"
+       << "#include <cstdint>\n"
+       << "#include <vector>\n\n"
+       << "#include \"eval/compiled.h\"\n"
+       << "#include \"expr/bytevector.h\"\n"
+       << "#include \"expr/number.h\"\n"
+       << "#include \"expr/primitive.h\"\n\n"
+       << "namespace {\n\n"
+       << "namespace rt = eval::compiled;\n"
+       << "using expr::Expr;\n\n"
+       << "Expr** k;\n"
+       << "eval::GlobalCell* c;\n\n";
+
+  for (size_t i = 0; i < codes_.size(); ++i) {
+    out_ << "Expr* F" << i << "(Expr** w);\n";
+  }
+  out_ << "\nconst rt::Code kCode[] = {\n";
+  for (size_t i = 0; i < codes_.size(); ++i) {
+    auto* code = codes_[i].get();
+    std::string source;
+    if (code->source()->node_type() == NodeType::Lambda) {
+      std::ostringstream os;
+      os << *code->source();
+      source = os.str();
+    }
+    out_ << "    {&F" << i << ", " << code->num_regs_ << ", "
+         << code->num_required_ << ", "
+         << (code->has_rest_ ? "true" : "false") << ", " << code->num_slots_
+         << ",\n     " << Quote(source) << "},\n";
+  }
+  out_ << "    {nullptr, 0, 0, false, 0, nullptr},\n};\n\n";
+
+  out_ << functions.str();
+
+  out_ << "const rt::Code* const kForms[] = {\n";
+  for (auto index : form_codes) {
+    out_ << "    &kCode[" << index << "],\n";
+  }
+  out_ << "    nullptr,\n};\n\n";
+
+  out_ << "void LoadConstants(expr::Env* env) {\n" << consts_.str() << "}\n\n"
+       << "}  // namespace\n\n"
+       << "std::vector<gc::Lock<Expr>> rt::RunProgram(expr::Env* env) {\n"
+       << "  static rt::Program program(" << const_index_.size() << ", "
+       << num_cells_ << ");\n"
+       << "  if (!k) {\n"
+       << "    k = program.consts();\n"
+       << "    c = program.cells();\n"
+       << "    LoadConstants(env);\n"
+       << "  }\n"
+       << "  return program.Run(kForms, " << form_codes.size() << ", env);\n"
+       << "}\n\n"
+       << "#ifndef PARP_NO_MAIN\n"
+       << "int main(int argc, char** argv) {\n"
+       << "  return rt::Main(argc, argv, &rt::RunProgram);\n"
+       << "}\n"
+       << "#endif  // PARP_NO_MAIN\n";
+}
+
+size_t CxxEmitter::AddCode(gc::Lock<Code> code) {
+  auto index = codes_.size();
+  auto* ptr = code.get();
+  codes_.push_back(std::move(code));
+  cell_bases_.push_back(num_cells_);
+  num_cells_ += ptr->cells_.size();
+
+  const auto& insts = ptr->code_;
+  for (size_t pc = 0; pc < insts.size();
+       pc += 1 + kNumOperands[insts[pc]]) {
+    // The nested code's constant is the second operand.
+    if (static_cast<Opcode>(insts[pc]) == Opcode::MakeClosure) {
+      auto* val = ptr->consts_[insts[pc + 2]];
+      auto* lambda = static_cast<Lambda*>(static_cast<Code*>(val)->source());
+      nested_[val] = AddCode(CompileLambda(lambda));
+    }
+  }
+  return index;
+}
+
+size_t CxxEmitter::AddConst(Expr* val) {
+  auto it = const_index_.find(val);
+  if (it != const_index_.end()) {
+    return it->second;
+  }
+
+  // Values are built after those they refer to. Lists are walked along their
+  // cdrs iteratively, so long ones don't recurse deeply.
+  std::ostringstream os;
+  switch (val->type()) {
+    case Expr::Type::EMPTY_LIST:
+      os << "expr::Nil()";
+      break;
+    case Expr::Type::BOOL:
+      os << (val->AsBool()->val() ? "expr::True()" : "expr::False()");
+      break;
+    case Expr::Type::NUMBER:
+      if (auto* int_val = val->AsNumber()->AsInt()) {
+        os << "new expr::Int(" << IntLiteral(int_val->val()) << ")";
+      } else {
+        os << "new expr::Float("
+           << DoubleLiteral(val->AsNumber()->AsFloat()->val()) << ")";
+      }
+      break;
+    case Expr::Type::CHAR:
+      os << "new expr::Char(static_cast<char>("
+         << static_cast<int>(val->AsChar()->val()) << "))";
+      break;
+    case Expr::Type::STRING: {
+      const auto& str = val->AsString()->val();
+      os << "new expr::String(std::string(" << Quote(str) << ", "
+         << str.size() << "), "
+         << (val->AsString()->read_only() ? "true" : "false") << ")";
+      break;
+    }
+    case Expr::Type::SYMBOL:
+      os << "expr::Symbol::New(" << Quote(val->AsSymbol()->val()) << ")";
+      break;
+    case Expr::Type::PAIR: {
+      std::vector<expr::Pair*> pairs;
+      Expr* tail = val;
+      while (auto* pair = tail->AsPair()) {
+        if (const_index_.count(pair)) {
+          break;
+        }
+        pairs.push_back(pair);
+        tail = pair->cdr();
+      }
+      auto cdr = AddConst(tail);
+      for (auto it = pairs.rbegin(); it != pairs.rend(); ++it) {
+        auto car = AddConst((*it)->car());
+        auto index = const_index_.size();
+        consts_ << "  k[" << index << "] = new expr::Pair(k[" << car << "], k["
+                << cdr << "]);\n";
+        const_index_.emplace(*it, index);
+        cdr = index;
+      }
+      return cdr;
+    }
+    case Expr::Type::VECTOR: {
+      std::vector<size_t> elems;
+      for (auto* elem : val->AsVector()->vals()) {
+        elems.push_back(AddConst(elem));
+      }
+      os << "new expr::Vector({";
+      for (size_t i = 0; i < elems.size(); ++i) {
+        os << (i ? ", " : "") << "k[" << elems[i] << "]";
+      }
+      os << "})";
+      break;
+    }
+    case Expr::Type::F64VECTOR: {
+      os << "new expr::F64Vector({";
+      const auto& vals = val->AsF64Vector()->vals();
+      for (size_t i = 0; i < vals.size(); ++i) {
+        os << (i ? ", " : "") << DoubleLiteral(vals[i]);
+      }
+      os << "})";
+      break;
+    }
+    case Expr::Type::BYTEVECTOR: {
+      os << "new expr::Bytevector({";
+      auto* bytes = val->AsBytevector();
+      for (size_t i = 0; i < bytes->size(); ++i) {
+        os << (i ? ", " : "") << static_cast<int>(bytes->data()[i]);
+      }
+      os << "})";
+      break;
+    }
+    default: {
+      // Primitives compared against by folded calls are those of the
+      // program's environment.
+      expr::Primitive primitive;
+      if (!expr::GetPrimitive(val, &primitive)) {
+        throw RuntimeException("Can't write constant as C++", val);
+      }
+      os << "env->Lookup(expr::Symbol::New("
+         << Quote(kPrimitiveNames[static_cast<size_t>(primitive)].var)
+         << "))";
+      break;
+    }
+  }
+
+  auto index = const_index_.size();
+  consts_ << "  k[" << index << "] = " << os.str() << ";\n";
+  const_index_.emplace(val, index);
+  return index;
+}
+
+void CxxEmitter::EmitFunction(size_t index, std::ostream& os) {
+  auto* code = codes_[index].get();
+  const auto& insts = code->code_;
+  auto cell_base = cell_bases_[index];
+
+  std::set<size_t> targets;
+  for (size_t pc = 0; pc < insts.size();
+       pc += 1 + kNumOperands[insts[pc]]) {
+    auto num_operands = kNumOperands[insts[pc]];
+    switch (static_cast<Opcode>(insts[pc])) {
+      case Opcode::Jump:
+      case Opcode::JumpIfFalse:
+      case Opcode::JumpIfTrue:
+      case Opcode::JumpIfEqv:
+        // The target is the last operand.
+        targets.insert(insts[pc + num_operands]);
+        break;
+      case Opcode::OpenCall:
+        targets.insert(SkipCall(insts, pc));
+        break;
+      default:
+        break;
+    }
+  }
+
+  auto k = [&](uint32_t operand) {
+    std::ostringstream os;
+    os << "k[" << AddConst(code->consts_[operand]) << "]";
+    return os.str();
+  };
+  auto cell = [&](uint32_t operand) {
+    std::ostringstream os;
+    os << "&c[" << cell_base + operand << "]";
+    return os.str();
+  };
+
+  os << "Expr* F" << index << "(Expr** w) {\n"
+     << "  Expr** r = w + 1;\n";
+  for (size_t pc = 0; pc < insts.size();
+       pc += 1 + kNumOperands[insts[pc]]) {
+    if (targets.count(pc)) {
+      os << "L" << pc << ":\n";
+    }
+    const auto* o = &insts[pc + 1];
+    os << "  ";
+    switch (static_cast<Opcode>(insts[pc])) {
+      case Opcode::Const:
+        os << "r[" << o[0] << "] = " << k(o[1]) << ";";
+        break;
+      case Opcode::LocalRef0:
+        os << "r[" << o[0] << "] = rt::LocalRef(w, 0, " << o[1] << ", "
+           << k(o[2]) << ");";
+        break;
+      case Opcode::LocalRef:
+        os << "r[" << o[0] << "] = rt::LocalRef(w, " << o[1] << ", " << o[2]
+           << ", " << k(o[3]) << ");";
+        break;
+      case Opcode::GlobalRef:
+        os << "r[" << o[0] << "] = rt::GlobalRef(w, " << o[1] << ", "
+           << k(o[2]) << ", " << cell(o[3]) << ");";
+        break;
+      case Opcode::LocalSet:
+        os << "rt::LocalSet(w, " << o[1] << ", " << o[2] << ", r[" << o[0]
+           << "]);";
+        break;
+      case Opcode::GlobalSet:
+        os << "rt::GlobalSet(w, " << o[1] << ", " << k(o[2]) << ", "
+           << cell(o[3]) << ", r[" << o[0] << "]);";
+        break;
+      case Opcode::Define:
+        os << "rt::Define(w, " << k(o[1]) << ", r[" << o[0] << "]);";
+        break;
+      case Opcode::Move:
+        os << "r[" << o[0] << "] = r[" << o[1] << "];";
+        break;
+      case Opcode::Jump:
+        if (o[0] <= pc) {
+          os << "rt::Step(); ";
+        }
+        os << "goto L" << o[0] << ";";
+        break;
+      case Opcode::JumpIfFalse:
+        os << "if (r[" << o[0] << "] == expr::False()) goto L" << o[1] << ";";
+        break;
+      case Opcode::JumpIfTrue:
+        os << "if (r[" << o[0] << "] != expr::False()) goto L" << o[1] << ";";
+        break;
+      case Opcode::JumpIfEqv:
+        os << "if (r[" << o[0] << "]->Eqv(" << k(o[1]) << ")) goto L" << o[2]
+           << ";";
+        break;
+      case Opcode::MakeClosure:
+        os << "r[" << o[0] << "] = rt::MakeProc(&kCode["
+           << nested_.at(code->consts_[o[1]]) << "], w, r + " << o[2] << ", "
+           << o[3] << ", " << o[4] << ");";
+        break;
+      case Opcode::MakePromise:
+        os << "r[" << o[0] << "] = rt::MakePromise(r[" << o[0] << "], "
+           << (o[1] ? "true" : "false") << ");";
+        break;
+      case Opcode::Box:
+        os << "rt::Box(w, " << o[0] << ");";
+        break;
+      case Opcode::BoxRef:
+        os << "r[" << o[0] << "] = rt::BoxRef(w, " << o[1] << ", " << o[2]
+           << ", " << k(o[3]) << ");";
+        break;
+      case Opcode::BoxSet:
+        os << "rt::BoxSet(w, " << o[1] << ", " << o[2] << ", r[" << o[0]
+           << "]);";
+        break;
+      case Opcode::PushEnv:
+        os << "rt::PushEnv(w, " << o[0] << ");";
+        break;
+      case Opcode::PopEnv:
+        os << "rt::PopEnv(w);";
+        break;
+      case Opcode::BindValues:
+        os << "rt::BindValues(w, r[" << o[0] << "], " << o[1] << ", "
+           << (o[2] ? "true" : "false") << ");";
+        break;
+      case Opcode::OpenCall: {
+        auto* apply = static_cast<PrimApply*>(code->consts_[o[3]]);
+        os << "if (rt::OpenCall(expr::Primitive::"
+           << kPrimitiveNames[static_cast<size_t>(apply->primitive())].name
+           << ", r + " << o[1] << ", " << o[2] << ", &r[" << o[0]
+           << "])) goto L" << SkipCall(insts, pc) << ";";
+        break;
+      }
+      case Opcode::Call:
+        os << "r[" << o[0] << "] = rt::Call(w, r + " << o[1] << ", " << o[2]
+           << ");";
+        break;
+      case Opcode::TailCall:
+        os << "return rt::TailCall(r + " << o[0] << ", " << o[1] << ");";
+        break;
+      case Opcode::Return:
+        os << "return r[" << o[0] << "];";
+        break;
+    }
+    os << "\n";
+  }
+  // Bytecode always ends in a return, so jumps never target the end.
+  assert(!targets.count(insts.size()));
+  os << "}\n\n";
+}
+
+void EmitCxx(const std::vector<Node*>& forms, std::ostream& out) {
+  CxxEmitter(out).Emit(forms);
+}
+
+}  // namespace eval
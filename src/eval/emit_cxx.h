@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVAL_EMIT_CXX_H_
+#define EVAL_EMIT_CXX_H_
+
+#include <iostream>
+#include <vector>
+
+#include "eval/node.h"
+
+namespace eval {
+
+// Writes |forms|, as returned by Optimize(), to |out| as a C++ program. Each
+// lambda body and top level form is compiled to bytecode, and each instruction
+// becomes a statement of a C++ function, using the runtime in compiled.h.
+//
+// The program defines compiled::RunProgram() and, unless PARP_NO_MAIN is
+// defined, a main() which runs the forms like parp runs a file. Build it
+// against the library `make lib` makes:
+//
+//   g++ -std=c++14 -O2 -Isrc out.cc bin/release/libparp.a
+//
+// Throws if a quoted datum can't be written as C++.
+void EmitCxx(const std::vector<Node*>& forms, std::ostream& out);
+
+}  // namespace eval
+
+#endif  // EVAL_EMIT_CXX_H_
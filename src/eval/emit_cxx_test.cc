@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "eval/compiled.h"
+#include "eval/emit_cxx.h"
+#include "eval/eval.h"
+#include "expr/number.h"
+#include "parse/parse.h"
+#include "test/util.h"
+
+using expr::Expr;
+using expr::Int;
+
+namespace eval {
+
+namespace {
+
+// Functions written the way EmitCxx() writes them, to test the runtime
+// without a C++ compiler.
+
+// (lambda (x . rest) rest)
+Expr* Rest(Expr** w) {
+  Expr** r = w + 1;
+  r[0] = compiled::LocalRef(w, 0, 1, nullptr);
+  return r[0];
+}
+
+// (lambda (f x) (f x))
+Expr* CallWith(Expr** w) {
+  Expr** r = w + 1;
+  r[0] = compiled::LocalRef(w, 0, 0, nullptr);
+  r[1] = compiled::LocalRef(w, 0, 1, nullptr);
+  return compiled::TailCall(r, 1);
+}
+
+const compiled::Code kRest = {&Rest, 1, 1, true, 2,
+                              "(lambda (x . rest) rest)"};
+const compiled::Code kCallWith = {&CallWith, 2, 2, false, 2,
+                                  "(lambda (f x) (f x))"};
+
+}  // namespace
+
+class EmitCxxTest : public test::TestBase {
+ protected:
+  EmitCxxTest() : env_(GetDefaultEnv()) {}
+
+  std::string EmitStr(const std::string& str) {
+    std::vector<gc::Lock<Node>> locks;
+    std::vector<Node*> forms;
+    for (const auto& expr : parse::Read(str)) {
+      auto node = Analyze(expr.get(), env_.get());
+      locks.push_back(Optimize(node.get(), env_.get()));
+      forms.push_back(locks.back().get());
+    }
+    std::ostringstream os;
+    EmitCxx(forms, os);
+    return os.str();
+  }
+
+  gc::Lock<Expr> Call(Expr* proc, std::vector<Expr*> args) {
+    return expr::TryEvals(proc)->DoEval(env_.get(), args.data(), args.size());
+  }
+
+  gc::Lock<expr::Env> env_;
+};
+
+// make test checks what programs compute against the interpreter. These check
+// how they are structured.
+TEST_F(EmitCxxTest, Program) {
+  auto out = EmitStr(
+      "(define (fib n) (if (< n 2) 1 (+ (fib (- n 1)) (fib (- n 2)))))\n"
+      "(fib 20)");
+  // One function for each top level form and one for the lambda.
+  EXPECT_NE(std::string::npos, out.find("Expr* F2(Expr** w) {"));
+  EXPECT_EQ(std::string::npos, out.find("Expr* F3("));
+  EXPECT_NE(std::string::npos, out.find("goto L"));
+
+  // Loops count against the limits of the evaluation.
+  auto loop = EmitStr("(do ((i 0 (+ i 1))) ((= i 10) i))");
+  EXPECT_NE(std::string::npos, loop.find("rt::Step(); goto L"));
+}
+
+TEST_F(EmitCxxTest, Constants) {
+  auto out = EmitStr(
+      "'(\"a\\\"b\n\" #\\c 2.5 #(x (y . z)) -9223372036854775808)");
+  // Each value is built after those it refers to.
+  std::istringstream lines(out);
+  std::string line;
+  size_t num_consts = 0;
+  while (std::getline(lines, line)) {
+    size_t index;
+    if (sscanf(line.c_str(), "  k[%zu] = ", &index) != 1) {
+      continue;
+    }
+    EXPECT_EQ(num_consts++, index);
+    for (auto pos = line.find("k[", line.find('=')); pos != std::string::npos;
+         pos = line.find("k[", pos + 1)) {
+      EXPECT_LT(std::stoul(line.substr(pos + 2)), index) << line;
+    }
+  }
+  EXPECT_EQ(15u, num_consts);
+}
+
+TEST_F(EmitCxxTest, Runtime) {
+  auto rest = gc::make_locked<compiled::Proc>(&kRest, env_.get());
+  auto call_with = gc::make_locked<compiled::Proc>(&kCallWith, env_.get());
+  auto one = gc::make_locked<Int>(1);
+  auto two = gc::make_locked<Int>(2);
+
+  std::ostringstream os;
+  os << *rest;
+  EXPECT_EQ("(lambda (x . rest) rest)", os.str());
+
+  auto list = Call(rest.get(), {one.get(), two.get(), one.get()});
+  EXPECT_EQ(*parse::Read("(2 1)")[0], *list);
+  EXPECT_EQ(expr::Nil(), Call(rest.get(), {one.get()}).get());
+  EXPECT_THROW(Call(rest.get(), {}), util::RuntimeException);
+
+  // Tail calls to other compiled procedures loop in the driver, while others
+  // are made once the body returns.
+  EXPECT_EQ(expr::Nil(),
+            Call(call_with.get(), {rest.get(), one.get()}).get());
+  auto car = env_->Lookup(expr::Symbol::New("car"));
+  EXPECT_EQ(two.get(), Call(call_with.get(), {car, list.get()}).get());
+  EXPECT_THROW(Call(call_with.get(), {rest.get()}), util::RuntimeException);
+  EXPECT_THROW(Call(call_with.get(), {one.get(), one.get()}),
+               util::RuntimeException);
+}
+
+}  // namespace eval
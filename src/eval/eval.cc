@@ -19,12 +19,14 @@
 
 #include "eval/eval.h"
 
-#include <cassert>
-#include <sstream>
+#include <iostream>
 #include <string>
-#include <utility>
 #include <vector>
 
+#include "eval/call_stack.h"
+#include "eval/limits.h"
+#include "eval/node.h"
+#include "eval/vm.h"
 #include "expr/primitive.h"
 #include "parse/parse.h"
 #include "util/exceptions.h"
@@ -36,77 +38,43 @@ namespace eval {
 
 namespace {
 
-gc::Lock<Expr> DoEval(Expr* expr, expr::Env* env) {
-  switch (expr->type()) {
-    // If we are evaluating a EVALS directly, it must take no arguments.
-    case Expr::Type::EVALS:
-      return gc::Lock<Expr>(expr->AsEvals()->DoEval(env, nullptr, 0));
-    case Expr::Type::SYMBOL:
-      return gc::Lock<Expr>(env->Lookup(expr->AsSymbol()));
-    default:
-      break;
-  }
-
-  return gc::Lock<Expr>(expr);
-}
-
-class Apply : public expr::Evals {
- public:
-  Apply(Expr* op, std::vector<Expr*> args) : op_(op), args_(args) {
-    assert(op);
-  }
-  ~Apply() override = default;
-
-  // Evals implementation:
-  std::ostream& AppendStream(std::ostream& stream) const override;
-  gc::Lock<Expr> DoEval(Env* env, Expr** exprs, size_t size) override;
-  void MarkReferences() override {
-    op_->GcMark();
-    for (auto arg : args_) {
-      arg->GcMark();
-    }
-  }
-
- private:
-  Expr* op_;
-  const std::vector<Expr*> args_;
-};
+Engine g_engine = Engine::TREE_WALKER;
+size_t g_jit_threshold = 0;
+bool g_dump_optimized = false;
 
-std::ostream& Apply::AppendStream(std::ostream& stream) const {
-  stream << "(" << *op_;
-  for (const auto* expr : args_) {
-    stream << " " << *expr;
-  }
-  stream << ")";
+}  // namespace
 
-  return stream;
+void SetEngine(Engine engine) {
+  g_engine = engine;
 }
 
-gc::Lock<Expr> Apply::DoEval(Env* env, Expr** exprs, size_t size) {
-  assert(!exprs);
-  assert(size == 0);
-  auto op = eval::DoEval(op_, env);
-  auto* evals = expr::TryEvals(op.get());
-  auto args_copy = args_;
-  return evals->DoEval(env, args_copy.data(), args_copy.size());
+Engine GetEngine() {
+  return g_engine;
 }
 
-}  // namespace
+void SetJitThreshold(size_t threshold) {
+  g_jit_threshold = threshold;
+}
 
-gc::Lock<Expr> Analyze(Expr* expr) {
-  auto* pair = expr->AsPair();
-  if (!pair) {
-    return gc::Lock<Expr>(expr);
-  }
+size_t GetJitThreshold() {
+  return g_jit_threshold;
+}
 
-  auto op = Analyze(pair->car());
-  auto args = ExprVecFromList(pair->cdr());
-  return gc::Lock<Expr>(new Apply(op.get(), std::move(args)));
+void SetDumpOptimized(bool dump) {
+  g_dump_optimized = dump;
 }
 
 gc::Lock<Expr> Eval(Expr* expr, expr::Env* env) {
-  auto e = Analyze(expr);
-  return DoEval(e.get(), env);
+  LimitScope limits;
+  auto node = Optimize(Analyze(expr, env).get(), env);
+  if (g_dump_optimized) {
+    std::cerr << *node << "\n";
+  }
+  if (g_engine == Engine::VM) {
+    auto code = Compile(node.get());
+    return RunAtPrompt(code.get(), env);
+  }
+  return RunAtPrompt(node.get(), env);
 }
 
 std::vector<gc::Lock<expr::Expr>> EvalString(const std::string& str,
@@ -125,4 +93,16 @@ gc::Lock<expr::Env> GetDefaultEnv() {
   return env;
 }
 
+void WriteResult(std::ostream& stream, Expr* val) {
+  if (val != MultipleValuesMarker()) {
+    stream << *val << "\n";
+    return;
+  }
+  auto& values = MultipleValues::Get();
+  for (size_t i = 0; i < values.num_vals(); ++i) {
+    stream << *values.vals()[i] << "\n";
+  }
+  values.Clear();
+}
+
 }  // namespace eval
@@ -20,6 +20,9 @@
 #ifndef EVAL_EVAL_H_
 #define EVAL_EVAL_H_
 
+#include <chrono>
+#include <cstdint>
+#include <ostream>
 #include <vector>
 #include <string>
 
@@ -28,7 +31,52 @@
 
 namespace eval {
 
-gc::Lock<expr::Expr> Analyze(expr::Expr* expr);
+class Node;
+
+// How Eval() runs analyzed code.
+enum class Engine {
+  TREE_WALKER,  // Executes the node tree directly.
+  VM,           // Compiles to bytecode for the register VM.
+};
+
+void SetEngine(Engine engine);
+Engine GetEngine();
+
+// The tree walker compiles lambdas to native code once they have been called
+// |threshold| times. Zero, the default, disables the JIT.
+void SetJitThreshold(size_t threshold);
+size_t GetJitThreshold();
+
+// Each top level evaluation, by Eval() or a compiled program, fails with
+// util::LimitException once it has made |fuel| procedure calls and loop
+// iterations, or run for |timeout|. The limits are set again for the next
+// evaluation, so the interpreter stays usable. Zero, the default, means no
+// limit.
+void SetFuel(uint64_t fuel);
+uint64_t GetFuel();
+void SetTimeout(std::chrono::milliseconds timeout);
+std::chrono::milliseconds GetTimeout();
+
+// Non-tail calls nest up to |bytes| of C stack beyond the thread's own, which
+// is allocated in segments as needed. Deeper recursion fails with
+// util::RuntimeException. The default is 1 GiB.
+void SetMaxStack(size_t bytes);
+size_t GetMaxStack();
+
+// Compiles |expr| into a tree of nodes. Keywords are looked up in |env|.
+gc::Lock<Node> Analyze(expr::Expr* expr, expr::Env* env);
+// Returns a simplified copy of |node|, as returned by Analyze() with |env|:
+// calls of pure primitives on constants are computed ahead of time, branches
+// which can't be taken and unused pure expressions are removed, and let
+// bindings of constants and other variables are replaced by their values.
+// Folded calls still check the primitives haven't been rebound when run.
+// Lambdas and delays become flat closures, which copy only the variables they
+// use.
+gc::Lock<Node> Optimize(Node* node, expr::Env* env);
+
+// Eval() writes each optimized form to standard error if set.
+void SetDumpOptimized(bool dump);
+
 gc::Lock<expr::Expr> Eval(expr::Expr* expr, expr::Env* env);
 std::vector<gc::Lock<expr::Expr>> EvalString(
     const std::string& str,
@@ -36,6 +84,11 @@ std::vector<gc::Lock<expr::Expr>> EvalString(
     const std::string& filename = "string");
 gc::Lock<expr::Env> GetDefaultEnv();
 
+// Writes |val|, as returned by Eval(), to |stream| the way the REPL shows it:
+// one value per line, so multiple values each get a line and none print
+// nothing.
+void WriteResult(std::ostream& stream, expr::Expr* val);
+
 }  // namespace eval
 
 #endif  // EVAL_EVAL_H_
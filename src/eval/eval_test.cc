@@ -17,10 +17,18 @@
  * along with parp.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
 #include <string>
 #include <utility>
 
 #include "eval/eval.h"
+#include "eval/node.h"
+#include "eval/value_stack.h"
 #include "expr/expr.h"
 #include "expr/number.h"
 #include "expr/primitive.h"
@@ -136,6 +144,38 @@ TEST_F(EvalTest, Quote) {
   EXPECT_EQ(*list, *EvalStr("''a"));
 }
 
+TEST_F(EvalTest, Quasiquote) {
+  EXPECT_EQ(*ParseExpr("(list 3 4)"), *EvalStr("`(list ,(+ 1 2) 4)"));
+  EXPECT_EQ(*ParseExpr("(list a (quote a))"),
+            *EvalStr("(let ((name 'a)) `(list ,name ',name))"));
+  EXPECT_EQ(*ParseExpr("(a 3 4 5 6 b)"),
+            *EvalStr("`(a ,(+ 1 2) ,@(map abs '(4 -5 6)) b)"));
+  EXPECT_EQ(*ParseExpr("((foo 7) . cons)"),
+            *EvalStr("`((foo ,(- 10 3)) ,@(cdr '(c)) . ,(car '(cons)))"));
+  EXPECT_EQ(*ParseExpr("#(10 5 2 4 3 8)"),
+            *EvalStr("`#(10 5 ,(+ 1 1) ,@(map abs '(-4 3)) 8)"));
+  EXPECT_EQ(*IntExpr(5), *EvalStr("`,(+ 2 3)"));
+  EXPECT_EQ(*ParseExpr("(1 2)"), *EvalStr("`(1 ,@'() 2)"));
+
+  // Unquotes belong to the innermost quasiquote.
+  EXPECT_EQ(*ParseExpr("(a `(b ,(c 3)))"), *EvalStr("`(a `(b ,(c ,(+ 1 2))))"));
+  EXPECT_EQ(
+      *ParseExpr("(a `(b ,x ,'y d) e)"),
+      *EvalStr("(let ((name1 'x) (name2 'y)) `(a `(b ,,name1 ,',name2 d) e))"));
+
+  // What follows the last unquote is shared, not rebuilt.
+  EvalStr("(define (f x) `(,x b c))");
+  EXPECT_EQ(*True(), *EvalStr("(eq? (cdr (f 1)) (cdr (f 2)))"));
+  EvalStr("(define (g) `(a #(b) c))");
+  EXPECT_EQ(*True(), *EvalStr("(eq? (g) (g))"));
+
+  // The list procedures are used whatever their names are bound to.
+  EXPECT_EQ(*ParseExpr("(1 2 3)"),
+            *EvalStr("(let ((cons #f) (list #f)) `(1 ,(+ 1 1) 3))"));
+  EXPECT_THROW(EvalStr("`(1 ,@2 3)"), util::RuntimeException);
+  EXPECT_THROW(EvalStr("`,@'(1)"), util::RuntimeException);
+}
+
 TEST_F(EvalTest, Lambda) {
   EXPECT_EQ(*IntExpr(42), *EvalStr("((lambda (x) x) 42)"));
   EXPECT_EQ(*IntExpr(8), *EvalStr("((lambda (x) (+ x x)) 4)"));
@@ -251,15 +291,432 @@ TEST_F(EvalTest, LetRec) {
   // clang-format on
 }
 
+TEST_F(EvalTest, NamedLet) {
+  // clang-format off
+  EXPECT_EQ(*parse::Read("((6 1 3) (-5 -2))")[0], *EvalStr(
+      "(let loop ((numbers '(3 -2 1 6 -5))"
+      "           (nonneg '())"
+      "           (neg '()))"
+      "  (cond ((null? numbers) (list nonneg neg))"
+      "        ((>= (car numbers) 0)"
+      "         (loop (cdr numbers)"
+      "               (cons (car numbers) nonneg)"
+      "               neg))"
+      "        ((< (car numbers) 0)"
+      "         (loop (cdr numbers)"
+      "               nonneg"
+      "               (cons (car numbers) neg)))))"));
+
+  // Each iteration binds fresh variables for the closures made in it.
+  EXPECT_EQ(*parse::Read("(2 1 0)")[0], *EvalStr(
+      "(let loop ((i 0) (fs '()))"
+      "  (if (= i 3)"
+      "      (map (lambda (f) (f)) fs)"
+      "      (loop (+ i 1) (cons (lambda () i) fs))))"));
+  EXPECT_EQ(*parse::Read("(3 2 1)")[0], *EvalStr(
+      "(let loop ((i 0) (fs '()))"
+      "  (if (= i 3)"
+      "      (map (lambda (f) (f)) fs)"
+      "      (begin"
+      "        (set! i (+ i 1))"
+      "        (loop i (cons (lambda () i) fs)))))"));
+
+  // Calls which aren't tail calls and escaping procedures.
+  EXPECT_EQ(*IntExpr(6), *EvalStr(
+      "(let loop ((l '(1 2 3)))"
+      "  (if (null? l) 0 (+ (car l) (loop (cdr l)))))"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr(
+      "(let loop ((n 3) (k #f))"
+      "  (if k (k 0) (loop n (lambda (x) n))))"));
+  EXPECT_EQ(*IntExpr(12), *EvalStr(
+      "(let outer ((i 0) (acc 0))"
+      "  (if (= i 2)"
+      "      acc"
+      "      (let inner ((j 0) (acc acc))"
+      "        (if (= j 3)"
+      "            (outer (+ i 1) acc)"
+      "            (inner (+ j 1) (+ acc j 1))))))"));
+  // clang-format on
+  EXPECT_EQ(*IntExpr(100000),
+            *EvalStr("(let loop ((i 0)) (if (= i 100000) i (loop (+ i 1))))"));
+}
+
+TEST_F(EvalTest, Do) {
+  // clang-format off
+  EXPECT_EQ(*parse::Read("#(0 1 2 3 4)")[0], *EvalStr(
+      "(do ((vec (make-vector 5))"
+      "     (i 0 (+ i 1)))"
+      "    ((= i 5) vec)"
+      "  (vector-set! vec i i))"));
+  EXPECT_EQ(*IntExpr(25), *EvalStr(
+      "(let ((x '(1 3 5 7 9)))"
+      "  (do ((x x (cdr x))"
+      "       (sum 0 (+ sum (car x))))"
+      "      ((null? x) sum)))"));
+  EXPECT_EQ(*parse::Read("((0 0) (0 1) (1 0) (1 1))")[0], *EvalStr(
+      "(do ((i 0 (+ i 1))"
+      "     (acc '() (do ((j 0 (+ j 1))"
+      "                   (acc acc (cons (list i j) acc)))"
+      "                  ((= j 2) acc))))"
+      "    ((= i 2) (reverse acc)))"));
+  // clang-format on
+  EXPECT_THROW(EvalStr("(do ((i 0 1 2)) (#t))"), util::RuntimeException);
+  EXPECT_THROW(EvalStr("(do ((i 0)))"), util::RuntimeException);
+}
+
 TEST_F(EvalTest, Begin) {
   EvalStr("(define x 0)");
   EXPECT_EQ(*IntExpr(6), *EvalStr("(begin (set! x 5) (+ x 1))"));
 }
 
 TEST_F(EvalTest, Define) {
-  // TODO(bcf): Test define function
   EvalStr("(define foo 42)");
   EXPECT_EQ(*IntExpr(42), *env_->Lookup(Symbol::New("foo")));
+
+  EvalStr("(define (add x . rest) (apply + x rest))");
+  EXPECT_EQ(*IntExpr(6), *EvalStr("(add 1 2 3)"));
+
+  // Internal definitions may be referenced before they appear.
+  // clang-format off
+  EXPECT_EQ(*True(), *EvalStr(
+      "((lambda (n)"
+      "   (define (ev? n) (if (zero? n) #t (od? (- n 1))))"
+      "   (define (od? n) (if (zero? n) #f (ev? (- n 1))))"
+      "   (ev? n))"
+      " 10)"));
+  // clang-format on
+}
+
+TEST_F(EvalTest, DefineSyntax) {
+  // clang-format off
+  EvalStr(
+      "(define-syntax swap!"
+      "  (syntax-rules ()"
+      "    ((_ a b) (let ((tmp a)) (set! a b) (set! b tmp)))))");
+  EvalStr(
+      "(define-syntax my-or"
+      "  (syntax-rules ()"
+      "    ((_) #f)"
+      "    ((_ e) e)"
+      "    ((_ e r ...) (let ((t e)) (if t t (my-or r ...))))))");
+  // clang-format on
+
+  // Variables the template binds don't capture those of the use.
+  EvalStr("(define tmp 1)");
+  EvalStr("(define other 2)");
+  EvalStr("(swap! tmp other)");
+  EXPECT_EQ(*ParseExpr("(2 1)"), *EvalStr("(list tmp other)"));
+  EXPECT_EQ(*IntExpr(5), *EvalStr("(let ((t 5)) (my-or #f t))"));
+
+  // Symbols the template inserts mean what they did where it was defined.
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(let ((if list)) (my-or #f 3))"));
+  EXPECT_EQ(*SymExpr("tmp"),
+            *EvalStr("(let-syntax ((q (syntax-rules () ((_) 'tmp)))) (q))"));
+
+  // Ellipses, literals, vectors and tails.
+  EvalStr(
+      "(define-syntax my-cond (syntax-rules (else)"
+      "  ((_ (else e)) e)"
+      "  ((_ (c e) rest ...) (if c e (my-cond rest ...)))))");
+  EXPECT_EQ(*IntExpr(2), *EvalStr("(my-cond (#f 1) (else 2))"));
+  EvalStr(
+      "(define-syntax flat (syntax-rules () ((_ (a ...) ...) '(a ... ...))))");
+  EXPECT_EQ(*ParseExpr("(1 2 3 4)"), *EvalStr("(flat (1 2) () (3 4))"));
+  EvalStr(
+      "(define-syntax rot"
+      "  (syntax-rules () ((_ (a b ...) ...) '((b ... a) ...))))");
+  EXPECT_EQ(*ParseExpr("((2 3 1) (4))"), *EvalStr("(rot (1 2 3) (4))"));
+  EvalStr(
+      "(define-syntax vec (syntax-rules () ((_ #(a ...) . r) '(r a ...))))");
+  EXPECT_EQ(*ParseExpr("((4) 1 2)"), *EvalStr("(vec #(1 2) 4)"));
+  EvalStr("(define-syntax last (syntax-rules () ((_ a ... z) 'z)))");
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(last 1 2 3)"));
+
+  // Expansions may define variables, and internal definitions are seen by
+  // the rest of the body.
+  EvalStr("(define-syntax def (syntax-rules () ((_ n v) (define n v))))");
+  EvalStr("(def forty-two 42)");
+  EXPECT_EQ(*IntExpr(42), *EvalStr("forty-two"));
+  EXPECT_EQ(*IntExpr(4), *EvalStr("(let () (define (f) w) (def w 4) (f))"));
+  EXPECT_EQ(*IntExpr(20),
+            *EvalStr("(let ((y 10))"
+                     "  (define-syntax dbl"
+                     "    (syntax-rules () ((_ v) (let ((y v)) (+ y y)))))"
+                     "  (dbl y))"));
+
+  // (... ...) is an ellipsis in the template of a macro a macro defines.
+  EvalStr(
+      "(define-syntax def-seq (syntax-rules ()"
+      "  ((_ name) (define-syntax name (syntax-rules ()"
+      "    ((_ e (... ...)) (begin e (... ...))))))))");
+  EvalStr("(def-seq seq)");
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(seq 1 2 3)"));
+
+  // Literals match identifiers with the same binding, not just the same name.
+  EvalStr(
+      "(define-syntax kw (syntax-rules (=>)"
+      "  ((_ a => b) (list a b))"
+      "  ((_ a b c) 'no)))");
+  EXPECT_EQ(*parse::Read("(1 2)")[0], *EvalStr("(kw 1 => 2)"));
+  EXPECT_EQ(*SymExpr("no"), *EvalStr("(let ((=> 0)) (kw 1 => 2))"));
+  EXPECT_EQ(*SymExpr("no"),
+            *EvalStr("(let () (define => 0) (kw 1 => 2))"));
+  EXPECT_EQ(*parse::Read("(1 2)")[0],
+            *EvalStr("(let ((x 0))"
+                     "  (define-syntax kw2 (syntax-rules (x)"
+                     "    ((_ x) 1)"
+                     "    ((_ y) 2)))"
+                     "  (list (kw2 x) (let ((x 1)) (kw2 x))))"));
+  // The expansion of a form is redone where its literals match differently.
+  auto use = ParseExpr("(kw 1 => 2)");
+  auto shadowed = ParseExpr("(let ((=> 0)) #f)");
+  shadowed->AsPair()->cdr()->AsPair()->cdr()->AsPair()->set_car(use.get());
+  EXPECT_EQ(*parse::Read("(1 2)")[0], *Eval(use.get(), env_.get()));
+  EXPECT_EQ(*SymExpr("no"), *Eval(shadowed.get(), env_.get()));
+  EXPECT_EQ(*parse::Read("(1 2)")[0], *Eval(use.get(), env_.get()));
+
+  // A form mutated after it was expanded is expanded again.
+  EvalStr("(define-syntax twice (syntax-rules () ((_ x) (list x x))))");
+  auto form = ParseExpr("(twice 1)");
+  EXPECT_EQ(*parse::Read("(1 1)")[0], *Eval(form.get(), env_.get()));
+  form->AsPair()->cdr()->AsPair()->set_car(IntExpr(2).get());
+  EXPECT_EQ(*parse::Read("(2 2)")[0], *Eval(form.get(), env_.get()));
+
+  EXPECT_THROW(EvalStr("(swap! 1)"), util::RuntimeException);
+  EXPECT_THROW(EvalStr("swap!"), util::RuntimeException);
+  EXPECT_THROW(EvalStr("(define-syntax bad (syntax-rules () ((_ a) (a ...))))"),
+               util::RuntimeException);
+  EXPECT_THROW(EvalStr("(define-syntax bad (lambda (x) x))"),
+               util::RuntimeException);
+}
+
+TEST_F(EvalTest, LetSyntax) {
+  EXPECT_EQ(*IntExpr(42),
+            *EvalStr("(let-syntax ((dbl (syntax-rules () ((_ x) (* x 2)))))"
+                     "  (dbl 21))"));
+
+  // The macros of let-syntax see the enclosing scope, those of letrec-syntax
+  // see each other.
+  // clang-format off
+  EXPECT_EQ(*IntExpr(1), *EvalStr(
+      "(let ((x 1))"
+      "  (let-syntax ((get-x (syntax-rules () ((_) x))))"
+      "    (let ((x 2)) (get-x))))"));
+  EXPECT_EQ(*IntExpr(1), *EvalStr(
+      "(let ((x 1))"
+      "  (let-syntax ((get-x (syntax-rules () ((_) (lambda () x)))))"
+      "    (let ((x 2)) ((get-x)))))"));
+  EXPECT_EQ(*True(), *EvalStr(
+      "(letrec-syntax"
+      "    ((ev? (syntax-rules () ((_) #t) ((_ x . r) (od? . r))))"
+      "     (od? (syntax-rules () ((_) #f) ((_ x . r) (ev? . r)))))"
+      "  (ev? 1 2 3 4))"));
+  EXPECT_THROW(EvalStr(
+      "(let-syntax"
+      "    ((ev? (syntax-rules () ((_) #t) ((_ x . r) (od? . r))))"
+      "     (od? (syntax-rules () ((_) #f) ((_ x . r) (ev? . r)))))"
+      "  (ev? 1 2 3 4))"), util::RuntimeException);
+  // clang-format on
+}
+
+TEST_F(EvalTest, SyntaxCheckedOnce) {
+  // Malformed forms are rejected when analyzed, even if never executed.
+  EXPECT_THROW((void)EvalStr("(lambda () (if))"), util::RuntimeException);
+  EXPECT_THROW((void)EvalStr("(lambda () (let ((x)) x))"),
+               util::RuntimeException);
+  EXPECT_THROW((void)EvalStr("(lambda () (cond (else 1) (#t 2)))"),
+               util::RuntimeException);
+  EXPECT_THROW((void)EvalStr("(lambda () (set! 1 2))"), util::RuntimeException);
+  EXPECT_THROW((void)EvalStr("(lambda () if)"), util::RuntimeException);
+
+  // Keywords may be shadowed by local variables.
+  EXPECT_EQ(*IntExpr(3), *EvalStr("((lambda (if) (if 1 2)) +)"));
+  EXPECT_EQ(*IntExpr(1), *EvalStr("(let ((else #f)) (cond (else 2) (#t 1)))"));
+
+  // Each let* binding is a new scope.
+  EXPECT_EQ(*IntExpr(1),
+            *EvalStr("(let* ((x 1) (f (lambda () x)) (x 2)) (f))"));
+  EXPECT_EQ(*IntExpr(5), *EvalStr("(let* () 5)"));
+  EXPECT_EQ(*IntExpr(5), *EvalStr("(let () 5)"));
+}
+
+TEST_F(EvalTest, LexicalAddressing) {
+  // References to variables several frames up.
+  // clang-format off
+  EXPECT_EQ(*IntExpr(123), *EvalStr(
+      "(((lambda (a)"
+      "   (let ((b 20))"
+      "     (let* ((c 3) (d (+ c 0)))"
+      "       (lambda (e) (+ a b d e)))))"
+      "  100)"
+      " 0)"));
+  // clang-format on
+
+  // set! of a captured variable is seen by every closure sharing the frame.
+  // clang-format off
+  EvalStr(
+      "(define make-account"
+      "  (lambda (balance)"
+      "    (list (lambda (n) (set! balance (+ balance n)))"
+      "          (lambda () balance))))");
+  // clang-format on
+  EvalStr("(define account (make-account 10))");
+  EvalStr("((car account) 5)");
+  EXPECT_EQ(*IntExpr(15), *EvalStr("((cadr account))"));
+
+  // Locals shadow top level variables only within their scope.
+  EvalStr("(define x 'global)");
+  EXPECT_EQ(*SymExpr("local"), *EvalStr("(let ((x 'local)) x)"));
+  EXPECT_EQ(*SymExpr("global"), *EvalStr("x"));
+  EvalStr("(let ((x 1)) (set! x 2))");
+  EXPECT_EQ(*SymExpr("global"), *EvalStr("x"));
+
+  EXPECT_THROW((void)EvalStr("(letrec ((a b) (b 1)) a)"),
+               util::RuntimeException);
+}
+
+TEST_F(EvalTest, TailCalls) {
+  // Loops written as tail calls run in constant stack, whether the call is in
+  // if, cond, case, and, or, begin or a let body.
+  // clang-format off
+  EvalStr(
+      "(define loop"
+      "  (lambda (n acc)"
+      "    (if (= n 0)"
+      "        acc"
+      "        (begin (loop (- n 1) (+ acc 1))))))");
+  EvalStr(
+      "(define even-loop?"
+      "  (lambda (n)"
+      "    (cond ((= n 0) #t)"
+      "          (else (let ((m (- n 1))) (odd-loop? m))))))");
+  EvalStr(
+      "(define odd-loop?"
+      "  (lambda (n)"
+      "    (and (not (= n 0))"
+      "         (or #f (case n ((1) #t) (else (even-loop? (- n 1))))))))");
+  // clang-format on
+  EXPECT_EQ(*IntExpr(200000), *EvalStr("(loop 200000 0)"));
+  EXPECT_EQ(*True(), *EvalStr("(even-loop? 100000)"));
+  EXPECT_EQ(*False(), *EvalStr("(odd-loop? 100000)"));
+
+  // Tail calls through cond's => and to primitives.
+  EXPECT_EQ(*IntExpr(3), *EvalStr("((lambda (x) (cond (x => car))) '(3))"));
+  EXPECT_EQ(*IntExpr(6), *EvalStr("((lambda (x) (+ x 1)) 5)"));
+
+  // An arity error in a tail call releases its arguments.
+  EXPECT_THROW((void)EvalStr("((lambda () ((lambda (x) x) (list 1) 2)))"),
+               util::RuntimeException);
+
+  // Non-tail recursion still works.
+  EvalStr("(define sum (lambda (n) (if (= n 0) 0 (+ n (sum (- n 1))))))");
+  EXPECT_EQ(*IntExpr(5050), *EvalStr("(sum 100)"));
+}
+
+TEST_F(EvalTest, GlobalCaches) {
+  auto prev_engine = GetEngine();
+  for (auto engine : {Engine::TREE_WALKER, Engine::VM}) {
+    SetEngine(engine);
+    auto env = GetDefaultEnv();
+    EvalString("(define (f) 1) (define (g) (f)) (define x 1)", env.get());
+    EXPECT_EQ(*IntExpr(1), *EvalString("(g)", env.get())[0]);
+
+    // Redefinition and set! are seen by call sites which have already run.
+    EvalString("(define (f) 2)", env.get());
+    EXPECT_EQ(*IntExpr(2), *EvalString("(g)", env.get())[0]);
+    EvalString("(set! f (lambda () 3))", env.get());
+    EXPECT_EQ(*IntExpr(3), *EvalString("(g)", env.get())[0]);
+
+    // As is a set! from another site.
+    EvalString("(define (get-x) x) (define (set-x v) (set! x v))", env.get());
+    EXPECT_EQ(*IntExpr(1), *EvalString("(get-x)", env.get())[0]);
+    EvalString("(set-x 5)", env.get());
+    EXPECT_EQ(*IntExpr(5), *EvalString("(get-x)", env.get())[0]);
+
+    // A reference which failed before the variable was defined.
+    EvalString("(define (h) later)", env.get());
+    EXPECT_THROW((void)EvalString("(h)", env.get()), util::RuntimeException);
+    EvalString("(define later 4)", env.get());
+    EXPECT_EQ(*IntExpr(4), *EvalString("(h)", env.get())[0]);
+
+    // A variable found in an enclosing environment, then shadowed.
+    auto inner = gc::make_locked<Env>(env.get());
+    EvalString("(define (k) x)", inner.get());
+    EXPECT_EQ(*IntExpr(5), *EvalString("(k)", inner.get())[0]);
+    EvalString("(define x 6)", inner.get());
+    EXPECT_EQ(*IntExpr(6), *EvalString("(k)", inner.get())[0]);
+  }
+  SetEngine(prev_engine);
+}
+
+TEST_F(EvalTest, VmEngine) {
+  // The whole suite also passes with --engine=vm. This covers what is specific
+  // to the VM.
+  auto prev_engine = GetEngine();
+  SetEngine(Engine::VM);
+  EvalStr("(define (sum n) (if (= n 0) 0 (+ n (sum (- n 1)))))");
+
+  // Calls between closures don't use the C++ stack.
+  EXPECT_EQ(*IntExpr(5000050000), *EvalStr("(sum 100000)"));
+  // Deep recursion is a clean error.
+  EXPECT_THROW((void)EvalStr("(sum -1)"), util::RuntimeException);
+
+  // Closures called back from primitives, and unwinding when they throw.
+  EXPECT_EQ(*EvalStr("'(1 4 9)"),
+            *EvalStr("(map (lambda (x) (* x x)) '(1 2 3))"));
+  EXPECT_THROW((void)EvalStr("(map (lambda (x) (car x)) '(1))"),
+               util::RuntimeException);
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(apply sum '(2))"));
+
+  SetEngine(prev_engine);
+}
+
+TEST_F(EvalTest, Jit) {
+  // The whole suite also passes with --jit=1. This covers what is specific to
+  // the JIT, with every lambda compiled on its first call.
+  auto prev_threshold = GetJitThreshold();
+  SetJitThreshold(1);
+  EvalStr("(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))");
+  EvalStr("(define (add a b) (+ a b))");
+  EvalStr("(define (loop n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1))))");
+  EXPECT_EQ(*IntExpr(6765), *EvalStr("(fib 20)"));
+
+  // Arguments the inline arithmetic doesn't handle go to the primitive.
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(add 1 2)"));
+  EXPECT_EQ(*EvalStr("3.5"), *EvalStr("(add 1.5 2)"));
+  EXPECT_THROW((void)EvalStr("(add 1 'a)"), util::RuntimeException);
+  // Tail calls run in constant stack.
+  EXPECT_EQ(*IntExpr(200000), *EvalStr("(loop 200000 0)"));
+
+  // Errors raised in jitted code.
+  EXPECT_THROW((void)EvalStr("((lambda (x) (car x)) 1)"),
+               util::RuntimeException);
+  EXPECT_THROW((void)EvalStr("((lambda () (letrec ((a b) (b 1)) a)))"),
+               util::RuntimeException);
+  EXPECT_THROW((void)EvalStr("((lambda () undefined-var))"),
+               util::RuntimeException);
+
+  // Closures, frames and assignments made by jitted code.
+  EvalStr(
+      "(define (make-counter)"
+      "  (let ((n 0)) (lambda () (let ((m 1)) (set! n (+ n m)) n))))");
+  EvalStr("(define counter (make-counter))");
+  EvalStr("(counter)");
+  EXPECT_EQ(*IntExpr(2), *EvalStr("(counter)"));
+  EXPECT_EQ(*EvalStr("'b"),
+            *EvalStr("((lambda (x) (case x ((1) 'a) ((2 3) 'b))) 3)"));
+
+  // Promises made by jitted code, forced once and then remembered.
+  EXPECT_EQ(*IntExpr(1), *EvalStr("(force ((lambda () (delay 1))))"));
+  EvalStr("(define p ((lambda () (delay (+ 1 2)))))");
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(force p)"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(force p)"));
+
+  // Calls inlined by jitted code see the primitive being rebound.
+  EvalStr("(define (+ a b) (* a b))");
+  EXPECT_EQ(*IntExpr(12), *EvalStr("(add 3 4)"));
+
+  SetJitThreshold(prev_threshold);
 }
 
 TEST_F(EvalTest, IsEqv) {
@@ -329,6 +786,17 @@ TEST_F(EvalTest, IsEqual) {
   EXPECT_EQ(*True(), *EvalStr("(equal? \"abc\" \"abc\")"));
   EXPECT_EQ(*True(), *EvalStr("(equal? 2 2)"));
   EXPECT_EQ(*True(), *EvalStr("(equal? '#(5 'a) '#(5 'a))"));
+
+  // Circular lists which unfold to the same infinite list.
+  EvalStr("(define x (list 1 2))");
+  EvalStr("(set-cdr! (cdr x) x)");
+  EvalStr("(define y (list 1 2 1 2))");
+  EvalStr("(set-cdr! (cdddr y) y)");
+  EXPECT_EQ(*True(), *EvalStr("(equal? x y)"));
+  EXPECT_EQ(*False(), *EvalStr("(equal? x (cdr y))"));
+  EXPECT_EQ(*EvalStr("(equal-hash x)"), *EvalStr("(equal-hash y)"));
+  EXPECT_EQ(*EvalStr("(equal-hash '(a \"b\"))"),
+            *EvalStr("(equal-hash (list 'a (string #\\b)))"));
 }
 
 TEST_F(EvalTest, NumberPredicates) {
@@ -766,14 +1234,256 @@ TEST_F(EvalTest, VectorListConversion) {
             *EvalStr("#(dididit dah)"));
 }
 
+TEST_F(EvalTest, F64Vector) {
+  EXPECT_EQ(*True(), *EvalStr("(f64vector? (f64vector 1 2.5))"));
+  EXPECT_EQ(*False(), *EvalStr("(f64vector? #(1 2.5))"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(f64vector-length (make-f64vector 3 1))"));
+  EXPECT_EQ(*FloatExpr(2.5), *EvalStr("(f64vector-ref (f64vector 1 2.5) 1)"));
+  EXPECT_EQ(*FloatExpr(7),
+            *EvalStr("(let ((v (make-f64vector 2)))"
+                     "  (f64vector-set! v 1 7)"
+                     "  (f64vector-ref v 1))"));
+  EXPECT_EQ(*EvalStr("'(1. 2.)"),
+            *EvalStr("(f64vector->list (f64vector 1 2))"));
+  EXPECT_EQ(*EvalStr("(f64vector 1 2)"), *EvalStr("(list->f64vector '(1 2))"));
+}
+
+TEST_F(EvalTest, NumericKernels) {
+  EvalStr("(define x (list->f64vector '(1 2 3 4 5 6 7 8 9 10)))");
+  EvalStr("(define y (make-f64vector 10 2))");
+
+  EXPECT_EQ(*FloatExpr(55), *EvalStr("(vector-sum x)"));
+  EXPECT_EQ(*FloatExpr(0), *EvalStr("(vector-sum (f64vector))"));
+  EXPECT_EQ(*FloatExpr(110), *EvalStr("(dot x y)"));
+  EXPECT_EQ(*FloatExpr(1), *EvalStr("(vector-min x)"));
+  EXPECT_EQ(*FloatExpr(10), *EvalStr("(vector-max x)"));
+
+  EXPECT_EQ(*EvalStr("(f64vector 3 4 5 6 7 8 9 10 11 12)"),
+            *EvalStr("(vector+ x y)"));
+  EXPECT_EQ(*EvalStr("(f64vector -1 0 1 2 3 4 5 6 7 8)"),
+            *EvalStr("(vector- x y)"));
+  EXPECT_EQ(*EvalStr("(f64vector 2 4 6 8 10 12 14 16 18 20)"),
+            *EvalStr("(vector* x y)"));
+  EXPECT_EQ(*EvalStr("(f64vector .5 1 1.5 2 2.5 3 3.5 4 4.5 5)"),
+            *EvalStr("(vector/ x y)"));
+
+  EvalStr("(axpy! 3 x y)");
+  EXPECT_EQ(*EvalStr("(f64vector 5 8 11 14 17 20 23 26 29 32)"),
+            *EvalStr("y"));
+  EvalStr("(scale! .5 x)");
+  EXPECT_EQ(*EvalStr("(f64vector .5 1 1.5 2 2.5 3 3.5 4 4.5 5)"),
+            *EvalStr("x"));
+
+  // Results agree with the equivalent scalar arithmetic.
+  EXPECT_EQ(*EvalStr("(apply + (f64vector->list x))"),
+            *EvalStr("(vector-sum x)"));
+}
+
+TEST_F(EvalTest, Bytevector) {
+  EXPECT_EQ(*True(), *EvalStr("(bytevector? #u8(1 2))"));
+  EXPECT_EQ(*False(), *EvalStr("(bytevector? #(1 2))"));
+  EXPECT_EQ(*EvalStr("#u8(12 12)"), *EvalStr("(make-bytevector 2 12)"));
+  EXPECT_EQ(*EvalStr("#u8(1 3 5 1 3 5)"),
+            *EvalStr("(bytevector 1 3 5 1 3 5)"));
+  EXPECT_EQ(*IntExpr(0), *EvalStr("(bytevector-length (bytevector))"));
+  EXPECT_EQ(*IntExpr(8),
+            *EvalStr("(bytevector-u8-ref #u8(1 1 2 3 5 8 13 21) 5)"));
+  EXPECT_THROW((void)EvalStr("(bytevector 256)"), util::RuntimeException);
+  EXPECT_THROW((void)EvalStr("(bytevector-u8-ref #u8(1) 1)"),
+               util::RuntimeException);
+
+  EvalStr("(define bv (bytevector 1 2 3 4))");
+  EvalStr("(bytevector-u8-set! bv 1 3)");
+  EXPECT_EQ(*EvalStr("#u8(1 3 3 4)"), *EvalStr("bv"));
+
+  EXPECT_EQ(*EvalStr("#u8(3 3)"), *EvalStr("(bytevector-copy bv 1 3)"));
+  EXPECT_EQ(*EvalStr("#u8(3 4)"), *EvalStr("(bytevector-copy bv 2)"));
+  EvalStr("(define b (bytevector 1 2 3 4 5))");
+  EvalStr("(bytevector-copy! b 1 b 0 3)");
+  EXPECT_EQ(*EvalStr("#u8(1 1 2 3 5)"), *EvalStr("b"));
+  EXPECT_THROW((void)EvalStr("(bytevector-copy! b 4 #u8(1 2))"),
+               util::RuntimeException);
+
+  EXPECT_EQ(*EvalStr("#u8(0 1 2 3 4 5)"),
+            *EvalStr("(bytevector-append #u8(0 1 2) #u8(3 4 5))"));
+  EXPECT_EQ(*EvalStr("\"A\""), *EvalStr("(utf8->string #u8(#x41))"));
+  EXPECT_EQ(*EvalStr("#u8(#xCE #xBB)"), *EvalStr("(string->utf8 \"\u03bb\")"));
+}
+
+TEST_F(EvalTest, BytevectorAccessors) {
+  EvalStr("(define bv (make-bytevector 8 0))");
+  EvalStr("(bytevector-u16-set! bv 0 #x1234 'big)");
+  EXPECT_EQ(*EvalStr("#u8(#x12 #x34 0 0 0 0 0 0)"), *EvalStr("bv"));
+  EXPECT_EQ(*IntExpr(0x3412), *EvalStr("(bytevector-u16-ref bv 0 'little)"));
+  EXPECT_EQ(*IntExpr(0x1234), *EvalStr("(bytevector-u16-ref bv 0 'big)"));
+
+  EvalStr("(bytevector-s32-set! bv 4 -2 'little)");
+  EXPECT_EQ(*IntExpr(-2), *EvalStr("(bytevector-s32-ref bv 4 'little)"));
+  EXPECT_EQ(*IntExpr(0xFEFFFFFF), *EvalStr("(bytevector-u32-ref bv 4 'big)"));
+  EXPECT_EQ(*IntExpr(-1), *EvalStr("(bytevector-s8-ref bv 7)"));
+  EXPECT_EQ(*IntExpr(255), *EvalStr("(bytevector-u8-ref bv 7)"));
+
+  EvalStr("(bytevector-s64-set! bv 0 -5)");
+  EXPECT_EQ(*IntExpr(-5), *EvalStr("(bytevector-s64-ref bv 0)"));
+  EXPECT_THROW((void)EvalStr("(bytevector-u64-ref bv 0)"),
+               util::RuntimeException);
+  EvalStr("(bytevector-u64-set! bv 0 5 'big)");
+  EXPECT_EQ(*IntExpr(5), *EvalStr("(bytevector-u64-ref bv 0 'big)"));
+
+  EvalStr("(bytevector-ieee-double-set! bv 0 1.5 'big)");
+  EXPECT_EQ(*EvalStr("#u8(#x3F #xF8 0 0 0 0 0 0)"), *EvalStr("bv"));
+  EXPECT_EQ(*FloatExpr(1.5),
+            *EvalStr("(bytevector-ieee-double-ref bv 0 'big)"));
+  EvalStr("(bytevector-ieee-single-set! bv 4 -.25)");
+  EXPECT_EQ(*FloatExpr(-.25), *EvalStr("(bytevector-ieee-single-ref bv 4)"));
+
+  EXPECT_THROW((void)EvalStr("(bytevector-u16-set! bv 0 65536)"),
+               util::RuntimeException);
+  EXPECT_THROW((void)EvalStr("(bytevector-s8-set! bv 0 128)"),
+               util::RuntimeException);
+  EXPECT_THROW((void)EvalStr("(bytevector-u32-ref bv 5)"),
+               util::RuntimeException);
+  EXPECT_THROW((void)EvalStr("(bytevector-u16-ref bv 0 'middle)"),
+               util::RuntimeException);
+}
+
+TEST_F(EvalTest, MmapBytevector) {
+  char path[] = "/tmp/parp_mmap_testXXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_NE(-1, fd);
+  close(fd);
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << "hello";
+  }
+
+  EvalStr(std::string("(define path \"") + path + "\")");
+  EvalStr("(define ro (mmap-bytevector path))");
+  EXPECT_EQ(*EvalStr("(string->utf8 \"hello\")"), *EvalStr("ro"));
+  EXPECT_THROW((void)EvalStr("(bytevector-u8-set! ro 0 0)"),
+               util::RuntimeException);
+
+  // Copy on write mappings are writable, but never change the file.
+  EvalStr("(define cow (mmap-bytevector path 'copy-on-write))");
+  EvalStr("(bytevector-u8-set! cow 0 #x6A)");
+  EXPECT_EQ(*EvalStr("\"jello\""), *EvalStr("(utf8->string cow)"));
+  EXPECT_EQ(*EvalStr("\"hello\""),
+            *EvalStr("(utf8->string (mmap-bytevector path))"));
+
+  EXPECT_THROW((void)EvalStr("(mmap-bytevector \"/nonexistent/file\")"),
+               util::RuntimeException);
+  std::remove(path);
+}
+
+TEST_F(EvalTest, HashTable) {
+  EvalStr("(define t (make-hash-table))");
+  EXPECT_EQ(*True(), *EvalStr("(hash-table? t)"));
+  EXPECT_EQ(*False(), *EvalStr("(hash-table? '())"));
+
+  EvalStr("(hash-table-set! t '(1 2) 'a)");
+  EvalStr("(hash-table-set! t \"b\" 'b)");
+  EXPECT_EQ(*IntExpr(2), *EvalStr("(hash-table-size t)"));
+  EXPECT_EQ(*Symbol::New("a"), *EvalStr("(hash-table-ref t (list 1 2))"));
+  EXPECT_EQ(*Symbol::New("b"), *EvalStr("(hash-table-ref/default t \"b\" #f)"));
+  EXPECT_EQ(*False(), *EvalStr("(hash-table-ref/default t 'c #f)"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(hash-table-ref t 'c (lambda () 3))"));
+  EXPECT_THROW((void)EvalStr("(hash-table-ref t 'c)"), util::RuntimeException);
+  EXPECT_EQ(*True(), *EvalStr("(hash-table-exists? t \"b\")"));
+
+  EvalStr("(hash-table-delete! t \"b\")");
+  EXPECT_EQ(*False(), *EvalStr("(hash-table-contains? t \"b\")"));
+  EXPECT_EQ(*EvalStr("'(((1 2) . a))"), *EvalStr("(hash-table->alist t)"));
+
+  EvalStr("(define counts (make-hash-table eq?))");
+  EvalStr("(for-each (lambda (x)"
+          "  (hash-table-update!/default counts x (lambda (n) (+ n 1)) 0))"
+          "  '(a b a c a))");
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(hash-table-ref counts 'a)"));
+  EvalStr("(hash-table-update! counts 'b (lambda (n) (* n 10)))");
+  EXPECT_EQ(*IntExpr(10), *EvalStr("(hash-table-ref counts 'b)"));
+  EXPECT_EQ(*IntExpr(14),
+            *EvalStr("(apply + (hash-table-values counts))"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(length (hash-table-keys counts))"));
+
+  EvalStr("(define sum 0)");
+  EvalStr("(hash-table-walk counts (lambda (k v) (set! sum (+ sum v))))");
+  EXPECT_EQ(*IntExpr(14), *EvalStr("sum"));
+
+  EvalStr("(define copy (hash-table-copy counts))");
+  EvalStr("(hash-table-clear! counts)");
+  EXPECT_EQ(*IntExpr(0), *EvalStr("(hash-table-size counts)"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(hash-table-size copy)"));
+
+  EvalStr("(define s (alist->hash-table '((\"x\" . 1) (\"x\" . 2)) string=?))");
+  EXPECT_EQ(*IntExpr(1), *EvalStr("(hash-table-ref s (string #\\x))"));
+  EXPECT_THROW((void)EvalStr("(hash-table-set! s 'x 1)"),
+               util::RuntimeException);
+  EXPECT_THROW((void)EvalStr("(make-hash-table car)"), util::RuntimeException);
+
+  EXPECT_EQ(*EvalStr("(hash (list 1 \"a\"))"), *EvalStr("(hash '(1 \"a\"))"));
+  EXPECT_EQ(*EvalStr("(string-hash \"abc\" 7)"),
+            *EvalStr("(string-hash (string #\\a #\\b #\\c) 7)"));
+  EXPECT_EQ(*True(), *EvalStr("(< (hash-by-identity 'a 10) 10)"));
+}
+
+TEST_F(EvalTest, IMap) {
+  EvalStr("(define m1 (imap 'a 1 \"b\" 2))");
+  EvalStr("(define m2 (imap-set m1 '(c) 3))");
+  EvalStr("(define m3 (imap-delete m2 'a))");
+  EXPECT_EQ(*True(), *EvalStr("(imap? m1)"));
+  EXPECT_EQ(*IntExpr(2), *EvalStr("(imap-size m1)"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(imap-size m2)"));
+  EXPECT_EQ(*IntExpr(2), *EvalStr("(imap-size m3)"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(imap-ref m2 (list 'c))"));
+  EXPECT_EQ(*IntExpr(2), *EvalStr("(imap-ref m3 (string #\\b))"));
+  EXPECT_EQ(*False(), *EvalStr("(imap-contains? m1 '(c))"));
+  EXPECT_EQ(*False(), *EvalStr("(imap-ref m3 'a #f)"));
+  EXPECT_THROW((void)EvalStr("(imap-ref m3 'a)"), util::RuntimeException);
+  EXPECT_THROW((void)EvalStr("(imap 'a)"), util::RuntimeException);
+
+  // Maps with the same contents are equal? regardless of history.
+  EXPECT_EQ(*True(), *EvalStr("(equal? m1 (imap-delete m2 '(c)))"));
+  EXPECT_EQ(*False(), *EvalStr("(equal? m1 m3)"));
+  EXPECT_EQ(*EvalStr("(hash m1)"), *EvalStr("(hash (imap-delete m2 '(c)))"));
+  EXPECT_EQ(*IntExpr(1),
+            *EvalStr("(imap-ref (alist->imap '((a . 1) (a . 2))) 'a)"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(apply + (imap-values m1))"));
+  EXPECT_EQ(*IntExpr(2), *EvalStr("(length (imap->alist m1))"));
+
+  EvalStr("(define t (imap-transient m1))");
+  EvalStr("(imap-set! t 'z 26)");
+  EvalStr("(imap-delete! t 'a)");
+  EXPECT_THROW((void)EvalStr("(imap-set t 'y 1)"), util::RuntimeException);
+  EvalStr("(define p (imap-persistent! t))");
+  EXPECT_EQ(*IntExpr(26), *EvalStr("(imap-ref p 'z)"));
+  EXPECT_EQ(*False(), *EvalStr("(imap-contains? p 'a)"));
+  EXPECT_EQ(*True(), *EvalStr("(imap-contains? m1 'a)"));
+  EXPECT_THROW((void)EvalStr("(imap-set! p 'y 1)"), util::RuntimeException);
+}
+
+TEST_F(EvalTest, ISet) {
+  EvalStr("(define s1 (iset 1 2 3 2))");
+  EvalStr("(define s2 (iset-remove (iset-add s1 4) 1))");
+  EXPECT_EQ(*True(), *EvalStr("(iset? s1)"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(iset-size s1)"));
+  EXPECT_EQ(*True(), *EvalStr("(iset-contains? s2 4)"));
+  EXPECT_EQ(*False(), *EvalStr("(iset-contains? s2 1)"));
+  EXPECT_EQ(*True(), *EvalStr("(iset-contains? s1 1)"));
+  EXPECT_EQ(*IntExpr(9), *EvalStr("(apply + (iset->list s2))"));
+  EXPECT_EQ(*True(), *EvalStr("(equal? (list->iset '(3 2 4)) s2)"));
+
+  EvalStr("(define t (iset-transient s1))");
+  EvalStr("(iset-add! t 10)");
+  EvalStr("(iset-remove! t 1)");
+  EXPECT_EQ(*True(), *EvalStr("(equal? (iset 2 3 10) (iset-persistent! t))"));
+}
+
 TEST_F(EvalTest, IsProcedure) {
   EXPECT_EQ(*True(), *EvalStr("(procedure? car)"));
   EXPECT_EQ(*False(), *EvalStr("(procedure? 'car)"));
   EXPECT_EQ(*True(), *EvalStr("(procedure? (lambda (x) (* x x)))"));
   EXPECT_EQ(*False(), *EvalStr("(procedure? '(lambda (x) (* x x)))"));
-#if 0
   EXPECT_EQ(*True(), *EvalStr("(call-with-current-continuation procedure?)"));
-#endif
 }
 
 TEST_F(EvalTest, Apply) {
@@ -819,6 +1529,64 @@ TEST_F(EvalTest, ForEach) {
   // clang-format on
 }
 
+TEST_F(EvalTest, Values) {
+  EXPECT_EQ(*IntExpr(5),
+            *EvalStr("(call-with-values (lambda () (values 4 5)) "
+                     "(lambda (a b) b))"));
+  EXPECT_EQ(*parse::Read("(1)")[0], *EvalStr("(call-with-values * list)"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(+ 1 (values 2))"));
+  EXPECT_EQ(*parse::Read("()")[0],
+            *EvalStr("(call-with-values values list)"));
+
+  (void)EvalStr(
+      "(define (div-mod a b) (values (quotient a b) (remainder a b)))");
+  EXPECT_EQ(*parse::Read("(3 2)")[0],
+            *EvalStr("(receive (q r) (div-mod 17 5) (list q r))"));
+  EXPECT_EQ(*parse::Read("(1 (2 3))")[0],
+            *EvalStr("(receive (a . rest) (values 1 2 3) (list a rest))"));
+  EXPECT_EQ(*parse::Read("(1 2 3)")[0],
+            *EvalStr("(receive all (values 1 2 3) all)"));
+  EXPECT_EQ(*IntExpr(7), *EvalStr("(receive (a) 7 a)"));
+  EXPECT_THROW(EvalStr("(receive (a b) (values 1) a)"),
+               util::RuntimeException);
+  EXPECT_THROW(EvalStr("(receive (a) (values 1 2) a)"),
+               util::RuntimeException);
+
+  // Values pass through continuations and dynamic-wind.
+  EXPECT_EQ(*IntExpr(3),
+            *EvalStr("(receive (a b) (call/cc (lambda (k) (k 1 2))) (+ a b))"));
+  EXPECT_EQ(*IntExpr(0),
+            *EvalStr("(receive () (call/cc (lambda (k) (k))) 0)"));
+  // clang-format off
+  EXPECT_EQ(*parse::Read("(3 4)")[0], *EvalStr(
+      "(receive (a b)"
+      "  (dynamic-wind"
+      "    (lambda () #f)"
+      "    (lambda () (values 3 4))"
+      "    (lambda () (values 5 6)))"
+      "  (list a b))"));
+
+  // Received variables can be captured and set!.
+  EXPECT_EQ(*IntExpr(12), *EvalStr(
+      "((receive (a b) (values 1 2)"
+      "   (set! a 10)"
+      "   (lambda () (+ a b))))"));
+  EXPECT_EQ(*IntExpr(960), *EvalStr(
+      "(let loop ((i 0) (acc 0))"
+      "  (if (= i 100)"
+      "      acc"
+      "      (receive (q r) (div-mod i 7)"
+      "        (loop (+ i 1) (+ acc q r)))))"));
+  // clang-format on
+
+  // The REPL writes each value on its own line, and nothing for none.
+  std::ostringstream os;
+  WriteResult(os, EvalStr("(values 1 2)").get());
+  WriteResult(os, EvalStr("(values)").get());
+  WriteResult(os, EvalStr("(values 'a)").get());
+  EXPECT_EQ("1\n2\na\n", os.str());
+}
+
 TEST_F(EvalTest, Force) {
   EXPECT_EQ(*EvalStr("(force (delay (+ 1 2)))"), *IntExpr(3));
   EXPECT_EQ(*EvalStr("(let ((p (delay (+ 1 2)))) (list (force p) (force p)))"),
@@ -851,6 +1619,192 @@ TEST_F(EvalTest, Force) {
   EXPECT_EQ(*IntExpr(6), *EvalStr("(force p)"));
 }
 
+TEST_F(EvalTest, DelayForce) {
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(force (delay-force (delay (+ 1 2))))"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(force (make-promise 3))"));
+  EXPECT_EQ(*True(),
+            *EvalStr("(let ((p (delay 1))) (eq? p (make-promise p)))"));
+  EXPECT_EQ(*True(), *EvalStr("(promise? (delay-force (delay 1)))"));
+  EXPECT_EQ(*False(), *EvalStr("(promise? 1)"));
+  EXPECT_THROW(EvalStr("(force (delay-force 1))"), util::RuntimeException);
+
+  // A chain of delay-force is forced without growing the stack.
+  // clang-format off
+  (void)EvalStr(
+      "(define (countdown n)"
+      "  (delay-force (if (= n 0) (delay 'done) (countdown (- n 1)))))");
+  // clang-format on
+  EXPECT_EQ(*EvalStr("'done"), *EvalStr("(force (countdown 100000))"));
+
+  // The promises of the chain share the result.
+  (void)EvalStr("(define count 0)");
+  // clang-format off
+  (void)EvalStr(
+      "(define inner (delay (begin (set! count (+ count 1)) count)))");
+  // clang-format on
+  (void)EvalStr("(define outer (delay-force inner))");
+  EXPECT_EQ(*IntExpr(1), *EvalStr("(force outer)"));
+  EXPECT_EQ(*IntExpr(1), *EvalStr("(force inner)"));
+}
+
+TEST_F(EvalTest, Streams) {
+  (void)EvalStr("(define (from n) (stream-cons n (from (+ n 1))))");
+  EXPECT_EQ(*EvalStr("'(1 2 3)"), *EvalStr("(stream->list (stream 1 2 3))"));
+  EXPECT_EQ(*IntExpr(8), *EvalStr("(stream-car (stream-cdr (from 7)))"));
+  EXPECT_EQ(*True(), *EvalStr("(stream-null? (stream))"));
+  EXPECT_EQ(*True(), *EvalStr("(stream-pair? (from 0))"));
+  EXPECT_EQ(*False(), *EvalStr("(stream-pair? '(1))"));
+  EXPECT_EQ(*EvalStr("'(0 1 4)"),
+            *EvalStr("(stream->list "
+                     "(stream-map (lambda (x) (* x x)) (from 0)) 3)"));
+  EXPECT_EQ(*EvalStr("'(1 3 5)"),
+            *EvalStr("(stream->list (stream-take 3 (stream-filter odd? "
+                     "(from 0))))"));
+  EXPECT_EQ(*EvalStr("'(1 2)"),
+            *EvalStr("(stream->list (stream-take 3 (stream 1 2)))"));
+
+  // Elements filtered out don't grow the stack.
+  EXPECT_EQ(*IntExpr(100000),
+            *EvalStr("(stream-car (stream-filter "
+                     "(lambda (x) (= x 100000)) (from 0)))"));
+  EXPECT_THROW(EvalStr("(stream-car '(1))"), util::RuntimeException);
+  EXPECT_THROW(EvalStr("(stream-take -1 (from 0))"), util::RuntimeException);
+  EXPECT_THROW(EvalStr("(stream-take 1.5 (from 0))"), util::RuntimeException);
+  EXPECT_EQ(*Nil(), *EvalStr("(stream->list (stream-take 0 (from 0)))"));
+}
+
+TEST_F(EvalTest, CallWithCurrentContinuation) {
+  // clang-format off
+  EXPECT_EQ(*IntExpr(-3), *EvalStr(
+      "(call-with-current-continuation"
+      "  (lambda (exit)"
+      "    (for-each (lambda (x) (if (negative? x) (exit x)))"
+      "              '(54 0 37 -3 245 19))"
+      "    #t))"));
+  (void)EvalStr(
+      "(define list-length"
+      "  (lambda (obj)"
+      "    (call/cc"
+      "      (lambda (return)"
+      "        (letrec ((r (lambda (obj)"
+      "                      (cond ((null? obj) 0)"
+      "                            ((pair? obj) (+ (r (cdr obj)) 1))"
+      "                            (else (return #f))))))"
+      "          (r obj))))))");
+  // clang-format on
+  EXPECT_EQ(*IntExpr(4), *EvalStr("(list-length '(1 2 3 4))"));
+  EXPECT_EQ(*False(), *EvalStr("(list-length '(a b . c))"));
+
+  // Escaping to an outer continuation passes through inner ones.
+  EXPECT_EQ(*IntExpr(1),
+            *EvalStr("(+ 1 (call/cc (lambda (k) (call/cc (lambda (j) (k 0))) "
+                     "5)))"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(call/cc (lambda (k) 3))"));
+
+  // Calling a continuation once its call has returned returns from the call
+  // again. A later top level form finishes the one it was captured in instead
+  // of its own.
+  (void)EvalStr("(define saved #f)");
+  EXPECT_EQ(*IntExpr(1),
+            *EvalStr("(+ (call/cc (lambda (k) (set! saved k) 0)) 1)"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(saved 2)"));
+  EXPECT_EQ(*IntExpr(11), *EvalStr("(saved 10)"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(call-with-values"
+                                  "  (lambda ()"
+                                  "    (call/cc (lambda (k)"
+                                  "               (set! saved k)"
+                                  "               (values 1 2))))"
+                                  "  +)"));
+  EXPECT_EQ(*IntExpr(9), *EvalStr("(saved 4 5)"));
+
+  // A generator resuming its traversal, and a loop jumping back into its
+  // body.
+  // clang-format off
+  (void)EvalStr(
+      "(define (make-gen lst)"
+      "  (define return #f)"
+      "  (define resume #f)"
+      "  (lambda ()"
+      "    (call/cc"
+      "      (lambda (r)"
+      "        (set! return r)"
+      "        (if resume"
+      "            (resume #f)"
+      "            (begin"
+      "              (for-each"
+      "                (lambda (x)"
+      "                  (call/cc (lambda (k) (set! resume k) (return x))))"
+      "                lst)"
+      "              (return 'done)))))))");
+  // clang-format on
+  (void)EvalStr("(define gen (make-gen '(1 2 3)))");
+  EXPECT_EQ(*IntExpr(1), *EvalStr("(gen)"));
+  EXPECT_EQ(*IntExpr(2), *EvalStr("(gen)"));
+  gc::Gc::Get().Collect();
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(gen)"));
+  EXPECT_EQ(*EvalStr("'done"), *EvalStr("(gen)"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(let ((n 0) (k #f))"
+                                  "  (call/cc (lambda (c) (set! k c)))"
+                                  "  (set! n (+ n 1))"
+                                  "  (if (< n 3) (k #f))"
+                                  "  n)"));
+
+  // Each resumption gets its own copy of the stacks, with the values live
+  // when the continuation was captured.
+  // clang-format off
+  (void)EvalStr(
+      "(define (deep n)"
+      "  (if (= n 0)"
+      "      (call/cc (lambda (k) (set! saved k) 0))"
+      "      (let ((l (list n)))"
+      "        (+ (car l) (deep (- n 1))))))");
+  // clang-format on
+  EXPECT_EQ(*IntExpr(5050), *EvalStr("(deep 100)"));
+  gc::Gc::Get().set_debug_mode(true);
+  auto ret = EvalStr("(saved 1)");
+  gc::Gc::Get().set_debug_mode(false);
+  EXPECT_EQ(*IntExpr(5051), *ret);
+  EXPECT_EQ(*IntExpr(5052), *EvalStr("(saved 2)"));
+
+  // Primitives such as map and dynamic-wind hold state the stacks can't
+  // carry, so continuations captured under them only escape.
+  (void)EvalStr("(map (lambda (x) (call/cc (lambda (k) (set! saved k) x))) "
+                "'(1))");
+  EXPECT_THROW(EvalStr("(saved 2)"), util::RuntimeException);
+  (void)EvalStr("(dynamic-wind (lambda () #f)"
+                "  (lambda () (call/cc (lambda (k) (set! saved k) 1)))"
+                "  (lambda () #f))");
+  EXPECT_THROW(EvalStr("(saved 2)"), util::RuntimeException);
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(call/cc (lambda (k) (+ 1 (k 3))))"));
+}
+
+TEST_F(EvalTest, DynamicWind) {
+  (void)EvalStr("(define path '())");
+  (void)EvalStr("(define (note x) (set! path (cons x path)))");
+  // clang-format off
+  EXPECT_EQ(*IntExpr(1), *EvalStr(
+      "(call/cc"
+      "  (lambda (k)"
+      "    (dynamic-wind"
+      "      (lambda () (note 'connect))"
+      "      (lambda () (note 'talk1) (k 1) (note 'talk2))"
+      "      (lambda () (note 'disconnect)))))"));
+  // clang-format on
+  EXPECT_EQ(*parse::Read("(disconnect talk1 connect)")[0], *EvalStr("path"));
+
+  (void)EvalStr("(set! path '())");
+  EXPECT_EQ(*IntExpr(2), *EvalStr("(dynamic-wind (lambda () (note 1)) "
+                                  "(lambda () 2) (lambda () (note 3)))"));
+  EXPECT_EQ(*parse::Read("(3 1)")[0], *EvalStr("path"));
+
+  // Errors also run the after thunk.
+  (void)EvalStr("(set! path '())");
+  EXPECT_THROW(EvalStr("(dynamic-wind (lambda () #t) (lambda () (car 1)) "
+                       "(lambda () (note 'after)))"),
+               util::RuntimeException);
+  EXPECT_EQ(*parse::Read("(after)")[0], *EvalStr("path"));
+}
+
 TEST_F(EvalTest, Eval) {
   EXPECT_EQ(*IntExpr(21),
             *EvalStr("(eval '(* 7 3) (scheme-report-environment 5))"));
@@ -862,4 +1816,185 @@ TEST_F(EvalTest, Eval) {
   // clang-format on
 }
 
+TEST_F(EvalTest, Limits) {
+  (void)EvalStr("(define (spin) (spin))");
+  (void)EvalStr("(define (spin-do) (do () (#f)))");
+  (void)EvalStr("(define (count n) (if (= n 0) 'done (count (- n 1))))");
+
+  SetFuel(10000);
+  EXPECT_THROW(EvalStr("(spin)"), util::LimitException);
+  EXPECT_THROW(EvalStr("(let loop () (loop))"), util::LimitException);
+  EXPECT_THROW(EvalStr("(do () (#f))"), util::LimitException);
+  EXPECT_THROW(EvalStr("(spin-do)"), util::LimitException);
+  EXPECT_THROW(EvalStr("(map (lambda (x) (spin)) '(1))"),
+               util::LimitException);
+  EXPECT_THROW(EvalStr("(eval '(let loop () (loop)) "
+                       "(scheme-report-environment 5))"),
+               util::LimitException);
+  // The fuel is for each top level form, and the interpreter stays usable.
+  EXPECT_EQ(*EvalStr("'done"), *EvalStr("(count 5000)"));
+  EXPECT_EQ(*EvalStr("'done"), *EvalStr("(count 5000)"));
+  EXPECT_THROW(EvalStr("(count 20000)"), util::LimitException);
+  SetFuel(0);
+  EXPECT_EQ(*EvalStr("'done"), *EvalStr("(count 20000)"));
+
+  SetTimeout(std::chrono::milliseconds(50));
+  EXPECT_THROW(EvalStr("(spin)"), util::LimitException);
+  EXPECT_THROW(EvalStr("(let loop () (loop))"), util::LimitException);
+  EXPECT_EQ(*EvalStr("'done"), *EvalStr("(count 10)"));
+  SetTimeout(std::chrono::milliseconds(0));
+}
+
+TEST_F(EvalTest, DeepRecursion) {
+  // clang-format off
+  (void)EvalStr("(define (count n) (if (= n 0) 0 (+ 1 (count (- n 1)))))");
+  (void)EvalStr(
+      "(define (build n) (if (= n 0) '() (cons n (build (- n 1)))))");
+  // Recursion through a primitive nests on the C stack in every engine.
+  (void)EvalStr(
+      "(define (count-map n)"
+      "  (if (= n 0) 0 (+ 1 (car (map count-map (list (- n 1)))))))");
+  // clang-format on
+  EXPECT_EQ(*IntExpr(100000), *EvalStr("(count 100000)"));
+  EXPECT_EQ(*IntExpr(100000), *EvalStr("(length (build 100000))"));
+  EXPECT_EQ(*IntExpr(100000), *EvalStr("(count-map 100000)"));
+  // Errors unwind through every segment.
+  EXPECT_THROW(EvalStr("(let f ((n 100000))"
+                       "  (if (= n 0) (car '()) (+ 1 (f (- n 1)))))"),
+               util::RuntimeException);
+
+  auto max_stack = GetMaxStack();
+  SetMaxStack(16 << 20);
+  EXPECT_THROW(EvalStr("(count-map 1000000)"), util::RuntimeException);
+  EXPECT_EQ(*IntExpr(1000), *EvalStr("(count-map 1000)"));
+  SetMaxStack(max_stack);
+}
+
+TEST_F(EvalTest, OpenCoded) {
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(car (cdr '(1 3)))"));
+  EXPECT_EQ(expr::True(), EvalStr("(eq? 'a 'a)").get());
+  EXPECT_EQ(expr::False(), EvalStr("(null? '(1))").get());
+  EXPECT_EQ(expr::True(), EvalStr("(pair? '(1))").get());
+  EXPECT_EQ(expr::True(), EvalStr("(< 1 2)").get());
+  EXPECT_EQ(expr::False(), EvalStr("(>= 1 2)").get());
+
+  // Cases the fast path leaves to the primitive.
+  EXPECT_EQ(*EvalStr("(apply + '(4611686018427387904 4611686018427387904))"),
+            *EvalStr("(+ 4611686018427387904 4611686018427387904)"));
+  EXPECT_EQ(*EvalStr("-1.5"), *EvalStr("(- 1 2.5)"));
+  EXPECT_EQ(expr::True(), EvalStr("(= 1 1.0)").get());
+  EXPECT_THROW(EvalStr("(car '())"), util::RuntimeException);
+  EXPECT_THROW(EvalStr("(< 'a 1)"), util::RuntimeException);
+
+  // clang-format off
+  (void)EvalStr(
+      "(define (len l acc)"
+      "  (if (null? l) acc (len (cdr l) (+ acc 1))))");
+  (void)EvalStr("(define (first l) (car l))");
+  // clang-format on
+  EXPECT_EQ(*IntExpr(3), *EvalStr("(len '(a b c) 0)"));
+  EXPECT_EQ(*IntExpr(1), *EvalStr("(first '(1 2))"));
+
+  // Code analyzed before a primitive is rebound still calls the new value.
+  (void)EvalStr("(set! car cdr)");
+  EXPECT_EQ(*EvalStr("'(2)"), *EvalStr("(first '(1 2))"));
+  (void)EvalStr("(define (+ a b) (- a b))");
+  EXPECT_EQ(*IntExpr(-3), *EvalStr("(len '(a b c) 0)"));
+  EXPECT_EQ(*IntExpr(-1), *EvalStr("(+ 1 2)"));
+}
+
+TEST_F(EvalTest, StackFrames) {
+  auto escapes = [this](const std::string& str) {
+    auto node = Analyze(ParseExpr(str).get(), env_.get());
+    if (node->node_type() == NodeType::Let) {
+      return static_cast<Let*>(node.get())->escapes();
+    }
+    return static_cast<Lambda*>(node.get())->escapes();
+  };
+  EXPECT_FALSE(escapes("(lambda (x) (let ((y x)) (f y)))"));
+  EXPECT_FALSE(escapes("(let ((f (lambda () 1))) (f))"));
+  EXPECT_TRUE(escapes("(lambda (x) (lambda () 1))"));
+  EXPECT_TRUE(escapes("(let* ((x 1)) (let ((y 2)) (lambda () y)))"));
+  EXPECT_TRUE(escapes("(letrec ((f (lambda () 1))) (f))"));
+  EXPECT_TRUE(escapes("(lambda (x) (define (g) x) (g))"));
+  EXPECT_TRUE(escapes("(lambda (x) (delay x))"));
+
+  // Frames are popped on return, by tail calls and when errors unwind.
+  auto* top = FrameStack::Get().top();
+  // clang-format off
+  (void)EvalStr(
+      "(define (count n acc)"
+      "  (if (= n 0) acc (let ((m (- n 1))) (count m (+ acc 1)))))");
+  // clang-format on
+  EXPECT_EQ(*IntExpr(10000), *EvalStr("(count 10000 0)"));
+  EXPECT_EQ(top, FrameStack::Get().top());
+  EXPECT_THROW(EvalStr("(let ((x 1)) (count (car x) 0))"),
+               util::RuntimeException);
+  EXPECT_EQ(top, FrameStack::Get().top());
+
+  // Values held only by stack frames survive collection, as do frames
+  // captured by closures and promises.
+  (void)EvalStr("(define (f x) (let ((l (list x x))) (list 1) (cdr l)))");
+  gc::Gc::Get().set_debug_mode(true);
+  auto ret = EvalStr("(f 'a)");
+  gc::Gc::Get().set_debug_mode(false);
+  EXPECT_EQ(*EvalStr("'(a)"), *ret);
+  (void)EvalStr("(define add (let ((k (list 2))) (lambda (x) (+ x (car k)))))");
+  (void)EvalStr("(define p (let ((x (list 5))) (delay (* (car x) 2))))");
+  gc::Gc::Get().Collect();
+  EXPECT_EQ(*IntExpr(5), *EvalStr("(add 3)"));
+  EXPECT_EQ(*IntExpr(10), *EvalStr("(force p)"));
+}
+
+TEST_F(EvalTest, FlatClosures) {
+  // A closure keeps only the variables it uses alive.
+  // clang-format off
+  (void)EvalStr(
+      "(define (build n acc)"
+      "  (if (= n 0) acc (build (- n 1) (cons n acc))))");
+  (void)EvalStr("(define (make big n) (lambda () n))");
+  (void)EvalStr("(define f #f)");
+  // clang-format on
+  gc::Gc::Get().Collect();
+  auto before = gc::Gc::Get().NumObjects();
+  (void)EvalStr("(set! f (make (build 1000 '()) 1))");
+  gc::Gc::Get().Collect();
+  EXPECT_GT(before + 100, gc::Gc::Get().NumObjects());
+  EXPECT_EQ(*IntExpr(1), *EvalStr("(f)"));
+
+  // Variables which are set! or defined later are shared through boxes.
+  // clang-format off
+  (void)EvalStr(
+      "(define (counter)"
+      "  (let ((n 0))"
+      "    (cons (lambda () (set! n (+ n 1)) n) (lambda () n))))");
+  // clang-format on
+  (void)EvalStr("(define c (counter))");
+  (void)EvalStr("((car c))");
+  EXPECT_EQ(*IntExpr(2), *EvalStr("((car c))"));
+  EXPECT_EQ(*IntExpr(2), *EvalStr("((cdr c))"));
+  // clang-format off
+  EXPECT_EQ(*EvalStr("#t"), *EvalStr(
+      "(let ()"
+      "  (define (even? n) (if (= n 0) #t (odd? (- n 1))))"
+      "  (define (odd? n) (if (= n 0) #f (even? (- n 1))))"
+      "  (even? 100))"));
+  EXPECT_EQ(*IntExpr(3), *EvalStr(
+      "(letrec ((len (lambda (l) (if (null? l) 0 (+ 1 (len (cdr l)))))))"
+      "  (len '(a b c)))"));
+  EXPECT_EQ(*IntExpr(6), *EvalStr(
+      "(let ((x 1))"
+      "  (let ((p (delay (* x 2))))"
+      "    (set! x 3)"
+      "    (force p)))"));
+  // clang-format on
+  EXPECT_THROW(EvalStr("(letrec ((a (lambda () b)) (b (a))) b)"),
+               util::RuntimeException);
+
+  // Closures which capture nothing are made once.
+  (void)EvalStr("(define (k) (lambda (x) x))");
+  EXPECT_EQ(*EvalStr("#t"), *EvalStr("(eq? (k) (k))"));
+  EXPECT_EQ(*EvalStr("#f"), *EvalStr("(eq? (make 1 2) (make 1 2))"));
+}
+
 }  // namespace eval
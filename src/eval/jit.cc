@@ -0,0 +1,869 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "eval/jit.h"
+
+#include <sys/mman.h>
+
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#include "eval/limits.h"
+#include "eval/value_stack.h"
+#include "expr/number.h"
+#include "expr/primitive.h"
+#include "util/exceptions.h"
+
+using expr::Env;
+using expr::Expr;
+using expr::Symbol;
+
+namespace eval {
+
+namespace {
+
+// Exceptions can't unwind through machine code without unwind information, so
+// helpers the code calls catch them and return null. The code returns null in
+// turn, and JitCode::DoEval rethrows the exception.
+std::exception_ptr g_error;
+
+}  // namespace
+
+#if defined(__x86_64__) && defined(__linux__)
+
+namespace {
+
+const size_t kNumOperands[] = {
+#define X(name, num_operands) num_operands,
+#include "eval/opcodes.inc"  // NOLINT(build/include)
+#undef X
+};
+
+enum Reg : uint8_t {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+};
+
+// Condition codes. Flipping the low bit negates a condition.
+enum Condition : uint8_t {
+  OVERFLOW = 0x0,
+  EQUAL = 0x4,
+  NOT_EQUAL = 0x5,
+  LESS = 0xc,
+  GREATER_EQUAL = 0xd,
+  LESS_EQUAL = 0xe,
+  GREATER = 0xf,
+};
+
+// Emits the handful of x86-64 instructions the templates are made of. All
+// operate on 64 bit values.
+class Assembler {
+ public:
+  const std::vector<uint8_t>& bytes() const { return bytes_; }
+  size_t size() const { return bytes_.size(); }
+
+  void Push(Reg reg) {
+    Rex(false, RAX, reg);
+    Byte(0x50 + (reg & 7));
+  }
+  void Pop(Reg reg) {
+    Rex(false, RAX, reg);
+    Byte(0x58 + (reg & 7));
+  }
+  void Ret() { Byte(0xc3); }
+
+  void Mov(Reg dst, Reg src) { RegReg(0x89, src, dst); }
+  void MovImm(Reg dst, uint64_t imm) {
+    if (imm <= UINT32_MAX) {
+      // Writing the low half clears the high half.
+      Rex(false, RAX, dst);
+      Byte(0xb8 + (dst & 7));
+      Imm(imm, 4);
+    } else {
+      Rex(true, RAX, dst);
+      Byte(0xb8 + (dst & 7));
+      Imm(imm, 8);
+    }
+  }
+  // dst = [base + disp]
+  void Load(Reg dst, Reg base, int32_t disp) { RegMem(0x8b, dst, base, disp); }
+  // [base + disp] = src
+  void Store(Reg base, int32_t disp, Reg src) {
+    RegMem(0x89, src, base, disp);
+  }
+
+  void Add(Reg dst, Reg src) { RegReg(0x01, src, dst); }
+  void Sub(Reg dst, Reg src) { RegReg(0x29, src, dst); }
+  void Imul(Reg dst, Reg src) {
+    Rex(true, dst, src);
+    Byte(0x0f);
+    Byte(0xaf);
+    ModRm(3, dst, src);
+  }
+  void Cmp(Reg lhs, Reg rhs) { RegReg(0x39, rhs, lhs); }
+  // Compares [base + disp] with |rhs|.
+  void CmpMem(Reg base, int32_t disp, Reg rhs) {
+    RegMem(0x39, rhs, base, disp);
+  }
+  void Test(Reg lhs, Reg rhs) { RegReg(0x85, rhs, lhs); }
+  // Tests the low byte of rax, where functions return bool.
+  void TestAl() {
+    Byte(0x84);
+    Byte(0xc0);
+  }
+  void Cmov(Condition cond, Reg dst, Reg src) {
+    Rex(true, dst, src);
+    Byte(0x0f);
+    Byte(0x40 + cond);
+    ModRm(3, dst, src);
+  }
+
+  // Calls |func|, clobbering rax.
+  void Call(uint64_t func) {
+    MovImm(RAX, func);
+    Byte(0xff);
+    ModRm(3, 2, RAX);
+  }
+
+  // Jumps return the position of their offset, to be set by Bind().
+  size_t Jump() {
+    Byte(0xe9);
+    Imm(0, 4);
+    return size() - 4;
+  }
+  size_t JumpIf(Condition cond) {
+    Byte(0x0f);
+    Byte(0x80 + cond);
+    Imm(0, 4);
+    return size() - 4;
+  }
+
+  // Points the jump whose offset is at |pos| to |target|.
+  void Bind(size_t pos, size_t target) {
+    auto rel = static_cast<int32_t>(target - (pos + 4));
+    std::memcpy(&bytes_[pos], &rel, sizeof(rel));
+  }
+  // Points the jump whose offset is at |pos| to the next instruction.
+  void Bind(size_t pos) { Bind(pos, size()); }
+
+ private:
+  void Byte(uint8_t byte) { bytes_.push_back(byte); }
+  void Imm(uint64_t imm, size_t num_bytes) {
+    for (size_t i = 0; i < num_bytes; ++i) {
+      Byte(static_cast<uint8_t>(imm >> (8 * i)));
+    }
+  }
+
+  // Emits the prefix needed for 64 bit operands or registers r8 and above.
+  void Rex(bool wide, uint8_t reg, uint8_t rm) {
+    uint8_t rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3);
+    if (rex != 0x40) {
+      Byte(rex);
+    }
+  }
+  void ModRm(uint8_t mod, uint8_t reg, uint8_t rm) {
+    Byte((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+  }
+
+  void RegReg(uint8_t opcode, Reg reg, Reg rm) {
+    Rex(true, reg, rm);
+    Byte(opcode);
+    ModRm(3, reg, rm);
+  }
+  void RegMem(uint8_t opcode, Reg reg, Reg base, int32_t disp) {
+    Rex(true, reg, base);
+    Byte(opcode);
+    ModRm(2, reg, base);
+    if ((base & 7) == RSP) {
+      // Addressing relative to rsp and r12 takes a SIB byte.
+      Byte(0x24);
+    }
+    Imm(static_cast<uint32_t>(disp), 4);
+  }
+
+  std::vector<uint8_t> bytes_;
+};
+
+// The window of a call holds its current frame, followed by its registers.
+Env* CurrentEnv(Expr** window) {
+  return static_cast<Env*>(window[0]);
+}
+
+Expr** Regs(Expr** window) {
+  return window + 1;
+}
+
+int32_t RegDisp(uint32_t reg) {
+  return static_cast<int32_t>(sizeof(Expr*) * (reg + 1));
+}
+
+// Slots are stored directly after the frame.
+int32_t SlotDisp(uint32_t index) {
+  return static_cast<int32_t>(sizeof(Env) + sizeof(Expr*) * index);
+}
+
+template <typename F>
+Expr* Guard(F func) {
+  try {
+    return func();
+  } catch (...) {
+    g_error = std::current_exception();
+    return nullptr;
+  }
+}
+
+// Helpers called by the machine code. Those which may fail return null.
+
+Expr* Unassigned(Symbol* var) {
+  return Guard([var]() -> Expr* {
+    throw util::RuntimeException("Attempt to reference unassigned variable",
+                                 var);
+  });
+}
+
+Expr* LocalRefHelper(Expr** window,
+                     uint64_t depth,
+                     uint64_t index,
+                     Symbol* var) {
+  auto* val = FrameAt(CurrentEnv(window), depth)->slot(index);
+  return val ? val : Unassigned(var);
+}
+
+Expr* GlobalRefHelper(Expr** window,
+                      uint64_t depth,
+                      Symbol* var,
+                      GlobalCell* cell) {
+  return Guard([=] {
+    auto* top = FrameAt(CurrentEnv(window), depth);
+    auto** loc = cell->Get(top, var);
+    return loc ? *loc : top->Lookup(var);
+  });
+}
+
+void LocalSetHelper(Expr** window,
+                    uint64_t src,
+                    uint64_t depth,
+                    uint64_t index) {
+  FrameAt(CurrentEnv(window), depth)->slot(index) = Regs(window)[src];
+}
+
+Expr* GlobalSetHelper(Expr** window,
+                      uint64_t src,
+                      uint64_t depth,
+                      Symbol* var,
+                      GlobalCell* cell) {
+  return Guard([=] {
+    auto* val = Regs(window)[src];
+    auto* top = FrameAt(CurrentEnv(window), depth);
+    if (auto** loc = cell->Get(top, var)) {
+      *loc = val;
+    } else {
+      top->SetVar(var, val);
+    }
+    return val;
+  });
+}
+
+Expr* DefineHelper(Expr** window, uint64_t src, Symbol* var) {
+  return Guard([=] {
+    auto* val = Regs(window)[src];
+    CurrentEnv(window)->DefineVar(var, val);
+    return val;
+  });
+}
+
+bool EqvHelper(Expr** window, uint64_t src, Expr* datum) {
+  return Regs(window)[src]->Eqv(datum);
+}
+
+// Lambdas within jitted code make LambdaImpls, which are jitted themselves
+// once hot.
+Expr* MakeClosureHelper(Expr** window,
+                        Code* code,
+                        uint64_t src,
+                        uint64_t num_captures,
+                        uint64_t top_depth) {
+  return Guard([=]() -> Expr* {
+    auto* lambda = static_cast<Lambda*>(code->source());
+    assert(lambda->flat().captures.size() == num_captures);
+    (void)num_captures;
+    return lambda
+        ->NewClosure(FrameAt(CurrentEnv(window), top_depth),
+                     Regs(window) + src)
+        .get();
+  });
+}
+
+Expr* MakePromiseHelper(Expr** window, uint64_t dst, uint64_t is_lazy) {
+  return Guard([=]() -> Expr* {
+    auto* regs = Regs(window);
+    return regs[dst] = new Promise(regs[dst], is_lazy);
+  });
+}
+
+Expr* BoxHelper(Expr** window, uint64_t index) {
+  return Guard([=]() -> Expr* {
+    auto& slot = CurrentEnv(window)->slot(index);
+    return slot = NewBox(slot).get();
+  });
+}
+
+Expr* BoxRefHelper(Expr** window,
+                   uint64_t depth,
+                   uint64_t index,
+                   Symbol* var) {
+  auto* val = Unbox(FrameAt(CurrentEnv(window), depth)->slot(index));
+  return val ? val : Unassigned(var);
+}
+
+void BoxSetHelper(Expr** window,
+                  uint64_t src,
+                  uint64_t depth,
+                  uint64_t index) {
+  Unbox(FrameAt(CurrentEnv(window), depth)->slot(index)) = Regs(window)[src];
+}
+
+Expr* PushEnvHelper(Expr** window, uint64_t num_slots) {
+  return Guard([=] {
+    window[0] = Env::NewFrame(CurrentEnv(window), num_slots).get();
+    return window[0];
+  });
+}
+
+void PopEnvHelper(Expr** window) {
+  window[0] = CurrentEnv(window)->enclosing();
+}
+
+Expr* BindValuesHelper(Expr** window,
+                       uint64_t src,
+                       uint64_t num_required,
+                       uint64_t has_rest) {
+  return Guard([=] {
+    BindValues(Regs(window)[src], num_required, has_rest, CurrentEnv(window));
+    return window[0];
+  });
+}
+
+Expr* CallHelper(Expr** window, uint64_t proc, uint64_t num_args) {
+  return Guard([=] {
+    auto* regs = Regs(window);
+    return expr::TryEvals(regs[proc])
+        ->DoEval(CurrentEnv(window), regs + proc + 1, num_args)
+        .get();
+  });
+}
+
+// Returns null to make the call normally. OpenCode() only fails to allocate,
+// and the call will report that.
+Expr* OpenCallHelper(Expr** window, uint64_t proc, PrimApply* apply) {
+  try {
+    auto* regs = Regs(window);
+    return apply->TryOpenCode(regs[proc], regs + proc + 1);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+Expr* TailCallHelper(Expr** window, uint64_t proc, uint64_t num_args) {
+  return Guard([=] {
+    auto* regs = Regs(window);
+    expr::TryEvals(regs[proc]);
+    return MakeTailCall(regs[proc], regs + proc + 1, num_args);
+  });
+}
+
+// Returns null if a limit of the evaluation is reached.
+Expr* StepHelper(Expr** window) {
+  return Guard([]() -> Expr* {
+    Step();
+    return expr::True();
+  });
+}
+
+Expr* NewIntHelper(int64_t val) {
+  return Guard([=]() -> Expr* { return new expr::Int(val); });
+}
+
+template <typename T>
+uint64_t Addr(T* ptr) {
+  return reinterpret_cast<uint64_t>(ptr);
+}
+
+}  // namespace
+
+// Translates bytecode into machine code, one template per instruction. The
+// code keeps the window in rbx and loads values from it as needed, so nothing
+// but the window is live across calls.
+class JitCompiler {
+ public:
+  JitCompiler(Code* code, Env* frame) : code_(code), frame_(frame) {}
+
+  gc::Lock<JitCode> Compile();
+
+ private:
+  // Emits a call to |helper| with the window and |args|.
+  void EmitCall(uint64_t helper, std::initializer_list<uint64_t> args);
+  // Returns null from the code if the helper just called failed.
+  void EmitCheck() {
+    as_.Test(RAX, RAX);
+    to_epilogue_.push_back(as_.JumpIf(EQUAL));
+  }
+
+  // True if CompileInlineCall() has a template for |primitive|, which is
+  // better than OpenCall's.
+  static bool HasInlineCall(expr::Primitive primitive);
+
+  // Returns false if |op| has no template.
+  bool CompileInstruction(Opcode op, const uint32_t* operands);
+  void CompileCall(uint32_t dst, uint32_t proc, uint32_t num_args);
+  // Emits the arithmetic or comparison of two fixnums if |proc| was loaded
+  // from a variable bound to one of the primitives. The code checks the
+  // procedure and arguments, and jumps to the positions added to |to_slow| to
+  // make the call normally. Returns the position of a jump past the normal
+  // call, or 0 if nothing was emitted.
+  size_t CompileInlineCall(uint32_t dst,
+                           uint32_t proc,
+                           std::vector<size_t>* to_slow);
+
+  Code* const code_;
+  Env* const frame_;
+  Assembler as_;
+  std::vector<Expr*> guards_;
+
+  // The top level variable each register was last loaded from, if any.
+  // Only a hint for which calls to inline, since the code checks the
+  // procedure it calls anyway.
+  std::vector<Symbol*> globals_;
+
+  // Jumps to bytecode offsets, to the epilogue, and to code raising an
+  // unassigned variable error.
+  std::vector<std::pair<size_t, uint32_t>> jumps_;
+  std::vector<size_t> to_epilogue_;
+  std::vector<std::pair<size_t, Symbol*>> to_unassigned_;
+};
+
+gc::Lock<JitCode> JitCompiler::Compile() {
+  const auto& code = code_->code_;
+  globals_.assign(code_->num_regs_, nullptr);
+
+  // One push keeps the stack aligned for calls.
+  as_.Push(RBX);
+  as_.Mov(RBX, RDI);
+
+  std::vector<size_t> offsets(code.size());
+  for (size_t pc = 0; pc < code.size(); pc += 1 + kNumOperands[code[pc]]) {
+    offsets[pc] = as_.size();
+    auto op = static_cast<Opcode>(code[pc]);
+    if (!CompileInstruction(op, code.data() + pc + 1)) {
+      return gc::Lock<JitCode>();
+    }
+  }
+  for (const auto& jump : jumps_) {
+    as_.Bind(jump.first, offsets[jump.second]);
+  }
+
+  for (const auto& error : to_unassigned_) {
+    as_.Bind(error.first);
+    as_.MovImm(RDI, Addr(error.second));
+    as_.Call(Addr(&Unassigned));
+    to_epilogue_.push_back(as_.Jump());
+  }
+
+  // The result is in rax.
+  for (auto pos : to_epilogue_) {
+    as_.Bind(pos);
+  }
+  as_.Pop(RBX);
+  as_.Ret();
+
+  const auto& bytes = as_.bytes();
+  void* mem = mmap(nullptr, bytes.size(), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    return gc::Lock<JitCode>();
+  }
+  std::memcpy(mem, bytes.data(), bytes.size());
+  if (mprotect(mem, bytes.size(), PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, bytes.size());
+    return gc::Lock<JitCode>();
+  }
+
+  return gc::Lock<JitCode>(
+      new JitCode(code_, std::move(guards_), mem, bytes.size()));
+}
+
+void JitCompiler::EmitCall(uint64_t helper,
+                           std::initializer_list<uint64_t> args) {
+  static const Reg kArgRegs[] = {RSI, RDX, RCX, R8};
+  assert(args.size() <= sizeof(kArgRegs) / sizeof(kArgRegs[0]));
+  as_.Mov(RDI, RBX);
+  const Reg* reg = kArgRegs;
+  for (auto arg : args) {
+    as_.MovImm(*reg++, arg);
+  }
+  as_.Call(helper);
+}
+
+bool JitCompiler::CompileInstruction(Opcode op, const uint32_t* operands) {
+  const auto& consts = code_->consts_;
+  auto& cells = code_->cells_;
+  uint32_t dst = kNumOperands[static_cast<size_t>(op)] > 0 ? operands[0] : 0;
+
+  switch (op) {
+    case Opcode::Const:
+      as_.MovImm(RAX, Addr(consts[operands[1]]));
+      as_.Store(RBX, RegDisp(dst), RAX);
+      break;
+
+    case Opcode::LocalRef0: {
+      as_.Load(RAX, RBX, 0);
+      as_.Load(RAX, RAX, SlotDisp(operands[1]));
+      as_.Test(RAX, RAX);
+      auto* var = static_cast<Symbol*>(consts[operands[2]]);
+      to_unassigned_.emplace_back(as_.JumpIf(EQUAL), var);
+      as_.Store(RBX, RegDisp(dst), RAX);
+      break;
+    }
+
+    case Opcode::LocalRef:
+      EmitCall(Addr(&LocalRefHelper),
+               {operands[1], operands[2], Addr(consts[operands[3]])});
+      EmitCheck();
+      as_.Store(RBX, RegDisp(dst), RAX);
+      break;
+
+    case Opcode::GlobalRef:
+      EmitCall(Addr(&GlobalRefHelper), {operands[1], Addr(consts[operands[2]]),
+                                        Addr(&cells[operands[3]])});
+      EmitCheck();
+      as_.Store(RBX, RegDisp(dst), RAX);
+      globals_[dst] = static_cast<Symbol*>(consts[operands[2]]);
+      return true;
+
+    case Opcode::LocalSet:
+      if (operands[1] == 0) {
+        as_.Load(RAX, RBX, 0);
+        as_.Load(RCX, RBX, RegDisp(operands[0]));
+        as_.Store(RAX, SlotDisp(operands[2]), RCX);
+      } else {
+        EmitCall(Addr(&LocalSetHelper),
+                 {operands[0], operands[1], operands[2]});
+      }
+      return true;
+
+    case Opcode::GlobalSet:
+      EmitCall(Addr(&GlobalSetHelper),
+               {operands[0], operands[1], Addr(consts[operands[2]]),
+                Addr(&cells[operands[3]])});
+      EmitCheck();
+      return true;
+
+    case Opcode::Define:
+      EmitCall(Addr(&DefineHelper), {operands[0], Addr(consts[operands[1]])});
+      EmitCheck();
+      return true;
+
+    case Opcode::Move:
+      as_.Load(RAX, RBX, RegDisp(operands[1]));
+      as_.Store(RBX, RegDisp(dst), RAX);
+      break;
+
+    case Opcode::Jump:
+      // Loops jump back.
+      if (operands[0] < operands - code_->code_.data()) {
+        EmitCall(Addr(&StepHelper), {});
+        EmitCheck();
+      }
+      jumps_.emplace_back(as_.Jump(), operands[0]);
+      return true;
+
+    case Opcode::JumpIfFalse:
+    case Opcode::JumpIfTrue:
+      as_.MovImm(RAX, Addr(expr::False()));
+      as_.CmpMem(RBX, RegDisp(operands[0]), RAX);
+      jumps_.emplace_back(
+          as_.JumpIf(op == Opcode::JumpIfFalse ? EQUAL : NOT_EQUAL),
+          operands[1]);
+      return true;
+
+    case Opcode::JumpIfEqv:
+      EmitCall(Addr(&EqvHelper), {operands[0], Addr(consts[operands[1]])});
+      as_.TestAl();
+      jumps_.emplace_back(as_.JumpIf(NOT_EQUAL), operands[2]);
+      return true;
+
+    case Opcode::MakeClosure:
+      EmitCall(Addr(&MakeClosureHelper), {Addr(consts[operands[1]]),
+                                          operands[2], operands[3],
+                                          operands[4]});
+      EmitCheck();
+      as_.Store(RBX, RegDisp(dst), RAX);
+      break;
+
+    case Opcode::MakePromise:
+      EmitCall(Addr(&MakePromiseHelper), {dst, operands[1]});
+      EmitCheck();
+      break;
+
+    case Opcode::Box:
+      EmitCall(Addr(&BoxHelper), {operands[0]});
+      EmitCheck();
+      return true;
+
+    case Opcode::BoxRef:
+      EmitCall(Addr(&BoxRefHelper),
+               {operands[1], operands[2], Addr(consts[operands[3]])});
+      EmitCheck();
+      as_.Store(RBX, RegDisp(dst), RAX);
+      break;
+
+    case Opcode::BoxSet:
+      EmitCall(Addr(&BoxSetHelper), {operands[0], operands[1], operands[2]});
+      return true;
+
+    case Opcode::PushEnv:
+      EmitCall(Addr(&PushEnvHelper), {operands[0]});
+      EmitCheck();
+      return true;
+
+    case Opcode::PopEnv:
+      EmitCall(Addr(&PopEnvHelper), {});
+      return true;
+
+    case Opcode::BindValues:
+      EmitCall(Addr(&BindValuesHelper),
+               {operands[0], operands[1], operands[2]});
+      EmitCheck();
+      return true;
+
+    case Opcode::OpenCall: {
+      auto* apply = static_cast<PrimApply*>(consts[operands[3]]);
+      const auto* next = operands + kNumOperands[static_cast<size_t>(op)];
+      if (static_cast<Opcode>(*next) == Opcode::Call &&
+          HasInlineCall(apply->primitive())) {
+        return true;
+      }
+      EmitCall(Addr(&OpenCallHelper), {operands[1], Addr(apply)});
+      as_.Test(RAX, RAX);
+      auto to_call = as_.JumpIf(EQUAL);
+      as_.Store(RBX, RegDisp(dst), RAX);
+      auto after_call = next - code_->code_.data() + 1 +
+                        kNumOperands[static_cast<size_t>(*next)];
+      jumps_.emplace_back(as_.Jump(), after_call);
+      as_.Bind(to_call);
+      return true;
+    }
+
+    case Opcode::Call:
+      CompileCall(dst, operands[1], operands[2]);
+      break;
+
+    case Opcode::TailCall:
+      // Returns TailCallMarker() or null.
+      EmitCall(Addr(&TailCallHelper), {operands[0], operands[1]});
+      to_epilogue_.push_back(as_.Jump());
+      return true;
+
+    case Opcode::Return:
+      as_.Load(RAX, RBX, RegDisp(operands[0]));
+      to_epilogue_.push_back(as_.Jump());
+      return true;
+  }
+
+  globals_[dst] = nullptr;
+  return true;
+}
+
+void JitCompiler::CompileCall(uint32_t dst, uint32_t proc, uint32_t num_args) {
+  std::vector<size_t> to_slow;
+  size_t to_done = num_args == 2 ? CompileInlineCall(dst, proc, &to_slow) : 0;
+  for (auto pos : to_slow) {
+    as_.Bind(pos);
+  }
+
+  EmitCall(Addr(&CallHelper), {proc, num_args});
+  EmitCheck();
+  as_.Store(RBX, RegDisp(dst), RAX);
+  if (to_done) {
+    as_.Bind(to_done);
+  }
+}
+
+// static
+bool JitCompiler::HasInlineCall(expr::Primitive primitive) {
+  switch (primitive) {
+    case expr::Primitive::Plus:
+    case expr::Primitive::Minus:
+    case expr::Primitive::Star:
+    case expr::Primitive::OpEq:
+    case expr::Primitive::OpLt:
+    case expr::Primitive::OpGt:
+    case expr::Primitive::OpLe:
+    case expr::Primitive::OpGe:
+      return true;
+    default:
+      return false;
+  }
+}
+
+size_t JitCompiler::CompileInlineCall(uint32_t dst,
+                                      uint32_t proc,
+                                      std::vector<size_t>* to_slow) {
+  auto* var = globals_[proc];
+  auto* val = var ? frame_->TryLookup(var) : nullptr;
+  expr::Primitive primitive;
+  if (!val || !expr::GetPrimitive(val, &primitive)) {
+    return 0;
+  }
+
+  void (Assembler::*arith)(Reg, Reg) = nullptr;
+  Condition cond = OVERFLOW;
+  switch (primitive) {
+    case expr::Primitive::Plus:
+      arith = &Assembler::Add;
+      break;
+    case expr::Primitive::Minus:
+      arith = &Assembler::Sub;
+      break;
+    case expr::Primitive::Star:
+      arith = &Assembler::Imul;
+      break;
+    case expr::Primitive::OpEq:
+      cond = EQUAL;
+      break;
+    case expr::Primitive::OpLt:
+      cond = LESS;
+      break;
+    case expr::Primitive::OpGt:
+      cond = GREATER;
+      break;
+    case expr::Primitive::OpLe:
+      cond = LESS_EQUAL;
+      break;
+    case expr::Primitive::OpGe:
+      cond = GREATER_EQUAL;
+      break;
+    default:
+      return 0;
+  }
+
+  // Ints are recognized by their vtable.
+  gc::Lock<expr::Int> probe(new expr::Int(0));
+  uint64_t int_vtable;
+  std::memcpy(&int_vtable, probe.get(), sizeof(int_vtable));
+  auto val_offset = static_cast<int32_t>(
+      reinterpret_cast<char*>(&probe->val_) -
+      reinterpret_cast<char*>(probe.get()));
+
+  // The variable may be rebound, so check the procedure is still the one
+  // looked up now.
+  guards_.push_back(val);
+  as_.MovImm(RCX, Addr(val));
+  as_.CmpMem(RBX, RegDisp(proc), RCX);
+  to_slow->push_back(as_.JumpIf(NOT_EQUAL));
+
+  as_.Load(RAX, RBX, RegDisp(proc + 1));
+  as_.Load(RDX, RBX, RegDisp(proc + 2));
+  as_.MovImm(RCX, int_vtable);
+  as_.CmpMem(RAX, 0, RCX);
+  to_slow->push_back(as_.JumpIf(NOT_EQUAL));
+  as_.CmpMem(RDX, 0, RCX);
+  to_slow->push_back(as_.JumpIf(NOT_EQUAL));
+  as_.Load(RAX, RAX, val_offset);
+  as_.Load(RDX, RDX, val_offset);
+
+  if (arith) {
+    // Results which overflow are left to the primitive.
+    (as_.*arith)(RAX, RDX);
+    to_slow->push_back(as_.JumpIf(OVERFLOW));
+    as_.Mov(RDI, RAX);
+    as_.Call(Addr(&NewIntHelper));
+    EmitCheck();
+  } else {
+    // Moves don't change the flags.
+    as_.Cmp(RAX, RDX);
+    as_.MovImm(RAX, Addr(expr::True()));
+    as_.MovImm(RCX, Addr(expr::False()));
+    as_.Cmov(static_cast<Condition>(cond ^ 1), RAX, RCX);
+  }
+  as_.Store(RBX, RegDisp(dst), RAX);
+  return as_.Jump();
+}
+
+gc::Lock<JitCode> JitCompile(Lambda* lambda, Env* frame) {
+  auto code = CompileLambda(lambda);
+  return JitCompiler(code.get(), frame).Compile();
+}
+
+JitCode::~JitCode() {
+  munmap(mem_, size_);
+}
+
+#else  // defined(__x86_64__) && defined(__linux__)
+
+gc::Lock<JitCode> JitCompile(Lambda* lambda, Env* frame) {
+  return gc::Lock<JitCode>();
+}
+
+JitCode::~JitCode() = default;
+
+#endif  // defined(__x86_64__) && defined(__linux__)
+
+JitCode::JitCode(Code* code,
+                 std::vector<Expr*> guards,
+                 void* mem,
+                 size_t size)
+    : code_(code), guards_(std::move(guards)), mem_(mem), size_(size) {}
+
+gc::Lock<Expr> JitCode::DoEval(Env* env, Expr** args, size_t num_args) {
+  assert(num_args == 0);
+  StackSlots window(code_->num_regs_ + 1);
+  window[0] = env;
+  gc::Lock<Expr> ret(reinterpret_cast<Entry>(mem_)(window.get()));
+  if (!ret.get()) {
+    std::exception_ptr error;
+    std::swap(error, g_error);
+    std::rethrow_exception(error);
+  }
+  return ret;
+}
+
+std::ostream& JitCode::AppendStream(std::ostream& stream) const {
+  return stream << "(jit-code " << *code_->source() << ")";
+}
+
+void JitCode::MarkReferences() {
+  code_->GcMark();
+  for (auto* guard : guards_) {
+    guard->GcMark();
+  }
+}
+
+}  // namespace eval
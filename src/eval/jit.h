@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVAL_JIT_H_
+#define EVAL_JIT_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "eval/node.h"
+#include "eval/vm.h"
+#include "expr/expr.h"
+#include "gc/lock.h"
+
+namespace eval {
+
+// x86-64 machine code for a lambda body, stitched together from a template
+// for each instruction of its bytecode. Registers live in a window of the
+// value stack as they do in the VM, but calls go through the procedures'
+// DoEval() and tail calls are left for LambdaImpl::DoEval, as in the tree
+// walker.
+class JitCode : public expr::Evals {
+ public:
+  using Entry = expr::Expr* (*)(expr::Expr** window);
+
+  // Evals implementation. Runs the body in |env|, the frame of a call. May
+  // return TailCallMarker().
+  gc::Lock<expr::Expr> DoEval(expr::Env* env,
+                              expr::Expr** args,
+                              size_t num_args) override;
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+ private:
+  friend class JitCompiler;
+
+  // |code| is the bytecode |entry| was generated from. |guards| are values
+  // the machine code compares against.
+  JitCode(Code* code,
+          std::vector<expr::Expr*> guards,
+          void* mem,
+          size_t size);
+  ~JitCode() override;
+
+  Code* const code_;
+  const std::vector<expr::Expr*> guards_;
+  // Executable pages holding the machine code.
+  void* const mem_;
+  const size_t size_;
+};
+
+// Compiles the body of |lambda|. |frame| is the frame of a call to it, in
+// which procedures the code calls may be looked up to call them inline.
+// Returns null if some of the body has no template, or on platforms other
+// than x86-64 Linux, in which case the body should be interpreted.
+gc::Lock<JitCode> JitCompile(Lambda* lambda, expr::Env* frame);
+
+}  // namespace eval
+
+#endif  // EVAL_JIT_H_
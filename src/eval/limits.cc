@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "eval/limits.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+#include "eval/eval.h"
+#include "util/exceptions.h"
+
+namespace eval {
+
+int64_t g_steps_left = std::numeric_limits<int64_t>::max();
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Steps between reads of the clock while a timeout is set.
+constexpr int64_t kStepsPerClockCheck = 4096;
+
+uint64_t g_fuel = 0;
+std::chrono::milliseconds g_timeout(0);
+
+bool g_armed = false;
+// Fuel not yet handed out to |g_steps_left|.
+uint64_t g_fuel_left = 0;
+Clock::time_point g_deadline;
+
+// Hands out the next batch of steps, up to the next check of the clock.
+void Refill() {
+  uint64_t batch = g_timeout.count() ? kStepsPerClockCheck
+                                     : std::numeric_limits<int64_t>::max();
+  if (g_fuel) {
+    batch = std::min(batch, g_fuel_left);
+    g_fuel_left -= batch;
+  }
+  g_steps_left = static_cast<int64_t>(batch);
+}
+
+}  // namespace
+
+void SetFuel(uint64_t fuel) {
+  g_fuel = fuel;
+}
+
+uint64_t GetFuel() {
+  return g_fuel;
+}
+
+void SetTimeout(std::chrono::milliseconds timeout) {
+  g_timeout = timeout;
+}
+
+std::chrono::milliseconds GetTimeout() {
+  return g_timeout;
+}
+
+void CheckLimits() {
+  if (!g_armed) {
+    g_steps_left = std::numeric_limits<int64_t>::max();
+    return;
+  }
+  // Once either limit is reached, every later step fails too, so nothing
+  // more runs while the exception unwinds, not even dynamic-wind's after.
+  if (g_fuel && g_fuel_left == 0) {
+    g_steps_left = 0;
+    throw util::LimitException("Evaluation ran out of fuel");
+  }
+  if (g_timeout.count() && Clock::now() >= g_deadline) {
+    g_steps_left = 0;
+    throw util::LimitException("Evaluation timed out");
+  }
+  Refill();
+  // The step which ran out of the last batch.
+  --g_steps_left;
+}
+
+LimitScope::LimitScope() {
+  if (g_armed || (!g_fuel && !g_timeout.count())) {
+    return;
+  }
+  armed_ = g_armed = true;
+  g_fuel_left = g_fuel;
+  g_deadline = Clock::now() + g_timeout;
+  Refill();
+}
+
+LimitScope::~LimitScope() {
+  if (armed_) {
+    g_armed = false;
+    g_steps_left = std::numeric_limits<int64_t>::max();
+  }
+}
+
+}  // namespace eval
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVAL_LIMITS_H_
+#define EVAL_LIMITS_H_
+
+#include <cstdint>
+
+#include "util/macros.h"
+
+namespace eval {
+
+// Steps the running evaluation may take before CheckLimits() must be called.
+// Effectively unlimited unless SetFuel() or SetTimeout() set a limit.
+extern int64_t g_steps_left;
+
+// Called once |g_steps_left| runs out. Throws util::LimitException if the
+// evaluation has used up its fuel or time, otherwise allows more steps.
+void CheckLimits();
+
+// Counts a procedure call or loop iteration. Every engine steps wherever code
+// can run again without returning, so no evaluation escapes the limits.
+inline void Step() {
+  if (--g_steps_left < 0) {
+    CheckLimits();
+  }
+}
+
+// Arms the limits for an evaluation, which are disarmed when it's destroyed.
+// Does nothing if an enclosing evaluation, e.g. the caller of eval, has
+// already armed them.
+class LimitScope {
+ public:
+  LimitScope();
+  ~LimitScope();
+
+ private:
+  bool armed_ = false;
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(LimitScope);
+};
+
+}  // namespace eval
+
+#endif  // EVAL_LIMITS_H_
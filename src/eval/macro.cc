@@ -0,0 +1,885 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "eval/macro.h"
+
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "util/exceptions.h"
+
+using expr::Expr;
+using expr::Nil;
+using expr::Pair;
+using expr::Symbol;
+using expr::Syntax;
+using util::RuntimeException;
+
+namespace eval {
+
+namespace {
+
+const size_t kNone = static_cast<size_t>(-1);
+
+// Cached expansions are dropped when there are this many, so programs which
+// make and evaluate new forms don't grow the cache without bound.
+const size_t kMaxCached = 4096;
+
+// Numbers aliases so each is a new symbol.
+size_t alias_count = 0;
+
+// The position of the '#' which starts an alias's number, or std::string::npos
+// if |name| isn't an alias.
+size_t AliasSuffix(const std::string& name) {
+  auto pos = name.rfind('#');
+  if (pos == std::string::npos || pos == 0 || pos + 1 == name.size()) {
+    return std::string::npos;
+  }
+  for (size_t i = pos + 1; i < name.size(); ++i) {
+    if (name[i] < '0' || name[i] > '9') {
+      return std::string::npos;
+    }
+  }
+  return pos;
+}
+
+// The name of the symbol |sym| renames.
+std::string BaseName(const Symbol* sym) {
+  std::string name = sym->val();
+  for (auto pos = AliasSuffix(name); pos != std::string::npos;
+       pos = AliasSuffix(name)) {
+    name.resize(pos);
+  }
+  return name;
+}
+
+bool HasName(Expr* expr, const char* name) {
+  auto* sym = expr->AsSymbol();
+  return sym && (sym->val() == name || (IsAlias(sym) && BaseName(sym) == name));
+}
+
+bool IsEllipsis(Expr* expr) {
+  return HasName(expr, "...");
+}
+
+// What a pattern variable matched. A variable followed by ellipses has one
+// item for each repetition.
+struct Binding {
+  Expr* expr = nullptr;
+  std::vector<Binding> items;
+};
+
+struct Pattern {
+  enum class Kind {
+    ANY,      // _
+    VAR,      // A pattern variable
+    LITERAL,  // An identifier in the literals list
+    DATUM,    // Anything else which isn't a list or vector
+    LIST,
+    VECTOR,
+  };
+
+  explicit Pattern(Kind kind) : kind(kind) {}
+
+  Kind kind;
+  // LITERAL: The symbol, without renaming. DATUM: The datum.
+  Expr* datum = nullptr;
+  // VAR: The index of its binding.
+  size_t var = 0;
+
+  // LIST, VECTOR: The element patterns, of which the one at |ellipsis|, if
+  // any, matches zero or more elements.
+  std::vector<Pattern> elems;
+  size_t ellipsis = kNone;
+  // The pattern variables of the repeated element.
+  std::vector<size_t> repeated_vars;
+  // LIST: What follows the elements, or null if they end the list.
+  std::unique_ptr<Pattern> tail;
+};
+
+struct Template {
+  enum class Kind {
+    SYMBOL,  // Inserted as an alias
+    VAR,     // Replaced by what it matched
+    DATUM,
+    LIST,
+    VECTOR,
+  };
+
+  explicit Template(Kind kind) : kind(kind) {}
+
+  Kind kind;
+  // SYMBOL: The symbol. DATUM: The datum.
+  Expr* datum = nullptr;
+  // VAR: The index of its binding.
+  size_t var = 0;
+
+  // LIST, VECTOR: The element templates.
+  std::vector<Template> elems;
+  // LIST: What follows the elements, or null if they end the list.
+  std::unique_ptr<Template> tail;
+
+  // As an element, the pattern variables which each ellipsis following it
+  // iterates over. An element followed by two ellipses is flattened.
+  std::vector<std::vector<size_t>> loops;
+};
+
+// Matches uses of a macro against the patterns of its rules.
+class Matcher {
+ public:
+  explicit Matcher(const Macro::SameBinding& same_binding)
+      : same_binding_(same_binding) {}
+
+  // Matches |input| against |pattern|, setting the bindings of its variables.
+  bool Match(const Pattern& pattern, Expr* input, std::vector<Binding>* binds);
+
+  // The identifiers which were checked against literals, in order.
+  std::vector<Macro::LiteralCheck>& checks() { return checks_; }
+
+ private:
+  // Matches the elements of a list or vector. |links| are the pairs of a list,
+  // which |last| ends.
+  bool MatchElems(const Pattern& pattern,
+                  const std::vector<Expr*>& items,
+                  const std::vector<Pair*>& links,
+                  Expr* last,
+                  std::vector<Binding>* binds);
+
+  // An identifier matches a literal of the same name if it also has the same
+  // binding.
+  bool MatchLiteral(Symbol* input, Symbol* literal) {
+    if (input != literal &&
+        !(IsAlias(input) && Unalias(input).get() == literal)) {
+      return false;
+    }
+    bool matched = !same_binding_ || same_binding_(input, literal);
+    checks_.push_back({input, literal, matched});
+    return matched;
+  }
+
+  const Macro::SameBinding& same_binding_;
+  std::vector<Macro::LiteralCheck> checks_;
+};
+
+bool Matcher::MatchElems(const Pattern& pattern,
+                         const std::vector<Expr*>& items,
+                         const std::vector<Pair*>& links,
+                         Expr* last,
+                         std::vector<Binding>* binds) {
+  const auto& elems = pattern.elems;
+  if (pattern.ellipsis == kNone) {
+    if (items.size() < elems.size() ||
+        (!pattern.tail &&
+         (items.size() != elems.size() || last != Nil()))) {
+      return false;
+    }
+    for (size_t i = 0; i < elems.size(); ++i) {
+      if (!Match(elems[i], items[i], binds)) {
+        return false;
+      }
+    }
+    if (!pattern.tail) {
+      return true;
+    }
+    return Match(*pattern.tail,
+                 elems.size() < links.size() ? links[elems.size()] : last,
+                 binds);
+  }
+
+  // A list ending in a tail pattern repeats over all of its elements.
+  auto num_fixed = elems.size() - 1;
+  if (items.size() < num_fixed || (!pattern.tail && last != Nil())) {
+    return false;
+  }
+  auto num_reps = items.size() - num_fixed;
+  auto before = pattern.ellipsis;
+  for (size_t i = 0; i < before; ++i) {
+    if (!Match(elems[i], items[i], binds)) {
+      return false;
+    }
+  }
+
+  for (auto var : pattern.repeated_vars) {
+    (*binds)[var].items.clear();
+  }
+  std::vector<Binding> rep(binds->size());
+  for (size_t i = 0; i < num_reps; ++i) {
+    if (!Match(elems[before], items[before + i], &rep)) {
+      return false;
+    }
+    for (auto var : pattern.repeated_vars) {
+      (*binds)[var].items.push_back(std::move(rep[var]));
+      rep[var] = Binding();
+    }
+  }
+
+  for (size_t i = before + 1; i < elems.size(); ++i) {
+    if (!Match(elems[i], items[i - 1 + num_reps], binds)) {
+      return false;
+    }
+  }
+  return !pattern.tail || Match(*pattern.tail, last, binds);
+}
+
+bool Matcher::Match(const Pattern& pattern,
+                    Expr* input,
+                    std::vector<Binding>* binds) {
+  switch (pattern.kind) {
+    case Pattern::Kind::ANY:
+      return true;
+
+    case Pattern::Kind::VAR:
+      (*binds)[pattern.var].expr = input;
+      return true;
+
+    case Pattern::Kind::LITERAL: {
+      auto* sym = input->AsSymbol();
+      return sym && MatchLiteral(sym, static_cast<Symbol*>(pattern.datum));
+    }
+
+    case Pattern::Kind::DATUM:
+      return input->Equal(pattern.datum);
+
+    case Pattern::Kind::LIST: {
+      std::vector<Expr*> items;
+      std::vector<Pair*> links;
+      Expr* cur = input;
+      while (auto* pair = cur->AsPair()) {
+        items.push_back(pair->car());
+        links.push_back(pair);
+        cur = pair->cdr();
+      }
+      return MatchElems(pattern, items, links, cur, binds);
+    }
+
+    case Pattern::Kind::VECTOR: {
+      auto* vec = input->AsVector();
+      return vec && MatchElems(pattern, vec->vals(), {}, Nil(), binds);
+    }
+  }
+  return false;
+}
+
+// Compiles the rules of a syntax-rules form.
+class RuleCompiler {
+ public:
+  RuleCompiler(std::vector<gc::Lock<Symbol>>* literals,
+               std::vector<Expr*>* refs)
+      : literals_(literals), refs_(refs) {}
+
+  Pattern CompilePattern(Expr* expr, size_t depth);
+  Template CompileTemplate(Expr* expr, size_t depth, bool escaped);
+
+  size_t num_vars() const { return vars_.size(); }
+
+ private:
+  struct Var {
+    Symbol* sym;
+    // The number of ellipses following it in the pattern.
+    size_t depth;
+  };
+
+  Pattern CompileElems(Pattern::Kind kind,
+                       const std::vector<Expr*>& items,
+                       Expr* last,
+                       size_t depth);
+  Template CompileTemplateElems(Template::Kind kind,
+                                const std::vector<Expr*>& items,
+                                Expr* last,
+                                size_t depth,
+                                bool escaped);
+  // Adds the pattern variables of |tmpl| to |vars|.
+  void TemplateVars(const Template& tmpl, std::vector<size_t>* vars);
+
+  size_t FindVar(Symbol* sym) const {
+    for (size_t i = 0; i < vars_.size(); ++i) {
+      if (vars_[i].sym == sym) {
+        return i;
+      }
+    }
+    return kNone;
+  }
+
+  std::vector<gc::Lock<Symbol>>* const literals_;
+  std::vector<Expr*>* const refs_;
+  std::vector<Var> vars_;
+};
+
+Pattern RuleCompiler::CompilePattern(Expr* expr, size_t depth) {
+  if (auto* sym = expr->AsSymbol()) {
+    if (IsEllipsis(sym)) {
+      throw RuntimeException("syntax-rules: misplaced ellipsis in pattern",
+                             expr);
+    }
+    auto unaliased = Unalias(sym);
+    for (const auto& literal : *literals_) {
+      if (literal.get() == unaliased.get()) {
+        Pattern pattern(Pattern::Kind::LITERAL);
+        pattern.datum = literal.get();
+        return pattern;
+      }
+    }
+    if (HasName(sym, "_")) {
+      return Pattern(Pattern::Kind::ANY);
+    }
+    if (FindVar(sym) != kNone) {
+      throw RuntimeException("syntax-rules: duplicate pattern variable", sym);
+    }
+    Pattern pattern(Pattern::Kind::VAR);
+    pattern.var = vars_.size();
+    vars_.push_back({sym, depth});
+    refs_->push_back(sym);
+    return pattern;
+  }
+
+  if (expr->AsPair()) {
+    std::vector<Expr*> items;
+    Expr* cur = expr;
+    for (; auto* pair = cur->AsPair(); cur = pair->cdr()) {
+      items.push_back(pair->car());
+    }
+    return CompileElems(Pattern::Kind::LIST, items, cur, depth);
+  }
+  if (expr == Nil()) {
+    return CompileElems(Pattern::Kind::LIST, {}, Nil(), depth);
+  }
+  if (auto* vec = expr->AsVector()) {
+    return CompileElems(Pattern::Kind::VECTOR, vec->vals(), Nil(), depth);
+  }
+
+  Pattern pattern(Pattern::Kind::DATUM);
+  pattern.datum = expr;
+  refs_->push_back(expr);
+  return pattern;
+}
+
+Pattern RuleCompiler::CompileElems(Pattern::Kind kind,
+                                   const std::vector<Expr*>& items,
+                                   Expr* last,
+                                   size_t depth) {
+  Pattern pattern(kind);
+  for (size_t i = 0; i < items.size(); ++i) {
+    bool repeated = i + 1 < items.size() && IsEllipsis(items[i + 1]);
+    if (!repeated) {
+      pattern.elems.push_back(CompilePattern(items[i], depth));
+      continue;
+    }
+    if (pattern.ellipsis != kNone) {
+      throw RuntimeException("syntax-rules: more than one ellipsis in pattern",
+                             items[i + 1]);
+    }
+    pattern.ellipsis = pattern.elems.size();
+    auto first_var = vars_.size();
+    pattern.elems.push_back(CompilePattern(items[i], depth + 1));
+    for (auto var = first_var; var < vars_.size(); ++var) {
+      pattern.repeated_vars.push_back(var);
+    }
+    ++i;
+  }
+  if (last != Nil()) {
+    pattern.tail.reset(new Pattern(CompilePattern(last, depth)));
+  }
+  return pattern;
+}
+
+Template RuleCompiler::CompileTemplate(Expr* expr, size_t depth, bool escaped) {
+  if (auto* sym = expr->AsSymbol()) {
+    auto var = FindVar(sym);
+    if (var == kNone) {
+      if (!escaped && IsEllipsis(sym)) {
+        throw RuntimeException("syntax-rules: misplaced ellipsis in template",
+                               expr);
+      }
+      Template tmpl(Template::Kind::SYMBOL);
+      tmpl.datum = sym;
+      refs_->push_back(sym);
+      return tmpl;
+    }
+    if (vars_[var].depth > depth) {
+      throw RuntimeException(
+          "syntax-rules: pattern variable used without ellipsis", sym);
+    }
+    Template tmpl(Template::Kind::VAR);
+    tmpl.var = var;
+    return tmpl;
+  }
+
+  if (auto* pair = expr->AsPair()) {
+    // (... template) inserts template with ellipses taken literally.
+    if (!escaped && IsEllipsis(pair->car())) {
+      auto* rest = pair->cdr()->AsPair();
+      if (!rest || rest->cdr() != Nil()) {
+        throw RuntimeException("syntax-rules: malformed (... template)", expr);
+      }
+      return CompileTemplate(rest->car(), depth, true);
+    }
+    std::vector<Expr*> items;
+    Expr* cur = expr;
+    for (; auto* link = cur->AsPair(); cur = link->cdr()) {
+      items.push_back(link->car());
+    }
+    return CompileTemplateElems(Template::Kind::LIST, items, cur, depth,
+                                escaped);
+  }
+  if (auto* vec = expr->AsVector()) {
+    return CompileTemplateElems(Template::Kind::VECTOR, vec->vals(), Nil(),
+                                depth, escaped);
+  }
+
+  Template tmpl(Template::Kind::DATUM);
+  tmpl.datum = expr;
+  refs_->push_back(expr);
+  return tmpl;
+}
+
+Template RuleCompiler::CompileTemplateElems(Template::Kind kind,
+                                            const std::vector<Expr*>& items,
+                                            Expr* last,
+                                            size_t depth,
+                                            bool escaped) {
+  Template tmpl(kind);
+  for (size_t i = 0; i < items.size(); ++i) {
+    size_t num_ellipses = 0;
+    while (!escaped && i + num_ellipses + 1 < items.size() &&
+           IsEllipsis(items[i + num_ellipses + 1])) {
+      ++num_ellipses;
+    }
+    tmpl.elems.push_back(
+        CompileTemplate(items[i], depth + num_ellipses, escaped));
+    auto& elem = tmpl.elems.back();
+
+    std::vector<size_t> elem_vars;
+    TemplateVars(elem, &elem_vars);
+    for (size_t level = 0; level < num_ellipses; ++level) {
+      std::vector<size_t> loop;
+      for (auto var : elem_vars) {
+        if (vars_[var].depth > depth + level &&
+            std::find(loop.begin(), loop.end(), var) == loop.end()) {
+          loop.push_back(var);
+        }
+      }
+      if (loop.empty()) {
+        throw RuntimeException(
+            "syntax-rules: no pattern variable to repeat before ellipsis",
+            items[i]);
+      }
+      elem.loops.push_back(std::move(loop));
+    }
+    i += num_ellipses;
+  }
+  if (last != Nil()) {
+    tmpl.tail.reset(new Template(CompileTemplate(last, depth, escaped)));
+  }
+  return tmpl;
+}
+
+void RuleCompiler::TemplateVars(const Template& tmpl,
+                                std::vector<size_t>* vars) {
+  if (tmpl.kind == Template::Kind::VAR) {
+    vars->push_back(tmpl.var);
+  }
+  for (const auto& elem : tmpl.elems) {
+    TemplateVars(elem, vars);
+  }
+  if (tmpl.tail) {
+    TemplateVars(*tmpl.tail, vars);
+  }
+}
+
+// Instantiates the template of a matched rule.
+class Expander {
+ public:
+  explicit Expander(const std::vector<Binding>& binds) {
+    for (const auto& bind : binds) {
+      binds_.push_back(&bind);
+    }
+  }
+
+  gc::Lock<Expr> Expand(const Template& tmpl);
+
+  // The aliases made, each paired with the symbol it renames.
+  std::vector<std::pair<Symbol*, Symbol*>> aliases() const {
+    std::vector<std::pair<Symbol*, Symbol*>> result;
+    for (const auto& rename : renames_) {
+      result.emplace_back(rename.second.get(), rename.first);
+    }
+    return result;
+  }
+
+ private:
+  // Appends the instances of |elem| repeated by its loops from |level| on.
+  void ExpandElem(const Template& elem,
+                  size_t level,
+                  std::vector<gc::Lock<Expr>>* out);
+
+  Symbol* Rename(Symbol* sym);
+
+  // The current binding of each pattern variable. Inside an ellipsis, a
+  // variable it iterates over is bound to an item.
+  std::vector<const Binding*> binds_;
+  // Each symbol the template inserted has one alias per expansion.
+  std::vector<std::pair<Symbol*, gc::Lock<Symbol>>> renames_;
+};
+
+gc::Lock<Expr> Expander::Expand(const Template& tmpl) {
+  switch (tmpl.kind) {
+    case Template::Kind::SYMBOL:
+      return gc::Lock<Expr>(Rename(tmpl.datum->AsSymbol()));
+
+    case Template::Kind::VAR:
+      return gc::Lock<Expr>(binds_[tmpl.var]->expr);
+
+    case Template::Kind::DATUM:
+      return gc::Lock<Expr>(tmpl.datum);
+
+    case Template::Kind::LIST:
+    case Template::Kind::VECTOR: {
+      std::vector<gc::Lock<Expr>> elems;
+      for (const auto& elem : tmpl.elems) {
+        ExpandElem(elem, 0, &elems);
+      }
+      if (tmpl.kind == Template::Kind::VECTOR) {
+        std::vector<Expr*> vals;
+        for (const auto& elem : elems) {
+          vals.push_back(elem.get());
+        }
+        return gc::Lock<Expr>(new expr::Vector(std::move(vals)));
+      }
+      gc::Lock<Expr> result(tmpl.tail ? Expand(*tmpl.tail)
+                                      : gc::Lock<Expr>(Nil()));
+      for (auto it = elems.rbegin(); it != elems.rend(); ++it) {
+        result.reset(new Pair(it->get(), result.get()));
+      }
+      return result;
+    }
+  }
+  return gc::Lock<Expr>(Nil());
+}
+
+void Expander::ExpandElem(const Template& elem,
+                          size_t level,
+                          std::vector<gc::Lock<Expr>>* out) {
+  if (level == elem.loops.size()) {
+    out->push_back(Expand(elem));
+    return;
+  }
+
+  const auto& loop = elem.loops[level];
+  auto num_reps = binds_[loop[0]]->items.size();
+  for (auto var : loop) {
+    if (binds_[var]->items.size() != num_reps) {
+      throw RuntimeException(
+          "syntax-rules: pattern variables repeat different numbers of times",
+          nullptr);
+    }
+  }
+
+  std::vector<const Binding*> saved;
+  for (auto var : loop) {
+    saved.push_back(binds_[var]);
+  }
+  for (size_t i = 0; i < num_reps; ++i) {
+    for (size_t j = 0; j < loop.size(); ++j) {
+      binds_[loop[j]] = &saved[j]->items[i];
+    }
+    ExpandElem(elem, level + 1, out);
+  }
+  for (size_t j = 0; j < loop.size(); ++j) {
+    binds_[loop[j]] = saved[j];
+  }
+}
+
+Symbol* Expander::Rename(Symbol* sym) {
+  for (const auto& rename : renames_) {
+    if (rename.first == sym) {
+      return rename.second.get();
+    }
+  }
+  auto alias =
+      Symbol::NewLock(sym->val() + '#' + std::to_string(++alias_count));
+  renames_.emplace_back(sym, alias);
+  return alias.get();
+}
+
+// The number of levels of nested lists and vectors |pattern| looks into.
+size_t PatternDepth(const Pattern& pattern) {
+  size_t depth = 0;
+  for (const auto& elem : pattern.elems) {
+    depth = std::max(depth, PatternDepth(elem) + 1);
+  }
+  switch (pattern.kind) {
+    case Pattern::Kind::LIST:
+      // The tail is matched against the rest of the same list.
+      depth = std::max<size_t>(depth, 1);
+      return pattern.tail ? std::max(depth, PatternDepth(*pattern.tail))
+                          : depth;
+    case Pattern::Kind::VECTOR:
+      return std::max<size_t>(depth, 1);
+    default:
+      return 0;
+  }
+}
+
+// Returns a copy of the pairs and vectors of |form| up to |depth| levels
+// down, sharing everything else, so a cached expansion can check its form
+// hasn't been mutated since. Deeper structure isn't looked into by matching,
+// and expansions share it with the form.
+gc::Lock<Expr> CopyStructure(Expr* form, size_t depth) {
+  if (depth == 0) {
+    return gc::Lock<Expr>(form);
+  }
+
+  if (auto* pair = form->AsPair()) {
+    std::vector<gc::Lock<Expr>> items;
+    Expr* cur = pair;
+    for (; auto* link = cur->AsPair(); cur = link->cdr()) {
+      items.push_back(CopyStructure(link->car(), depth - 1));
+    }
+    auto result = CopyStructure(cur, depth);
+    for (auto it = items.rbegin(); it != items.rend(); ++it) {
+      result.reset(new Pair(it->get(), result.get()));
+    }
+    return result;
+  }
+
+  if (auto* vec = form->AsVector()) {
+    std::vector<gc::Lock<Expr>> items;
+    std::vector<Expr*> vals;
+    for (auto* val : vec->vals()) {
+      items.push_back(CopyStructure(val, depth - 1));
+      vals.push_back(items.back().get());
+    }
+    return gc::Lock<Expr>(new expr::Vector(std::move(vals)));
+  }
+
+  return gc::Lock<Expr>(form);
+}
+
+// Returns whether |form| matches |copy|, made by CopyStructure() with
+// |depth|.
+bool SameStructure(Expr* form, Expr* copy, size_t depth) {
+  if (depth == 0) {
+    return form == copy;
+  }
+
+  for (; auto* link = form->AsPair(); form = link->cdr()) {
+    auto* copy_link = copy->AsPair();
+    if (!copy_link ||
+        !SameStructure(link->car(), copy_link->car(), depth - 1)) {
+      return false;
+    }
+    copy = copy_link->cdr();
+  }
+
+  if (auto* vec = form->AsVector()) {
+    auto* copy_vec = copy->AsVector();
+    if (!copy_vec || copy_vec->vals().size() != vec->vals().size()) {
+      return false;
+    }
+    for (size_t i = 0; i < vec->vals().size(); ++i) {
+      if (!SameStructure(vec->vals()[i], copy_vec->vals()[i], depth - 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  return form == copy;
+}
+
+// Returns whether the identifiers of |checks| still match the literals they
+// were checked against, as they did.
+bool SameLiterals(const std::vector<Macro::LiteralCheck>& checks,
+                  const Macro::SameBinding& same_binding) {
+  if (!same_binding) {
+    return true;
+  }
+  for (const auto& check : checks) {
+    if (same_binding(check.input, check.literal) != check.matched) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool IsAlias(const Symbol* sym) {
+  return AliasSuffix(sym->val()) != std::string::npos;
+}
+
+gc::Lock<Symbol> Unalias(Symbol* sym) {
+  if (!IsAlias(sym)) {
+    return gc::Lock<Symbol>(sym);
+  }
+  return Symbol::NewLock(BaseName(sym));
+}
+
+gc::Lock<Expr> UnaliasDatum(Expr* datum) {
+  if (auto* sym = datum->AsSymbol()) {
+    auto unaliased = Unalias(sym);
+    return gc::Lock<Expr>(unaliased.get());
+  }
+
+  if (auto* pair = datum->AsPair()) {
+    std::vector<gc::Lock<Expr>> items;
+    Expr* cur = pair;
+    bool changed = false;
+    for (; auto* link = cur->AsPair(); cur = link->cdr()) {
+      items.push_back(UnaliasDatum(link->car()));
+      changed |= items.back().get() != link->car();
+    }
+    auto result = UnaliasDatum(cur);
+    changed |= result.get() != cur;
+    if (!changed) {
+      return gc::Lock<Expr>(datum);
+    }
+    for (auto it = items.rbegin(); it != items.rend(); ++it) {
+      result.reset(new Pair(it->get(), result.get()));
+    }
+    return result;
+  }
+
+  if (auto* vec = datum->AsVector()) {
+    std::vector<gc::Lock<Expr>> items;
+    bool changed = false;
+    for (auto* val : vec->vals()) {
+      items.push_back(UnaliasDatum(val));
+      changed |= items.back().get() != val;
+    }
+    if (!changed) {
+      return gc::Lock<Expr>(datum);
+    }
+    std::vector<Expr*> vals;
+    for (const auto& item : items) {
+      vals.push_back(item.get());
+    }
+    return gc::Lock<Expr>(new expr::Vector(std::move(vals)));
+  }
+
+  return gc::Lock<Expr>(datum);
+}
+
+struct Macro::Rule {
+  Pattern pattern;
+  Template tmpl;
+  size_t num_vars;
+};
+
+gc::Lock<Macro> Macro::New(Expr** args, size_t num_args) {
+  if (num_args < 1) {
+    throw RuntimeException("syntax-rules: Expected (literal...)", nullptr);
+  }
+  std::vector<Expr*> refs;
+  std::vector<gc::Lock<Symbol>> literals;
+  Expr* cur = args[0];
+  for (; auto* pair = cur->AsPair(); cur = pair->cdr()) {
+    auto* sym = pair->car()->AsSymbol();
+    if (!sym) {
+      throw RuntimeException("syntax-rules: Expected symbol for literal",
+                             pair->car());
+    }
+    literals.push_back(Unalias(sym));
+    refs.push_back(literals.back().get());
+  }
+  if (cur != Nil()) {
+    throw RuntimeException("syntax-rules: Malformed literal list", cur);
+  }
+
+  std::vector<Rule> rules;
+  for (size_t i = 1; i < num_args; ++i) {
+    auto* rule = args[i]->AsPair();
+    auto* pattern = rule ? rule->car()->AsPair() : nullptr;
+    auto* rest = rule ? rule->cdr()->AsPair() : nullptr;
+    if (!pattern || !rest || rest->cdr() != Nil()) {
+      throw RuntimeException("syntax-rules: Expected (pattern template)",
+                             args[i]);
+    }
+
+    // The keyword at the start of the pattern isn't matched.
+    RuleCompiler compiler(&literals, &refs);
+    auto compiled = compiler.CompilePattern(pattern->cdr(), 0);
+    auto tmpl = compiler.CompileTemplate(rest->car(), 0, false);
+    rules.push_back(
+        {std::move(compiled), std::move(tmpl), compiler.num_vars()});
+  }
+
+  return gc::Lock<Macro>(new Macro(std::move(rules), std::move(refs)));
+}
+
+Macro::Macro(std::vector<Rule> rules, std::vector<Expr*> refs)
+    : Syntax(Kind::MACRO), rules_(std::move(rules)), refs_(std::move(refs)) {
+  // A use of the macro is a list, even if no rule looks into it.
+  for (const auto& rule : rules_) {
+    depth_ = std::max(depth_, PatternDepth(rule.pattern));
+  }
+}
+
+Macro::~Macro() = default;
+
+const Macro::Expansion& Macro::Expand(Pair* form,
+                                      const SameBinding& same_binding) {
+  auto it = cache_.find(form);
+  if (it != cache_.end() && SameStructure(form, it->second.form, depth_) &&
+      SameLiterals(it->second.literals, same_binding)) {
+    return it->second.expansion;
+  }
+
+  Matcher matcher(same_binding);
+  for (const auto& rule : rules_) {
+    std::vector<Binding> binds(rule.num_vars);
+    if (!matcher.Match(rule.pattern, form->cdr(), &binds)) {
+      continue;
+    }
+    Expander expander(binds);
+    auto expr = expander.Expand(rule.tmpl);
+    if (cache_.size() >= kMaxCached) {
+      cache_.clear();
+    }
+    auto copy = CopyStructure(form, depth_);
+    auto& entry = cache_[form];
+    entry.form = copy.get();
+    entry.literals = std::move(matcher.checks());
+    entry.expansion.expr = expr.get();
+    entry.expansion.aliases = expander.aliases();
+    return entry.expansion;
+  }
+
+  std::ostringstream os;
+  os << *form->car() << ": bad syntax (no rule matches)";
+  throw RuntimeException(os.str(), form);
+}
+
+std::ostream& Macro::AppendStream(std::ostream& stream) const {
+  return stream << "#<macro>";
+}
+
+void Macro::MarkReferences() {
+  for (auto* ref : refs_) {
+    ref->GcMark();
+  }
+  for (auto& entry : cache_) {
+    entry.second.form->GcMark();
+    entry.second.expansion.expr->GcMark();
+  }
+}
+
+}  // namespace eval
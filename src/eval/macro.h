@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVAL_MACRO_H_
+#define EVAL_MACRO_H_
+
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "expr/expr.h"
+#include "gc/lock.h"
+
+namespace eval {
+
+// Symbols a template inserts are renamed to aliases, "name#N", which the
+// reader can't make. An alias which the expansion doesn't bind refers to what
+// its name meant where the macro was defined.
+bool IsAlias(const expr::Symbol* sym);
+
+// Returns the symbol |sym| renames, through any number of expansions.
+gc::Lock<expr::Symbol> Unalias(expr::Symbol* sym);
+
+// Returns |datum| with aliases replaced by the symbols they rename, copying
+// only the pairs and vectors which contain them. Quoted data doesn't show
+// renaming.
+gc::Lock<expr::Expr> UnaliasDatum(expr::Expr* datum);
+
+// A keyword defined by syntax-rules. Patterns and templates are compiled once,
+// when the syntax-rules form is analyzed, and expansion happens during
+// analysis, never at run time.
+class Macro : public expr::Syntax {
+ public:
+  // |args| are the arguments of (syntax-rules (literal...) rule...).
+  static gc::Lock<Macro> New(expr::Expr** args, size_t num_args);
+
+  // The result of expanding a form, and the aliases it introduced paired
+  // with the symbols they rename.
+  struct Expansion {
+    expr::Expr* expr;
+    std::vector<std::pair<expr::Symbol*, expr::Symbol*>> aliases;
+  };
+
+  // Returns whether |input|, an identifier in a use of the macro, has the
+  // same binding where it's used as |literal| has where the macro was
+  // defined.
+  using SameBinding =
+      std::function<bool(expr::Symbol* input, expr::Symbol* literal)>;
+
+  // An identifier of a use checked against a literal of the same name.
+  struct LiteralCheck {
+    expr::Symbol* input;
+    expr::Symbol* literal;
+    bool matched;
+  };
+
+  // Returns the expansion of |form|, a use of the macro. An identifier
+  // matches a literal with the same name if |same_binding|, when given,
+  // holds. Expansions are cached by form, so a form analyzed again, e.g. a
+  // procedure body read once and evaluated many times, isn't expanded again
+  // unless it has been mutated or its literals match differently since. The
+  // result is valid until the next call.
+  const Expansion& Expand(expr::Pair* form,
+                          const SameBinding& same_binding = nullptr);
+
+  // Expr implementation:
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+ private:
+  struct Rule;
+
+  explicit Macro(std::vector<Rule> rules, std::vector<expr::Expr*> refs);
+  ~Macro() override;
+
+  std::vector<Rule> rules_;
+  // Symbols and data the compiled rules refer to.
+  std::vector<expr::Expr*> refs_;
+  // How many levels of a use's lists and vectors the rules look into.
+  size_t depth_ = 1;
+  // A cached expansion, a copy of the structure of its form and the literals
+  // it was matched with. The copy is kept rather than the form, which may be
+  // garbage once analyzed.
+  struct CacheEntry {
+    expr::Expr* form;
+    std::vector<LiteralCheck> literals;
+    Expansion expansion;
+  };
+  std::unordered_map<expr::Pair*, CacheEntry> cache_;
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(Macro);
+};
+
+}  // namespace eval
+
+#endif  // EVAL_MACRO_H_
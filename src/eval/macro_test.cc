@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+
+#include "eval/macro.h"
+#include "parse/parse.h"
+#include "test/util.h"
+
+using expr::Expr;
+using expr::Symbol;
+
+namespace eval {
+
+class MacroTest : public test::TestBase {
+ protected:
+  // Makes the macro of the syntax-rules form |str|.
+  gc::Lock<Macro> MacroFromStr(const std::string& str) {
+    spec_ = parse::Read(str)[0];
+    auto args = expr::ExprVecFromList(spec_->AsPair()->cdr());
+    return Macro::New(args.data(), args.size());
+  }
+
+  gc::Lock<Expr> spec_;
+};
+
+TEST_F(MacroTest, Expand) {
+  auto macro = MacroFromStr(
+      "(syntax-rules () ((_ a b) (let ((tmp a)) (set! a b) (set! b tmp))))");
+  auto form = parse::Read("(swap! x y)")[0];
+  const auto& expansion = macro->Expand(form->AsPair());
+
+  // tmp, let and set! are renamed. Each is renamed once per expansion.
+  ASSERT_EQ(3u, expansion.aliases.size());
+  for (const auto& alias : expansion.aliases) {
+    EXPECT_TRUE(IsAlias(alias.first));
+    EXPECT_FALSE(IsAlias(alias.second));
+    EXPECT_EQ(alias.second, Unalias(alias.first).get());
+  }
+  auto* tmp = expansion.expr->AsPair()->Cr("aaad");
+  ASSERT_TRUE(tmp && tmp->AsSymbol());
+  EXPECT_NE(Symbol::New("tmp"), tmp);
+  EXPECT_EQ(*parse::Read("(let ((tmp x)) (set! x y) (set! y tmp))")[0],
+            *UnaliasDatum(expansion.expr));
+
+  EXPECT_THROW(macro->Expand(parse::Read("(swap! x)")[0]->AsPair()),
+               util::RuntimeException);
+}
+
+TEST_F(MacroTest, Cache) {
+  auto macro = MacroFromStr("(syntax-rules () ((_ a ...) (list a ...)))");
+  auto form = parse::Read("(m 1 2 3)")[0];
+  auto* first = macro->Expand(form->AsPair()).expr;
+
+  // The same form expands to the same expansion, equal forms don't.
+  EXPECT_EQ(first, macro->Expand(form->AsPair()).expr);
+  auto copy = parse::Read("(m 1 2 3)")[0];
+  auto* second = macro->Expand(copy->AsPair()).expr;
+  EXPECT_NE(first, second);
+  EXPECT_EQ(*UnaliasDatum(first), *UnaliasDatum(second));
+
+  // Expansions aren't collected while the macro is alive.
+  gc::Gc::Get().Collect();
+  EXPECT_EQ(*parse::Read("(list 1 2 3)")[0], *UnaliasDatum(first));
+
+  // A form mutated since it was expanded is expanded again, including in
+  // nested lists and vectors the rules look into.
+  form->AsPair()->cdr()->AsPair()->set_car(parse::Read("4")[0].get());
+  auto* mutated = macro->Expand(form->AsPair()).expr;
+  EXPECT_NE(first, mutated);
+  EXPECT_EQ(*parse::Read("(list 4 2 3)")[0], *UnaliasDatum(mutated));
+
+  auto deep = MacroFromStr(
+      "(syntax-rules () ((_ #((a b))) (list a b)) ((_ x) (list x)))");
+  auto nested = parse::Read("(m #((1)))")[0];
+  auto* vec = nested->AsPair()->cdr()->AsPair()->car()->AsVector();
+  EXPECT_EQ(*parse::Read("(list #((1)))")[0],
+            *UnaliasDatum(deep->Expand(nested->AsPair()).expr));
+  vec->vals()[0]->AsPair()->set_cdr(parse::Read("(2)")[0].get());
+  EXPECT_EQ(*parse::Read("(list 1 2)")[0],
+            *UnaliasDatum(deep->Expand(nested->AsPair()).expr));
+}
+
+}  // namespace eval
@@ -0,0 +1,932 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "eval/node.h"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "eval/call_stack.h"
+#include "eval/eval.h"
+#include "eval/jit.h"
+#include "eval/limits.h"
+#include "eval/value_stack.h"
+#include "util/exceptions.h"
+
+using expr::Env;
+using expr::Expr;
+using expr::Nil;
+using util::RuntimeException;
+
+namespace eval {
+
+namespace {
+
+std::ostream& AppendNodes(std::ostream& stream,
+                          const std::vector<Node*>& nodes) {
+  for (const auto* node : nodes) {
+    stream << " " << *node;
+  }
+  return stream;
+}
+
+// Calls |proc| with |args|, or if |tail|, makes it the pending tail call.
+gc::Lock<Expr> Call(bool tail,
+                    Env* env,
+                    Expr* proc,
+                    Expr** args,
+                    size_t num_args) {
+  auto* evals = expr::TryEvals(proc);
+  if (!tail) {
+    return evals->DoEval(env, args, num_args);
+  }
+
+  return gc::Lock<Expr>(MakeTailCall(proc, args, num_args));
+}
+
+// Returns a new frame of |num_slots| slots. If it |escapes|, it is allocated
+// on the heap and held by the value stack slot |heap_frame|, otherwise it is
+// pushed onto |frames|. Neither holds a lock, so continuations may copy them.
+Env* NewFrame(Env* enclosing,
+              size_t num_slots,
+              bool escapes,
+              StackFrames* frames,
+              Expr** heap_frame) {
+  if (!escapes) {
+    return frames->Push(enclosing, num_slots);
+  }
+  auto frame = Env::NewFrame(enclosing, num_slots);
+  *heap_frame = frame.get();
+  return frame.get();
+}
+
+// Appends the formals of a lambda or receive.
+std::ostream& AppendFormals(std::ostream& stream,
+                            const std::vector<expr::Symbol*>& required,
+                            expr::Symbol* variable) {
+  if (required.empty() && variable != nullptr) {
+    return stream << *variable;
+  }
+  stream << "(";
+  const char* sep = "";
+  for (auto* var : required) {
+    stream << sep << *var;
+    sep = " ";
+  }
+  if (variable) {
+    stream << " . " << *variable;
+  }
+  return stream << ")";
+}
+
+// Stands for the values in MultipleValues. It is only seen by user code if
+// values is called where one value is expected.
+class ValuesMarker : public expr::Evals {
+ public:
+  // Evals implementation:
+  gc::Lock<Expr> DoEval(Env* /* env */,
+                        Expr** /* args */,
+                        size_t /* num_args */) override {
+    throw RuntimeException("Attempt to apply multiple values", this);
+  }
+  std::ostream& AppendStream(std::ostream& stream) const override {
+    return stream << "#<values>";
+  }
+};
+
+}  // namespace
+
+Expr* TailCallMarker() {
+  static Constant marker(Nil());
+  return &marker;
+}
+
+Expr* RecurMarker() {
+  static Constant marker(Nil());
+  return &marker;
+}
+
+Expr* MultipleValuesMarker() {
+  static ValuesMarker marker;
+  return &marker;
+}
+
+void ThrowArgCountError(size_t num_required, bool has_rest, size_t num_args) {
+  std::ostringstream os;
+  os << "Invalid number of arguments. expected ";
+  if (has_rest) {
+    os << "at least ";
+  }
+  os << num_required << " given: " << num_args;
+  throw RuntimeException(os.str(), nullptr);
+}
+
+void BindValues(Expr* val, size_t num_required, bool has_rest, Env* frame) {
+  auto& values = MultipleValues::Get();
+  Expr** vals = &val;
+  size_t num_vals = 1;
+  if (val == MultipleValuesMarker()) {
+    vals = values.vals();
+    num_vals = values.num_vals();
+  }
+  if (num_vals < num_required || (num_vals > num_required && !has_rest)) {
+    std::ostringstream os;
+    os << "Invalid number of values. expected ";
+    if (has_rest) {
+      os << "at least ";
+    }
+    os << num_required << " given: " << num_vals;
+    values.Clear();
+    throw RuntimeException(os.str(), nullptr);
+  }
+
+  for (size_t i = 0; i < num_required; ++i) {
+    frame->slot(i) = vals[i];
+  }
+  if (has_rest) {
+    gc::Lock<Expr> rest(Nil());
+    for (size_t i = num_vals; i > num_required; --i) {
+      rest.reset(new expr::Pair(vals[i - 1], rest.get()));
+    }
+    frame->slot(num_required) = rest.get();
+  }
+  values.Clear();
+}
+
+gc::Lock<Env> NewClosureFrame(Env* top, Expr** captures, size_t num_captures) {
+  auto frame = Env::NewFrame(top, num_captures);
+  for (size_t i = 0; i < num_captures; ++i) {
+    frame->slot(i) = captures[i];
+  }
+  return frame;
+}
+
+Expr* MakeTailCall(Expr* proc, Expr** args, size_t num_args) {
+  TailCall::Get().Set(proc, args, num_args);
+  return TailCallMarker();
+}
+
+std::ostream& Constant::AppendStream(std::ostream& stream) const {
+  switch (val_->type()) {
+    case Expr::Type::EMPTY_LIST:
+    case Expr::Type::SYMBOL:
+    case Expr::Type::PAIR:
+      return stream << "(quote " << *val_ << ")";
+    default:
+      return stream << *val_;
+  }
+}
+
+gc::Lock<Expr> Apply::Exec(Env* env) {
+  // The procedure followed by its arguments.
+  StackSlots slots(args_.size() + 1);
+  slots[0] = op_->Exec(env).get();
+  expr::TryEvals(slots[0]);
+  for (size_t i = 0; i < args_.size(); ++i) {
+    slots[i + 1] = args_[i]->Exec(env).get();
+  }
+
+  return Call(tail_, env, slots[0], slots.get() + 1, args_.size());
+}
+
+std::ostream& Apply::AppendStream(std::ostream& stream) const {
+  stream << "(" << *op_;
+  return AppendNodes(stream, args_) << ")";
+}
+
+void Apply::MarkReferences() {
+  op_->GcMark();
+  for (auto* arg : args_) {
+    arg->GcMark();
+  }
+}
+
+gc::Lock<Expr> PrimApply::Exec(Env* env) {
+  StackSlots slots(args().size() + 1);
+  slots[0] = op()->Exec(env).get();
+  if (slots[0] != expected_) {
+    expr::TryEvals(slots[0]);
+  }
+  for (size_t i = 0; i < args().size(); ++i) {
+    slots[i + 1] = args()[i]->Exec(env).get();
+  }
+  if (auto* val = TryOpenCode(slots[0], slots.get() + 1)) {
+    return gc::Lock<Expr>(val);
+  }
+
+  return Call(tail(), env, slots[0], slots.get() + 1, args().size());
+}
+
+void PrimApply::MarkReferences() {
+  Apply::MarkReferences();
+  expected_->GcMark();
+}
+
+gc::Lock<Expr> Folded::Exec(Env* env) {
+  for (const auto& guard : guards_) {
+    if (guard.ref->Exec(env).get() != guard.expected) {
+      return original_->Exec(env);
+    }
+  }
+  return folded_->Exec(env);
+}
+
+void Folded::MarkReferences() {
+  original_->GcMark();
+  for (const auto& guard : guards_) {
+    guard.ref->GcMark();
+    guard.expected->GcMark();
+  }
+  folded_->GcMark();
+}
+
+gc::Lock<Expr> If::Exec(Env* env) {
+  if (test_->Exec(env).get() != expr::False()) {
+    return consequent_->Exec(env);
+  }
+  if (alternate_) {
+    return alternate_->Exec(env);
+  }
+  return gc::Lock<Expr>(Nil());
+}
+
+std::ostream& If::AppendStream(std::ostream& stream) const {
+  stream << "(if " << *test_ << " " << *consequent_;
+  if (alternate_) {
+    stream << " " << *alternate_;
+  }
+  return stream << ")";
+}
+
+void If::MarkTail() {
+  consequent_->MarkTail();
+  if (alternate_) {
+    alternate_->MarkTail();
+  }
+}
+
+void If::MarkReferences() {
+  test_->GcMark();
+  consequent_->GcMark();
+  if (alternate_) {
+    alternate_->GcMark();
+  }
+}
+
+gc::Lock<Expr> Sequence::Exec(Env* env) {
+  for (size_t i = 0; i < body_.size() - 1; ++i) {
+    body_[i]->Exec(env);
+  }
+  return body_.back()->Exec(env);
+}
+
+void Sequence::MarkTail() {
+  body_.back()->MarkTail();
+}
+
+std::ostream& Sequence::AppendStream(std::ostream& stream) const {
+  stream << "(begin";
+  return AppendNodes(stream, body_) << ")";
+}
+
+void Sequence::MarkReferences() {
+  for (auto* node : body_) {
+    node->GcMark();
+  }
+}
+
+gc::Lock<Expr> And::Exec(Env* env) {
+  if (tests_.empty()) {
+    return gc::Lock<Expr>(expr::True());
+  }
+  for (size_t i = 0; i + 1 < tests_.size(); ++i) {
+    if (tests_[i]->Exec(env).get() == expr::False()) {
+      return gc::Lock<Expr>(expr::False());
+    }
+  }
+  return tests_.back()->Exec(env);
+}
+
+void And::MarkTail() {
+  if (!tests_.empty()) {
+    tests_.back()->MarkTail();
+  }
+}
+
+std::ostream& And::AppendStream(std::ostream& stream) const {
+  stream << "(and";
+  return AppendNodes(stream, tests_) << ")";
+}
+
+void And::MarkReferences() {
+  for (auto* test : tests_) {
+    test->GcMark();
+  }
+}
+
+gc::Lock<Expr> Or::Exec(Env* env) {
+  for (auto* test : tests_) {
+    auto e = test->Exec(env);
+    if (e.get() != expr::False()) {
+      return e;
+    }
+  }
+  return gc::Lock<Expr>(expr::False());
+}
+
+void Or::MarkTail() {
+  if (!tests_.empty()) {
+    tests_.back()->MarkTail();
+  }
+}
+
+std::ostream& Or::AppendStream(std::ostream& stream) const {
+  stream << "(or";
+  return AppendNodes(stream, tests_) << ")";
+}
+
+void Or::MarkReferences() {
+  for (auto* test : tests_) {
+    test->GcMark();
+  }
+}
+
+gc::Lock<Expr> Cond::Exec(Env* env) {
+  for (const auto& clause : clauses_) {
+    auto test = clause.test->Exec(env);
+    if (test.get() == expr::False()) {
+      continue;
+    }
+    if (!clause.body) {
+      return test;
+    }
+    // Nothing is locked while the body runs, as continuations captured by it
+    // may copy this frame.
+    if (!clause.is_arrow) {
+      test.reset();
+      return clause.body->Exec(env);
+    }
+
+    StackSlots vals(2);
+    vals[0] = test.get();
+    test.reset();
+    vals[1] = clause.body->Exec(env).get();
+    return Call(tail_, env, vals[1], vals.get(), 1);
+  }
+
+  if (else_body_) {
+    return else_body_->Exec(env);
+  }
+  return gc::Lock<Expr>(Nil());
+}
+
+void Cond::MarkTail() {
+  tail_ = true;
+  for (const auto& clause : clauses_) {
+    if (clause.body && !clause.is_arrow) {
+      clause.body->MarkTail();
+    }
+  }
+  if (else_body_) {
+    else_body_->MarkTail();
+  }
+}
+
+std::ostream& Cond::AppendStream(std::ostream& stream) const {
+  stream << "(cond";
+  for (const auto& clause : clauses_) {
+    stream << " (" << *clause.test;
+    if (clause.body) {
+      stream << (clause.is_arrow ? " => " : " ") << *clause.body;
+    }
+    stream << ")";
+  }
+  if (else_body_) {
+    stream << " (else " << *else_body_ << ")";
+  }
+  return stream << ")";
+}
+
+void Cond::MarkReferences() {
+  for (const auto& clause : clauses_) {
+    clause.test->GcMark();
+    if (clause.body) {
+      clause.body->GcMark();
+    }
+  }
+  if (else_body_) {
+    else_body_->GcMark();
+  }
+}
+
+gc::Lock<Expr> Case::Exec(Env* env) {
+  // The key is released before the body runs, so its frame may be copied.
+  auto* body = else_body_;
+  auto key = key_->Exec(env);
+  for (const auto& clause : clauses_) {
+    if (std::any_of(clause.data.begin(), clause.data.end(),
+                    [&key](Expr* datum) { return key->Eqv(datum); })) {
+      body = clause.body;
+      break;
+    }
+  }
+  key.reset();
+
+  if (body) {
+    return body->Exec(env);
+  }
+  return gc::Lock<Expr>(Nil());
+}
+
+void Case::MarkTail() {
+  for (const auto& clause : clauses_) {
+    clause.body->MarkTail();
+  }
+  if (else_body_) {
+    else_body_->MarkTail();
+  }
+}
+
+std::ostream& Case::AppendStream(std::ostream& stream) const {
+  stream << "(case " << *key_;
+  for (const auto& clause : clauses_) {
+    stream << " ((";
+    const char* sep = "";
+    for (const auto* datum : clause.data) {
+      stream << sep << *datum;
+      sep = " ";
+    }
+    stream << ") " << *clause.body << ")";
+  }
+  if (else_body_) {
+    stream << " (else " << *else_body_ << ")";
+  }
+  return stream << ")";
+}
+
+void Case::MarkReferences() {
+  key_->GcMark();
+  for (const auto& clause : clauses_) {
+    for (auto* datum : clause.data) {
+      datum->GcMark();
+    }
+    clause.body->GcMark();
+  }
+  if (else_body_) {
+    else_body_->GcMark();
+  }
+}
+
+gc::Lock<Expr> LocalRef::Exec(Env* env) {
+  auto* val = FrameAt(env, depth_)->slot(index_);
+  if (boxed_) {
+    val = Unbox(val);
+  }
+  if (!val) {
+    throw RuntimeException("Attempt to reference unassigned variable", var_);
+  }
+  return gc::Lock<Expr>(val);
+}
+
+gc::Lock<Expr> LocalSet::Exec(Env* env) {
+  auto val = val_->Exec(env);
+  auto& slot = FrameAt(env, depth_)->slot(index_);
+  (boxed_ ? Unbox(slot) : slot) = val.get();
+  return gc::Lock<Expr>(Nil());
+}
+
+std::ostream& LocalSet::AppendStream(std::ostream& stream) const {
+  return stream << (is_define_ ? "(define " : "(set! ") << *var_ << " "
+                << *val_ << ")";
+}
+
+void LocalSet::MarkReferences() {
+  var_->GcMark();
+  val_->GcMark();
+}
+
+gc::Lock<Expr> GlobalSet::Exec(Env* env) {
+  auto val = val_->Exec(env);
+  auto* top = FrameAt(env, depth_);
+  if (auto** cell = cell_.Get(top, var_)) {
+    *cell = val.get();
+  } else {
+    top->SetVar(var_, val.get());
+  }
+  return gc::Lock<Expr>(Nil());
+}
+
+std::ostream& GlobalSet::AppendStream(std::ostream& stream) const {
+  return stream << "(set! " << *var_ << " " << *val_ << ")";
+}
+
+void GlobalSet::MarkReferences() {
+  var_->GcMark();
+  val_->GcMark();
+  cell_.MarkReferences();
+}
+
+gc::Lock<Expr> Define::Exec(Env* env) {
+  env->DefineVar(var_, val_->Exec(env).get());
+  return gc::Lock<Expr>(Nil());
+}
+
+std::ostream& Define::AppendStream(std::ostream& stream) const {
+  return stream << "(define " << *var_ << " " << *val_ << ")";
+}
+
+void Define::MarkReferences() {
+  var_->GcMark();
+  val_->GcMark();
+}
+
+gc::Lock<Expr> Lambda::Exec(Env* env) {
+  if (!is_flat_) {
+    return gc::Lock<Expr>(new LambdaImpl(this, env));
+  }
+  const auto& captures = flat_.captures;
+  StackSlots vals(captures.size());
+  for (size_t i = 0; i < captures.size(); ++i) {
+    vals[i] = FrameAt(env, captures[i]->depth())->slot(captures[i]->index());
+  }
+  return NewClosure(FrameAt(env, flat_.top_depth), vals.get());
+}
+
+gc::Lock<Expr> Lambda::NewClosure(Env* top, Expr** captures) {
+  assert(is_flat_);
+  auto num_captures = flat_.captures.size();
+  if (num_captures == 0 && lifted_ && lifted_->env()->enclosing() == top) {
+    return gc::Lock<Expr>(lifted_);
+  }
+  auto frame = NewClosureFrame(top, captures, num_captures);
+  auto* proc = new LambdaImpl(this, frame.get());
+  if (num_captures == 0) {
+    lifted_ = proc;
+  }
+  return gc::Lock<Expr>(proc);
+}
+
+std::ostream& Lambda::AppendStream(std::ostream& stream) const {
+  stream << "(lambda ";
+  AppendFormals(stream, required_args_, variable_arg_);
+  return stream << " " << *body_ << ")";
+}
+
+JitCode* Lambda::Jit(Env* frame) {
+  auto threshold = GetJitThreshold();
+  if (threshold == 0 || jit_failed_) {
+    return nullptr;
+  }
+  if (!jit_code_ && ++num_calls_ >= threshold) {
+    auto code = JitCompile(this, frame);
+    jit_code_ = code.get();
+    jit_failed_ = !jit_code_;
+  }
+  return jit_code_;
+}
+
+void Lambda::MarkReferences() {
+  for (auto* arg : required_args_) {
+    arg->GcMark();
+  }
+  if (variable_arg_) {
+    variable_arg_->GcMark();
+  }
+  body_->GcMark();
+  for (auto* capture : flat_.captures) {
+    capture->GcMark();
+  }
+  if (lifted_) {
+    lifted_->GcMark();
+  }
+  if (jit_code_) {
+    jit_code_->GcMark();
+  }
+}
+
+gc::Lock<Expr> Let::Exec(Env* env) {
+  StackFrames frames;
+  StackSlots heap_frame(1);
+  auto* frame = NewFrame(env, num_slots_, escapes_, &frames, heap_frame.get());
+  for (auto index : boxed_) {
+    frame->slot(index) = NewBox(nullptr).get();
+  }
+  // Inits of let are evaluated outside the new scope. let* and letrec differ
+  // only in which bindings the analyzer let each init see.
+  Env* init_env = kind_ == Kind::LET ? env : frame;
+  for (size_t i = 0; i < inits_.size(); ++i) {
+    auto val = inits_[i]->Exec(init_env);
+    auto& slot = frame->slot(i);
+    bool boxed = !boxed_.empty() &&
+                 std::find(boxed_.begin(), boxed_.end(), i) != boxed_.end();
+    (boxed ? Unbox(slot) : slot) = val.get();
+  }
+
+  // A tail call's arguments are already evaluated, so the frame may be popped
+  // before it is made.
+  return body_->Exec(frame);
+}
+
+void Let::MarkTail() {
+  body_->MarkTail();
+}
+
+std::ostream& Let::AppendStream(std::ostream& stream) const {
+  static const char* const kNames[] = {"(let (", "(let* (", "(letrec ("};
+  stream << kNames[static_cast<size_t>(kind_)];
+  const char* sep = "";
+  for (size_t i = 0; i < vars_.size(); ++i) {
+    stream << sep << "(" << *vars_[i] << " " << *inits_[i] << ")";
+    sep = " ";
+  }
+  return stream << ") " << *body_ << ")";
+}
+
+void Let::MarkReferences() {
+  for (auto* var : vars_) {
+    var->GcMark();
+  }
+  for (auto* init : inits_) {
+    init->GcMark();
+  }
+  body_->GcMark();
+}
+
+gc::Lock<Expr> Loop::Exec(Env* env) {
+  StackFrames frames;
+  auto* frame = frames.Push(env, vars_.size());
+  for (size_t i = 0; i < inits_.size(); ++i) {
+    frame->slot(i) = inits_[i]->Exec(env).get();
+  }
+
+  while (true) {
+    Step();
+    for (auto index : boxed_) {
+      frame->slot(index) = NewBox(frame->slot(index)).get();
+    }
+    auto ret = body_->Exec(frame);
+    if (ret.get() != RecurMarker()) {
+      return ret;
+    }
+  }
+}
+
+std::ostream& Loop::AppendStream(std::ostream& stream) const {
+  stream << "(let " << *name_ << " (";
+  const char* sep = "";
+  for (size_t i = 0; i < vars_.size(); ++i) {
+    stream << sep << "(" << *vars_[i] << " " << *inits_[i] << ")";
+    sep = " ";
+  }
+  return stream << ") " << *body_ << ")";
+}
+
+void Loop::MarkReferences() {
+  name_->GcMark();
+  for (auto* var : vars_) {
+    var->GcMark();
+  }
+  for (auto* init : inits_) {
+    init->GcMark();
+  }
+  body_->GcMark();
+}
+
+// The arguments are all evaluated before any variable is set, since they may
+// refer to the variables.
+gc::Lock<Expr> Recur::Exec(Env* env) {
+  StackSlots vals(args_.size());
+  for (size_t i = 0; i < args_.size(); ++i) {
+    vals[i] = args_[i]->Exec(env).get();
+  }
+  auto* frame = FrameAt(env, depth_);
+  for (size_t i = 0; i < args_.size(); ++i) {
+    frame->slot(i) = vals[i];
+  }
+  return gc::Lock<Expr>(RecurMarker());
+}
+
+std::ostream& Recur::AppendStream(std::ostream& stream) const {
+  stream << "(" << *name_;
+  return AppendNodes(stream, args_) << ")";
+}
+
+void Recur::MarkReferences() {
+  name_->GcMark();
+  for (auto* arg : args_) {
+    arg->GcMark();
+  }
+}
+
+gc::Lock<Expr> Receive::Exec(Env* env) {
+  auto val = producer_->Exec(env);
+  StackFrames frames;
+  StackSlots heap_frame(1);
+  auto* frame = NewFrame(env, num_slots_, escapes_, &frames, heap_frame.get());
+  BindValues(val.get(), required_vars_.size(), variable_var_ != nullptr,
+             frame);
+  val.reset();
+  for (auto index : boxed_) {
+    frame->slot(index) = NewBox(frame->slot(index)).get();
+  }
+  return body_->Exec(frame);
+}
+
+std::ostream& Receive::AppendStream(std::ostream& stream) const {
+  stream << "(receive ";
+  AppendFormals(stream, required_vars_, variable_var_);
+  return stream << " " << *producer_ << " " << *body_ << ")";
+}
+
+void Receive::MarkReferences() {
+  for (auto* var : required_vars_) {
+    var->GcMark();
+  }
+  if (variable_var_) {
+    variable_var_->GcMark();
+  }
+  producer_->GcMark();
+  body_->GcMark();
+}
+
+gc::Lock<Expr> Delay::Exec(Env* env) {
+  auto thunk = thunk_->Exec(env);
+  return gc::Lock<Expr>(new Promise(thunk.get(), is_lazy_));
+}
+
+std::ostream& Delay::AppendStream(std::ostream& stream) const {
+  return stream << (is_lazy_ ? "(delay-force " : "(delay ")
+                << *thunk_->body() << ")";
+}
+
+gc::Lock<Expr> LambdaImpl::DoEval(Env* env, Expr** args, size_t num_args) {
+  if (StackIsLow()) {
+    return CallOnNewSegment(this, env, args, num_args);
+  }
+  auto& call = TailCall::Get();
+  // Holds the procedure being run once tail calls replace this one.
+  StackSlots proc(1);
+  StackSlots heap_frame(1);
+  // Frames of calls which don't escape. Each is popped when the next tail call
+  // is made.
+  StackFrames frames;
+  auto* lambda = this;
+  while (true) {
+    Step();
+    frames.Clear();
+    auto* frame = lambda->BindArgs(args, num_args, &frames, heap_frame.get());
+    // The arguments are in the frame now, so the call can be reused.
+    call.Clear();
+    gc::Lock<Expr> ret;
+    if (auto* jit_code = lambda->lambda_->Jit(frame)) {
+      // Jitted code boxes slots itself, as the bytecode does.
+      ret = jit_code->DoEval(frame, nullptr, 0);
+    } else {
+      for (auto index : lambda->lambda_->flat().boxed) {
+        frame->slot(index) = NewBox(frame->slot(index)).get();
+      }
+      ret = lambda->lambda_->body()->Exec(frame);
+    }
+    if (ret.get() != TailCallMarker()) {
+      return ret;
+    }
+
+    proc[0] = call.proc();
+    args = call.args();
+    num_args = call.num_args();
+    lambda = dynamic_cast<LambdaImpl*>(proc[0]);
+    if (!lambda) {
+      // Other procedures may make tail calls of their own while reading
+      // their arguments, so move them to the value stack.
+      StackSlots proc_args(num_args);
+      std::copy(args, args + num_args, proc_args.get());
+      call.Clear();
+      frames.Clear();
+      return expr::TryEvals(proc[0])->DoEval(env, proc_args.get(), num_args);
+    }
+  }
+}
+
+Env* LambdaImpl::BindArgs(Expr** args,
+                          size_t num_args,
+                          StackFrames* frames,
+                          Expr** heap_frame) {
+  const auto& required_args = lambda_->required_args();
+  auto* variable_arg = lambda_->variable_arg();
+  if (num_args < required_args.size() ||
+      (num_args > required_args.size() && variable_arg == nullptr)) {
+    // The arguments may be those of a pending tail call.
+    TailCall::Get().Clear();
+    ThrowArgCountError(required_args.size(), variable_arg != nullptr,
+                       num_args);
+  }
+
+  auto* frame = NewFrame(env_, lambda_->num_slots(), lambda_->escapes(),
+                         frames, heap_frame);
+  size_t slot = 0;
+  for (; slot < required_args.size(); ++slot) {
+    frame->slot(slot) = args[slot];
+  }
+  if (variable_arg != nullptr) {
+    gc::Lock<Expr> rest(Nil());
+    for (size_t i = num_args; i > slot; --i) {
+      rest.reset(new expr::Pair(args[i - 1], rest.get()));
+    }
+    frame->slot(slot) = rest.get();
+  }
+
+  return frame;
+}
+
+gc::Lock<Expr> Promise::MakeForced(Expr* val) {
+  auto* promise = new Promise(nullptr, false);
+  promise->forced_val_ = val;
+  return gc::Lock<Expr>(promise);
+}
+
+Promise* Promise::Find() {
+  auto* root = this;
+  while (root->link_) {
+    root = root->link_;
+  }
+  for (auto* promise = this; promise != root;) {
+    auto* next = promise->link_;
+    promise->link_ = root;
+    promise = next;
+  }
+  return root;
+}
+
+gc::Lock<Expr> Promise::DoEval(Env* env,
+                               Expr** /* args */,
+                               size_t /* num_args */) {
+  // The locks below can't be copied by a continuation.
+  CaptureBarrier barrier;
+  gc::Lock<Promise> self(this);
+  while (true) {
+    auto* state = Find();
+    if (state->forced_val_) {
+      return gc::Lock<Expr>(state->forced_val_);
+    }
+
+    // |thunk_| is released once forced, so hold on to it here.
+    gc::Lock<Expr> thunk(state->thunk_);
+    bool is_lazy = state->is_lazy_;
+    auto ret = expr::TryEvals(thunk.get())->DoEval(env, nullptr, 0);
+    // The promise may have been forced reentrantly, in which case the first
+    // value wins.
+    state = Find();
+    if (state->forced_val_) {
+      continue;
+    }
+    if (!is_lazy) {
+      state->forced_val_ = ret.get();
+      state->thunk_ = nullptr;
+      continue;
+    }
+
+    auto* next = dynamic_cast<Promise*>(ret.get());
+    if (!next) {
+      throw RuntimeException("delay-force: Expected promise", ret.get());
+    }
+    next = next->Find();
+    if (next == state) {
+      continue;
+    }
+    state->thunk_ = next->thunk_;
+    state->is_lazy_ = next->is_lazy_;
+    state->forced_val_ = next->forced_val_;
+    next->thunk_ = nullptr;
+    next->forced_val_ = nullptr;
+    next->link_ = state;
+  }
+}
+
+void Promise::MarkReferences() {
+  if (link_)
+    link_->GcMark();
+  if (thunk_)
+    thunk_->GcMark();
+  if (forced_val_)
+    forced_val_->GcMark();
+}
+
+}  // namespace eval
@@ -0,0 +1,995 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVAL_NODE_H_
+#define EVAL_NODE_H_
+
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "expr/expr.h"
+#include "expr/primitive.h"
+#include "gc/gc.h"
+#include "gc/lock.h"
+
+namespace eval {
+
+class JitCode;
+class LambdaImpl;
+class StackFrames;
+
+enum class NodeType : uint8_t {
+#define X(name) name,
+#include "eval/nodes.inc"  // NOLINT(build/include)
+#undef X
+};
+
+// Analyzed code. Analyze() compiles an expression into a tree of nodes once,
+// with all syntax checking done up front. The tree may then be executed any
+// number of times.
+class Node : public expr::Evals {
+ public:
+  virtual gc::Lock<expr::Expr> Exec(expr::Env* env) = 0;
+
+  NodeType node_type() const { return node_type_; }
+
+  // Called by the analyzer on nodes in tail position of a lambda body. Once
+  // marked, Exec() may return TailCallMarker() in place of a value, leaving the
+  // call for LambdaImpl::DoEval to make. Nodes which contain other expressions
+  // in tail position pass the mark on to them.
+  virtual void MarkTail() {}
+
+  // Evals implementation:
+  gc::Lock<expr::Expr> DoEval(expr::Env* env,
+                              expr::Expr** args,
+                              size_t num_args) override {
+    assert(num_args == 0);
+    return Exec(env);
+  }
+
+ protected:
+  explicit Node(NodeType node_type) : node_type_(node_type) {}
+  ~Node() override = default;
+
+ private:
+  const NodeType node_type_;
+};
+
+// Returned by nodes in tail position in place of the value of a tail call.
+expr::Expr* TailCallMarker();
+
+// Returned by Recur to the enclosing Loop, once the loop's variables hold
+// their next values.
+expr::Expr* RecurMarker();
+
+// Leaves a call of |proc| with |args| for the driver of the enclosing
+// procedure, such as LambdaImpl::DoEval, to make and returns TailCallMarker().
+expr::Expr* MakeTailCall(expr::Expr* proc,
+                         expr::Expr** args,
+                         size_t num_args);
+
+// The call left by MakeTailCall(). There is at most one pending call at a
+// time, since it is taken as soon as the marker reaches the enclosing driver.
+// The arguments are copied out of the value stack, since the caller pops them
+// when it returns.
+class TailCall : public gc::RootSet {
+ public:
+  static TailCall& Get() {
+    static TailCall tail_call;
+    return tail_call;
+  }
+
+  void Set(expr::Expr* proc, expr::Expr** args, size_t num_args) {
+    proc_ = proc;
+    args_.assign(args, args + num_args);
+  }
+
+  // Clears the call once it has been taken. Capacity is kept, so setting a
+  // call doesn't allocate once warmed up.
+  void Clear() {
+    proc_ = nullptr;
+    args_.clear();
+  }
+
+  expr::Expr* proc() const { return proc_; }
+  expr::Expr** args() { return args_.data(); }
+  size_t num_args() const { return args_.size(); }
+
+  // RootSet implementation:
+  void MarkRoots() override {
+    if (proc_) {
+      proc_->GcMark();
+    }
+    for (auto* arg : args_) {
+      arg->GcMark();
+    }
+  }
+
+ private:
+  TailCall() { gc::Gc::Get().AddRootSet(this); }
+  ~TailCall() { gc::Gc::Get().RemoveRootSet(this); }
+
+  expr::Expr* proc_ = nullptr;
+  std::vector<expr::Expr*> args_;
+};
+
+// Returned by values in place of other than one value, which are left in
+// MultipleValues::Get() for the caller to take.
+expr::Expr* MultipleValuesMarker();
+
+// The values returned with MultipleValuesMarker(). They pass through this
+// buffer rather than a list, so returning them doesn't allocate.
+class MultipleValues : public gc::RootSet {
+ public:
+  static MultipleValues& Get() {
+    static MultipleValues values;
+    return values;
+  }
+
+  // Returns MultipleValuesMarker(), or the value itself if there is one.
+  expr::Expr* Set(expr::Expr** vals, size_t num_vals) {
+    if (num_vals == 1) {
+      return vals[0];
+    }
+    vals_.assign(vals, vals + num_vals);
+    return MultipleValuesMarker();
+  }
+
+  // Clears the values once they have been taken. Capacity is kept, as for
+  // TailCall.
+  void Clear() { vals_.clear(); }
+
+  expr::Expr** vals() { return vals_.data(); }
+  size_t num_vals() const { return vals_.size(); }
+
+  // RootSet implementation:
+  void MarkRoots() override {
+    for (auto* val : vals_) {
+      val->GcMark();
+    }
+  }
+
+ private:
+  MultipleValues() { gc::Gc::Get().AddRootSet(this); }
+  ~MultipleValues() { gc::Gc::Get().RemoveRootSet(this); }
+
+  std::vector<expr::Expr*> vals_;
+};
+
+// Throws the error for a call with |num_args| arguments of a procedure which
+// takes |num_required|, or at least that many if |has_rest|. Out of line, so
+// the call drivers' frames, which nest in deep recursion, stay small.
+[[noreturn]] void ThrowArgCountError(size_t num_required,
+                                     bool has_rest,
+                                     size_t num_args);
+
+// Sets the first slots of |frame| to the values |val| stands for, which are
+// taken from MultipleValues::Get() if it is MultipleValuesMarker():
+// |num_required| of them, then a list of the rest if |has_rest|. Throws if
+// there are too few or too many.
+void BindValues(expr::Expr* val,
+                size_t num_required,
+                bool has_rest,
+                expr::Env* frame);
+
+// A self evaluating or quoted value.
+class Constant : public Node {
+ public:
+  explicit Constant(expr::Expr* val)
+      : Node(NodeType::Constant), val_(val) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override {
+    return gc::Lock<expr::Expr>(val_);
+  }
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override { val_->GcMark(); }
+
+  expr::Expr* val() const { return val_; }
+
+ private:
+  expr::Expr* const val_;
+};
+
+// Returns the frame |depth| levels above |env|.
+inline expr::Env* FrameAt(expr::Env* env, size_t depth) {
+  for (; depth > 0; --depth) {
+    env = env->enclosing();
+  }
+  return env;
+}
+
+// Variables which closures capture and which may be assigned after being
+// captured are kept in a box, a heap frame of one slot, shared by the
+// variable's own frame and the closures.
+inline gc::Lock<expr::Env> NewBox(expr::Expr* val) {
+  auto box = expr::Env::NewFrame(nullptr, 1);
+  box->slot(0) = val;
+  return box;
+}
+
+inline expr::Expr*& Unbox(expr::Expr* box) {
+  return static_cast<expr::Env*>(box)->slot(0);
+}
+
+// Returns the frame of a closure converted by Optimize(), enclosed by the top
+// level environment |top| and holding |num_captures| values from |captures|.
+gc::Lock<expr::Env> NewClosureFrame(expr::Env* top,
+                                    expr::Expr** captures,
+                                    size_t num_captures);
+
+// A reference to a local variable, resolved to its frame and slot. If
+// |boxed|, the slot holds the variable's box.
+class LocalRef : public Node {
+ public:
+  LocalRef(expr::Symbol* var, size_t depth, size_t index, bool boxed = false)
+      : Node(NodeType::LocalRef),
+        var_(var),
+        depth_(depth),
+        index_(index),
+        boxed_(boxed) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  std::ostream& AppendStream(std::ostream& stream) const override {
+    return var_->AppendStream(stream);
+  }
+  void MarkReferences() override { var_->GcMark(); }
+
+  expr::Symbol* var() const { return var_; }
+  size_t depth() const { return depth_; }
+  size_t index() const { return index_; }
+  bool boxed() const { return boxed_; }
+
+ private:
+  expr::Symbol* const var_;
+  const size_t depth_;
+  const size_t index_;
+  const bool boxed_;
+};
+
+// Caches the location of a top level variable's value for a reference to it.
+// Only variables defined in the top level environment itself are cached, not
+// ones found in an enclosing environment, which a later definition could
+// shadow. Redefinition needs no invalidation since it updates the location.
+class GlobalCell {
+ public:
+  // Returns the location of |var| in |env|, or null if it must be looked up.
+  expr::Expr** Get(expr::Env* env, expr::Symbol* var) {
+    if (env != env_ || !cell_) {
+      env_ = env;
+      cell_ = env->FindCell(var);
+    }
+    return cell_;
+  }
+
+  // Keeps the environment alive so a new one can't reuse its address.
+  void MarkReferences() {
+    if (env_) {
+      env_->GcMark();
+    }
+  }
+
+ private:
+  expr::Env* env_ = nullptr;
+  expr::Expr** cell_ = nullptr;
+};
+
+// A reference to a top level variable. |depth| is the number of frames between
+// the reference and the top level environment.
+class GlobalRef : public Node {
+ public:
+  GlobalRef(expr::Symbol* var, size_t depth)
+      : Node(NodeType::GlobalRef), var_(var), depth_(depth) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override {
+    auto* top = FrameAt(env, depth_);
+    auto** cell = cell_.Get(top, var_);
+    return gc::Lock<expr::Expr>(cell ? *cell : top->Lookup(var_));
+  }
+  std::ostream& AppendStream(std::ostream& stream) const override {
+    return var_->AppendStream(stream);
+  }
+  void MarkReferences() override {
+    var_->GcMark();
+    cell_.MarkReferences();
+  }
+
+  expr::Symbol* var() const { return var_; }
+  size_t depth() const { return depth_; }
+
+ private:
+  expr::Symbol* const var_;
+  const size_t depth_;
+  GlobalCell cell_;
+};
+
+// Procedure application.
+class Apply : public Node {
+ public:
+  Apply(Node* op, std::vector<Node*> args)
+      : Apply(NodeType::Apply, op, std::move(args)) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  void MarkTail() override { tail_ = true; }
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  Node* op() const { return op_; }
+  const std::vector<Node*>& args() const { return args_; }
+  bool tail() const { return tail_; }
+
+ protected:
+  Apply(NodeType node_type, Node* op, std::vector<Node*> args)
+      : Node(node_type), op_(op), args_(std::move(args)) {}
+
+ private:
+  Node* const op_;
+  const std::vector<Node*> args_;
+  bool tail_ = false;
+};
+
+// A call of a top level variable which was bound to a primitive with an open
+// coded fast path, see expr::OpenCode(). The variable may be rebound later, so
+// the fast path is only taken while it still holds |expected|. Otherwise, or
+// if the arguments need the full primitive, it is an ordinary Apply.
+class PrimApply : public Apply {
+ public:
+  PrimApply(GlobalRef* op,
+            std::vector<Node*> args,
+            expr::Primitive primitive,
+            expr::Expr* expected)
+      : Apply(NodeType::PrimApply, op, std::move(args)),
+        primitive_(primitive),
+        expected_(expected) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  void MarkReferences() override;
+
+  expr::Primitive primitive() const { return primitive_; }
+  expr::Expr* expected() const { return expected_; }
+
+  // Computes the call of |proc| with |args| inline if possible, returning
+  // null otherwise.
+  expr::Expr* TryOpenCode(expr::Expr* proc, expr::Expr** args) const {
+    return proc == expected_
+               ? expr::OpenCode(primitive_, args, this->args().size())
+               : nullptr;
+  }
+
+ private:
+  const expr::Primitive primitive_;
+  expr::Expr* const expected_;
+};
+
+// Code which Optimize() simplified using the values of calls of primitives on
+// constants, computed ahead of time. Like PrimApply, |folded| is only run
+// while each guard's variable still holds the primitive it was bound to.
+// Otherwise |original| is, which is the code as written.
+class Folded : public Node {
+ public:
+  struct Guard {
+    GlobalRef* ref;
+    expr::Expr* expected;
+  };
+
+  Folded(Node* original, std::vector<Guard> guards, Node* folded)
+      : Node(NodeType::Folded),
+        original_(original),
+        guards_(std::move(guards)),
+        folded_(folded) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  void MarkTail() override {
+    original_->MarkTail();
+    folded_->MarkTail();
+  }
+  std::ostream& AppendStream(std::ostream& stream) const override {
+    return folded_->AppendStream(stream);
+  }
+  void MarkReferences() override;
+
+  Node* original() const { return original_; }
+  const std::vector<Guard>& guards() const { return guards_; }
+  Node* folded() const { return folded_; }
+
+ private:
+  Node* const original_;
+  const std::vector<Guard> guards_;
+  Node* const folded_;
+};
+
+class If : public Node {
+ public:
+  // |alternate| may be null.
+  If(Node* test, Node* consequent, Node* alternate)
+      : Node(NodeType::If),
+        test_(test),
+        consequent_(consequent),
+        alternate_(alternate) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  void MarkTail() override;
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  Node* test() const { return test_; }
+  Node* consequent() const { return consequent_; }
+  Node* alternate() const { return alternate_; }
+
+ private:
+  Node* const test_;
+  Node* const consequent_;
+  Node* const alternate_;
+};
+
+// Evaluates each node in turn, returning the value of the last. Used for
+// begin and bodies.
+class Sequence : public Node {
+ public:
+  explicit Sequence(std::vector<Node*> body)
+      : Node(NodeType::Sequence), body_(std::move(body)) {
+    assert(body_.size() > 0);
+  }
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  void MarkTail() override;
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  const std::vector<Node*>& body() const { return body_; }
+
+ private:
+  const std::vector<Node*> body_;
+};
+
+class And : public Node {
+ public:
+  explicit And(std::vector<Node*> tests)
+      : Node(NodeType::And), tests_(std::move(tests)) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  void MarkTail() override;
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  const std::vector<Node*>& tests() const { return tests_; }
+
+ private:
+  const std::vector<Node*> tests_;
+};
+
+class Or : public Node {
+ public:
+  explicit Or(std::vector<Node*> tests)
+      : Node(NodeType::Or), tests_(std::move(tests)) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  void MarkTail() override;
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  const std::vector<Node*>& tests() const { return tests_; }
+
+ private:
+  const std::vector<Node*> tests_;
+};
+
+class Cond : public Node {
+ public:
+  struct Clause {
+    Node* test;
+    // Null if the clause is just (test).
+    Node* body;
+    // True for (test => receiver), in which case |body| is the receiver.
+    bool is_arrow;
+  };
+
+  // |else_body| may be null.
+  Cond(std::vector<Clause> clauses, Node* else_body)
+      : Node(NodeType::Cond),
+        clauses_(std::move(clauses)),
+        else_body_(else_body) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  void MarkTail() override;
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  const std::vector<Clause>& clauses() const { return clauses_; }
+  Node* else_body() const { return else_body_; }
+
+ private:
+  const std::vector<Clause> clauses_;
+  Node* const else_body_;
+  bool tail_ = false;
+};
+
+class Case : public Node {
+ public:
+  struct Clause {
+    std::vector<expr::Expr*> data;
+    Node* body;
+  };
+
+  // |else_body| may be null.
+  Case(Node* key, std::vector<Clause> clauses, Node* else_body)
+      : Node(NodeType::Case),
+        key_(key),
+        clauses_(std::move(clauses)),
+        else_body_(else_body) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  void MarkTail() override;
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  Node* key() const { return key_; }
+  const std::vector<Clause>& clauses() const { return clauses_; }
+  Node* else_body() const { return else_body_; }
+
+ private:
+  Node* const key_;
+  const std::vector<Clause> clauses_;
+  Node* const else_body_;
+};
+
+// set! of a local variable. Also used for internal definitions.
+class LocalSet : public Node {
+ public:
+  LocalSet(expr::Symbol* var,
+           size_t depth,
+           size_t index,
+           Node* val,
+           bool is_define,
+           bool boxed = false)
+      : Node(NodeType::LocalSet),
+        var_(var),
+        depth_(depth),
+        index_(index),
+        val_(val),
+        is_define_(is_define),
+        boxed_(boxed) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  expr::Symbol* var() const { return var_; }
+  size_t depth() const { return depth_; }
+  size_t index() const { return index_; }
+  Node* val() const { return val_; }
+  bool is_define() const { return is_define_; }
+  bool boxed() const { return boxed_; }
+
+ private:
+  expr::Symbol* const var_;
+  const size_t depth_;
+  const size_t index_;
+  Node* const val_;
+  const bool is_define_;
+  const bool boxed_;
+};
+
+class GlobalSet : public Node {
+ public:
+  GlobalSet(expr::Symbol* var, size_t depth, Node* val)
+      : Node(NodeType::GlobalSet), var_(var), depth_(depth), val_(val) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  expr::Symbol* var() const { return var_; }
+  size_t depth() const { return depth_; }
+  Node* val() const { return val_; }
+
+ private:
+  expr::Symbol* const var_;
+  const size_t depth_;
+  Node* const val_;
+  GlobalCell cell_;
+};
+
+// A top level definition.
+class Define : public Node {
+ public:
+  Define(expr::Symbol* var, Node* val)
+      : Node(NodeType::Define), var_(var), val_(val) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  expr::Symbol* var() const { return var_; }
+  Node* val() const { return val_; }
+
+ private:
+  expr::Symbol* const var_;
+  Node* const val_;
+};
+
+// How a lambda converted by Optimize() captures its free variables.
+struct FlatClosure {
+  // The frame of each closure holds only the captured slots, read by
+  // |captures| where the lambda is evaluated. Boxed variables share their box.
+  // The frame is enclosed by the top level environment, |top_depth| frames up
+  // from there.
+  std::vector<LocalRef*> captures;
+  size_t top_depth;
+  // Slots of each call's frame which hold boxes.
+  std::vector<size_t> boxed;
+};
+
+// Creates a LambdaImpl. Calling it creates a frame of |num_slots| slots, the
+// first of which hold the arguments.
+//
+// As made by Analyze(), the closure is enclosed by the current environment.
+// Optimize() converts lambdas to flat closures, which keep only the variables
+// they use alive. Those with no free variables are lifted: every evaluation
+// returns the same procedure.
+class Lambda : public Node {
+ public:
+  // |variable_arg| may be null. |escapes| is false if no closure or promise
+  // can capture the frames of calls, so they may be popped on return.
+  Lambda(std::vector<expr::Symbol*> required_args,
+         expr::Symbol* variable_arg,
+         size_t num_slots,
+         Node* body,
+         bool escapes)
+      : Node(NodeType::Lambda),
+        required_args_(std::move(required_args)),
+        variable_arg_(variable_arg),
+        num_slots_(num_slots),
+        body_(body),
+        escapes_(escapes) {}
+
+  // A flat closure. Its calls' frames never escape, since closures made in
+  // them copy what they capture.
+  Lambda(std::vector<expr::Symbol*> required_args,
+         expr::Symbol* variable_arg,
+         size_t num_slots,
+         Node* body,
+         FlatClosure flat)
+      : Node(NodeType::Lambda),
+        required_args_(std::move(required_args)),
+        variable_arg_(variable_arg),
+        num_slots_(num_slots),
+        body_(body),
+        escapes_(false),
+        is_flat_(true),
+        flat_(std::move(flat)) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  const std::vector<expr::Symbol*>& required_args() const {
+    return required_args_;
+  }
+  expr::Symbol* variable_arg() const { return variable_arg_; }
+  size_t num_slots() const { return num_slots_; }
+  Node* body() const { return body_; }
+  bool escapes() const { return escapes_; }
+  bool is_flat() const { return is_flat_; }
+  const FlatClosure& flat() const { return flat_; }
+
+  // Returns a procedure for this flat closure, whose frame is enclosed by
+  // |top| and holds |captures|.
+  gc::Lock<expr::Expr> NewClosure(expr::Env* top, expr::Expr** captures);
+
+  // Counts a call, with |frame| holding its arguments. Returns native code
+  // for the body once the lambda has been called often enough with the JIT
+  // enabled, or null if the body should be interpreted.
+  JitCode* Jit(expr::Env* frame);
+
+ private:
+  const std::vector<expr::Symbol*> required_args_;
+  expr::Symbol* const variable_arg_;
+  const size_t num_slots_;
+  Node* const body_;
+  const bool escapes_;
+  const bool is_flat_ = false;
+  const FlatClosure flat_{};
+  // The procedure returned for a lifted lambda.
+  LambdaImpl* lifted_ = nullptr;
+
+  size_t num_calls_ = 0;
+  JitCode* jit_code_ = nullptr;
+  // Set if the JIT couldn't compile the body.
+  bool jit_failed_ = false;
+};
+
+// let, let* and letrec. Creates a frame of |num_slots| slots, the first of
+// which hold |vars|. The frame is popped on exit unless it |escapes|, as for
+// Lambda. Slots listed in |boxed| hold boxes, made before the inits run.
+class Let : public Node {
+ public:
+  enum class Kind { LET, LET_STAR, LETREC };
+
+  Let(Kind kind,
+      std::vector<expr::Symbol*> vars,
+      std::vector<Node*> inits,
+      size_t num_slots,
+      Node* body,
+      bool escapes,
+      std::vector<size_t> boxed = {})
+      : Node(NodeType::Let),
+        kind_(kind),
+        vars_(std::move(vars)),
+        inits_(std::move(inits)),
+        num_slots_(num_slots),
+        body_(body),
+        escapes_(escapes),
+        boxed_(std::move(boxed)) {
+    assert(vars_.size() == inits_.size());
+  }
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  void MarkTail() override;
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  Kind kind() const { return kind_; }
+  const std::vector<expr::Symbol*>& vars() const { return vars_; }
+  const std::vector<Node*>& inits() const { return inits_; }
+  size_t num_slots() const { return num_slots_; }
+  Node* body() const { return body_; }
+  bool escapes() const { return escapes_; }
+  const std::vector<size_t>& boxed() const { return boxed_; }
+
+ private:
+  const Kind kind_;
+  const std::vector<expr::Symbol*> vars_;
+  const std::vector<Node*> inits_;
+  const size_t num_slots_;
+  Node* const body_;
+  const bool escapes_;
+  const std::vector<size_t> boxed_;
+};
+
+// A named let, or do, whose procedure |name| is only called in tail position
+// of its own body, as made by Optimize(). Creates a frame holding |vars| and
+// runs |body| in it until it returns something other than RecurMarker(). The
+// calls are Recur nodes, which rebind the variables in place, so iterations
+// don't allocate. Slots listed in |boxed| get new boxes for each iteration.
+class Loop : public Node {
+ public:
+  Loop(expr::Symbol* name,
+       std::vector<expr::Symbol*> vars,
+       std::vector<Node*> inits,
+       Node* body,
+       std::vector<size_t> boxed)
+      : Node(NodeType::Loop),
+        name_(name),
+        vars_(std::move(vars)),
+        inits_(std::move(inits)),
+        body_(body),
+        boxed_(std::move(boxed)) {
+    assert(vars_.size() == inits_.size());
+  }
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  void MarkTail() override { body_->MarkTail(); }
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  const std::vector<expr::Symbol*>& vars() const { return vars_; }
+  const std::vector<Node*>& inits() const { return inits_; }
+  Node* body() const { return body_; }
+  const std::vector<size_t>& boxed() const { return boxed_; }
+
+ private:
+  expr::Symbol* const name_;
+  const std::vector<expr::Symbol*> vars_;
+  const std::vector<Node*> inits_;
+  Node* const body_;
+  const std::vector<size_t> boxed_;
+};
+
+// A call of a Loop's procedure, |depth| frames below the loop's frame. Sets
+// the loop's variables to |args| and returns RecurMarker().
+class Recur : public Node {
+ public:
+  Recur(expr::Symbol* name, size_t depth, std::vector<Node*> args)
+      : Node(NodeType::Recur),
+        name_(name),
+        depth_(depth),
+        args_(std::move(args)) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  size_t depth() const { return depth_; }
+  const std::vector<Node*>& args() const { return args_; }
+
+ private:
+  expr::Symbol* const name_;
+  const size_t depth_;
+  const std::vector<Node*> args_;
+};
+
+// (receive formals producer body...), which binds the values of |producer|
+// as a lambda with |required_vars| and |variable_var| binds its arguments,
+// then runs |body| in the new frame. The values are taken directly from
+// MultipleValues, where a call to values left them.
+class Receive : public Node {
+ public:
+  Receive(std::vector<expr::Symbol*> required_vars,
+          expr::Symbol* variable_var,
+          size_t num_slots,
+          Node* producer,
+          Node* body,
+          bool escapes,
+          std::vector<size_t> boxed = {})
+      : Node(NodeType::Receive),
+        required_vars_(std::move(required_vars)),
+        variable_var_(variable_var),
+        num_slots_(num_slots),
+        producer_(producer),
+        body_(body),
+        escapes_(escapes),
+        boxed_(std::move(boxed)) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  void MarkTail() override { body_->MarkTail(); }
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  const std::vector<expr::Symbol*>& required_vars() const {
+    return required_vars_;
+  }
+  expr::Symbol* variable_var() const { return variable_var_; }
+  size_t num_slots() const { return num_slots_; }
+  Node* producer() const { return producer_; }
+  Node* body() const { return body_; }
+  bool escapes() const { return escapes_; }
+  const std::vector<size_t>& boxed() const { return boxed_; }
+
+ private:
+  const std::vector<expr::Symbol*> required_vars_;
+  expr::Symbol* const variable_var_;
+  const size_t num_slots_;
+  Node* const producer_;
+  Node* const body_;
+  const bool escapes_;
+  const std::vector<size_t> boxed_;
+};
+
+// Makes a Promise of the value of |thunk|'s body, which takes no arguments.
+// For delay-force, |is_lazy|, the body's value is itself a promise, which is
+// forced in its place.
+class Delay : public Node {
+ public:
+  Delay(Lambda* thunk, bool is_lazy)
+      : Node(NodeType::Delay), thunk_(thunk), is_lazy_(is_lazy) {}
+
+  // Node implementation:
+  gc::Lock<expr::Expr> Exec(expr::Env* env) override;
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override { thunk_->GcMark(); }
+
+  Lambda* thunk() const { return thunk_; }
+  bool is_lazy() const { return is_lazy_; }
+
+ private:
+  Lambda* const thunk_;
+  const bool is_lazy_;
+};
+
+// A procedure created by evaluating a lambda expression. DoEval() is the
+// driver for tail calls: when the body returns TailCallMarker(), it makes the
+// pending call itself, looping rather than recursing if the callee is another
+// LambdaImpl.
+class LambdaImpl final : public expr::Evals {
+ public:
+  LambdaImpl(Lambda* lambda, expr::Env* env) : lambda_(lambda), env_(env) {
+    assert(env);
+  }
+
+  // Evals implementation:
+  std::ostream& AppendStream(std::ostream& stream) const override {
+    return lambda_->AppendStream(stream);
+  }
+  gc::Lock<expr::Expr> DoEval(expr::Env* env,
+                              expr::Expr** args,
+                              size_t num_args) override;
+  void MarkReferences() override {
+    lambda_->GcMark();
+    env_->GcMark();
+  }
+
+  expr::Env* env() const { return env_; }
+
+ private:
+  ~LambdaImpl() override = default;
+
+  // Checks the number of arguments and returns a new frame holding them. The
+  // frame is pushed onto |frames| unless the lambda's frames escape, in which
+  // case the value stack slot |heap_frame| holds it.
+  expr::Env* BindArgs(expr::Expr** args,
+                      size_t num_args,
+                      StackFrames* frames,
+                      expr::Expr** heap_frame);
+
+  Lambda* const lambda_;
+  expr::Env* const env_;
+};
+
+// The result of delay, delay-force or make-promise. Calling it forces the
+// promise, calling |thunk| the first time.
+//
+// A lazy promise's thunk returns another promise, whose value becomes its
+// own. Forcing adopts the other promise's thunk and loops rather than
+// recursing, as in R7RS, so a chain of delay-force is forced in constant
+// stack. The adopted promise is linked to this one so both share the result,
+// and no longer refers to the rest of the chain.
+class Promise : public expr::Evals {
+ public:
+  Promise(expr::Expr* thunk, bool is_lazy) : thunk_(thunk), is_lazy_(is_lazy) {}
+
+  // Returns a promise already forced to |val|.
+  static gc::Lock<expr::Expr> MakeForced(expr::Expr* val);
+
+  // Evals implementation:
+  std::ostream& AppendStream(std::ostream& stream) const override {
+    return stream << "promise";
+  }
+  gc::Lock<expr::Expr> DoEval(expr::Env* env,
+                              expr::Expr** args,
+                              size_t num_args) override;
+  void MarkReferences() override;
+
+ private:
+  ~Promise() override = default;
+
+  // Returns the promise holding the state shared with this one.
+  Promise* Find();
+
+  // Set once this promise's state is shared with another's.
+  Promise* link_ = nullptr;
+  expr::Expr* thunk_;
+  bool is_lazy_;
+  expr::Expr* forced_val_ = nullptr;
+};
+
+}  // namespace eval
+
+#endif  // EVAL_NODE_H_
@@ -0,0 +1,1093 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+#include <vector>
+
+#include "eval/eval.h"
+#include "eval/node.h"
+#include "expr/number.h"
+#include "expr/primitive.h"
+#include "util/exceptions.h"
+
+using expr::Env;
+using expr::Expr;
+using expr::Primitive;
+
+namespace eval {
+
+namespace {
+
+// Primitives whose result depends only on their arguments, without side
+// effects or allocating anything mutable, so calls on constants can be made
+// ahead of time.
+bool IsFoldable(Primitive primitive) {
+  switch (primitive) {
+    case Primitive::IsEqv:
+    case Primitive::IsEq:
+    case Primitive::IsEqual:
+    case Primitive::IsNumber:
+    case Primitive::IsComplex:
+    case Primitive::IsReal:
+    case Primitive::IsRational:
+    case Primitive::IsInteger:
+    case Primitive::IsExact:
+    case Primitive::IsInexact:
+    case Primitive::OpEq:
+    case Primitive::OpLt:
+    case Primitive::OpGt:
+    case Primitive::OpLe:
+    case Primitive::OpGe:
+    case Primitive::IsZero:
+    case Primitive::IsPositive:
+    case Primitive::IsNegative:
+    case Primitive::IsOdd:
+    case Primitive::IsEven:
+    case Primitive::Max:
+    case Primitive::Min:
+    case Primitive::Plus:
+    case Primitive::Star:
+    case Primitive::Minus:
+    case Primitive::Slash:
+    case Primitive::Abs:
+    case Primitive::Quotient:
+    case Primitive::Remainder:
+    case Primitive::Modulo:
+    case Primitive::Gcd:
+    case Primitive::Lcm:
+    case Primitive::Floor:
+    case Primitive::Ceiling:
+    case Primitive::Truncate:
+    case Primitive::Round:
+    case Primitive::Exp:
+    case Primitive::Log:
+    case Primitive::Sin:
+    case Primitive::Cos:
+    case Primitive::Tan:
+    case Primitive::Asin:
+    case Primitive::ACos:
+    case Primitive::ATan:
+    case Primitive::Sqrt:
+    case Primitive::Expt:
+    case Primitive::ExactToInexact:
+    case Primitive::InexactToExact:
+    case Primitive::Not:
+    case Primitive::IsBoolean:
+    case Primitive::IsPair:
+    case Primitive::IsNull:
+    case Primitive::IsSymbol:
+    case Primitive::IsChar:
+    case Primitive::IsCharEq:
+    case Primitive::IsCharLt:
+    case Primitive::IsCharGt:
+    case Primitive::IsCharLe:
+    case Primitive::IsCharGe:
+    case Primitive::IsString:
+    case Primitive::IsVector:
+    case Primitive::IsProcedure:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Exact division by zero, or of the smallest fixnum by -1, traps in the
+// division primitives, so such calls are left for when they run.
+bool MayTrap(Primitive primitive, const std::vector<Expr*>& args) {
+  switch (primitive) {
+    case Primitive::Slash:
+    case Primitive::Quotient:
+    case Primitive::Remainder:
+    case Primitive::Modulo:
+      break;
+    default:
+      return false;
+  }
+  for (size_t i = 1; i < args.size(); ++i) {
+    auto* number = args[i]->AsNumber();
+    auto* divisor = number ? number->AsInt() : nullptr;
+    if (divisor && (divisor->val() == 0 || divisor->val() == -1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Only calls on immutable values are folded. A quoted list, for example, may
+// be changed by set-car! before the call runs.
+bool IsAtom(Expr* val) {
+  switch (val->type()) {
+    case Expr::Type::EMPTY_LIST:
+    case Expr::Type::BOOL:
+    case Expr::Type::NUMBER:
+    case Expr::Type::CHAR:
+    case Expr::Type::SYMBOL:
+      return true;
+    default:
+      return false;
+  }
+}
+
+using Guards = std::vector<Folded::Guard>;
+
+// Adds the guards in |from| which aren't already in |to|. All guards of a
+// Folded are checked in the same place, so a variable only needs one.
+void AddGuards(const Guards& from, Guards* to) {
+  for (const auto& guard : from) {
+    if (std::none_of(to->begin(), to->end(), [&](const Folded::Guard& g) {
+          return g.ref->var() == guard.ref->var();
+        })) {
+      to->push_back(guard);
+    }
+  }
+}
+
+// Returns the value of optimized |node| if it is known ahead of time, adding
+// the guards it depends on to |guards|.
+Expr* KnownVal(Node* node, Guards* guards) {
+  if (node->node_type() == NodeType::Folded) {
+    auto* folded = static_cast<Folded*>(node);
+    if (folded->folded()->node_type() == NodeType::Constant) {
+      AddGuards(folded->guards(), guards);
+      return static_cast<Constant*>(folded->folded())->val();
+    }
+    return nullptr;
+  }
+  return node->node_type() == NodeType::Constant
+             ? static_cast<Constant*>(node)->val()
+             : nullptr;
+}
+
+// Rebuilds an analyzed tree, simplifying it along the way. Every node is
+// new, since nodes can't be changed once built and tail positions are marked
+// again on the new lambda bodies.
+//
+// Removing let bindings renumbers the slots after them, and removing a whole
+// let frame changes the depth of references which cross it. So each frame
+// being rebuilt keeps a map from its old slots to its new ones, which is
+// decided before any reference to it is rebuilt.
+//
+// Lambdas become flat closures. A variable of an enclosing lambda's frames
+// which the body uses is copied into the closure's frame when the lambda is
+// evaluated, and the body refers to the copy. A variable which may change
+// after it is copied, because it is set! or not yet defined, is boxed so
+// that the copies share it. Continuations copy frames too, so a variable
+// which is set! is boxed even if no lambda uses it.
+class Optimizer {
+ public:
+  explicit Optimizer(Env* env) : env_(env) { levels_.push_back({0, {}}); }
+
+  Node* Optimize(Node* node);
+
+ private:
+  // What is known about a slot of a frame.
+  struct Slot {
+    // Set before any reference to the slot can run: arguments and let and
+    // let* bindings, but not letrec or internal definitions.
+    bool initialized = false;
+    // Counts of references and set!s in the unoptimized tree.
+    size_t num_refs = 0;
+    size_t num_sets = 0;
+    // Set if a set! other than the slot's definition assigns it.
+    bool assigned = false;
+
+    // If set, references are replaced by this value...
+    Expr* constant = nullptr;
+    // ...or by references to the slot |copy| refers to, of
+    // frames_[copy_frame].
+    LocalRef* copy = nullptr;
+    size_t copy_frame = 0;
+
+    // Index in the new frame. Unused if the binding is dropped.
+    size_t new_index = 0;
+    bool dropped = false;
+
+    // Set if a lambda or delay refers to the slot.
+    bool captured = false;
+    // Set if the slot holds a box, decided before the frame is rebuilt.
+    bool boxed = false;
+
+    // For the procedure of a named let, the number of arguments it takes and
+    // the references which call it with that many in tail position of its
+    // body.
+    size_t loop_arity = 0;
+    size_t num_loop_calls = 0;
+  };
+
+  struct Frame {
+    std::vector<Slot> slots;
+    // True if the new tree has no frame here.
+    bool elided = false;
+    // True if this held the procedure of a named let which is now a Loop,
+    // whose frame follows. Calls of the procedure become Recurs.
+    bool loop = false;
+  };
+
+  // A variable copied into a closure's frame, from slot |index| of
+  // frames_[frame].
+  struct Capture {
+    size_t frame;
+    size_t index;
+    // Where the variable is found when the closure is made.
+    LocalRef* source;
+  };
+
+  // The body of a lambda being rebuilt, or the top level. Its frames start at
+  // frames_[first_frame].
+  struct Level {
+    size_t first_frame;
+    std::vector<Capture> captures;
+  };
+
+  // Boxes the captured slots of |frame| whose value may change after it is
+  // copied, returning their indices in the new frame.
+  static std::vector<size_t> BoxSlots(Frame* frame);
+
+  template <typename T, typename... Args>
+  T* New(Args&&... args) {
+    T* node = new T(std::forward<Args>(args)...);
+    nodes_.emplace_back(node);
+    return node;
+  }
+
+  // Returns |folded| to be run in place of |original| while |guards| hold.
+  Node* Guard(Node* original, Guards guards, Node* folded) {
+    return guards.empty() ? folded
+                          : New<Folded>(original, std::move(guards), folded);
+  }
+
+  Node* OptimizeApply(Apply* apply);
+  Node* OptimizeIf(If* node);
+  Node* OptimizeSequence(Sequence* seq);
+  Node* OptimizeAnd(And* node);
+  Node* OptimizeOr(Or* node);
+  Node* OptimizeCond(Cond* cond);
+  Lambda* OptimizeLambda(Lambda* lambda);
+  Node* OptimizeLet(Let* let);
+  Node* OptimizeLoop(Apply* apply, Lambda* lambda);
+  Node* OptimizeReceive(Receive* receive);
+
+  // Returns the procedure of |apply| if it is a named let which can run as a
+  // Loop: one which is only called in tail position of its own body, with
+  // the number of arguments it takes.
+  static Lambda* LoopLambda(Apply* apply);
+
+  // Adds references and set!s of the frame |level| frames above |node| to
+  // |slots|. |in_closure| is set within lambdas and delays in |node|.
+  static void CountRefs(Node* node,
+                        size_t level,
+                        std::vector<Slot>* slots,
+                        bool in_closure = false);
+
+  // True if evaluating |node|, which isn't optimized yet, has no effects and
+  // can't fail.
+  bool IsPure(Node* node) const;
+
+  // The frame an unoptimized reference |depth| frames up refers to.
+  size_t FrameIndex(size_t depth) const {
+    assert(depth < frames_.size());
+    return frames_.size() - 1 - depth;
+  }
+  Slot& SlotAt(size_t depth, size_t index) {
+    return frames_[FrameIndex(depth)].slots[index];
+  }
+
+  // The number of frames in the new tree between the innermost frame and the
+  // top level. Within a lambda, this includes the closure's frame.
+  size_t NewTopDepth() const {
+    return NumFrames(levels_.back().first_frame, frames_.size()) +
+           (levels_.size() > 1 ? 1 : 0);
+  }
+  // The number of frames in the new tree among frames_[from] to
+  // frames_[to - 1].
+  size_t NumFrames(size_t from, size_t to) const;
+
+  // Finds slot |index| of frames_[frame] from where frames_[end - 1] is the
+  // innermost frame within levels_[level], capturing it if it is outside.
+  // The result is a reference to the box if the slot is boxed.
+  LocalRef* Locate(expr::Symbol* var,
+                   size_t level,
+                   size_t end,
+                   size_t frame,
+                   size_t index);
+
+  // A reference to slot |index| of frames_[frame] in the new tree.
+  Node* NewLocalRef(expr::Symbol* var, size_t frame, size_t index);
+  GlobalRef* NewGlobalRef(GlobalRef* ref) {
+    assert(ref->depth() == frames_.size());
+    return New<GlobalRef>(ref->var(), NewTopDepth());
+  }
+
+  Env* const env_;
+  std::vector<Frame> frames_;
+  std::vector<Level> levels_;
+  // Every node created, so partially built trees aren't collected.
+  std::vector<gc::Lock<Node>> nodes_;
+};
+
+Node* Optimizer::Optimize(Node* node) {
+  switch (node->node_type()) {
+    case NodeType::Constant:
+      return node;
+
+    case NodeType::LocalRef: {
+      auto* ref = static_cast<LocalRef*>(node);
+      return NewLocalRef(ref->var(), FrameIndex(ref->depth()), ref->index());
+    }
+
+    case NodeType::GlobalRef:
+      return NewGlobalRef(static_cast<GlobalRef*>(node));
+
+    case NodeType::Apply:
+    case NodeType::PrimApply:
+      return OptimizeApply(static_cast<Apply*>(node));
+
+    // Only made here.
+    case NodeType::Folded:
+    case NodeType::Loop:
+    case NodeType::Recur:
+      assert(false);
+      return node;
+
+    case NodeType::If:
+      return OptimizeIf(static_cast<If*>(node));
+
+    case NodeType::Sequence:
+      return OptimizeSequence(static_cast<Sequence*>(node));
+
+    case NodeType::And:
+      return OptimizeAnd(static_cast<And*>(node));
+
+    case NodeType::Or:
+      return OptimizeOr(static_cast<Or*>(node));
+
+    case NodeType::Cond:
+      return OptimizeCond(static_cast<Cond*>(node));
+
+    case NodeType::Case: {
+      auto* case_node = static_cast<Case*>(node);
+      auto* key = Optimize(case_node->key());
+      std::vector<Case::Clause> clauses;
+      for (const auto& clause : case_node->clauses()) {
+        clauses.push_back({clause.data, Optimize(clause.body)});
+      }
+      return New<Case>(key, std::move(clauses),
+                       case_node->else_body()
+                           ? Optimize(case_node->else_body())
+                           : nullptr);
+    }
+
+    case NodeType::LocalSet: {
+      auto* set = static_cast<LocalSet*>(node);
+      auto frame = FrameIndex(set->depth());
+      const auto& slot = frames_[frame].slots[set->index()];
+      assert(!slot.dropped);
+      auto* val = Optimize(set->val());
+      auto* loc = Locate(set->var(), levels_.size() - 1, frames_.size(), frame,
+                         set->index());
+      return New<LocalSet>(set->var(), loc->depth(), loc->index(), val,
+                           set->is_define(), slot.boxed);
+    }
+
+    case NodeType::GlobalSet: {
+      auto* set = static_cast<GlobalSet*>(node);
+      assert(set->depth() == frames_.size());
+      return New<GlobalSet>(set->var(), NewTopDepth(), Optimize(set->val()));
+    }
+
+    case NodeType::Define: {
+      auto* define = static_cast<Define*>(node);
+      return New<Define>(define->var(), Optimize(define->val()));
+    }
+
+    case NodeType::Lambda:
+      return OptimizeLambda(static_cast<Lambda*>(node));
+
+    case NodeType::Let:
+      return OptimizeLet(static_cast<Let*>(node));
+
+    case NodeType::Receive:
+      return OptimizeReceive(static_cast<Receive*>(node));
+
+    case NodeType::Delay: {
+      auto* delay = static_cast<Delay*>(node);
+      return New<Delay>(OptimizeLambda(delay->thunk()), delay->is_lazy());
+    }
+  }
+
+  assert(false);
+  return node;
+}
+
+Node* Optimizer::OptimizeApply(Apply* apply) {
+  if (auto* lambda = LoopLambda(apply)) {
+    return OptimizeLoop(apply, lambda);
+  }
+  std::vector<Node*> args;
+  if (apply->op()->node_type() == NodeType::LocalRef) {
+    auto* ref = static_cast<LocalRef*>(apply->op());
+    auto frame = FrameIndex(ref->depth());
+    if (frames_[frame].loop) {
+      for (auto* arg : apply->args()) {
+        args.push_back(Optimize(arg));
+      }
+      return New<Recur>(ref->var(), NumFrames(frame + 2, frames_.size()),
+                        std::move(args));
+    }
+  }
+
+  auto* op = Optimize(apply->op());
+  for (auto* arg : apply->args()) {
+    args.push_back(Optimize(arg));
+  }
+
+  Node* call;
+  if (apply->node_type() == NodeType::PrimApply) {
+    auto* prim_apply = static_cast<PrimApply*>(apply);
+    call = New<PrimApply>(static_cast<GlobalRef*>(op), args,
+                          prim_apply->primitive(), prim_apply->expected());
+  } else {
+    call = New<Apply>(op, args);
+  }
+
+  // Fold calls of foldable primitives whose arguments are constants or
+  // folded themselves, taking on the guards of the latter.
+  if (op->node_type() != NodeType::GlobalRef) {
+    return call;
+  }
+  auto* ref = static_cast<GlobalRef*>(op);
+  auto* proc = env_->TryLookup(ref->var());
+  Primitive primitive;
+  if (!proc || !expr::GetPrimitive(proc, &primitive) ||
+      !IsFoldable(primitive)) {
+    return call;
+  }
+
+  Guards guards;
+  std::vector<Expr*> vals;
+  for (auto* arg : args) {
+    auto* val = KnownVal(arg, &guards);
+    if (!val || !IsAtom(val)) {
+      return call;
+    }
+    vals.push_back(val);
+  }
+  if (MayTrap(primitive, vals)) {
+    return call;
+  }
+  AddGuards({{ref, proc}}, &guards);
+
+  try {
+    auto val = expr::TryEvals(proc)->DoEval(env_, vals.data(), vals.size());
+    return New<Folded>(call, std::move(guards), New<Constant>(val.get()));
+  } catch (util::RuntimeException&) {
+    // The error is left for when the call runs.
+    return call;
+  }
+}
+
+// Only the branch a known test takes is kept. If the test was folded, both
+// are still needed for the original code.
+Node* Optimizer::OptimizeIf(If* node) {
+  auto* test = Optimize(node->test());
+  Guards guards;
+  auto* val = KnownVal(test, &guards);
+  auto optimize_branch = [&](Node* branch) {
+    return branch ? Optimize(branch) : nullptr;
+  };
+  if (!val || !guards.empty()) {
+    auto* consequent = Optimize(node->consequent());
+    auto* alternate = optimize_branch(node->alternate());
+    auto* original = New<If>(test, consequent, alternate);
+    if (!val) {
+      return original;
+    }
+    auto* taken = val != expr::False() ? consequent : alternate;
+    return Guard(original, std::move(guards),
+                 taken ? taken : New<Constant>(expr::Nil()));
+  }
+
+  auto* taken = optimize_branch(val != expr::False() ? node->consequent()
+                                                     : node->alternate());
+  return taken ? taken : New<Constant>(expr::Nil());
+}
+
+Node* Optimizer::OptimizeSequence(Sequence* seq) {
+  const auto& body = seq->body();
+  std::vector<Node*> new_body;
+  for (size_t i = 0; i < body.size(); ++i) {
+    bool last = i == body.size() - 1;
+    if (!last && IsPure(body[i])) {
+      continue;
+    }
+    auto* node = Optimize(body[i]);
+    // Splice in nested sequences, whose values are unused but the last.
+    if (node->node_type() == NodeType::Sequence) {
+      const auto& inner = static_cast<Sequence*>(node)->body();
+      new_body.insert(new_body.end(), inner.begin(), inner.end() - 1);
+      node = inner.back();
+    }
+    if (last || node->node_type() != NodeType::Constant) {
+      new_body.push_back(node);
+    }
+  }
+
+  if (new_body.size() == 1) {
+    return new_body[0];
+  }
+  return New<Sequence>(std::move(new_body));
+}
+
+// Tests which are known to be true are dropped, and none after one known to
+// be false are run. The last test is the value, so it is always kept.
+Node* Optimizer::OptimizeAnd(And* node) {
+  std::vector<Node*> all;
+  for (auto* test : node->tests()) {
+    all.push_back(Optimize(test));
+  }
+
+  Guards guards;
+  std::vector<Node*> tests;
+  for (size_t i = 0; i < all.size(); ++i) {
+    auto* val = i < all.size() - 1 ? KnownVal(all[i], &guards) : nullptr;
+    if (!val) {
+      tests.push_back(all[i]);
+    } else if (val == expr::False()) {
+      tests.push_back(New<Constant>(val));
+      break;
+    }
+  }
+
+  Node* folded;
+  if (tests.empty()) {
+    folded = New<Constant>(expr::True());
+  } else if (tests.size() == 1) {
+    folded = tests[0];
+  } else {
+    folded = New<And>(std::move(tests));
+  }
+  return guards.empty() ? folded
+                        : Guard(New<And>(all), std::move(guards), folded);
+}
+
+Node* Optimizer::OptimizeOr(Or* node) {
+  std::vector<Node*> all;
+  for (auto* test : node->tests()) {
+    all.push_back(Optimize(test));
+  }
+
+  Guards guards;
+  std::vector<Node*> tests;
+  for (size_t i = 0; i < all.size(); ++i) {
+    auto* val = i < all.size() - 1 ? KnownVal(all[i], &guards) : nullptr;
+    if (!val) {
+      tests.push_back(all[i]);
+    } else if (val != expr::False()) {
+      tests.push_back(New<Constant>(val));
+      break;
+    }
+  }
+
+  Node* folded;
+  if (tests.empty()) {
+    folded = New<Constant>(expr::False());
+  } else if (tests.size() == 1) {
+    folded = tests[0];
+  } else {
+    folded = New<Or>(std::move(tests));
+  }
+  return guards.empty() ? folded
+                        : Guard(New<Or>(all), std::move(guards), folded);
+}
+
+// Clauses whose test is known to be false are dropped, and one known to be
+// true becomes the else clause.
+Node* Optimizer::OptimizeCond(Cond* cond) {
+  std::vector<Cond::Clause> all;
+  for (const auto& clause : cond->clauses()) {
+    all.push_back({Optimize(clause.test),
+                   clause.body ? Optimize(clause.body) : nullptr,
+                   clause.is_arrow});
+  }
+  auto* else_body = cond->else_body() ? Optimize(cond->else_body()) : nullptr;
+
+  Guards guards;
+  std::vector<Cond::Clause> clauses;
+  auto* taken = else_body;
+  for (const auto& clause : all) {
+    auto* val = clause.is_arrow ? nullptr : KnownVal(clause.test, &guards);
+    if (!val) {
+      clauses.push_back(clause);
+    } else if (val != expr::False()) {
+      taken = clause.body ? clause.body : New<Constant>(val);
+      break;
+    }
+  }
+
+  Node* folded;
+  if (clauses.empty()) {
+    folded = taken ? taken : New<Constant>(expr::Nil());
+  } else {
+    folded = New<Cond>(std::move(clauses), taken);
+  }
+  return guards.empty() ? folded
+                        : Guard(New<Cond>(all, else_body), std::move(guards),
+                                folded);
+}
+
+Lambda* Optimizer::OptimizeLambda(Lambda* lambda) {
+  Frame frame;
+  frame.slots.resize(lambda->num_slots());
+  auto num_args =
+      lambda->required_args().size() + (lambda->variable_arg() ? 1 : 0);
+  for (size_t i = 0; i < frame.slots.size(); ++i) {
+    frame.slots[i].initialized = i < num_args;
+    frame.slots[i].new_index = i;
+  }
+  CountRefs(lambda->body(), 0, &frame.slots);
+  auto boxed = BoxSlots(&frame);
+
+  // The closure's frame is enclosed by the top level as seen from here.
+  auto top_depth = NewTopDepth();
+  levels_.push_back({frames_.size(), {}});
+  frames_.push_back(std::move(frame));
+  auto* body = Optimize(lambda->body());
+  frames_.pop_back();
+  std::vector<LocalRef*> captures;
+  for (const auto& capture : levels_.back().captures) {
+    captures.push_back(capture.source);
+  }
+  levels_.pop_back();
+
+  body->MarkTail();
+  return New<Lambda>(lambda->required_args(), lambda->variable_arg(),
+                     lambda->num_slots(), body,
+                     FlatClosure{std::move(captures), top_depth,
+                                 std::move(boxed)});
+}
+
+// static
+Lambda* Optimizer::LoopLambda(Apply* apply) {
+  // Matches the tree Analyze() makes for named let.
+  if (apply->op()->node_type() != NodeType::Let) {
+    return nullptr;
+  }
+  auto* let = static_cast<Let*>(apply->op());
+  if (let->kind() != Let::Kind::LETREC || let->num_slots() != 1 ||
+      let->inits().size() != 1 ||
+      let->inits()[0]->node_type() != NodeType::Lambda ||
+      let->body()->node_type() != NodeType::LocalRef) {
+    return nullptr;
+  }
+  auto* ref = static_cast<LocalRef*>(let->body());
+  auto* lambda = static_cast<Lambda*>(let->inits()[0]);
+  auto num_args = lambda->required_args().size();
+  // Internal definitions would need their slots cleared for each iteration.
+  if (ref->depth() != 0 || lambda->variable_arg() ||
+      lambda->num_slots() != num_args || apply->args().size() != num_args) {
+    return nullptr;
+  }
+
+  std::vector<Slot> slots(1);
+  slots[0].loop_arity = num_args;
+  CountRefs(lambda->body(), 1, &slots);
+  const auto& slot = slots[0];
+  return slot.num_sets == 0 && slot.num_refs == slot.num_loop_calls ? lambda
+                                                                    : nullptr;
+}
+
+// The loop's frame takes the place of the frame of each call of |lambda|. The
+// frame which held the procedure is elided.
+Node* Optimizer::OptimizeLoop(Apply* apply, Lambda* lambda) {
+  std::vector<Node*> inits;
+  for (auto* arg : apply->args()) {
+    inits.push_back(Optimize(arg));
+  }
+
+  Frame proc_frame;
+  proc_frame.slots.resize(1);
+  proc_frame.elided = true;
+  proc_frame.loop = true;
+  Frame frame;
+  frame.slots.resize(lambda->num_slots());
+  for (size_t i = 0; i < frame.slots.size(); ++i) {
+    frame.slots[i].initialized = true;
+    frame.slots[i].new_index = i;
+  }
+  CountRefs(lambda->body(), 0, &frame.slots);
+  auto boxed = BoxSlots(&frame);
+
+  frames_.push_back(std::move(proc_frame));
+  frames_.push_back(std::move(frame));
+  auto* body = Optimize(lambda->body());
+  frames_.pop_back();
+  frames_.pop_back();
+
+  auto* let = static_cast<Let*>(apply->op());
+  return New<Loop>(let->vars()[0], lambda->required_args(), std::move(inits),
+                   body, std::move(boxed));
+}
+
+// Bindings which are never set! and bound to a constant or a copy of another
+// such variable are replaced by their value. Those left unreferenced with
+// pure inits are dropped, along with the frame if nothing is left in it.
+Node* Optimizer::OptimizeLet(Let* let) {
+  const auto& vars = let->vars();
+  const auto& inits = let->inits();
+  bool is_let = let->kind() == Let::Kind::LET;
+
+  Frame frame;
+  frame.slots.resize(let->num_slots());
+  for (size_t i = 0; i < vars.size(); ++i) {
+    frame.slots[i].initialized = let->kind() != Let::Kind::LETREC;
+  }
+  CountRefs(let->body(), 0, &frame.slots);
+  if (!is_let) {
+    for (auto* init : inits) {
+      CountRefs(init, 0, &frame.slots);
+    }
+  }
+
+  // The bindings are decided from the unoptimized inits, in order, so let*
+  // inits may refer to the bindings before them.
+  if (!is_let) {
+    frames_.push_back(std::move(frame));
+  }
+  auto& slots = is_let ? frame.slots : frames_.back().slots;
+  size_t num_kept = 0;
+  for (size_t i = 0; i < slots.size(); ++i) {
+    auto& slot = slots[i];
+    if (i < vars.size() && slot.initialized && slot.num_sets == 0) {
+      if (inits[i]->node_type() == NodeType::Constant) {
+        slot.constant = static_cast<Constant*>(inits[i])->val();
+      } else if (inits[i]->node_type() == NodeType::LocalRef) {
+        auto* ref = static_cast<LocalRef*>(inits[i]);
+        auto& target = SlotAt(ref->depth(), ref->index());
+        if (target.initialized && target.num_sets == 0) {
+          slot.copy = ref;
+          slot.copy_frame = FrameIndex(ref->depth());
+        }
+      }
+    }
+    bool unused = slot.constant || slot.copy ||
+                  (slot.num_refs == 0 && slot.num_sets == 0);
+    slot.dropped = i < vars.size() && unused && IsPure(inits[i]);
+    if (!slot.dropped) {
+      slot.new_index = num_kept++;
+    }
+  }
+  if (is_let) {
+    frame.elided = num_kept == 0;
+  } else {
+    frames_.back().elided = num_kept == 0;
+  }
+  auto boxed = BoxSlots(is_let ? &frame : &frames_.back());
+
+  std::vector<expr::Symbol*> new_vars;
+  std::vector<Node*> new_inits;
+  auto optimize_inits = [&]() {
+    for (size_t i = 0; i < vars.size(); ++i) {
+      const auto& slot = is_let ? frame.slots[i] : frames_.back().slots[i];
+      if (!slot.dropped) {
+        new_vars.push_back(vars[i]);
+        new_inits.push_back(Optimize(inits[i]));
+      }
+    }
+  };
+
+  optimize_inits();
+  if (is_let) {
+    frames_.push_back(std::move(frame));
+  }
+  bool elided = frames_.back().elided;
+  auto* body = Optimize(let->body());
+  frames_.pop_back();
+
+  if (elided) {
+    return body;
+  }
+  // Closures no longer refer to the frame, so it never escapes.
+  return New<Let>(let->kind(), std::move(new_vars), std::move(new_inits),
+                  num_kept, body, false, std::move(boxed));
+}
+
+// The received values aren't known, so every binding is kept.
+Node* Optimizer::OptimizeReceive(Receive* receive) {
+  auto* producer = Optimize(receive->producer());
+
+  Frame frame;
+  frame.slots.resize(receive->num_slots());
+  auto num_vars =
+      receive->required_vars().size() + (receive->variable_var() ? 1 : 0);
+  for (size_t i = 0; i < frame.slots.size(); ++i) {
+    frame.slots[i].initialized = i < num_vars;
+    frame.slots[i].new_index = i;
+  }
+  CountRefs(receive->body(), 0, &frame.slots);
+  auto boxed = BoxSlots(&frame);
+
+  frames_.push_back(std::move(frame));
+  auto* body = Optimize(receive->body());
+  frames_.pop_back();
+
+  return New<Receive>(receive->required_vars(), receive->variable_var(),
+                      receive->num_slots(), producer, body, false,
+                      std::move(boxed));
+}
+
+// static
+std::vector<size_t> Optimizer::BoxSlots(Frame* frame) {
+  std::vector<size_t> boxed;
+  for (auto& slot : frame->slots) {
+    slot.boxed = !slot.dropped &&
+                 (slot.assigned ||
+                  (slot.captured && (slot.num_sets > 0 || !slot.initialized)));
+    if (slot.boxed) {
+      boxed.push_back(slot.new_index);
+    }
+  }
+  return boxed;
+}
+
+// static
+void Optimizer::CountRefs(Node* node,
+                          size_t level,
+                          std::vector<Slot>* slots,
+                          bool in_closure) {
+  auto count = [&](Node* child) {
+    CountRefs(child, level, slots, in_closure);
+  };
+  switch (node->node_type()) {
+    case NodeType::Constant:
+    case NodeType::GlobalRef:
+      return;
+
+    case NodeType::LocalRef: {
+      auto* ref = static_cast<LocalRef*>(node);
+      if (ref->depth() == level) {
+        ++(*slots)[ref->index()].num_refs;
+        (*slots)[ref->index()].captured |= in_closure;
+      }
+      return;
+    }
+
+    case NodeType::Apply:
+    case NodeType::PrimApply: {
+      auto* apply = static_cast<Apply*>(node);
+      if (apply->op()->node_type() == NodeType::LocalRef && apply->tail() &&
+          !in_closure) {
+        auto* ref = static_cast<LocalRef*>(apply->op());
+        if (ref->depth() == level &&
+            apply->args().size() == (*slots)[ref->index()].loop_arity) {
+          ++(*slots)[ref->index()].num_loop_calls;
+        }
+      }
+      count(apply->op());
+      for (auto* arg : apply->args()) {
+        count(arg);
+      }
+      return;
+    }
+
+    case NodeType::Folded:
+      count(static_cast<Folded*>(node)->original());
+      return;
+
+    // Only made by Optimize().
+    case NodeType::Loop:
+    case NodeType::Recur:
+      assert(false);
+      return;
+
+    case NodeType::If: {
+      auto* if_node = static_cast<If*>(node);
+      count(if_node->test());
+      count(if_node->consequent());
+      if (if_node->alternate()) {
+        count(if_node->alternate());
+      }
+      return;
+    }
+
+    case NodeType::Sequence:
+      for (auto* child : static_cast<Sequence*>(node)->body()) {
+        count(child);
+      }
+      return;
+
+    case NodeType::And:
+      for (auto* test : static_cast<And*>(node)->tests()) {
+        count(test);
+      }
+      return;
+
+    case NodeType::Or:
+      for (auto* test : static_cast<Or*>(node)->tests()) {
+        count(test);
+      }
+      return;
+
+    case NodeType::Cond: {
+      auto* cond = static_cast<Cond*>(node);
+      for (const auto& clause : cond->clauses()) {
+        count(clause.test);
+        if (clause.body) {
+          count(clause.body);
+        }
+      }
+      if (cond->else_body()) {
+        count(cond->else_body());
+      }
+      return;
+    }
+
+    case NodeType::Case: {
+      auto* case_node = static_cast<Case*>(node);
+      count(case_node->key());
+      for (const auto& clause : case_node->clauses()) {
+        count(clause.body);
+      }
+      if (case_node->else_body()) {
+        count(case_node->else_body());
+      }
+      return;
+    }
+
+    case NodeType::LocalSet: {
+      auto* set = static_cast<LocalSet*>(node);
+      if (set->depth() == level) {
+        ++(*slots)[set->index()].num_sets;
+        (*slots)[set->index()].assigned |= !set->is_define();
+        (*slots)[set->index()].captured |= in_closure;
+      }
+      count(set->val());
+      return;
+    }
+
+    case NodeType::GlobalSet:
+      count(static_cast<GlobalSet*>(node)->val());
+      return;
+
+    case NodeType::Define:
+      count(static_cast<Define*>(node)->val());
+      return;
+
+    case NodeType::Lambda:
+      CountRefs(static_cast<Lambda*>(node)->body(), level + 1, slots, true);
+      return;
+
+    case NodeType::Let: {
+      auto* let = static_cast<Let*>(node);
+      auto init_level = let->kind() == Let::Kind::LET ? level : level + 1;
+      for (auto* init : let->inits()) {
+        CountRefs(init, init_level, slots, in_closure);
+      }
+      CountRefs(let->body(), level + 1, slots, in_closure);
+      return;
+    }
+
+    case NodeType::Receive: {
+      auto* receive = static_cast<Receive*>(node);
+      count(receive->producer());
+      CountRefs(receive->body(), level + 1, slots, in_closure);
+      return;
+    }
+
+    case NodeType::Delay:
+      count(static_cast<Delay*>(node)->thunk());
+      return;
+  }
+}
+
+bool Optimizer::IsPure(Node* node) const {
+  switch (node->node_type()) {
+    case NodeType::Constant:
+    case NodeType::Lambda:
+    case NodeType::Delay:
+      return true;
+    case NodeType::LocalRef: {
+      // Otherwise it may be unassigned.
+      auto* ref = static_cast<LocalRef*>(node);
+      return frames_[FrameIndex(ref->depth())].slots[ref->index()].initialized;
+    }
+    default:
+      return false;
+  }
+}
+
+size_t Optimizer::NumFrames(size_t from, size_t to) const {
+  size_t num_frames = 0;
+  for (size_t i = from; i < to; ++i) {
+    if (!frames_[i].elided) {
+      ++num_frames;
+    }
+  }
+  return num_frames;
+}
+
+Node* Optimizer::NewLocalRef(expr::Symbol* var, size_t frame, size_t index) {
+  const auto& slot = frames_[frame].slots[index];
+  if (slot.constant) {
+    return New<Constant>(slot.constant);
+  }
+  if (slot.copy) {
+    return NewLocalRef(slot.copy->var(), slot.copy_frame,
+                       slot.copy->index());
+  }
+  auto* loc = Locate(var, levels_.size() - 1, frames_.size(), frame, index);
+  if (!slot.boxed) {
+    return loc;
+  }
+  return New<LocalRef>(var, loc->depth(), loc->index(), true);
+}
+
+LocalRef* Optimizer::Locate(expr::Symbol* var,
+                            size_t level,
+                            size_t end,
+                            size_t frame,
+                            size_t index) {
+  auto& lv = levels_[level];
+  if (frame >= lv.first_frame) {
+    const auto& slot = frames_[frame].slots[index];
+    assert(!slot.dropped && !frames_[frame].elided);
+    return New<LocalRef>(var, NumFrames(frame + 1, end), slot.new_index);
+  }
+
+  // The closure's frame follows the frames of its body.
+  auto depth = NumFrames(lv.first_frame, end);
+  for (size_t i = 0; i < lv.captures.size(); ++i) {
+    if (lv.captures[i].frame == frame && lv.captures[i].index == index) {
+      return New<LocalRef>(var, depth, i);
+    }
+  }
+  auto* source = Locate(var, level - 1, lv.first_frame, frame, index);
+  levels_[level].captures.push_back({frame, index, source});
+  return New<LocalRef>(var, depth, levels_[level].captures.size() - 1);
+}
+
+}  // namespace
+
+gc::Lock<Node> Optimize(Node* node, Env* env) {
+  Optimizer optimizer(env);
+  return gc::Lock<Node>(optimizer.Optimize(node));
+}
+
+}  // namespace eval
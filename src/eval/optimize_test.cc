@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <string>
+
+#include "eval/eval.h"
+#include "eval/node.h"
+#include "expr/number.h"
+#include "expr/primitive.h"
+#include "parse/parse.h"
+#include "test/util.h"
+
+using expr::Expr;
+using expr::Int;
+
+namespace eval {
+
+class OptimizeTest : public test::TestBase {
+ protected:
+  OptimizeTest() : env_(GetDefaultEnv()) {}
+
+  // Returns the optimized form of |str| as --dump-optimized prints it.
+  std::string OptimizeStr(const std::string& str) {
+    auto expr = parse::Read(str)[0];
+    auto node = Analyze(expr.get(), env_.get());
+    std::ostringstream os;
+    os << *Optimize(node.get(), env_.get());
+    return os.str();
+  }
+
+  gc::Lock<Expr> EvalStr(const std::string& str) {
+    return Eval(parse::Read(str)[0].get(), env_.get());
+  }
+
+  gc::Lock<expr::Env> env_;
+};
+
+TEST_F(OptimizeTest, Fold) {
+  EXPECT_EQ("3", OptimizeStr("(+ 1 2)"));
+  EXPECT_EQ("#t", OptimizeStr("(< (* 2 3) (+ 4 5))"));
+  EXPECT_EQ("(f 3)", OptimizeStr("(f (+ 1 2))"));
+
+  // Calls which fail, have effects or allocate are left alone.
+  EXPECT_EQ("(/ 1 0)", OptimizeStr("(/ 1 0)"));
+  EXPECT_EQ("(symbol->string (quote a))", OptimizeStr("(symbol->string 'a)"));
+  EXPECT_EQ("(list 1 2)", OptimizeStr("(list 1 2)"));
+  EXPECT_EQ("(+ x 1)", OptimizeStr("(+ x 1)"));
+  EXPECT_EQ("(quotient -9223372036854775808 -1)",
+            OptimizeStr("(quotient -9223372036854775808 -1)"));
+  EXPECT_THROW(EvalStr("(+ 1 'a)"), util::RuntimeException);
+}
+
+TEST_F(OptimizeTest, DeadCode) {
+  EXPECT_EQ("(f)", OptimizeStr("(if #t (f) (g))"));
+  EXPECT_EQ("(g)", OptimizeStr("(if (> 1 2) (f) (g))"));
+  EXPECT_EQ("(quote '())", OptimizeStr("(if #f (f))"));
+  EXPECT_EQ("(f)", OptimizeStr("(begin 1 (lambda () 2) (f))"));
+  EXPECT_EQ("(begin (f) (g) 2)",
+            OptimizeStr("(begin (begin (f) 1) (begin (g) 2))"));
+  EXPECT_EQ("(and (f) (g))", OptimizeStr("(and 1 (f) #t (g))"));
+  EXPECT_EQ("(and (f) #f)", OptimizeStr("(and (f) #f (g))"));
+  EXPECT_EQ("(or (f) 1)", OptimizeStr("(or #f (f) 1 (g))"));
+  EXPECT_EQ("#t", OptimizeStr("(and)"));
+  EXPECT_EQ("(cond ((f) 1) (else 2))",
+            OptimizeStr("(cond (#f 0) ((f) 1) ((= 1 1) 2) (else 3))"));
+  EXPECT_EQ("3", OptimizeStr("(cond ((null? 1) 2) (else 3))"));
+  EXPECT_EQ("(case x ((1 2) (f)) ((a) 3) (else (g)))",
+            OptimizeStr("(case x ((1 2) (f)) ((a) 3) (else (g)))"));
+
+  // Unbound variables are still reported.
+  EXPECT_EQ("(begin undefined-var 1)", OptimizeStr("(begin undefined-var 1)"));
+}
+
+TEST_F(OptimizeTest, Propagate) {
+  EXPECT_EQ("10", OptimizeStr("(let ((x 5) (y 2)) (* x y))"));
+  EXPECT_EQ("(f 1 1)", OptimizeStr("(let* ((x 1) (y x)) (f x y))"));
+  EXPECT_EQ("(lambda (a) (car a))",
+            OptimizeStr("(lambda (a) (let ((b a)) (car b)))"));
+
+  // Assigned variables and impure inits stay.
+  EXPECT_EQ("(let ((x 1)) (begin (set! x 2) x))",
+            OptimizeStr("(let ((x 1) (unused 2)) (set! x 2) x)"));
+  EXPECT_EQ("(let ((x (f))) 1)", OptimizeStr("(let ((x (f))) 1)"));
+  EXPECT_EQ("(letrec ((a (lambda () b)) (b 1)) (a))",
+            OptimizeStr("(letrec ((a (lambda () b)) (b 1)) (a))"));
+
+  // References across removed frames and slots are renumbered.
+  // clang-format off
+  (void)EvalStr(
+      "(define (f a)"
+      "  (let ((k 1) (n (+ a 1)))"
+      "    (let ((m 2))"
+      "      (lambda (b) (list a k n m b)))))");
+  EXPECT_EQ(*parse::Read("(5 1 6 2 7)")[0], *EvalStr("((f 5) 7)"));
+  EXPECT_EQ(*parse::Read("(1 2 3)")[0], *EvalStr(
+      "(let* ((x 1) (y (list x 2)) (z 3))"
+      "  (define w (append y (list z)))"
+      "  w)"));
+  // clang-format on
+}
+
+TEST_F(OptimizeTest, Loop) {
+  EXPECT_EQ("(let loop ((i 0)) (if (< i n) (loop (+ i 1)) i))",
+            OptimizeStr("(let loop ((i 0)) (if (< i n) (loop (+ i 1)) i))"));
+  EXPECT_EQ(
+      "(let #do-loop ((i 0)) (if (= i n) (quote '()) (begin (f i) "
+      "(#do-loop (+ i 1)))))",
+      OptimizeStr("(do ((i 0 (+ i 1))) ((= i n)) (f i))"));
+
+  // Procedures used other than by tail calls stay procedures.
+  EXPECT_EQ(
+      "((letrec ((loop (lambda (i) (+ 1 (loop i))))) loop) 0)",
+      OptimizeStr("(let loop ((i 0)) (+ 1 (loop i)))"));
+  EXPECT_EQ(
+      "((letrec ((loop (lambda (i) (f loop)))) loop) 0)",
+      OptimizeStr("(let loop ((i 0)) (f loop))"));
+  EXPECT_EQ(
+      "((letrec ((loop (lambda (i) (f (lambda () (loop i)))))) loop) 0)",
+      OptimizeStr("(let loop ((i 0)) (f (lambda () (loop i))))"));
+}
+
+TEST_F(OptimizeTest, Quasiquote) {
+  EXPECT_EQ("(quote (a . (b . '())))", OptimizeStr("`(a b)"));
+  EXPECT_EQ("(cons (quote a) (cons x (quote (c . (d . '())))))",
+            OptimizeStr("`(a ,x c d)"));
+  EXPECT_EQ("(list (quote a) x)", OptimizeStr("`(a ,x)"));
+  EXPECT_EQ("(cons x (append y (quote (c . '()))))",
+            OptimizeStr("`(,x ,@y c)"));
+  EXPECT_EQ("(list->vector (list 1 x))", OptimizeStr("`#(1 ,x)"));
+}
+
+TEST_F(OptimizeTest, Rebound) {
+  (void)EvalStr("(define (three) (+ 1 2))");
+  EXPECT_EQ(*gc::make_locked<Int>(3), *EvalStr("(three)"));
+  (void)EvalStr("(set! + *)");
+  EXPECT_EQ(*gc::make_locked<Int>(2), *EvalStr("(three)"));
+}
+
+}  // namespace eval
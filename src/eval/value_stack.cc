@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "eval/value_stack.h"
+
+#include <algorithm>
+
+using expr::Env;
+using expr::Expr;
+
+namespace eval {
+
+namespace {
+
+// Both stacks are sized for recursion as deep as eval::SetMaxStack() allows.
+// Their pages are only committed once the stack grows into them.
+
+// Number of slots in the value stack.
+constexpr size_t kStackSize = 1 << 25;
+
+// Number of bytes in the frame stack.
+constexpr size_t kFrameStackSize = 1 << 28;
+
+}  // namespace
+
+// static
+ValueStack& ValueStack::Get() {
+  static ValueStack stack;
+  return stack;
+}
+
+ValueStack::ValueStack()
+    : stack_(new Expr*[kStackSize]),
+      top_(stack_.get()),
+      limit_(stack_.get() + kStackSize) {
+  gc::Gc::Get().AddRootSet(this);
+}
+
+ValueStack::~ValueStack() {
+  gc::Gc::Get().RemoveRootSet(this);
+}
+
+Expr** ValueStack::Push(size_t num_slots) {
+  auto* slots = top_;
+  SetTop(top_ + num_slots);
+  std::fill(slots, top_, nullptr);
+  return slots;
+}
+
+void ValueStack::MarkRoots() {
+  for (auto** slot = stack_.get(); slot < top_; ++slot) {
+    if (*slot) {
+      (*slot)->GcMark();
+    }
+  }
+}
+
+// static
+FrameStack& FrameStack::Get() {
+  static FrameStack stack;
+  return stack;
+}
+
+FrameStack::FrameStack()
+    : stack_(new char[kFrameStackSize]),
+      top_(stack_.get()),
+      limit_(stack_.get() + kFrameStackSize) {
+  gc::Gc::Get().AddRootSet(this);
+}
+
+FrameStack::~FrameStack() {
+  gc::Gc::Get().RemoveRootSet(this);
+  PopTo(stack_.get());
+}
+
+Env* FrameStack::Push(Env* enclosing, size_t num_slots) {
+  auto size = Env::FrameSize(num_slots);
+  if (size > static_cast<size_t>(limit_ - top_)) {
+    throw util::RuntimeException("Stack overflow", nullptr);
+  }
+  auto* frame = Env::NewFrameAt(top_, enclosing, num_slots);
+  top_ += size;
+  return frame;
+}
+
+void FrameStack::PopTo(char* top) {
+  // Frames vary in size, so find those above |top| from the bottom up.
+  for (auto* pos = top; pos < top_;) {
+    auto* frame = reinterpret_cast<Env*>(pos);
+    pos += Env::FrameSize(frame->num_slots());
+    Env::DeleteFrameAt(frame);
+  }
+  top_ = top;
+}
+
+// Frames aren't in the heap, so their marks are never cleared by a sweep.
+// Mark their references directly instead, as GcMark() would skip a frame
+// marked by an earlier collection.
+void FrameStack::MarkRoots() {
+  for (auto* pos = stack_.get(); pos < top_;) {
+    auto* frame = reinterpret_cast<Env*>(pos);
+    pos += Env::FrameSize(frame->num_slots());
+    frame->MarkReferences();
+  }
+}
+
+}  // namespace eval
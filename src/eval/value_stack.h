@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVAL_VALUE_STACK_H_
+#define EVAL_VALUE_STACK_H_
+
+#include <cstddef>
+#include <memory>
+
+#include "expr/expr.h"
+#include "gc/gc.h"
+#include "util/macros.h"
+
+namespace eval {
+
+// Values being passed between procedures: evaluated arguments and the VM's
+// registers. Every slot below the top is a GC root, so values on the stack
+// need no locks, and pushing never allocates.
+class ValueStack : public gc::RootSet {
+ public:
+  static ValueStack& Get();
+
+  expr::Expr** top() const { return top_; }
+
+  // Moves the top to |top|. Throws if that would overflow the stack. Slots
+  // above the old top must be set before a collection can run.
+  void SetTop(expr::Expr** top) {
+    if (top > limit_) {
+      throw util::RuntimeException("Stack overflow", nullptr);
+    }
+    top_ = top;
+  }
+
+  // Returns |num_slots| slots pushed onto the top, cleared to null.
+  expr::Expr** Push(size_t num_slots);
+
+  // RootSet implementation:
+  void MarkRoots() override;
+
+ private:
+  ValueStack();
+  ~ValueStack();
+
+  std::unique_ptr<expr::Expr*[]> stack_;
+  expr::Expr** top_;
+  expr::Expr** const limit_;
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(ValueStack);
+};
+
+// Slots pushed onto the value stack for the life of the object.
+class StackSlots {
+ public:
+  explicit StackSlots(size_t num_slots)
+      : stack_(ValueStack::Get()),
+        prev_top_(stack_.top()),
+        slots_(stack_.Push(num_slots)) {}
+  ~StackSlots() { stack_.SetTop(prev_top_); }
+
+  expr::Expr*& operator[](size_t index) { return slots_[index]; }
+  expr::Expr** get() { return slots_; }
+
+ private:
+  ValueStack& stack_;
+  expr::Expr** const prev_top_;
+  expr::Expr** const slots_;
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(StackSlots);
+};
+
+// Frames of scopes which the analyzer proved no closure or promise captures.
+// They are popped when their scope exits rather than left for the collector.
+// Live frames are GC roots.
+class FrameStack : public gc::RootSet {
+ public:
+  static FrameStack& Get();
+
+  char* top() const { return top_; }
+
+  // Returns a new frame on top of the stack. Throws if the stack is full.
+  expr::Env* Push(expr::Env* enclosing, size_t num_slots);
+
+  // Pops the frames above |top|.
+  void PopTo(char* top);
+
+  // Moves the top to |top| without constructing or destroying frames, once a
+  // continuation has copied the frames below it back into place.
+  void RestoreTop(char* top) { top_ = top; }
+
+  bool Contains(const void* ptr) const {
+    return ptr >= stack_.get() && ptr < limit_;
+  }
+
+  // RootSet implementation:
+  void MarkRoots() override;
+
+ private:
+  FrameStack();
+  ~FrameStack();
+
+  std::unique_ptr<char[]> stack_;
+  char* top_;
+  char* const limit_;
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(FrameStack);
+};
+
+// Frames pushed onto the frame stack are popped when the object is destroyed.
+class StackFrames {
+ public:
+  StackFrames() : stack_(FrameStack::Get()), prev_top_(stack_.top()) {}
+  ~StackFrames() { stack_.PopTo(prev_top_); }
+
+  expr::Env* Push(expr::Env* enclosing, size_t num_slots) {
+    return stack_.Push(enclosing, num_slots);
+  }
+
+  // Pops the frames pushed so far.
+  void Clear() { stack_.PopTo(prev_top_); }
+
+ private:
+  FrameStack& stack_;
+  char* const prev_top_;
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(StackFrames);
+};
+
+}  // namespace eval
+
+#endif  // EVAL_VALUE_STACK_H_
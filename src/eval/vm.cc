@@ -0,0 +1,456 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "eval/vm.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "eval/call_stack.h"
+#include "eval/limits.h"
+#include "eval/node.h"
+#include "eval/value_stack.h"
+#include "util/exceptions.h"
+
+using expr::Env;
+using expr::Expr;
+using expr::Nil;
+using util::RuntimeException;
+
+namespace eval {
+
+namespace {
+
+// Each call's window of the value stack starts with the procedure being run
+// and its current frame, keeping both alive. Registers follow.
+constexpr size_t kProcSlot = 0;
+constexpr size_t kEnvSlot = 1;
+constexpr size_t kNumHeaderSlots = 2;
+
+struct OpcodeInfo {
+  const char* name;
+  size_t num_operands;
+};
+
+const OpcodeInfo kOpcodeInfo[] = {
+#define X(name, num_operands) {#name, num_operands},
+#include "eval/opcodes.inc"  // NOLINT(build/include)
+#undef X
+};
+
+}  // namespace
+
+// Runs bytecode. Calls from one Closure to another push a frame rather than
+// recursing, so only calls through other procedures use the C++ stack.
+class Vm {
+ public:
+  static Vm& Get() {
+    static Vm vm;
+    return vm;
+  }
+
+  gc::Lock<Expr> Run(Code* code, Env* env);
+  gc::Lock<Expr> Call(Closure* closure, Expr** args, size_t num_args);
+
+ private:
+  friend std::vector<VmFrame>& VmFrames();
+
+  Vm() : stack_(ValueStack::Get()) {}
+  ~Vm() = default;
+
+  // Sets up the window at |base| for |code|, with |proc| and |env| in its
+  // header and every register cleared.
+  void InitWindow(Expr** base, Code* code, Expr* proc, Env* env);
+
+  // Binds |args| in a new frame and sets up the window at |base| to run
+  // |closure|'s body. |args| may be in the window being replaced.
+  void EnterClosure(Closure* closure,
+                    Expr** args,
+                    size_t num_args,
+                    Expr** base);
+
+  // Wraps Execute(), unwinding to the current state on exceptions.
+  gc::Lock<Expr> ExecuteGuarded();
+
+  // Runs the top frame until it returns.
+  gc::Lock<Expr> Execute();
+
+  ValueStack& stack_;
+  std::vector<VmFrame> frames_;
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(Vm);
+};
+
+gc::Lock<Expr> Vm::Run(Code* code, Env* env) {
+  auto* base = stack_.top();
+  InitWindow(base, code, code, env);
+  frames_.push_back({code, code->code_.data(), base, 0});
+  return ExecuteGuarded();
+}
+
+gc::Lock<Expr> Vm::Call(Closure* closure, Expr** args, size_t num_args) {
+  // Holds |closure| until its window does.
+  StackSlots proc(1);
+  proc[0] = closure;
+  auto* base = stack_.top();
+  EnterClosure(closure, args, num_args, base);
+  auto* code = closure->code();
+  frames_.push_back({code, code->code_.data(), base, 0});
+  return ExecuteGuarded();
+}
+
+void Vm::InitWindow(Expr** base, Code* code, Expr* proc, Env* env) {
+  auto* end = base + kNumHeaderSlots + code->num_regs_;
+  stack_.SetTop(end);
+  base[kProcSlot] = proc;
+  base[kEnvSlot] = env;
+  std::fill(base + kNumHeaderSlots, end, nullptr);
+}
+
+void Vm::EnterClosure(Closure* closure,
+                      Expr** args,
+                      size_t num_args,
+                      Expr** base) {
+  Step();
+  auto* code = closure->code();
+  if (num_args < code->num_required_ ||
+      (num_args > code->num_required_ && !code->has_rest_)) {
+    ThrowArgCountError(code->num_required_, code->has_rest_, num_args);
+  }
+
+  // The arguments stay reachable from the caller until the window is reused.
+  auto frame = Env::NewFrame(closure->env(), code->num_slots_);
+  size_t slot = 0;
+  for (; slot < code->num_required_; ++slot) {
+    frame->slot(slot) = args[slot];
+  }
+  if (code->has_rest_) {
+    gc::Lock<Expr> rest(Nil());
+    for (size_t i = num_args; i > slot; --i) {
+      rest.reset(new expr::Pair(args[i - 1], rest.get()));
+    }
+    frame->slot(slot) = rest.get();
+  }
+
+  InitWindow(base, code, closure, frame.get());
+}
+
+gc::Lock<Expr> Vm::ExecuteGuarded() {
+  auto num_frames = frames_.size() - 1;
+  auto* top = frames_.back().base;
+  try {
+    return Execute();
+  } catch (...) {
+    frames_.resize(num_frames);
+    stack_.SetTop(top);
+    throw;
+  }
+}
+
+gc::Lock<Expr> Vm::Execute() {
+  static void* const kLabels[] = {
+#define X(name, num_operands) &&op_##name,
+#include "eval/opcodes.inc"  // NOLINT(build/include)
+#undef X
+  };
+
+  const auto entry = frames_.size() - 1;
+  Code* code;
+  const uint32_t* pc;
+  Expr** base;
+  Expr** regs;
+  Env* env;
+  Expr* val;
+
+#define LOAD_FRAME()                          \
+  do {                                        \
+    const auto& frame = frames_.back();       \
+    code = frame.code;                        \
+    pc = frame.pc;                            \
+    base = frame.base;                        \
+    regs = base + kNumHeaderSlots;            \
+    env = static_cast<Env*>(base[kEnvSlot]);  \
+  } while (0)
+#define DISPATCH() goto* kLabels[*pc++]
+#define CONST(i) (code->consts_[pc[i]])
+#define SYMBOL(i) (static_cast<expr::Symbol*>(CONST(i)))
+
+  LOAD_FRAME();
+  DISPATCH();
+
+op_Const:
+  regs[pc[0]] = CONST(1);
+  pc += 2;
+  DISPATCH();
+
+op_LocalRef0:
+  val = env->slot(pc[1]);
+  if (!val) {
+    throw RuntimeException("Attempt to reference unassigned variable",
+                           CONST(2));
+  }
+  regs[pc[0]] = val;
+  pc += 3;
+  DISPATCH();
+
+op_LocalRef:
+  val = FrameAt(env, pc[1])->slot(pc[2]);
+  if (!val) {
+    throw RuntimeException("Attempt to reference unassigned variable",
+                           CONST(3));
+  }
+  regs[pc[0]] = val;
+  pc += 4;
+  DISPATCH();
+
+op_GlobalRef: {
+  auto* top = FrameAt(env, pc[1]);
+  auto** cell = code->cells_[pc[3]].Get(top, SYMBOL(2));
+  regs[pc[0]] = cell ? *cell : top->Lookup(SYMBOL(2));
+  pc += 4;
+  DISPATCH();
+}
+
+op_LocalSet:
+  FrameAt(env, pc[1])->slot(pc[2]) = regs[pc[0]];
+  pc += 3;
+  DISPATCH();
+
+op_GlobalSet: {
+  auto* top = FrameAt(env, pc[1]);
+  if (auto** cell = code->cells_[pc[3]].Get(top, SYMBOL(2))) {
+    *cell = regs[pc[0]];
+  } else {
+    top->SetVar(SYMBOL(2), regs[pc[0]]);
+  }
+  pc += 4;
+  DISPATCH();
+}
+
+op_Define:
+  env->DefineVar(SYMBOL(1), regs[pc[0]]);
+  pc += 2;
+  DISPATCH();
+
+op_Move:
+  regs[pc[0]] = regs[pc[1]];
+  pc += 2;
+  DISPATCH();
+
+op_Jump: {
+  auto* target = code->code_.data() + pc[0];
+  // Loops jump back.
+  if (target < pc) {
+    Step();
+  }
+  pc = target;
+  DISPATCH();
+}
+
+op_JumpIfFalse:
+  pc = regs[pc[0]] == expr::False() ? code->code_.data() + pc[1] : pc + 2;
+  DISPATCH();
+
+op_JumpIfTrue:
+  pc = regs[pc[0]] != expr::False() ? code->code_.data() + pc[1] : pc + 2;
+  DISPATCH();
+
+op_JumpIfEqv:
+  pc = regs[pc[0]]->Eqv(CONST(1)) ? code->code_.data() + pc[2] : pc + 3;
+  DISPATCH();
+
+op_MakeClosure: {
+  auto* closure_code = static_cast<Code*>(CONST(1));
+  auto* top = FrameAt(env, pc[4]);
+  // A closure which captures nothing is made once.
+  auto* lifted = closure_code->lifted_;
+  if (pc[3] == 0 && lifted && lifted->env()->enclosing() == top) {
+    regs[pc[0]] = lifted;
+  } else {
+    auto frame = NewClosureFrame(top, regs + pc[2], pc[3]);
+    auto* closure = new Closure(closure_code, frame.get());
+    if (pc[3] == 0) {
+      closure_code->lifted_ = closure;
+    }
+    regs[pc[0]] = closure;
+  }
+  pc += 5;
+  DISPATCH();
+}
+
+op_MakePromise:
+  regs[pc[0]] = new Promise(regs[pc[0]], pc[1]);
+  pc += 2;
+  DISPATCH();
+
+op_Box:
+  env->slot(pc[0]) = NewBox(env->slot(pc[0])).get();
+  pc += 1;
+  DISPATCH();
+
+op_BoxRef:
+  val = Unbox(FrameAt(env, pc[1])->slot(pc[2]));
+  if (!val) {
+    throw RuntimeException("Attempt to reference unassigned variable",
+                           CONST(3));
+  }
+  regs[pc[0]] = val;
+  pc += 4;
+  DISPATCH();
+
+op_BoxSet:
+  Unbox(FrameAt(env, pc[1])->slot(pc[2])) = regs[pc[0]];
+  pc += 3;
+  DISPATCH();
+
+op_PushEnv:
+  env = Env::NewFrame(env, pc[0]).get();
+  base[kEnvSlot] = env;
+  pc += 1;
+  DISPATCH();
+
+op_PopEnv:
+  env = env->enclosing();
+  base[kEnvSlot] = env;
+  DISPATCH();
+
+op_BindValues:
+  BindValues(regs[pc[0]], pc[1], pc[2], env);
+  pc += 3;
+  DISPATCH();
+
+op_OpenCall:
+  val = static_cast<PrimApply*>(CONST(3))->TryOpenCode(regs[pc[1]],
+                                                        regs + pc[1] + 1);
+  if (val) {
+    regs[pc[0]] = val;
+    pc += 4;
+    pc += 1 + kOpcodeInfo[*pc].num_operands;
+  } else {
+    pc += 4;
+  }
+  DISPATCH();
+
+op_Call: {
+  auto* dst = regs + pc[0];
+  auto* proc = regs + pc[1];
+  size_t num_args = pc[2];
+  pc += 3;
+  auto* evals = expr::TryEvals(*proc);
+  if (auto* closure = evals->AsClosure()) {
+    frames_.back().pc = pc;
+    auto* callee_base = stack_.top();
+    EnterClosure(closure, proc + 1, num_args, callee_base);
+    frames_.push_back({closure->code(), closure->code()->code_.data(),
+                       callee_base, static_cast<uint32_t>(dst - regs)});
+    LOAD_FRAME();
+    DISPATCH();
+  }
+  *dst = evals->DoEval(env, proc + 1, num_args).get();
+  DISPATCH();
+}
+
+op_TailCall: {
+  auto* proc = regs + pc[0];
+  size_t num_args = pc[1];
+  auto* evals = expr::TryEvals(*proc);
+  if (auto* closure = evals->AsClosure()) {
+    EnterClosure(closure, proc + 1, num_args, base);
+    auto& frame = frames_.back();
+    frame.code = closure->code();
+    frame.pc = frame.code->code_.data();
+    LOAD_FRAME();
+    DISPATCH();
+  }
+  auto ret = evals->DoEval(env, proc + 1, num_args);
+  val = ret.get();
+  goto do_return;
+}
+
+op_Return:
+  val = regs[pc[0]];
+
+do_return: {
+  auto dst = frames_.back().dst;
+  frames_.pop_back();
+  stack_.SetTop(base);
+  if (frames_.size() == entry) {
+    return gc::Lock<Expr>(val);
+  }
+  LOAD_FRAME();
+  stack_.SetTop(regs + code->num_regs_);
+  regs[dst] = val;
+  DISPATCH();
+}
+
+#undef LOAD_FRAME
+#undef DISPATCH
+#undef CONST
+#undef SYMBOL
+}
+
+std::vector<VmFrame>& VmFrames() {
+  return Vm::Get().frames_;
+}
+
+gc::Lock<Expr> Code::DoEval(Env* env, Expr** args, size_t num_args) {
+  assert(num_args == 0);
+  return Vm::Get().Run(this, env);
+}
+
+std::ostream& Code::AppendStream(std::ostream& stream) const {
+  stream << "(code " << *source_;
+  for (size_t pc = 0; pc < code_.size();) {
+    const auto& info = kOpcodeInfo[code_[pc]];
+    stream << "\n  " << pc << ": " << info.name;
+    for (size_t i = 1; i <= info.num_operands; ++i) {
+      stream << " " << code_[pc + i];
+    }
+    pc += 1 + info.num_operands;
+  }
+  return stream << ")";
+}
+
+void Code::MarkReferences() {
+  source_->GcMark();
+  for (auto* val : consts_) {
+    val->GcMark();
+  }
+  for (auto& cell : cells_) {
+    cell.MarkReferences();
+  }
+  if (lifted_) {
+    lifted_->GcMark();
+  }
+}
+
+gc::Lock<Expr> Closure::DoEval(Env* env, Expr** args, size_t num_args) {
+  // Calls within the VM don't recurse, but calls from outside it do.
+  if (StackIsLow()) {
+    return CallOnNewSegment(this, env, args, num_args);
+  }
+  return Vm::Get().Call(this, args, num_args);
+}
+
+std::ostream& Closure::AppendStream(std::ostream& stream) const {
+  return code_->source()->AppendStream(stream);
+}
+
+}  // namespace eval
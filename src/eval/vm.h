@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVAL_VM_H_
+#define EVAL_VM_H_
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "eval/node.h"
+#include "expr/expr.h"
+#include "gc/lock.h"
+
+namespace eval {
+
+class Closure;
+
+enum class Opcode : uint8_t {
+#define X(name, num_operands) name,
+#include "eval/opcodes.inc"  // NOLINT(build/include)
+#undef X
+};
+
+// Bytecode for a lambda body or a top level expression. Each instruction is an
+// opcode word followed by its operands, listed in opcodes.inc. Registers are
+// numbered from 0 within each call's window of the VM's value stack, while
+// variables live in frames as they do for the tree walker.
+class Code : public expr::Evals {
+ public:
+  // Evals implementation. Runs top level code in |env|.
+  gc::Lock<expr::Expr> DoEval(expr::Env* env,
+                              expr::Expr** args,
+                              size_t num_args) override;
+  // Prints a disassembly.
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  Node* source() const { return source_; }
+
+ private:
+  friend class Compiler;
+  friend class CxxEmitter;
+  friend class JitCode;
+  friend class JitCompiler;
+  friend class Vm;
+  friend gc::Lock<Code> Compile(Node* node);
+  friend gc::Lock<Code> CompileLambda(Lambda* lambda);
+
+  explicit Code(Node* source) : source_(source) {}
+  ~Code() override = default;
+
+  // The lambda or top level node this was compiled from.
+  Node* const source_;
+  std::vector<uint32_t> code_;
+  std::vector<expr::Expr*> consts_;
+  std::vector<GlobalCell> cells_;
+  uint32_t num_regs_ = 0;
+
+  // Arguments and frame size of a lambda body.
+  uint32_t num_required_ = 0;
+  bool has_rest_ = false;
+  uint32_t num_slots_ = 0;
+
+  // The closure returned for a lambda which captures nothing.
+  Closure* lifted_ = nullptr;
+};
+
+// A call the VM is making: the code it runs and where its registers are.
+struct VmFrame {
+  Code* code;
+  // Where to resume once the call this frame is making returns.
+  const uint32_t* pc;
+  expr::Expr** base;
+  // Register of the caller receiving the result.
+  uint32_t dst;
+};
+
+// The VM's frames, outermost first. Continuations copy them along with the
+// value stack. Each frame's code is reachable from its window.
+std::vector<VmFrame>& VmFrames();
+
+// A procedure created by evaluating a lambda expression in the VM.
+class Closure final : public expr::Evals {
+ public:
+  Closure(Code* code, expr::Env* env) : code_(code), env_(env) {
+    assert(env);
+  }
+
+  // Evals implementation:
+  Closure* AsClosure() override { return this; }
+  gc::Lock<expr::Expr> DoEval(expr::Env* env,
+                              expr::Expr** args,
+                              size_t num_args) override;
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override {
+    code_->GcMark();
+    env_->GcMark();
+  }
+
+  Code* code() const { return code_; }
+  expr::Env* env() const { return env_; }
+
+ private:
+  ~Closure() override = default;
+
+  Code* const code_;
+  expr::Env* const env_;
+};
+
+// Compiles |node|, as returned by Optimize(), into bytecode.
+gc::Lock<Code> Compile(Node* node);
+
+// Compiles the body of |lambda| into bytecode which runs in the frame of a
+// call to it.
+gc::Lock<Code> CompileLambda(Lambda* lambda);
+
+}  // namespace eval
+
+#endif  // EVAL_VM_H_
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "expr/bytevector.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include "util/exceptions.h"
+
+namespace expr {
+
+namespace {
+
+util::RuntimeException ErrnoException(const std::string& msg,
+                                      const std::string& path) {
+  return util::RuntimeException(msg + " " + path + ": " + std::strerror(errno),
+                                nullptr);
+}
+
+}  // namespace
+
+Bytevector::Bytevector(std::vector<uint8_t> vals)
+    : Expr(Type::BYTEVECTOR),
+      owned_(std::move(vals)),
+      data_(owned_.data()),
+      size_(owned_.size()),
+      mapped_(false),
+      read_only_(false) {}
+
+Bytevector::Bytevector(uint8_t* data, size_t size, bool read_only)
+    : Expr(Type::BYTEVECTOR),
+      data_(data),
+      size_(size),
+      mapped_(true),
+      read_only_(read_only) {}
+
+Bytevector::~Bytevector() {
+  if (mapped_) {
+    munmap(data_, size_);
+  }
+}
+
+// static
+gc::Lock<Bytevector> Bytevector::Map(const std::string& path, MapMode mode) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw ErrnoException("Failed to open", path);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    auto e = ErrnoException("Failed to stat", path);
+    close(fd);
+    throw e;
+  }
+
+  // Zero length mappings are not allowed.
+  if (st.st_size == 0) {
+    close(fd);
+    return gc::make_locked<Bytevector>(std::vector<uint8_t>());
+  }
+
+  bool read_only = mode == MapMode::READ_ONLY;
+  int prot = read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+  void* addr = mmap(nullptr, st.st_size, prot, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    auto e = ErrnoException("Failed to map", path);
+    close(fd);
+    throw e;
+  }
+  close(fd);
+
+  return gc::Lock<Bytevector>(new Bytevector(static_cast<uint8_t*>(addr),
+                                             st.st_size, read_only));
+}
+
+std::ostream& Bytevector::AppendStream(std::ostream& stream) const {
+  stream << "#u8(";
+
+  for (size_t i = 0; i < size_; ++i) {
+    if (i > 0)
+      stream << " ";
+    stream << static_cast<int>(data_[i]);
+  }
+
+  return stream << ")";
+}
+
+bool Bytevector::EqualImpl(const Expr* other) const {
+  auto* as_bv = other->AsBytevector();
+  return size_ == as_bv->size_ &&
+         (size_ == 0 || std::memcmp(data_, as_bv->data_, size_) == 0);
+}
+
+}  // namespace expr
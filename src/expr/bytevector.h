@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXPR_BYTEVECTOR_H_
+#define EXPR_BYTEVECTOR_H_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "expr/expr.h"
+#include "gc/lock.h"
+
+namespace expr {
+
+// R7RS bytevector. Contents are either owned by the object or a memory mapping
+// of a file, which lets large files be scanned without copying them into the
+// heap.
+class Bytevector : public Expr {
+ public:
+  enum class MapMode {
+    READ_ONLY,      // Writes are errors.
+    COPY_ON_WRITE,  // Writes are private to this bytevector.
+  };
+
+  explicit Bytevector(std::vector<uint8_t> vals);
+
+  // Maps the file at |path|. The mapping is released when the bytevector is
+  // collected.
+  static gc::Lock<Bytevector> Map(const std::string& path, MapMode mode);
+
+  // Expr implementation:
+  const Bytevector* AsBytevector() const override { return this; }
+  Bytevector* AsBytevector() override { return this; }
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  bool EqualImpl(const Expr* other) const override;
+
+  const uint8_t* data() const { return data_; }
+  uint8_t* mutable_data() {
+    assert(!read_only_);
+    return data_;
+  }
+  size_t size() const { return size_; }
+  bool read_only() const { return read_only_; }
+  bool mapped() const { return mapped_; }
+
+ private:
+  Bytevector(uint8_t* data, size_t size, bool read_only);
+  ~Bytevector() override;
+
+  std::vector<uint8_t> owned_;
+  uint8_t* data_;
+  size_t size_;
+  const bool mapped_;
+  const bool read_only_;
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(Bytevector);
+};
+
+}  // namespace expr
+
+#endif  // EXPR_BYTEVECTOR_H_
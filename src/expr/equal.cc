@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Implementation of Expr::Equal. See "Efficient Nondestructive Equality
+// Checking for Trees and Graphs", Adams and Dybvig, ICFP 2008.
+
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "expr/expr.h"
+
+namespace expr {
+
+namespace {
+
+// Number of pairs and vectors compared before tracking which objects have
+// already been compared. Acyclic structures smaller than this never pay for
+// the bookkeeping; larger or circular ones switch to union-find.
+constexpr size_t kUnionFindThreshold = 1000;
+
+// Disjoint sets of objects which are assumed to be equal.
+class UnionFind {
+ public:
+  // Returns true if |a| and |b| were already in the same set. Otherwise merges
+  // their sets.
+  bool Union(const Expr* a, const Expr* b) {
+    auto* root_a = Find(a);
+    auto* root_b = Find(b);
+    if (root_a == root_b) {
+      return true;
+    }
+    parent_[root_a] = root_b;
+    return false;
+  }
+
+ private:
+  const Expr* Find(const Expr* expr) {
+    while (true) {
+      auto it = parent_.find(expr);
+      if (it == parent_.end()) {
+        return expr;
+      }
+
+      // Path halving.
+      auto grand_parent = parent_.find(it->second);
+      if (grand_parent != parent_.end()) {
+        it->second = grand_parent->second;
+      }
+      expr = it->second;
+    }
+  }
+
+  std::unordered_map<const Expr*, const Expr*> parent_;
+};
+
+bool IsCompound(Expr::Type type) {
+  return type == Expr::Type::PAIR || type == Expr::Type::VECTOR;
+}
+
+}  // namespace
+
+bool Expr::Equal(const Expr* other) const {
+  // Compares non compound objects of the same type.
+  auto leaf_equal = [](const Expr* a, const Expr* b) {
+    if (a->type_ == Type::STRING) {
+      const auto& s1 = a->AsString()->val();
+      const auto& s2 = b->AsString()->val();
+      return s1.size() == s2.size() &&
+             std::memcmp(s1.data(), s2.data(), s1.size()) == 0;
+    }
+    return a->EqualImpl(b);
+  };
+
+  if (Eq(other)) {
+    return true;
+  }
+  if (type_ != other->type_) {
+    return false;
+  }
+  if (!IsCompound(type_)) {
+    return leaf_equal(this, other);
+  }
+
+  // Pairs of compound objects still to be compared.
+  std::vector<std::pair<const Expr*, const Expr*>> pending = {{this, other}};
+
+  // Compares |a| and |b| now if neither are compound, otherwise defers them.
+  auto compare_or_defer = [&pending, &leaf_equal](const Expr* a,
+                                                 const Expr* b) {
+    if (a == b) {
+      return true;
+    }
+    if (a->type_ != b->type_) {
+      return false;
+    }
+    if (IsCompound(a->type_)) {
+      pending.emplace_back(a, b);
+      return true;
+    }
+    return leaf_equal(a, b);
+  };
+
+  UnionFind union_find;
+  size_t num_compared = 0;
+  while (!pending.empty()) {
+    auto* a = pending.back().first;
+    auto* b = pending.back().second;
+    pending.pop_back();
+
+    // Iterate rather than defer along cdrs so long lists don't grow |pending|.
+    while (true) {
+      if (++num_compared > kUnionFindThreshold && union_find.Union(a, b)) {
+        break;
+      }
+
+      if (a->type_ == Type::VECTOR) {
+        const auto& v1 = a->AsVector()->vals();
+        const auto& v2 = b->AsVector()->vals();
+        if (v1.size() != v2.size()) {
+          return false;
+        }
+        // Defer in reverse so elements are compared in order.
+        for (size_t i = v1.size(); i-- > 0;) {
+          if (!compare_or_defer(v1[i], v2[i])) {
+            return false;
+          }
+        }
+        break;
+      }
+
+      auto* p1 = a->AsPair();
+      auto* p2 = b->AsPair();
+      if (!compare_or_defer(p1->car(), p2->car())) {
+        return false;
+      }
+
+      a = p1->cdr();
+      b = p2->cdr();
+      if (a == b) {
+        break;
+      }
+      if (a->type_ != b->type_) {
+        return false;
+      }
+      if (!IsCompound(a->type_)) {
+        if (!leaf_equal(a, b)) {
+          return false;
+        }
+        break;
+      }
+    }
+  }
+
+  return true;
+}
+
+}  // namespace expr
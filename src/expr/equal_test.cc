@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+
+#include "expr/expr.h"
+#include "expr/hash.h"
+#include "expr/number.h"
+#include "test/util.h"
+
+namespace expr {
+
+class EqualTest : public test::TestBase {
+ protected:
+  // Returns a list of |size| copies of |val|, optionally ending in |tail|.
+  gc::Lock<Pair> MakeList(size_t size, Expr* val, Expr* tail = Nil()) {
+    gc::Lock<Expr> ret(tail);
+    for (size_t i = 0; i < size; ++i) {
+      ret.reset(new Pair(val, ret.get()));
+    }
+    return gc::Lock<Pair>(ret->AsPair());
+  }
+
+  // Returns a circular list of |size| copies of |val|.
+  gc::Lock<Pair> MakeCircularList(size_t size, Expr* val) {
+    auto ret = MakeList(size, val);
+    Pair* last = ret.get();
+    while (last->cdr() != Nil()) {
+      last = last->cdr()->AsPair();
+    }
+    last->set_cdr(ret.get());
+    return ret;
+  }
+};
+
+TEST_F(EqualTest, Basic) {
+  auto s1 = gc::make_locked<String>(std::string("a\0b", 3));
+  auto s2 = gc::make_locked<String>(std::string("a\0b", 3));
+  auto s3 = gc::make_locked<String>(std::string("a\0c", 3));
+  EXPECT_TRUE(s1->Equal(s2.get()));
+  EXPECT_FALSE(s1->Equal(s3.get()));
+
+  auto v1 = gc::make_locked<Vector>(std::vector<Expr*>{s1.get(), Nil()});
+  auto v2 = gc::make_locked<Vector>(std::vector<Expr*>{s2.get(), Nil()});
+  auto v3 = gc::make_locked<Vector>(std::vector<Expr*>{s2.get()});
+  EXPECT_TRUE(v1->Equal(v2.get()));
+  EXPECT_FALSE(v1->Equal(v3.get()));
+
+  auto l1 = MakeList(3, v1.get());
+  auto l2 = MakeList(3, v2.get());
+  auto l3 = MakeList(3, v2.get(), s3.get());
+  EXPECT_TRUE(l1->Equal(l2.get()));
+  EXPECT_FALSE(l1->Equal(l3.get()));
+  EXPECT_EQ(EqualHash(l1.get()), EqualHash(l2.get()));
+}
+
+TEST_F(EqualTest, LongLists) {
+  // Far deeper than recursive comparison could handle.
+  constexpr size_t kSize = 200000;
+  auto one = gc::make_locked<Int>(1);
+  auto other_one = gc::make_locked<Int>(1);
+  auto two = gc::make_locked<Int>(2);
+
+  auto l1 = MakeList(kSize, one.get());
+  auto l2 = MakeList(kSize, other_one.get());
+  EXPECT_TRUE(l1->Equal(l2.get()));
+
+  auto l3 = MakeList(kSize, one.get(), two.get());
+  EXPECT_FALSE(l1->Equal(l3.get()));
+
+  // Deeply nested in the car direction.
+  gc::Lock<Expr> n1(Nil());
+  gc::Lock<Expr> n2(Nil());
+  for (size_t i = 0; i < kSize; ++i) {
+    n1.reset(new Pair(n1.get(), Nil()));
+    n2.reset(new Pair(n2.get(), Nil()));
+  }
+  EXPECT_TRUE(n1->Equal(n2.get()));
+}
+
+TEST_F(EqualTest, CircularLists) {
+  auto one = gc::make_locked<Int>(1);
+  auto two = gc::make_locked<Int>(2);
+
+  // Both unfold to an infinite list of 1s.
+  auto c1 = MakeCircularList(1, one.get());
+  auto c2 = MakeCircularList(2, one.get());
+  auto c3 = MakeCircularList(3, one.get());
+  EXPECT_TRUE(c1->Equal(c2.get()));
+  EXPECT_TRUE(c2->Equal(c3.get()));
+  EXPECT_EQ(EqualHash(c1.get()), EqualHash(c3.get()));
+
+  auto c4 = MakeCircularList(2000, one.get());
+  c4->cdr()->AsPair()->set_car(two.get());
+  EXPECT_FALSE(c1->Equal(c4.get()));
+
+  // Circular through a vector.
+  auto v1 = gc::make_locked<Vector>(std::vector<Expr*>{one.get(), Nil()});
+  v1->vals()[1] = v1.get();
+  auto v2 = gc::make_locked<Vector>(std::vector<Expr*>{one.get(), Nil()});
+  auto v3 = gc::make_locked<Vector>(std::vector<Expr*>{one.get(), v2.get()});
+  v2->vals()[1] = v3.get();
+  EXPECT_TRUE(v1->Equal(v2.get()));
+  EXPECT_EQ(EqualHash(v1.get()), EqualHash(v2.get()));
+}
+
+}  // namespace expr
@@ -19,6 +19,7 @@
 
 #include "expr/expr.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <cstring>
@@ -47,9 +48,15 @@ const char* TypeToString(Expr::Type type) {
     CASE_STR(SYMBOL);
     CASE_STR(PAIR);
     CASE_STR(VECTOR);
+    CASE_STR(F64VECTOR);
+    CASE_STR(BYTEVECTOR);
+    CASE_STR(HASH_TABLE);
+    CASE_STR(IMAP);
+    CASE_STR(ISET);
     CASE_STR(INPUT_PORT);
     CASE_STR(OUTPUT_PORT);
     CASE_STR(ENV);
+    CASE_STR(SYNTAX);
     CASE_STR(EVALS);
   }
 #undef CASE_STR
@@ -110,26 +117,24 @@ std::ostream& Vector::AppendStream(std::ostream& stream) const {
   return stream << ")";
 }
 
-bool Vector::EqualImpl(const Expr* other) const {
-  const auto& v1 = vals_;
-  const auto& v2 = other->AsVector()->vals_;
-  if (v1.size() != v2.size())
-    return false;
-
-  for (auto i1 = v1.begin(), i2 = v2.begin(); i1 != v1.end(); ++i1, ++i2) {
-    if (!(*i1)->Equal(*i2))
-      return false;
-  }
-
-  return true;
-}
-
 void Vector::MarkReferences() {
   for (auto val : vals_) {
     val->GcMark();
   }
 }
 
+std::ostream& F64Vector::AppendStream(std::ostream& stream) const {
+  stream << "#f64(";
+
+  for (size_t i = 0; i < vals_.size(); ++i) {
+    if (i > 0)
+      stream << " ";
+    stream << vals_[i];
+  }
+
+  return stream << ")";
+}
+
 // static
 gc::Lock<InputPort> InputPort::Open(const std::string& path) {
   std::ifstream ifs(path);
@@ -152,10 +157,33 @@ gc::Lock<OutputPort> OutputPort::Open(const std::string& path) {
   return gc::Lock<OutputPort>(new OutputPort(path, std::move(ifs)));
 }
 
+Env::Env(Env* enclosing, size_t num_slots)
+    : Expr(Type::ENV), enclosing_(enclosing), num_slots_(num_slots) {
+  std::fill(slots(), slots() + num_slots_, nullptr);
+}
+
+// static
+gc::Lock<Env> Env::NewFrame(Env* enclosing, size_t num_slots) {
+  void* mem = gc::Gc::Get().AllocExpr(FrameSize(num_slots));
+  return gc::Lock<Env>(::new (mem) Env(enclosing, num_slots));
+}
+
+// static
+Env* Env::NewFrameAt(void* mem, Env* enclosing, size_t num_slots) {
+  return ::new (mem) Env(enclosing, num_slots);
+}
+
 std::ostream& Env::AppendStream(std::ostream& stream) const {
   stream << "{";
   for (const auto& pair : map_)
     stream << "(" << *pair.first << ", " << *pair.second << ")";
+  for (size_t i = 0; i < num_slots_; ++i) {
+    stream << "(" << i << ", ";
+    if (slots()[i]) {
+      stream << *slots()[i];
+    }
+    stream << ")";
+  }
 
   return stream << "}";
 }
@@ -168,6 +196,11 @@ void Env::MarkReferences() {
     pair.first->GcMark();
     pair.second->GcMark();
   }
+  for (size_t i = 0; i < num_slots_; ++i) {
+    if (slots()[i]) {
+      slots()[i]->GcMark();
+    }
+  }
 }
 
 Expr* Env::TryLookup(Symbol* var) const {
@@ -222,6 +255,26 @@ Bool* False() {
   return &false_val;
 }
 
+const char* Syntax::name() const {
+  static const char* const kNames[] = {
+#define X(name, str) #str,
+#include "expr/syntax.inc"  // NOLINT(build/include)
+#undef X
+      "macro",
+  };
+  return kNames[static_cast<size_t>(kind_)];
+}
+
+std::ostream& Syntax::AppendStream(std::ostream& stream) const {
+  return stream << "#<syntax " << name() << ">";
+}
+
+void ThrowTypeError(Expr::Type expected, Expr* expr) {
+  std::ostringstream os;
+  os << "Expected " << expected << ". Given: " << expr->type();
+  throw util::RuntimeException(os.str(), expr);
+}
+
 std::vector<Expr*> ExprVecFromList(Expr* expr) {
   std::vector<Expr*> exprs;
   for (; auto* list = expr->AsPair(); expr = list->cdr()) {
@@ -35,6 +35,10 @@
 #include "util/macros.h"
 #include "util/exceptions.h"
 
+namespace eval {
+class Closure;
+}  // namespace eval
+
 namespace expr {
 
 class EmptyList;
@@ -45,9 +49,15 @@ class String;
 class Symbol;
 class Pair;
 class Vector;
+class F64Vector;
+class Bytevector;
+class HashTable;
+class IMap;
+class ISet;
 class InputPort;
 class OutputPort;
 class Env;
+class Syntax;
 class Evals;
 
 // TODO(bcf): Define interface to get all references.
@@ -63,14 +73,20 @@ class Expr {
     SYMBOL,
     PAIR,
     VECTOR,
+    F64VECTOR,  // Homogeneous vector of unboxed doubles
+    BYTEVECTOR,
+    HASH_TABLE,
+    IMAP,  // Persistent map
+    ISET,  // Persistent set
 
     // IO
     INPUT_PORT,
     OUTPUT_PORT,
 
     // Special types
-    ENV,    // Environment
-    EVALS,  // Type which is not self evaluating.
+    ENV,     // Environment
+    SYNTAX,  // Syntactic keyword
+    EVALS,   // Type which is not self evaluating.
   };
 
   Type type() const { return type_; }
@@ -79,9 +95,9 @@ class Expr {
   bool Eqv(const Expr* other) const {
     return Eq(other) || (type_ == other->type_ && EqvImpl(other));
   }
-  bool Equal(const Expr* other) const {
-    return Eq(other) || (type_ == other->type_ && EqualImpl(other));
-  }
+  // Iterative, so deep structures don't overflow the stack, and terminates on
+  // circular structures. Defined in equal.cc.
+  bool Equal(const Expr* other) const;
 
   virtual std::ostream& AppendStream(
       std::ostream& stream) const = 0;  // NOLINT(runtime/references)
@@ -102,12 +118,24 @@ class Expr {
   virtual Pair* AsPair() { return nullptr; }
   virtual const Vector* AsVector() const { return nullptr; }
   virtual Vector* AsVector() { return nullptr; }
+  virtual const F64Vector* AsF64Vector() const { return nullptr; }
+  virtual F64Vector* AsF64Vector() { return nullptr; }
+  virtual const Bytevector* AsBytevector() const { return nullptr; }
+  virtual Bytevector* AsBytevector() { return nullptr; }
+  virtual const HashTable* AsHashTable() const { return nullptr; }
+  virtual HashTable* AsHashTable() { return nullptr; }
+  virtual const IMap* AsIMap() const { return nullptr; }
+  virtual IMap* AsIMap() { return nullptr; }
+  virtual const ISet* AsISet() const { return nullptr; }
+  virtual ISet* AsISet() { return nullptr; }
   virtual const InputPort* AsInputPort() const { return nullptr; }
   virtual InputPort* AsInputPort() { return nullptr; }
   virtual const OutputPort* AsOutputPort() const { return nullptr; }
   virtual OutputPort* AsOutputPort() { return nullptr; }
   virtual const Env* AsEnv() const { return nullptr; }
   virtual Env* AsEnv() { return nullptr; }
+  virtual const Syntax* AsSyntax() const { return nullptr; }
+  virtual Syntax* AsSyntax() { return nullptr; }
   virtual const Evals* AsEvals() const { return nullptr; }
   virtual Evals* AsEvals() { return nullptr; }
 
@@ -120,12 +148,14 @@ class Expr {
 
   void GcLockInc() { ++gc_lock_count_; }
   void GcLockDec() { --gc_lock_count_; }
+  // References are marked later by the collector, so marking deep structures
+  // doesn't recurse.
   void GcMark() {
     if (gc_mark_) {
       return;
     }
     gc_mark_ = true;
-    MarkReferences();
+    gc::Gc::Get().PushMarked(this);
   }
 
  protected:
@@ -136,6 +166,8 @@ class Expr {
   friend class gc::Gc;
 
   virtual bool EqvImpl(const Expr* other) const { return Eq(other); }
+  // Compares objects of the same type. Not called for pairs and vectors, which
+  // Equal() traverses itself.
   virtual bool EqualImpl(const Expr* other) const { return Eqv(other); }
   virtual void MarkReferences() {}
 
@@ -313,10 +345,6 @@ class Pair : public Expr {
   bool EqvImpl(const Expr* other) const override {
     return car_ == other->AsPair()->car_ && cdr_ == other->AsPair()->cdr_;
   }
-  bool EqualImpl(const Expr* other) const override {
-    return car_->Equal(other->AsPair()->car_) &&
-           cdr_->Equal(other->AsPair()->cdr_);
-  }
   void MarkReferences() override;
 
   expr::Expr* Cr(const std::string& str) const;
@@ -349,7 +377,6 @@ class Vector : public Expr {
   bool EqvImpl(const Expr* other) const override {
     return vals_ == other->AsVector()->vals_;
   }
-  bool EqualImpl(const Expr* other) const override;
   void MarkReferences() override;
 
   std::vector<Expr*>& vals() { return vals_; }
@@ -363,6 +390,34 @@ class Vector : public Expr {
   DISALLOW_MOVE_COPY_AND_ASSIGN(Vector);
 };
 
+// SRFI 4 f64vector. Elements are stored unboxed so numeric kernels can operate
+// on them directly.
+class F64Vector : public Expr {
+ public:
+  explicit F64Vector(std::vector<double> vals)
+      : Expr(Type::F64VECTOR), vals_(std::move(vals)) {
+    vals_.shrink_to_fit();
+  }
+
+  // Expr implementation:
+  const F64Vector* AsF64Vector() const override { return this; }
+  F64Vector* AsF64Vector() override { return this; }
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  bool EqualImpl(const Expr* other) const override {
+    return vals_ == other->AsF64Vector()->vals_;
+  }
+
+  std::vector<double>& vals() { return vals_; }
+  const std::vector<double>& vals() const { return vals_; }
+
+ private:
+  ~F64Vector() override = default;
+
+  std::vector<double> vals_;
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(F64Vector);
+};
+
 class InputPort : public Expr {
  public:
   static gc::Lock<InputPort> Open(const std::string& path);
@@ -411,11 +466,26 @@ class OutputPort : public Expr {
   DISALLOW_MOVE_COPY_AND_ASSIGN(OutputPort);
 };
 
+// An environment is either a top level environment, which maps symbols to
+// values, or a frame of local variables. Frames are fixed size slot arrays
+// whose variables the analyzer has resolved to (depth, index) pairs.
 class Env : public Expr {
  public:
   explicit Env(Env* enclosing = nullptr)
       : Expr(Type::ENV), enclosing_(enclosing) {}
 
+  // Slots are initially null, meaning unassigned.
+  static gc::Lock<Env> NewFrame(Env* enclosing, size_t num_slots);
+
+  // Like NewFrame(), but constructs the frame in |mem| outside the heap. |mem|
+  // must hold FrameSize(num_slots) bytes. The owner marks the frame's
+  // references while it is live and destroys it with DeleteFrameAt().
+  static Env* NewFrameAt(void* mem, Env* enclosing, size_t num_slots);
+  static void DeleteFrameAt(Env* frame) { frame->~Env(); }
+  static size_t FrameSize(size_t num_slots) {
+    return sizeof(Env) + num_slots * sizeof(Expr*);
+  }
+
   // Expr implementation:
   const Env* AsEnv() const override { return this; }
   Env* AsEnv() override { return this; }
@@ -425,12 +495,35 @@ class Env : public Expr {
   Expr* TryLookup(Symbol* var) const;
   Expr* Lookup(Symbol* var) const;
   const Env* enclosing() const { return enclosing_; }
+  Env* enclosing() { return enclosing_; }
   void DefineVar(Symbol* var, Expr* expr) { map_[var] = expr; }
   void SetVar(Symbol* var, Expr* expr);
 
+  // Returns the location of |var|'s value if it is defined in this
+  // environment, ignoring enclosing ones, or null otherwise. The location
+  // lives as long as the environment and define and set! update it in place,
+  // so it may be cached.
+  Expr** FindCell(Symbol* var) {
+    auto search = map_.find(var);
+    return search == map_.end() ? nullptr : &search->second;
+  }
+
+  size_t num_slots() const { return num_slots_; }
+  Expr*& slot(size_t index) {
+    assert(index < num_slots_);
+    return slots()[index];
+  }
+
  private:
+  Env(Env* enclosing, size_t num_slots);
   ~Env() override = default;
 
+  // Slots are stored directly after the object.
+  Expr** slots() { return reinterpret_cast<Expr**>(this + 1); }
+  Expr* const* slots() const {
+    return reinterpret_cast<Expr* const*>(this + 1);
+  }
+
   struct VarHash {
     std::size_t operator()(Symbol* var) const {
       return std::hash<std::string>()(var->val());
@@ -442,15 +535,50 @@ class Env : public Expr {
   };
 
   Env* enclosing_;
+  const size_t num_slots_ = 0;
   std::unordered_map<Symbol*, Expr*, VarHash, VarEqual> map_;
 
   DISALLOW_MOVE_COPY_AND_ASSIGN(Env);
 };
 
+// A syntactic keyword such as `if`. Forms headed by a keyword are compiled by
+// eval::Analyze, so keywords have no meaning as runtime values.
+class Syntax : public Expr {
+ public:
+  enum class Kind : uint8_t {
+#define X(name, str) name,
+#include "expr/syntax.inc"  // NOLINT(build/include)
+#undef X
+    // Defined by syntax-rules. See eval::Macro.
+    MACRO,
+  };
+
+  explicit Syntax(Kind kind) : Expr(Type::SYNTAX), kind_(kind) {}
+
+  // Expr implementation:
+  const Syntax* AsSyntax() const override { return this; }
+  Syntax* AsSyntax() override { return this; }
+  std::ostream& AppendStream(std::ostream& stream) const override;
+
+  Kind kind() const { return kind_; }
+  const char* name() const;
+
+ protected:
+  ~Syntax() override = default;
+
+ private:
+  const Kind kind_;
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(Syntax);
+};
+
 class Evals : public Expr {
  public:
   virtual gc::Lock<Expr> DoEval(Env* env, Expr** args, size_t num_args) = 0;
 
+  // Procedures compiled for the bytecode VM, which it calls without recursing.
+  virtual eval::Closure* AsClosure() { return nullptr; }
+
   // Expr implementation:
   const Evals* AsEvals() const override { return this; }
   Evals* AsEvals() override { return this; }
@@ -470,15 +598,17 @@ Bool* False();
 // Helpers
 std::vector<Expr*> ExprVecFromList(Expr* expr);
 
-#define TRY_AS_IMPL(op, etype)                                               \
-  {                                                                          \
-    auto* ret = expr->op();                                                  \
-    if (!ret) {                                                              \
-      std::ostringstream os;                                                 \
-      os << "Expected " << Expr::Type::etype << ". Given: " << expr->type(); \
-      throw util::RuntimeException(os.str(), expr);                          \
-    }                                                                        \
-    return ret;                                                              \
+// Throws the error for |expr| not being of type |expected|. Out of line, so
+// the Try functions inline to a test and call.
+[[noreturn]] void ThrowTypeError(Expr::Type expected, Expr* expr);
+
+#define TRY_AS_IMPL(op, etype)                 \
+  {                                            \
+    auto* ret = expr->op();                    \
+    if (!ret) {                                \
+      ThrowTypeError(Expr::Type::etype, expr); \
+    }                                          \
+    return ret;                                \
   }
 
 // TODO(bcf): Replace similar pattern with these.
@@ -491,9 +621,15 @@ inline String* TryString(Expr* expr) TRY_AS_IMPL(AsString, STRING)
 inline Symbol* TrySymbol(Expr* expr) TRY_AS_IMPL(AsSymbol, SYMBOL)
 inline Pair* TryPair(Expr* expr) TRY_AS_IMPL(AsPair, PAIR)
 inline Vector* TryVector(Expr* expr) TRY_AS_IMPL(AsVector, VECTOR)
+inline F64Vector* TryF64Vector(Expr* expr) TRY_AS_IMPL(AsF64Vector, F64VECTOR)
+inline Bytevector* TryBytevector(Expr* expr) TRY_AS_IMPL(AsBytevector, BYTEVECTOR)
+inline HashTable* TryHashTable(Expr* expr) TRY_AS_IMPL(AsHashTable, HASH_TABLE)
+inline IMap* TryIMap(Expr* expr) TRY_AS_IMPL(AsIMap, IMAP)
+inline ISet* TryISet(Expr* expr) TRY_AS_IMPL(AsISet, ISET)
 inline InputPort* TryInputPort(Expr* expr) TRY_AS_IMPL(AsInputPort, VECTOR)
 inline OutputPort* TryOutputPort(Expr* expr) TRY_AS_IMPL(AsOutputPort, VECTOR)
 inline Env* TryEnv(Expr* expr) TRY_AS_IMPL(AsEnv, ENV)
+inline Syntax* TrySyntax(Expr* expr) TRY_AS_IMPL(AsSyntax, SYNTAX)
 inline Evals* TryEvals(Expr* expr) TRY_AS_IMPL(AsEvals, EVALS)
 // clang-format on
 
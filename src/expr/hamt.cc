@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "expr/hamt.h"
+
+#include <cassert>
+
+#include "expr/expr.h"
+
+namespace expr {
+
+namespace {
+
+constexpr unsigned kBitsPerLevel = 5;
+constexpr unsigned kMaxShift = 60;
+
+uint32_t Bit(size_t hash, unsigned shift) {
+  return 1u << ((hash >> shift) & 0x1f);
+}
+
+// Index of |bit|'s slot among the slots present in |bitmap|.
+size_t Index(uint32_t bitmap, uint32_t bit) {
+  return __builtin_popcount(bitmap & (bit - 1));
+}
+
+bool Matches(const Hamt::Entry& entry, size_t hash, Expr* key) {
+  return entry.hash == hash && entry.key->Equal(key);
+}
+
+}  // namespace
+
+Hamt::Hamt(HashFunc hash_func)
+    : hash_func_(hash_func), root_(std::make_shared<Node>()) {}
+
+// static
+uint64_t Hamt::NewEdit() {
+  static uint64_t next_edit = 0;
+  return ++next_edit;
+}
+
+const Hamt::Entry* Hamt::Find(Expr* key) const {
+  return FindImpl(root_.get(), hash_func_(key), key);
+}
+
+Hamt Hamt::Set(Expr* key, Expr* val) const {
+  Hamt ret(*this);
+  ret.SetInPlace(key, val, 0);
+  return ret;
+}
+
+Hamt Hamt::Delete(Expr* key) const {
+  Hamt ret(*this);
+  ret.DeleteInPlace(key, 0);
+  return ret;
+}
+
+void Hamt::SetInPlace(Expr* key, Expr* val, uint64_t edit) {
+  bool added = false;
+  root_ = Insert(root_, 0, {hash_func_(key), key, val}, edit, &added);
+  size_ += added;
+}
+
+void Hamt::DeleteInPlace(Expr* key, uint64_t edit) {
+  bool removed = false;
+  root_ = Remove(root_, 0, hash_func_(key), key, edit, &removed);
+  size_ -= removed;
+}
+
+void Hamt::MarkReferences() const {
+  ForEach([](const Entry& entry) {
+    entry.key->GcMark();
+    if (entry.val) {
+      entry.val->GcMark();
+    }
+  });
+}
+
+Hamt Hamt::Rehash() const {
+  Hamt ret(hash_func_);
+  auto edit = NewEdit();
+  ForEach([&ret, edit](const Entry& entry) {
+    ret.SetInPlace(entry.key, entry.val, edit);
+  });
+  return ret;
+}
+
+size_t Hamt::KeysHash() const {
+  size_t hash = size_;
+  ForEach([&hash](const Entry& entry) { hash += entry.hash; });
+  return MixHash(hash);
+}
+
+// static
+const Hamt::Entry* Hamt::FindImpl(const Node* node, size_t hash, Expr* key) {
+  for (unsigned shift = 0;; shift += kBitsPerLevel) {
+    if (node->collision) {
+      for (const auto& entry : node->entries) {
+        if (Matches(entry, hash, key)) {
+          return &entry;
+        }
+      }
+      return nullptr;
+    }
+
+    auto bit = Bit(hash, shift);
+    if (node->datamap & bit) {
+      const auto& entry = node->entries[Index(node->datamap, bit)];
+      return Matches(entry, hash, key) ? &entry : nullptr;
+    }
+    if (!(node->nodemap & bit)) {
+      return nullptr;
+    }
+    node = node->children[Index(node->nodemap, bit)].get();
+  }
+}
+
+// static
+Hamt::NodePtr Hamt::Insert(const NodePtr& node,
+                           unsigned shift,
+                           const Entry& entry,
+                           uint64_t edit,
+                           bool* added) {
+  if (node->collision) {
+    auto ret = Editable(node, edit);
+    for (auto& cur : ret->entries) {
+      if (Matches(cur, entry.hash, entry.key)) {
+        cur.val = entry.val;
+        return ret;
+      }
+    }
+    ret->entries.push_back(entry);
+    *added = true;
+    return ret;
+  }
+
+  auto bit = Bit(entry.hash, shift);
+  if (node->datamap & bit) {
+    auto idx = Index(node->datamap, bit);
+    const auto& cur = node->entries[idx];
+    if (Matches(cur, entry.hash, entry.key)) {
+      auto ret = Editable(node, edit);
+      ret->entries[idx].val = entry.val;
+      return ret;
+    }
+
+    // Push both entries down into a new child.
+    auto child = MakeNode(shift + kBitsPerLevel, cur, entry, edit);
+    auto ret = Editable(node, edit);
+    ret->entries.erase(ret->entries.begin() + idx);
+    ret->datamap ^= bit;
+    ret->nodemap |= bit;
+    ret->children.insert(ret->children.begin() + Index(ret->nodemap, bit),
+                         std::move(child));
+    *added = true;
+    return ret;
+  }
+
+  if (node->nodemap & bit) {
+    auto idx = Index(node->nodemap, bit);
+    const auto& child = node->children[idx];
+    auto new_child = Insert(child, shift + kBitsPerLevel, entry, edit, added);
+    if (new_child == child) {
+      return node;
+    }
+    auto ret = Editable(node, edit);
+    ret->children[idx] = std::move(new_child);
+    return ret;
+  }
+
+  auto ret = Editable(node, edit);
+  ret->entries.insert(ret->entries.begin() + Index(node->datamap, bit), entry);
+  ret->datamap |= bit;
+  *added = true;
+  return ret;
+}
+
+// static
+Hamt::NodePtr Hamt::Remove(const NodePtr& node,
+                           unsigned shift,
+                           size_t hash,
+                           Expr* key,
+                           uint64_t edit,
+                           bool* removed) {
+  if (node->collision) {
+    for (size_t i = 0; i < node->entries.size(); ++i) {
+      if (Matches(node->entries[i], hash, key)) {
+        auto ret = Editable(node, edit);
+        ret->entries.erase(ret->entries.begin() + i);
+        *removed = true;
+        return ret;
+      }
+    }
+    return node;
+  }
+
+  auto bit = Bit(hash, shift);
+  if (node->datamap & bit) {
+    auto idx = Index(node->datamap, bit);
+    if (!Matches(node->entries[idx], hash, key)) {
+      return node;
+    }
+    auto ret = Editable(node, edit);
+    ret->entries.erase(ret->entries.begin() + idx);
+    ret->datamap ^= bit;
+    *removed = true;
+    return ret;
+  }
+
+  if (!(node->nodemap & bit)) {
+    return node;
+  }
+
+  auto idx = Index(node->nodemap, bit);
+  auto new_child =
+      Remove(node->children[idx], shift + kBitsPerLevel, hash, key, edit,
+             removed);
+  if (!*removed) {
+    return node;
+  }
+
+  auto ret = Editable(node, edit);
+  if (new_child->children.empty() && new_child->entries.size() == 1) {
+    // Keep the trie canonical by pulling a lone entry up into this node.
+    auto entry = new_child->entries[0];
+    ret->children.erase(ret->children.begin() + idx);
+    ret->nodemap ^= bit;
+    ret->entries.insert(ret->entries.begin() + Index(ret->datamap, bit),
+                        entry);
+    ret->datamap |= bit;
+  } else {
+    ret->children[idx] = std::move(new_child);
+  }
+  return ret;
+}
+
+// static
+Hamt::NodePtr Hamt::MakeNode(unsigned shift,
+                             const Entry& e1,
+                             const Entry& e2,
+                             uint64_t edit) {
+  auto ret = std::make_shared<Node>();
+  ret->edit = edit;
+  if (shift > kMaxShift) {
+    assert(e1.hash == e2.hash);
+    ret->collision = true;
+    ret->entries = {e1, e2};
+    return ret;
+  }
+
+  auto b1 = Bit(e1.hash, shift);
+  auto b2 = Bit(e2.hash, shift);
+  if (b1 == b2) {
+    ret->nodemap = b1;
+    ret->children.push_back(MakeNode(shift + kBitsPerLevel, e1, e2, edit));
+  } else {
+    ret->datamap = b1 | b2;
+    if (b1 < b2) {
+      ret->entries = {e1, e2};
+    } else {
+      ret->entries = {e2, e1};
+    }
+  }
+  return ret;
+}
+
+// static
+Hamt::NodePtr Hamt::Editable(const NodePtr& node, uint64_t edit) {
+  if (edit != 0 && node->edit == edit) {
+    return node;
+  }
+
+  auto ret = std::make_shared<Node>(*node);
+  ret->edit = edit;
+  return ret;
+}
+
+}  // namespace expr
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXPR_HAMT_H_
+#define EXPR_HAMT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "expr/hash.h"
+
+namespace expr {
+
+class Expr;
+
+// Persistent hash array mapped trie keyed by equal?.
+//
+// Nodes are compressed by two 32 bit bitmaps, one for entries stored inline
+// and one for child nodes, so a node only stores its occupied slots and a
+// slot's index is the popcount of the bitmap below its bit. Each level
+// consumes 5 bits of the key's hash; keys whose hashes fully collide share a
+// collision node at the bottom.
+//
+// Updates copy the path to the modified node and share everything else.
+// Transient updates, identified by a token from NewEdit(), instead modify
+// nodes created under the same token in place, so batches of updates don't
+// copy each node more than once. A trie must not be shared while it is being
+// updated transiently.
+class Hamt {
+ public:
+  using HashFunc = size_t (*)(const Expr* expr);
+
+  struct Entry {
+    size_t hash;
+    Expr* key;
+    Expr* val;  // nullptr for sets.
+  };
+
+  explicit Hamt(HashFunc hash_func = EqualHash);
+
+  // Returns a token for transient updates. Tokens are never reused.
+  static uint64_t NewEdit();
+
+  // Returns nullptr if |key| is not present.
+  const Entry* Find(Expr* key) const;
+
+  // Persistent updates.
+  Hamt Set(Expr* key, Expr* val) const;
+  Hamt Delete(Expr* key) const;
+
+  // Transient updates. |edit| must be non zero.
+  void SetInPlace(Expr* key, Expr* val, uint64_t edit);
+  void DeleteInPlace(Expr* key, uint64_t edit);
+
+  // Calls |func| on each entry.
+  template <typename Func>
+  void ForEach(Func func) const;
+
+  // Marks all keys and values.
+  void MarkReferences() const;
+
+  // Recomputes hashes, e.g. after the collector moved objects.
+  Hamt Rehash() const;
+
+  size_t size() const { return size_; }
+
+  // Order independent hash of the keys.
+  size_t KeysHash() const;
+
+ private:
+  struct Node;
+  using NodePtr = std::shared_ptr<Node>;
+
+  static const Entry* FindImpl(const Node* node, size_t hash, Expr* key);
+  static NodePtr Insert(const NodePtr& node,
+                        unsigned shift,
+                        const Entry& entry,
+                        uint64_t edit,
+                        bool* added);
+  static NodePtr Remove(const NodePtr& node,
+                        unsigned shift,
+                        size_t hash,
+                        Expr* key,
+                        uint64_t edit,
+                        bool* removed);
+  static NodePtr MakeNode(unsigned shift,
+                          const Entry& e1,
+                          const Entry& e2,
+                          uint64_t edit);
+  static NodePtr Editable(const NodePtr& node, uint64_t edit);
+  template <typename Func>
+  static void ForEachImpl(const Node* node, Func func);
+
+  HashFunc hash_func_;
+  NodePtr root_;
+  size_t size_ = 0;
+};
+
+struct Hamt::Node {
+  // Token of the transient which may modify this node in place, or 0.
+  uint64_t edit = 0;
+  uint32_t datamap = 0;
+  uint32_t nodemap = 0;
+
+  // If true, all entries have the same hash and bitmaps are unused.
+  bool collision = false;
+
+  std::vector<Entry> entries;
+  std::vector<NodePtr> children;
+};
+
+template <typename Func>
+void Hamt::ForEach(Func func) const {
+  ForEachImpl(root_.get(), func);
+}
+
+// static
+template <typename Func>
+void Hamt::ForEachImpl(const Node* node, Func func) {
+  for (const auto& entry : node->entries) {
+    func(entry);
+  }
+  for (const auto& child : node->children) {
+    ForEachImpl(child.get(), func);
+  }
+}
+
+}  // namespace expr
+
+#endif  // EXPR_HAMT_H_
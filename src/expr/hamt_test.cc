@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <map>
+#include <random>
+#include <vector>
+
+#include "expr/hamt.h"
+#include "expr/number.h"
+#include "test/util.h"
+
+namespace expr {
+
+namespace {
+
+// Puts every key in one of 4 buckets so tries are deep and full collisions
+// are common.
+size_t WeakHash(const Expr* expr) {
+  return TryInt(const_cast<Expr*>(expr))->val() % 4;
+}
+
+Int::ValType IntVal(Expr* expr) {
+  return TryInt(expr)->val();
+}
+
+}  // namespace
+
+class HamtTest : public test::TestBase {
+ protected:
+  Int* NewInt(Int::ValType val) {
+    locks_.push_back(gc::make_locked<Int>(val));
+    return locks_.back().get();
+  }
+
+  void ExpectMatches(const std::map<Int::ValType, Int::ValType>& expected,
+                     const Hamt& hamt) {
+    ASSERT_EQ(expected.size(), hamt.size());
+    std::map<Int::ValType, Int::ValType> got;
+    hamt.ForEach([&got](const Hamt::Entry& entry) {
+      got[IntVal(entry.key)] = IntVal(entry.val);
+    });
+    EXPECT_EQ(expected, got);
+    for (const auto& kv : expected) {
+      auto key = gc::make_locked<Int>(kv.first);
+      auto* entry = hamt.Find(key.get());
+      ASSERT_NE(nullptr, entry);
+      EXPECT_EQ(kv.second, IntVal(entry->val));
+    }
+  }
+
+  // Applies random persistent updates, checking every version stays intact.
+  void RunRandomized(Hamt::HashFunc hash_func) {
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<Int::ValType> key_dist(0, 300);
+    std::vector<std::map<Int::ValType, Int::ValType>> expected(1);
+    std::vector<Hamt> versions = {Hamt(hash_func)};
+
+    for (int i = 0; i < 2000; ++i) {
+      auto map = expected.back();
+      auto* key = NewInt(key_dist(gen));
+      if (i % 3 == 0) {
+        map.erase(key->val());
+        versions.push_back(versions.back().Delete(key));
+      } else {
+        map[key->val()] = i;
+        versions.push_back(versions.back().Set(key, NewInt(i)));
+      }
+      expected.push_back(std::move(map));
+    }
+
+    for (size_t i = 0; i < versions.size(); i += 97) {
+      ExpectMatches(expected[i], versions[i]);
+    }
+    ExpectMatches(expected.back(), versions.back());
+  }
+
+  std::vector<gc::Lock<Int>> locks_;
+};
+
+TEST_F(HamtTest, Randomized) {
+  RunRandomized(EqualHash);
+}
+
+TEST_F(HamtTest, RandomizedCollisions) {
+  RunRandomized(WeakHash);
+}
+
+TEST_F(HamtTest, DeleteAll) {
+  for (auto hash_func : {EqualHash, WeakHash}) {
+    Hamt hamt(hash_func);
+    for (int i = 0; i < 500; ++i) {
+      hamt = hamt.Set(NewInt(i), NewInt(i));
+    }
+    for (int i = 0; i < 500; ++i) {
+      hamt = hamt.Delete(NewInt(i));
+      ASSERT_EQ(499u - i, hamt.size());
+    }
+    EXPECT_EQ(nullptr, hamt.Find(NewInt(0)));
+  }
+}
+
+TEST_F(HamtTest, Transient) {
+  Hamt original;
+  for (int i = 0; i < 100; ++i) {
+    original = original.Set(NewInt(i), NewInt(i));
+  }
+
+  // Transient updates of a copy don't affect the original.
+  Hamt copy(original);
+  auto edit = Hamt::NewEdit();
+  std::map<Int::ValType, Int::ValType> expected;
+  for (int i = 0; i < 200; ++i) {
+    copy.SetInPlace(NewInt(i), NewInt(-i), edit);
+    expected[i] = -i;
+  }
+  for (int i = 0; i < 200; i += 2) {
+    copy.DeleteInPlace(NewInt(i), edit);
+    expected.erase(i);
+  }
+  ExpectMatches(expected, copy);
+
+  expected.clear();
+  for (int i = 0; i < 100; ++i) {
+    expected[i] = i;
+  }
+  ExpectMatches(expected, original);
+}
+
+}  // namespace expr
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "expr/hash.h"
+
+#include <cstring>
+#include <vector>
+
+#include "expr/bytevector.h"
+#include "expr/expr.h"
+#include "expr/imap.h"
+#include "expr/number.h"
+
+namespace expr {
+
+namespace {
+
+// Maximum number of nodes EqualHash visits. Bounding the traversal keeps
+// hashing large or circular structures cheap; equal objects visit the same
+// prefix, so they still hash the same.
+constexpr size_t kEqualHashBudget = 64;
+
+size_t FloatHash(double val) {
+  // 0.0 and -0.0 compare equal.
+  if (val == 0) {
+    val = 0;
+  }
+  uint64_t bits;
+  std::memcpy(&bits, &val, sizeof(bits));
+  return CombineHash(1, bits);
+}
+
+size_t NumberHash(const Number* num) {
+  if (auto* as_int = num->AsInt()) {
+    return MixHash(as_int->val());
+  }
+  return FloatHash(num->AsFloat()->val());
+}
+
+}  // namespace
+
+size_t EqHash(const Expr* expr) {
+  return MixHash(reinterpret_cast<uintptr_t>(expr));
+}
+
+size_t EqvHash(const Expr* expr) {
+  switch (expr->type()) {
+    case Expr::Type::NUMBER:
+      return NumberHash(expr->AsNumber());
+    case Expr::Type::CHAR:
+      return CombineHash(2, static_cast<unsigned char>(expr->AsChar()->val()));
+    case Expr::Type::PAIR:
+      return CombineHash(EqHash(expr->AsPair()->car()),
+                         EqHash(expr->AsPair()->cdr()));
+    case Expr::Type::VECTOR: {
+      size_t hash = 3;
+      for (auto* val : expr->AsVector()->vals()) {
+        hash = CombineHash(hash, EqHash(val));
+      }
+      return hash;
+    }
+    default:
+      return EqHash(expr);
+  }
+}
+
+size_t EqualHash(const Expr* expr) {
+  size_t hash = 0;
+  size_t budget = kEqualHashBudget;
+  std::vector<const Expr*> stack = {expr};
+  while (!stack.empty() && budget > 0) {
+    const Expr* cur = stack.back();
+    stack.pop_back();
+    --budget;
+
+    switch (cur->type()) {
+      case Expr::Type::STRING:
+        hash = CombineHash(hash, StringHash(cur->AsString()->val()));
+        break;
+      case Expr::Type::PAIR:
+        hash = CombineHash(hash, 4);
+        stack.push_back(cur->AsPair()->cdr());
+        stack.push_back(cur->AsPair()->car());
+        break;
+      case Expr::Type::VECTOR: {
+        const auto& vals = cur->AsVector()->vals();
+        hash = CombineHash(hash, vals.size());
+        for (auto it = vals.rbegin(); it != vals.rend(); ++it) {
+          stack.push_back(*it);
+        }
+        break;
+      }
+      case Expr::Type::F64VECTOR:
+        for (auto val : cur->AsF64Vector()->vals()) {
+          hash = CombineHash(hash, FloatHash(val));
+        }
+        break;
+      case Expr::Type::BYTEVECTOR:
+        hash = CombineHash(hash, HashBytes(cur->AsBytevector()->data(),
+                                           cur->AsBytevector()->size()));
+        break;
+      case Expr::Type::IMAP:
+      case Expr::Type::ISET:
+        hash = CombineHash(
+            hash, static_cast<const HamtCollection*>(cur)->hamt().KeysHash());
+        break;
+      default:
+        hash = CombineHash(hash, EqvHash(cur));
+        break;
+    }
+  }
+
+  return hash;
+}
+
+size_t HashBytes(const void* data, size_t size) {
+  auto* bytes = static_cast<const unsigned char*>(data);
+  uint64_t hash = size;
+  for (; size >= sizeof(uint64_t);
+       size -= sizeof(uint64_t), bytes += sizeof(uint64_t)) {
+    uint64_t chunk;
+    std::memcpy(&chunk, bytes, sizeof(chunk));
+    hash = CombineHash(hash, chunk);
+  }
+
+  uint64_t tail = 0;
+  std::memcpy(&tail, bytes, size);
+  return CombineHash(hash, tail);
+}
+
+}  // namespace expr
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXPR_HASH_H_
+#define EXPR_HASH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace expr {
+
+class Expr;
+
+// Hash functions consistent with the equivalence predicates of the same name:
+// if (eq? a b) then EqHash(a) == EqHash(b), and so on.
+//
+// EqHash and the fallback cases of the others hash object addresses. Containers
+// which store these hashes must rehash when gc::Gc::move_epoch() changes.
+size_t EqHash(const Expr* expr);
+size_t EqvHash(const Expr* expr);
+size_t EqualHash(const Expr* expr);
+
+size_t HashBytes(const void* data, size_t size);
+inline size_t StringHash(const std::string& str) {
+  return HashBytes(str.data(), str.size());
+}
+
+// Finalizer which spreads entropy from all bits of |val| to the low bits.
+inline size_t MixHash(uint64_t val) {
+  val ^= val >> 33;
+  val *= 0xff51afd7ed558ccdULL;
+  val ^= val >> 33;
+  val *= 0xc4ceb9fe1a85ec53ULL;
+  val ^= val >> 33;
+  return val;
+}
+
+inline size_t CombineHash(size_t seed, size_t val) {
+  return MixHash(seed ^ (val + 0x9e3779b97f4a7c15ULL + (seed << 6)));
+}
+
+}  // namespace expr
+
+#endif  // EXPR_HASH_H_
@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "expr/hash_table.h"
+
+#include <algorithm>
+#include <initializer_list>
+
+#include "expr/hash.h"
+#include "gc/gc.h"
+
+namespace expr {
+
+namespace {
+
+constexpr size_t kMinCapacity = 8;
+
+// Number of old slots migrated per operation while growing. Must be large
+// enough that migration finishes before the new array needs to grow again.
+constexpr size_t kMigrateSlots = 8;
+
+// Marks slots of the old array which were migrated or deleted. Never
+// dereferenced.
+Expr* Tombstone() {
+  static char tombstone;
+  return reinterpret_cast<Expr*>(&tombstone);
+}
+
+bool IsLive(const Expr* key) {
+  return key != nullptr && key != Tombstone();
+}
+
+const char* KindToString(HashTable::Kind kind) {
+  switch (kind) {
+    case HashTable::Kind::EQ:
+      return "eq";
+    case HashTable::Kind::EQV:
+      return "eqv";
+    case HashTable::Kind::EQUAL:
+      return "equal";
+    case HashTable::Kind::STRING:
+      return "string";
+  }
+
+  assert(false);
+  return nullptr;
+}
+
+}  // namespace
+
+HashTable::HashTable(Kind kind)
+    : Expr(Type::HASH_TABLE),
+      kind_(kind),
+      epoch_(gc::Gc::Get().move_epoch()) {}
+
+std::ostream& HashTable::AppendStream(std::ostream& stream) const {
+  return stream << "#<hash-table " << KindToString(kind_) << " " << size()
+                << ">";
+}
+
+void HashTable::MarkReferences() {
+  for (auto* slots : {&slots_, &old_slots_}) {
+    for (const auto& slot : *slots) {
+      if (IsLive(slot.key)) {
+        slot.key->GcMark();
+        slot.val->GcMark();
+      }
+    }
+  }
+}
+
+Expr* HashTable::Lookup(Expr* key) {
+  RehashIfMoved();
+  MigrateStep(kMigrateSlots);
+
+  size_t hash = Hash(key);
+  auto idx = Find(slots_, hash, key);
+  if (idx >= 0) {
+    return slots_[idx].val;
+  }
+
+  idx = Find(old_slots_, hash, key);
+  return idx >= 0 ? old_slots_[idx].val : nullptr;
+}
+
+void HashTable::Set(Expr* key, Expr* val) {
+  RehashIfMoved();
+  MigrateStep(kMigrateSlots);
+
+  size_t hash = Hash(key);
+  auto idx = Find(slots_, hash, key);
+  if (idx >= 0) {
+    slots_[idx].val = val;
+    return;
+  }
+
+  idx = Find(old_slots_, hash, key);
+  if (idx >= 0) {
+    EraseOld(idx);
+  }
+
+  // Keep load factor at most 3/4.
+  if ((count_ + 1) * 4 > slots_.size() * 3) {
+    Grow();
+  }
+  InsertNew(&slots_, {hash, key, val});
+  ++count_;
+}
+
+bool HashTable::Delete(Expr* key) {
+  RehashIfMoved();
+  MigrateStep(kMigrateSlots);
+
+  size_t hash = Hash(key);
+  auto idx = Find(slots_, hash, key);
+  if (idx >= 0) {
+    EraseShift(&slots_, idx);
+    --count_;
+    return true;
+  }
+
+  idx = Find(old_slots_, hash, key);
+  if (idx >= 0) {
+    EraseOld(idx);
+    return true;
+  }
+
+  return false;
+}
+
+void HashTable::Clear() {
+  std::vector<Slot>().swap(slots_);
+  std::vector<Slot>().swap(old_slots_);
+  count_ = 0;
+  old_count_ = 0;
+  migrate_pos_ = 0;
+}
+
+gc::Lock<HashTable> HashTable::Copy() const {
+  auto ret = gc::make_locked<HashTable>(kind_);
+  ret->slots_ = slots_;
+  ret->count_ = count_;
+  ret->old_slots_ = old_slots_;
+  ret->old_count_ = old_count_;
+  ret->migrate_pos_ = migrate_pos_;
+  ret->epoch_ = epoch_;
+  return ret;
+}
+
+std::vector<std::pair<Expr*, Expr*>> HashTable::Entries() const {
+  std::vector<std::pair<Expr*, Expr*>> ret;
+  ret.reserve(size());
+  for (const auto* slots : {&slots_, &old_slots_}) {
+    for (const auto& slot : *slots) {
+      if (IsLive(slot.key)) {
+        ret.emplace_back(slot.key, slot.val);
+      }
+    }
+  }
+
+  return ret;
+}
+
+size_t HashTable::Hash(Expr* key) const {
+  switch (kind_) {
+    case Kind::EQ:
+      return EqHash(key);
+    case Kind::EQV:
+      return EqvHash(key);
+    case Kind::EQUAL:
+      return EqualHash(key);
+    case Kind::STRING:
+      return StringHash(TryString(key)->val());
+  }
+
+  assert(false);
+  return 0;
+}
+
+bool HashTable::KeyEqual(Expr* a, Expr* b) const {
+  switch (kind_) {
+    case Kind::EQ:
+      return a->Eq(b);
+    case Kind::EQV:
+      return a->Eqv(b);
+    case Kind::EQUAL:
+      return a->Equal(b);
+    case Kind::STRING:
+      return a->AsString()->val() == b->AsString()->val();
+  }
+
+  assert(false);
+  return false;
+}
+
+ptrdiff_t HashTable::Find(const std::vector<Slot>& slots,
+                          size_t hash,
+                          Expr* key) const {
+  if (slots.empty()) {
+    return -1;
+  }
+
+  size_t mask = slots.size() - 1;
+  for (size_t idx = hash & mask;; idx = (idx + 1) & mask) {
+    const auto& slot = slots[idx];
+    if (slot.key == nullptr) {
+      return -1;
+    }
+    if (slot.hash == hash && slot.key != Tombstone() &&
+        KeyEqual(slot.key, key)) {
+      return idx;
+    }
+  }
+}
+
+// static
+void HashTable::InsertNew(std::vector<Slot>* slots, const Slot& slot) {
+  size_t mask = slots->size() - 1;
+  size_t idx = slot.hash & mask;
+  while ((*slots)[idx].key != nullptr) {
+    idx = (idx + 1) & mask;
+  }
+  (*slots)[idx] = slot;
+}
+
+// static
+void HashTable::EraseShift(std::vector<Slot>* slots, size_t idx) {
+  // Backward shift deletion: move later members of the probe run into the
+  // hole so lookups never need tombstones.
+  auto& s = *slots;
+  size_t mask = s.size() - 1;
+  size_t hole = idx;
+  for (size_t cur = (hole + 1) & mask; s[cur].key != nullptr;
+       cur = (cur + 1) & mask) {
+    size_t home = s[cur].hash & mask;
+    // Distance from |home| to |cur| vs |home| to |hole| (mod size).
+    if (((cur - home) & mask) >= ((cur - hole) & mask)) {
+      s[hole] = s[cur];
+      hole = cur;
+    }
+  }
+  s[hole] = {0, nullptr, nullptr};
+}
+
+void HashTable::EraseOld(size_t idx) {
+  old_slots_[idx].key = Tombstone();
+  old_slots_[idx].val = nullptr;
+  if (--old_count_ == 0) {
+    std::vector<Slot>().swap(old_slots_);
+    migrate_pos_ = 0;
+  }
+}
+
+void HashTable::Grow() {
+  // Finish any growth in progress first.
+  MigrateStep(old_slots_.size());
+  assert(old_slots_.empty());
+
+  size_t new_size = std::max(kMinCapacity, slots_.size() * 2);
+  old_slots_.swap(slots_);
+  slots_.assign(new_size, {0, nullptr, nullptr});
+  old_count_ = count_;
+  count_ = 0;
+  migrate_pos_ = 0;
+
+  if (old_count_ == 0) {
+    std::vector<Slot>().swap(old_slots_);
+  }
+}
+
+void HashTable::MigrateStep(size_t max_slots) {
+  if (old_slots_.empty()) {
+    return;
+  }
+
+  size_t end = std::min(old_slots_.size(), migrate_pos_ + max_slots);
+  for (; migrate_pos_ < end; ++migrate_pos_) {
+    auto& slot = old_slots_[migrate_pos_];
+    if (IsLive(slot.key)) {
+      InsertNew(&slots_, slot);
+      ++count_;
+      --old_count_;
+      slot.key = Tombstone();
+    }
+  }
+
+  if (old_count_ == 0) {
+    std::vector<Slot>().swap(old_slots_);
+    migrate_pos_ = 0;
+  }
+}
+
+void HashTable::RehashIfMoved() {
+  auto epoch = gc::Gc::Get().move_epoch();
+  if (epoch == epoch_) {
+    return;
+  }
+
+  // Stored hashes may depend on addresses which are no longer valid.
+  auto entries = Entries();
+  epoch_ = epoch;
+  std::fill(slots_.begin(), slots_.end(), Slot{0, nullptr, nullptr});
+  std::vector<Slot>().swap(old_slots_);
+  count_ = entries.size();
+  old_count_ = 0;
+  migrate_pos_ = 0;
+  for (const auto& entry : entries) {
+    InsertNew(&slots_, {Hash(entry.first), entry.first, entry.second});
+  }
+}
+
+}  // namespace expr
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXPR_HASH_TABLE_H_
+#define EXPR_HASH_TABLE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "expr/expr.h"
+
+namespace expr {
+
+// SRFI 69 hash table.
+//
+// Open addressing with linear probing. Each slot stores its key's hash so
+// probes rarely need to call the equivalence predicate, and so entries can be
+// moved without rehashing. Growth is incremental: when the table grows, the old
+// slot array is kept and a few slots are migrated into the new array on each
+// operation rather than rehashing everything at once.
+class HashTable : public Expr {
+ public:
+  enum class Kind {
+    EQ,      // eq?
+    EQV,     // eqv?
+    EQUAL,   // equal?
+    STRING,  // string=?, keys must be strings.
+  };
+
+  explicit HashTable(Kind kind);
+
+  // Expr implementation:
+  const HashTable* AsHashTable() const override { return this; }
+  HashTable* AsHashTable() override { return this; }
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  void MarkReferences() override;
+
+  // Returns nullptr if |key| is not present.
+  Expr* Lookup(Expr* key);
+  void Set(Expr* key, Expr* val);
+
+  // Returns whether |key| was present.
+  bool Delete(Expr* key);
+  void Clear();
+  gc::Lock<HashTable> Copy() const;
+
+  // Returns all entries. Callers which may modify the table while using the
+  // result must keep the entries alive themselves.
+  std::vector<std::pair<Expr*, Expr*>> Entries() const;
+
+  Kind kind() const { return kind_; }
+  size_t size() const { return count_ + old_count_; }
+
+ private:
+  struct Slot {
+    size_t hash;
+    Expr* key;  // nullptr if empty.
+    Expr* val;
+  };
+
+  ~HashTable() override = default;
+
+  size_t Hash(Expr* key) const;
+  bool KeyEqual(Expr* a, Expr* b) const;
+
+  // Returns the index of |key| in |slots| or -1.
+  ptrdiff_t Find(const std::vector<Slot>& slots, size_t hash, Expr* key) const;
+  static void InsertNew(std::vector<Slot>* slots, const Slot& slot);
+  static void EraseShift(std::vector<Slot>* slots, size_t idx);
+  void EraseOld(size_t idx);
+
+  void Grow();
+  void MigrateStep(size_t max_slots);
+  void RehashIfMoved();
+
+  const Kind kind_;
+
+  std::vector<Slot> slots_;
+  size_t count_ = 0;
+
+  // Slots of the table before the last growth which haven't been migrated
+  // yet. Migrated or deleted entries are replaced with tombstones.
+  std::vector<Slot> old_slots_;
+  size_t old_count_ = 0;
+  size_t migrate_pos_ = 0;
+
+  // Value of gc::Gc::move_epoch() when hashes were computed.
+  uint64_t epoch_;
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(HashTable);
+};
+
+}  // namespace expr
+
+#endif  // EXPR_HASH_TABLE_H_
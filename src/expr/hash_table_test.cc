@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <random>
+#include <unordered_map>
+
+#include "expr/hash.h"
+#include "expr/hash_table.h"
+#include "expr/number.h"
+#include "test/util.h"
+
+namespace expr {
+
+class HashTableTest : public test::TestBase {};
+
+TEST_F(HashTableTest, Basic) {
+  auto table = gc::make_locked<HashTable>(HashTable::Kind::EQUAL);
+  auto key = gc::make_locked<String>("foo");
+  auto val = gc::make_locked<Int>(1);
+
+  EXPECT_EQ(nullptr, table->Lookup(key.get()));
+  table->Set(key.get(), val.get());
+  EXPECT_EQ(1u, table->size());
+  EXPECT_EQ(val.get(), table->Lookup(key.get()));
+
+  // A different but equal? key finds the same entry.
+  auto other_key = gc::make_locked<String>("foo");
+  EXPECT_EQ(val.get(), table->Lookup(other_key.get()));
+  table->Set(other_key.get(), Nil());
+  EXPECT_EQ(1u, table->size());
+  EXPECT_EQ(Nil(), table->Lookup(key.get()));
+
+  EXPECT_TRUE(table->Delete(key.get()));
+  EXPECT_FALSE(table->Delete(key.get()));
+  EXPECT_EQ(0u, table->size());
+  EXPECT_EQ(nullptr, table->Lookup(key.get()));
+}
+
+TEST_F(HashTableTest, EqUsesIdentity) {
+  auto table = gc::make_locked<HashTable>(HashTable::Kind::EQ);
+  auto key = gc::make_locked<String>("foo");
+  auto other_key = gc::make_locked<String>("foo");
+  table->Set(key.get(), True());
+  EXPECT_EQ(True(), table->Lookup(key.get()));
+  EXPECT_EQ(nullptr, table->Lookup(other_key.get()));
+}
+
+// Randomized inserts and deletes across many growths, checked against
+// std::unordered_map. Also exercises lookups during incremental migration.
+TEST_F(HashTableTest, MatchesReference) {
+  auto table = gc::make_locked<HashTable>(HashTable::Kind::EQV);
+  std::unordered_map<Int::ValType, Int::ValType> reference;
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<Int::ValType> key_dist(0, 5000);
+
+  for (int i = 0; i < 20000; ++i) {
+    auto key = gc::make_locked<Int>(key_dist(gen));
+    if (i % 3 == 0) {
+      EXPECT_EQ(reference.erase(key->val()) == 1, table->Delete(key.get()));
+    } else {
+      table->Set(key.get(), gc::make_locked<Int>(i).get());
+      reference[key->val()] = i;
+    }
+    ASSERT_EQ(reference.size(), table->size());
+
+    // Keys and values are only reachable through the table.
+    if (i % 5000 == 0) {
+      gc::Gc::Get().Collect();
+    }
+  }
+
+  for (Int::ValType k = 0; k <= 5000; ++k) {
+    auto key = gc::make_locked<Int>(k);
+    auto* val = table->Lookup(key.get());
+    auto it = reference.find(k);
+    if (it == reference.end()) {
+      EXPECT_EQ(nullptr, val);
+    } else {
+      ASSERT_NE(nullptr, val);
+      EXPECT_EQ(it->second, TryInt(val)->val());
+    }
+  }
+  EXPECT_EQ(reference.size(), table->Entries().size());
+}
+
+TEST_F(HashTableTest, RehashAfterMove) {
+  auto table = gc::make_locked<HashTable>(HashTable::Kind::EQ);
+  std::vector<gc::Lock<Int>> keys;
+  for (int i = 0; i < 100; ++i) {
+    keys.push_back(gc::make_locked<Int>(i));
+    table->Set(keys.back().get(), keys.back().get());
+  }
+
+  gc::Gc::Get().NotifyObjectsMoved();
+  for (const auto& key : keys) {
+    EXPECT_EQ(key.get(), table->Lookup(key.get()));
+  }
+  EXPECT_EQ(keys.size(), table->size());
+}
+
+TEST_F(HashTableTest, EqualHashConsistentWithEqual) {
+  auto str = gc::make_locked<String>("x");
+  auto zero = gc::make_locked<Float>(0.0);
+  auto neg_zero = gc::make_locked<Float>(-0.0);
+  auto a = gc::make_locked<Pair>(str.get(), zero.get());
+  auto other_str = gc::make_locked<String>("x");
+  auto b = gc::make_locked<Pair>(other_str.get(), neg_zero.get());
+  ASSERT_TRUE(a->Equal(b.get()));
+  EXPECT_EQ(EqualHash(a.get()), EqualHash(b.get()));
+
+  auto i1 = gc::make_locked<Int>(7);
+  auto i2 = gc::make_locked<Int>(7);
+  EXPECT_EQ(EqvHash(i1.get()), EqvHash(i2.get()));
+}
+
+}  // namespace expr
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "expr/imap.h"
+
+#include <utility>
+
+#include "gc/gc.h"
+
+namespace expr {
+
+HamtCollection::HamtCollection(Type type, Hamt hamt, bool transient)
+    : Expr(type),
+      hamt_(std::move(hamt)),
+      edit_(transient ? Hamt::NewEdit() : 0),
+      epoch_(gc::Gc::Get().move_epoch()) {}
+
+std::ostream& HamtCollection::AppendStream(std::ostream& stream) const {
+  stream << "#<" << (type() == Type::IMAP ? "imap" : "iset");
+  if (transient()) {
+    stream << " transient";
+  }
+  return stream << " " << size() << ">";
+}
+
+bool HamtCollection::EqualImpl(const Expr* other) const {
+  auto* as_other = static_cast<const HamtCollection*>(other);
+  if (size() != as_other->size()) {
+    return false;
+  }
+
+  // Equal collections have equal keys, so it is enough to look up each of our
+  // entries in |other|.
+  bool equal = true;
+  hamt().ForEach([&equal, as_other](const Hamt::Entry& entry) {
+    if (!equal) {
+      return;
+    }
+    auto* found = as_other->hamt().Find(entry.key);
+    equal = found && (entry.val == nullptr || entry.val->Equal(found->val));
+  });
+  return equal;
+}
+
+void HamtCollection::MarkReferences() {
+  hamt_.MarkReferences();
+}
+
+const Hamt& HamtCollection::hamt() const {
+  auto epoch = gc::Gc::Get().move_epoch();
+  if (epoch != epoch_) {
+    // Stored hashes may depend on addresses which are no longer valid.
+    hamt_ = hamt_.Rehash();
+    epoch_ = epoch;
+  }
+  return hamt_;
+}
+
+const Hamt& HamtCollection::persistent_hamt() const {
+  if (transient()) {
+    throw util::RuntimeException("Expected persistent", this);
+  }
+  return hamt();
+}
+
+Hamt* HamtCollection::mutable_hamt() {
+  if (!transient()) {
+    throw util::RuntimeException("Expected transient", this);
+  }
+  hamt();
+  return &hamt_;
+}
+
+Expr* IMap::Lookup(Expr* key) {
+  auto* entry = hamt().Find(key);
+  return entry ? entry->val : nullptr;
+}
+
+gc::Lock<IMap> IMap::Set(Expr* key, Expr* val) {
+  return gc::make_locked<IMap>(persistent_hamt().Set(key, val));
+}
+
+gc::Lock<IMap> IMap::Delete(Expr* key) {
+  return gc::make_locked<IMap>(persistent_hamt().Delete(key));
+}
+
+gc::Lock<IMap> IMap::Transient() {
+  return gc::make_locked<IMap>(persistent_hamt(), true /* transient */);
+}
+
+void IMap::SetInPlace(Expr* key, Expr* val) {
+  mutable_hamt()->SetInPlace(key, val, edit());
+}
+
+void IMap::DeleteInPlace(Expr* key) {
+  mutable_hamt()->DeleteInPlace(key, edit());
+}
+
+bool ISet::Contains(Expr* key) {
+  return hamt().Find(key) != nullptr;
+}
+
+gc::Lock<ISet> ISet::Add(Expr* key) {
+  return gc::make_locked<ISet>(persistent_hamt().Set(key, nullptr));
+}
+
+gc::Lock<ISet> ISet::Remove(Expr* key) {
+  return gc::make_locked<ISet>(persistent_hamt().Delete(key));
+}
+
+gc::Lock<ISet> ISet::Transient() {
+  return gc::make_locked<ISet>(persistent_hamt(), true /* transient */);
+}
+
+void ISet::AddInPlace(Expr* key) {
+  mutable_hamt()->SetInPlace(key, nullptr, edit());
+}
+
+void ISet::RemoveInPlace(Expr* key) {
+  mutable_hamt()->DeleteInPlace(key, edit());
+}
+
+}  // namespace expr
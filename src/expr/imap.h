@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXPR_IMAP_H_
+#define EXPR_IMAP_H_
+
+#include <cstdint>
+
+#include "expr/expr.h"
+#include "expr/hamt.h"
+
+namespace expr {
+
+// Common implementation of IMap and ISet.
+//
+// A transient is created from a persistent collection, supports in place
+// updates, and is turned back into a persistent collection by
+// MakePersistent(), after which it can't be updated in place again.
+class HamtCollection : public Expr {
+ public:
+  // Expr implementation:
+  std::ostream& AppendStream(std::ostream& stream) const override;
+  bool EqualImpl(const Expr* other) const override;
+  void MarkReferences() override;
+
+  const Hamt& hamt() const;
+  bool transient() const { return edit_ != 0; }
+  void MakePersistent() { edit_ = 0; }
+  size_t size() const { return hamt_.size(); }
+
+ protected:
+  HamtCollection(Type type, Hamt hamt, bool transient);
+  ~HamtCollection() override = default;
+
+  // Persistent updates must only be made from persistent collections and in
+  // place updates only to transients, otherwise a transient could modify
+  // nodes shared with another collection.
+  const Hamt& persistent_hamt() const;
+  Hamt* mutable_hamt();
+  uint64_t edit() const { return edit_; }
+
+ private:
+  // Rehashed lazily when objects move.
+  mutable Hamt hamt_;
+
+  // Transient edit token, or 0 if persistent.
+  uint64_t edit_;
+
+  // Value of gc::Gc::move_epoch() when hashes were computed.
+  mutable uint64_t epoch_;
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(HamtCollection);
+};
+
+// Immutable map keyed by equal?.
+class IMap : public HamtCollection {
+ public:
+  explicit IMap(Hamt hamt = Hamt(), bool transient = false)
+      : HamtCollection(Type::IMAP, std::move(hamt), transient) {}
+
+  // Expr implementation:
+  const IMap* AsIMap() const override { return this; }
+  IMap* AsIMap() override { return this; }
+
+  // Returns nullptr if |key| isn't present.
+  Expr* Lookup(Expr* key);
+
+  gc::Lock<IMap> Set(Expr* key, Expr* val);
+  gc::Lock<IMap> Delete(Expr* key);
+  gc::Lock<IMap> Transient();
+
+  // Transient updates.
+  void SetInPlace(Expr* key, Expr* val);
+  void DeleteInPlace(Expr* key);
+
+ private:
+  ~IMap() override = default;
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(IMap);
+};
+
+// Immutable set of equal? distinct values.
+class ISet : public HamtCollection {
+ public:
+  explicit ISet(Hamt hamt = Hamt(), bool transient = false)
+      : HamtCollection(Type::ISET, std::move(hamt), transient) {}
+
+  // Expr implementation:
+  const ISet* AsISet() const override { return this; }
+  ISet* AsISet() override { return this; }
+
+  bool Contains(Expr* key);
+
+  gc::Lock<ISet> Add(Expr* key);
+  gc::Lock<ISet> Remove(Expr* key);
+  gc::Lock<ISet> Transient();
+
+  // Transient updates.
+  void AddInPlace(Expr* key);
+  void RemoveInPlace(Expr* key);
+
+ private:
+  ~ISet() override = default;
+
+  DISALLOW_MOVE_COPY_AND_ASSIGN(ISet);
+};
+
+}  // namespace expr
+
+#endif  // EXPR_IMAP_H_
@@ -26,6 +26,10 @@
 #include "expr/expr.h"
 #include "gc/gc.h"
 
+namespace eval {
+class JitCompiler;
+}  // namespace eval
+
 namespace expr {
 
 class Int;
@@ -89,6 +93,9 @@ class Int : public Number {
   void set_val(ValType val) { val_ = val; }
 
  private:
+  // Generates code which reads |val_| directly.
+  friend class eval::JitCompiler;
+
   // Override from Number
   std::ostream& AppendStream(std::ostream& stream) const override {
     return stream << val_;
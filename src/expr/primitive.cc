@@ -19,9 +19,12 @@
 
 #include <strings.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cctype>
+#include <cstring>
 #include <functional>
+#include <initializer_list>
 #include <limits>
 #include <sstream>
 #include <string>
@@ -29,13 +32,21 @@
 #include <vector>
 #include <utility>
 
+#include "expr/bytevector.h"
 #include "expr/expr.h"
+#include "expr/hash.h"
+#include "expr/hash_table.h"
+#include "expr/imap.h"
 #include "expr/number.h"
 #include "expr/primitive.h"
+#include "eval/call_stack.h"
 #include "eval/eval.h"
+#include "eval/node.h"
+#include "eval/value_stack.h"
 #include "gc/lock.h"
 #include "parse/lexer.h"
 #include "util/exceptions.h"
+#include "util/simd.h"
 #include "util/util.h"
 
 using eval::Eval;
@@ -77,22 +88,27 @@ void ExpectNumArgsGe(size_t num_args, size_t expected) {
   }
 }
 
-std::vector<gc::Lock<Expr>> EvalArgs(Env* env, Expr** args, size_t num_args) {
-  std::vector<gc::Lock<Expr>> locks;
-  locks.reserve(num_args);
-  for (size_t i = 0; i < num_args; ++i) {
-    auto lock = Eval(args[i], env);
-    args[i] = lock.get();
-    locks.emplace_back(lock);
+// Returns true if |primitive| holds nothing but value stack slots across the
+// procedures it calls, so continuations captured by them may be resumed.
+bool IsReentrant(Primitive primitive) {
+  switch (primitive) {
+    case Primitive::Apply:
+    case Primitive::ForEach:
+    case Primitive::CallWithCurrentContinuation:
+    case Primitive::CallWithValues:
+      return true;
+    default:
+      return false;
   }
-
-  return locks;
 }
 
 class PrimitiveImpl : public Evals {
  public:
-  PrimitiveImpl(const char* name, PrimitiveFunc func, bool eval_args)
-      : name_(name), func_(func), eval_args_(eval_args) {}
+  PrimitiveImpl(Primitive primitive, const char* name, PrimitiveFunc func)
+      : primitive_(primitive),
+        name_(name),
+        func_(func),
+        reentrant_(IsReentrant(primitive)) {}
 
   // Evals implementation:
   std::ostream& AppendStream(std::ostream& stream) const override {
@@ -100,22 +116,24 @@ class PrimitiveImpl : public Evals {
   }
 
   gc::Lock<Expr> DoEval(Env* env, Expr** args, size_t num_args) override {
-    std::vector<gc::Lock<Expr>> locks;
-    if (eval_args_) {
-      locks = EvalArgs(env, args, num_args);
-    }
-
     try {
+      if (reentrant_) {
+        return func_(env, args, num_args);
+      }
+      eval::CaptureBarrier barrier;
       return func_(env, args, num_args);
     } catch (RuntimeException& e) {
       throw RuntimeException(e.what(), nullptr);
     }
   }
 
+  Primitive primitive() const { return primitive_; }
+
  private:
+  const Primitive primitive_;
   const char* const name_;
   const PrimitiveFunc func_;
-  const bool eval_args_;
+  const bool reentrant_;
 };
 
 template <template <typename T> class Op>
@@ -175,130 +193,6 @@ gc::Lock<Expr> MostOp(Expr** args, size_t num_args) {
   return gc::Lock<Expr>(ret);
 }
 
-gc::Lock<Expr> ExecuteList(Env* env, Expr* cur) {
-  gc::Lock<Expr> last_eval;
-  while (auto* link = cur->AsPair()) {
-    last_eval = Eval(link->car(), env);
-    cur = link->cdr();
-  }
-
-  if (cur != Nil()) {
-    throw RuntimeException("Unexpected expression", cur);
-  }
-
-  if (!last_eval) {
-    throw RuntimeException("Unexpected empty sequence", cur);
-  }
-
-  return last_eval;
-}
-
-gc::Lock<Expr> EvalArray(Env* env, Expr** args, size_t num_args) {
-  gc::Lock<Expr> last_eval;
-  for (size_t i = 0; i < num_args; ++i) {
-    last_eval = Eval(args[i], env);
-  }
-
-  return last_eval;
-}
-
-class LambdaImpl : public Evals {
- public:
-  explicit LambdaImpl(std::vector<Symbol*> required_args,
-                      Symbol* variable_arg,
-                      std::vector<Expr*> body,
-                      Env* env)
-      : required_args_(std::move(required_args)),
-        variable_arg_(variable_arg),
-        body_(std::move(body)),
-        env_(env) {
-    assert(body_.size() > 0);
-    assert(env);
-  }
-  ~LambdaImpl() override = default;
-
-  // Evals implementation:
-  std::ostream& AppendStream(std::ostream& stream) const override;
-  gc::Lock<Expr> DoEval(Env* env, Expr** args, size_t num_args) override;
-  void MarkReferences() override {
-    for (auto arg : required_args_) {
-      arg->GcMark();
-    }
-    if (variable_arg_) {
-      variable_arg_->GcMark();
-    }
-
-    for (auto expr : body_) {
-      expr->GcMark();
-    }
-
-    env_->GcMark();
-  }
-
- private:
-  const std::vector<Symbol*> required_args_;
-  Symbol* const variable_arg_;
-  const std::vector<Expr*> body_;
-  Env* const env_;
-};
-
-std::ostream& LambdaImpl::AppendStream(std::ostream& stream) const {
-  stream << "(lambda ";
-  if (required_args_.size() == 0 && variable_arg_ != nullptr) {
-    stream << *variable_arg_;
-  } else {
-    stream << "(";
-    for (auto* arg : required_args_)
-      stream << *arg << " ";
-
-    if (variable_arg_) {
-      stream << ". " << *variable_arg_;
-    }
-    stream << ")";
-  }
-
-  for (auto* expr : body_) {
-    stream << " " << *expr;
-  }
-  return stream << ")";
-}
-
-gc::Lock<Expr> LambdaImpl::DoEval(Env* env, Expr** args, size_t num_args) {
-  if (num_args < required_args_.size()) {
-    std::ostringstream os;
-    os << "Invalid number of arguments. expected ";
-    if (variable_arg_ != nullptr) {
-      os << "at least ";
-    }
-
-    os << required_args_.size();
-    os << " given: " << num_args;
-    throw RuntimeException(os.str(), nullptr);
-  }
-
-  auto locks = EvalArgs(env, args, num_args);
-
-  auto arg_it = args;
-  auto new_env = gc::make_locked<Env>(env_);
-
-  for (auto* sym : required_args_) {
-    new_env->DefineVar(sym, *arg_it++);
-  }
-  if (variable_arg_ != nullptr) {
-    gc::Lock<Expr> rest(Nil());
-    for (Expr** temp = args + num_args - 1; temp >= arg_it; --temp) {
-      rest.reset(new Pair(*temp, rest.get()));
-    }
-    new_env->DefineVar(variable_arg_, rest.get());
-  }
-
-  assert(body_.size() >= 1);
-  for (size_t i = 0; i < body_.size() - 1; ++i) {
-    Eval(body_[i], new_env.get());
-  }
-  return Eval(body_.back(), new_env.get());
-}
-
 class CrImpl : public Evals {
  public:
   explicit CrImpl(const std::string& cr) : cr_(cr) {}
@@ -310,7 +204,6 @@ class CrImpl : public Evals {
   }
   gc::Lock<Expr> DoEval(Env* env, Expr** args, size_t num_args) override {
     ExpectNumArgs(num_args, 1);
-    auto locks = EvalArgs(env, args, num_args);
     return gc::Lock<Expr>(TryPair(args[0])->Cr(cr_));
   }
 
@@ -462,20 +355,219 @@ struct ICaseCmpStr {
   }
 };
 
+F64Vector* TryF64VectorOfSize(Expr* expr, size_t size) {
+  auto* vec = TryF64Vector(expr);
+  if (vec->vals().size() != size) {
+    throw RuntimeException("Expected f64vector of length " +
+                               std::to_string(size),
+                           expr);
+  }
+  return vec;
+}
+
+using BinaryKernel = void (*)(const double*, const double*, double*, size_t);
+
+gc::Lock<Expr> EvalBinaryKernel(BinaryKernel kernel, Expr* v1, Expr* v2) {
+  auto& x = TryF64Vector(v1)->vals();
+  auto& y = TryF64VectorOfSize(v2, x.size())->vals();
+  std::vector<double> out(x.size());
+  kernel(x.data(), y.data(), out.data(), out.size());
+  return gc::Lock<Expr>(new expr::F64Vector(std::move(out)));
+}
+
+using ReduceKernel = double (*)(const double*, size_t);
+
+gc::Lock<Expr> EvalReduceNonEmpty(ReduceKernel kernel, Expr* v) {
+  auto& x = TryF64Vector(v)->vals();
+  if (x.empty()) {
+    throw RuntimeException("Expected non-empty f64vector", v);
+  }
+  return gc::Lock<Expr>(new Float(kernel(x.data(), x.size())));
+}
+
+// Parses the optional [start [end]] arguments beginning at |args[idx]| for a
+// sequence of length |size|.
+std::pair<size_t, size_t> TryGetRange(Expr** args,
+                                      size_t num_args,
+                                      size_t idx,
+                                      size_t size) {
+  size_t start = num_args > idx ? TryGetNonNegExactIntVal(args[idx], size + 1)
+                                : 0;
+  size_t end = num_args > idx + 1
+                   ? TryGetNonNegExactIntVal(args[idx + 1], size + 1)
+                   : size;
+  if (start > end) {
+    throw RuntimeException("Expected start <= end", args[idx]);
+  }
+  return {start, end};
+}
+
+uint8_t* TryGetWritableBytes(expr::Bytevector* bv) {
+  if (bv->read_only()) {
+    throw RuntimeException("Attempt to write read only bytevector", bv);
+  }
+  return bv->mutable_data();
+}
+
+// Returns the offset given by |expr| of a |width| byte value in |bv|.
+size_t TryGetByteOffset(Expr* expr, const expr::Bytevector* bv, size_t width) {
+  if (bv->size() < width) {
+    throw RuntimeException("index out of range", expr);
+  }
+  return TryGetNonNegExactIntVal(expr, bv->size() - width + 1);
+}
+
+// Returns whether the optional endianness argument |args[idx]| requires
+// swapping bytes relative to the host.
+bool TryGetNeedSwap(Expr** args, size_t num_args, size_t idx) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  constexpr bool kHostBig = true;
+#else
+  constexpr bool kHostBig = false;
+#endif
+  if (num_args <= idx) {
+    return kHostBig;
+  }
+
+  auto& name = TrySymbol(args[idx])->val();
+  if (name != "big" && name != "little") {
+    throw RuntimeException("Expected 'big or 'little", args[idx]);
+  }
+  return (name == "big") != kHostBig;
+}
+
+template <typename T>
+T LoadBytes(const uint8_t* src, bool swap) {
+  uint8_t buf[sizeof(T)];
+  std::memcpy(buf, src, sizeof(T));
+  if (swap) {
+    std::reverse(buf, buf + sizeof(T));
+  }
+  T ret;
+  std::memcpy(&ret, buf, sizeof(T));
+  return ret;
+}
+
+template <typename T>
+void StoreBytes(uint8_t* dst, T val, bool swap) {
+  uint8_t buf[sizeof(T)];
+  std::memcpy(buf, &val, sizeof(T));
+  if (swap) {
+    std::reverse(buf, buf + sizeof(T));
+  }
+  std::memcpy(dst, buf, sizeof(T));
+}
+
+template <typename T>
+gc::Lock<Expr> BytevectorIntRef(Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 2);
+  ExpectNumArgsLe(num_args, sizeof(T) > 1 ? 3 : 2);
+  auto* bv = TryBytevector(args[0]);
+  auto offset = TryGetByteOffset(args[1], bv, sizeof(T));
+  T val = LoadBytes<T>(bv->data() + offset, TryGetNeedSwap(args, num_args, 2));
+  // Only a u64 can exceed the range of Int.
+  if (!std::numeric_limits<T>::is_signed && sizeof(T) == sizeof(Int::ValType) &&
+      val > static_cast<T>(std::numeric_limits<Int::ValType>::max())) {
+    throw RuntimeException("Value too large for integer", args[1]);
+  }
+  return gc::Lock<Expr>(new Int(val));
+}
+
+template <typename T>
+gc::Lock<Expr> BytevectorIntSet(Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 3);
+  ExpectNumArgsLe(num_args, sizeof(T) > 1 ? 4 : 3);
+  auto* bv = TryBytevector(args[0]);
+  auto offset = TryGetByteOffset(args[1], bv, sizeof(T));
+  auto val = TryInt(args[2])->val();
+  bool fits = std::numeric_limits<T>::is_signed
+                  ? val >= static_cast<Int::ValType>(
+                               std::numeric_limits<T>::min()) &&
+                        val <= static_cast<Int::ValType>(
+                                   std::numeric_limits<T>::max())
+                  : val >= 0 && static_cast<uint64_t>(val) <=
+                                    std::numeric_limits<T>::max();
+  if (!fits) {
+    throw RuntimeException("Value out of range", args[2]);
+  }
+  StoreBytes<T>(TryGetWritableBytes(bv) + offset, static_cast<T>(val),
+                TryGetNeedSwap(args, num_args, 3));
+  return gc::Lock<Expr>(Nil());
+}
+
+template <typename T>
+gc::Lock<Expr> BytevectorFloatRef(Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 2);
+  ExpectNumArgsLe(num_args, 3);
+  auto* bv = TryBytevector(args[0]);
+  auto offset = TryGetByteOffset(args[1], bv, sizeof(T));
+  T val = LoadBytes<T>(bv->data() + offset, TryGetNeedSwap(args, num_args, 2));
+  return gc::Lock<Expr>(new Float(val));
+}
+
+template <typename T>
+gc::Lock<Expr> BytevectorFloatSet(Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 3);
+  ExpectNumArgsLe(num_args, 4);
+  auto* bv = TryBytevector(args[0]);
+  auto offset = TryGetByteOffset(args[1], bv, sizeof(T));
+  T val = TryGetFloatVal(args[2]);
+  StoreBytes<T>(TryGetWritableBytes(bv) + offset, val,
+                TryGetNeedSwap(args, num_args, 3));
+  return gc::Lock<Expr>(Nil());
+}
+
+gc::Lock<Expr> CallProcedure(Env* env,
+                             Expr* procedure,
+                             std::initializer_list<Expr*> args) {
+  eval::StackSlots slots(args.size());
+  std::copy(args.begin(), args.end(), slots.get());
+  return TryEvals(procedure)->DoEval(env, slots.get(), args.size());
+}
+
+HashTable::Kind TryGetHashTableKind(Env* env, Expr* equiv) {
+  static const std::pair<const char*, HashTable::Kind> kKinds[] = {
+      {"eq?", HashTable::Kind::EQ},
+      {"eqv?", HashTable::Kind::EQV},
+      {"equal?", HashTable::Kind::EQUAL},
+      {"string=?", HashTable::Kind::STRING},
+  };
+
+  for (const auto& kind : kKinds) {
+    if (env->TryLookup(Symbol::New(kind.first)) == equiv) {
+      return kind.second;
+    }
+  }
+
+  throw RuntimeException("Unsupported hash table equivalence procedure", equiv);
+}
+
+gc::Lock<Expr> EntriesToList(
+    const std::vector<std::pair<Expr*, Expr*>>& entries,
+    const std::function<Expr*(const std::pair<Expr*, Expr*>&,
+                              std::vector<gc::Lock<Pair>>*)>& func) {
+  std::vector<gc::Lock<Pair>> locks;
+  gc::Lock<Expr> ret(Nil());
+  for (const auto& entry : entries) {
+    auto* val = func(entry, &locks);
+    ret.reset(new Pair(val, ret.get()));
+  }
+  return ret;
+}
+
 template <bool need_return>
 gc::Lock<Expr> MapImpl(Env* env, Expr** args, size_t num_args) {
   static constexpr char kEqualSizeListErr[] =
       "Expected equal sized argument lists";
   Evals* procedure = TryEvals(args[0]);
 
-  gc::Lock<Expr> ret(Nil());
+  eval::StackSlots ret(1);
+  ret[0] = Nil();
   Pair* prev = nullptr;
 
-  std::vector<gc::Lock<Pair>> locks;
-
+  eval::StackSlots new_args(num_args - 1);
   while (true) {
     bool done = false;
-    std::vector<Expr*> new_args(num_args - 1);
     for (size_t i = 1; i < num_args; ++i) {
       if (auto* list = args[i]->AsPair()) {
         if (done) {
@@ -501,489 +593,181 @@ gc::Lock<Expr> MapImpl(Env* env, Expr** args, size_t num_args) {
       break;
     }
 
-    // Quote non-self evaluating types to make sure they aren't considered an
-    // evaluation.
-    for (auto& expr : new_args) {
-      if (expr->type() == Expr::Type::PAIR ||
-          expr->type() == Expr::Type::SYMBOL) {
-        auto back = gc::make_locked<Pair>(expr, Nil());
-        auto pair = gc::make_locked<Pair>(Symbol::New("quote"), back.get());
-        expr = pair.get();
-        locks.push_back(std::move(pair));
-      }
-    }
-
-    auto res = procedure->DoEval(env, new_args.data(), new_args.size());
+    auto res = procedure->DoEval(env, new_args.get(), num_args - 1);
     if (need_return) {
+      // Reachable from |ret| once linked in.
       auto pair = gc::make_locked<Pair>(res.get(), Nil());
       Pair* new_link = pair.get();
-      locks.push_back(std::move(pair));
       if (prev) {
         prev->set_cdr(new_link);
       } else {
-        ret.reset(new_link);
+        ret[0] = new_link;
       }
       prev = new_link;
     }
   }
 
-  return ret;
+  return gc::Lock<Expr>(ret[0]);
+}
+
+class Continuation;
+
+// Thrown to unwind the stack to the call/cc which made |target|. Not a
+// std::exception, so only CallWithCurrentContinuation() catches it.
+struct ContinuationThrow {
+  Continuation* target;
+  // Other than one value is passed as a list, since after thunks of
+  // dynamic-wind may return values of their own on the way.
+  gc::Lock<Expr> val;
+  bool multiple;
+};
+
+// Returns |val| from call/cc, or the values in the list |val| if |multiple|.
+gc::Lock<Expr> ReturnValues(Expr* val, bool multiple) {
+  if (!multiple) {
+    return gc::Lock<Expr>(val);
+  }
+  auto vals = ExprVecFromList(val);
+  return gc::Lock<Expr>(
+      eval::MultipleValues::Get().Set(vals.data(), vals.size()));
 }
 
-class Promise : public Evals {
+// The continuation of a call to call/cc. While the call runs, calling it
+// returns from the call by unwinding the stack, so dynamic-wind's after thunks
+// run on the way. Once the call has returned, calling it copies the call's
+// stacks back, as described in eval/call_stack.h, and returns from it again.
+class Continuation : public Evals {
  public:
-  Promise(Expr* expr, Env* env) : expr_(expr), env_(env) {}
+  Continuation() : capture_(this) {}
 
   // Evals implementation:
   std::ostream& AppendStream(std::ostream& stream) const override {
-    return stream << "promise";
+    return stream << "continuation";
   }
-  gc::Lock<Expr> DoEval(Env* /* env */,
-                        Expr** /* args */,
-                        size_t /* num_args */) override {
-    if (forced_val_) {
-      return gc::Lock<Expr>(forced_val_);
+  gc::Lock<Expr> DoEval(Env* env, Expr** args, size_t num_args) override {
+    if (!capture_.live() && !capture_.resumable()) {
+      throw RuntimeException("Continuation called after its extent ended",
+                             this);
     }
-
-    auto ret = Eval(expr_, env_);
-    forced_val_ = ret.get();
-    expr_ = nullptr;
-    env_ = nullptr;
-    return ret;
+    gc::Lock<Expr> val(num_args == 1 ? args[0] : Nil());
+    if (num_args != 1) {
+      for (size_t i = num_args; i > 0; --i) {
+        val.reset(new Pair(args[i - 1], val.get()));
+      }
+    }
+    if (capture_.live()) {
+      throw ContinuationThrow{this, std::move(val), num_args != 1};
+    }
+    resume_val_ = val.get();
+    resume_multiple_ = num_args != 1;
+    capture_.Resume();
   }
   void MarkReferences() override {
-    if (expr_)
-      expr_->GcMark();
-    if (env_)
-      env_->GcMark();
-    if (forced_val_)
-      forced_val_->GcMark();
+    capture_.MarkReferences();
+    if (resume_val_) {
+      resume_val_->GcMark();
+    }
   }
 
- private:
-  Expr* expr_;
-  Env* env_;
-  Expr* forced_val_ = nullptr;
-};
-
-gc::Lock<Expr> Quote(Env* /* env */, Expr** args, size_t num_args) {
-  ExpectNumArgs(num_args, 1);
-  return gc::Lock<Expr>(args[0]);
-}
+  eval::StackCapture& capture() { return capture_; }
 
-gc::Lock<Expr> Lambda(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgsGe(num_args, 2);
-  std::vector<Symbol*> req_args;
-  Symbol* var_arg = nullptr;
-  switch (args[0]->type()) {
-    case Expr::Type::EMPTY_LIST:
-      break;
-    case Expr::Type::SYMBOL:
-      var_arg = args[0]->AsSymbol();
-      break;
-    case Expr::Type::PAIR: {
-      Expr* cur_arg = args[0];
-      while (auto* pair = cur_arg->AsPair()) {
-        auto* arg = TrySymbol(pair->car());
-        req_args.push_back(arg);
-        cur_arg = pair->cdr();
-      }
-      if (cur_arg != expr::Nil()) {
-        var_arg = TrySymbol(cur_arg);
-      }
-      break;
-    };
-    default:
-      throw RuntimeException("Expected arguments", nullptr);
+  // Returns the values passed to the call which resumed the continuation.
+  gc::Lock<Expr> TakeResumeValues() {
+    return ReturnValues(std::exchange(resume_val_, nullptr), resume_multiple_);
   }
 
-  std::vector<gc::Lock<Expr>> locks;
-  locks.reserve(num_args - 1);
-  // TODO(bcf): Analyze in other places as appropriate.
-  for (size_t i = 1; i < num_args; ++i) {
-    auto lock = eval::Analyze(args[i]);
-    args[i] = lock.get();
-    locks.push_back(std::move(lock));
-  }
+ private:
+  ~Continuation() override = default;
 
-  req_args.shrink_to_fit();
-  return gc::Lock<Expr>(new LambdaImpl(std::move(req_args), var_arg,
-                                       {args + 1, args + num_args}, env));
-}
+  eval::StackCapture capture_;
+  Expr* resume_val_ = nullptr;
+  bool resume_multiple_ = false;
+};
 
-gc::Lock<Expr> If(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgsGe(num_args, 2);
-  ExpectNumArgsLe(num_args, 3);
-  auto cond = Eval(args[0], env);
-  if (cond.get() == False()) {
-    if (num_args == 3) {
-      return Eval(args[2], env);
-    } else {
-      return gc::Lock<Expr>(Nil());
-    }
-  }
-  return Eval(args[1], env);
+gc::Lock<Expr> IsEqv(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  return gc::Lock<Expr>(args[0]->Eqv(args[1]) ? True() : False());
 }
 
-gc::Lock<Expr> Set(Env* env, Expr** args, size_t num_args) {
+gc::Lock<Expr> IsEq(Env* env, Expr** args, size_t num_args) {
   ExpectNumArgs(num_args, 2);
-  env->SetVar(TrySymbol(args[0]), Eval(args[1], env).get());
-  return gc::Lock<Expr>(Nil());
+  return gc::Lock<Expr>(args[0]->Eq(args[1]) ? True() : False());
 }
 
-gc::Lock<Expr> Cond(Env* env, Expr** args, size_t num_args) {
-  for (size_t i = 0; i < num_args; ++i) {
-    auto* pair = args[i]->AsPair();
-    if (!pair) {
-      throw RuntimeException(
-          "cond: bad syntax (clause is not a test-value pair)", args[i]);
-    }
-
-    auto* first = pair->car();
-    if (i == num_args - 1) {
-      auto* first_sym = first->AsSymbol();
-      if (first_sym && first_sym->val() == "else" &&
-          env->TryLookup(first_sym) == nullptr) {
-        return ExecuteList(env, pair->cdr());
-      }
-    }
-
-    auto test = Eval(first, env);
-    if (test.get() == False()) {
-      continue;
-    }
-
-    if (pair->cdr() == Nil()) {
-      return test;
-    }
-    auto* second = pair->Cr("ad");
-    auto* second_sym = second ? second->AsSymbol() : nullptr;
-    if (second_sym && second_sym->val() == "=>" &&
-        env->TryLookup(second_sym) == nullptr) {
-      auto* trailing = pair->Cr("ddd");
-      if (trailing != Nil()) {
-        throw RuntimeException("Unexpected expression", trailing);
-      }
-
-      auto val = Eval(pair->Cr("add"), env);
-      auto* func = val->AsEvals();
-      if (!func) {
-        throw RuntimeException("Expected procedure", val.get());
-      }
-
-      Expr* exprs[] = {test.get()};
-      return func->DoEval(env, exprs, 1);
-    }
+gc::Lock<Expr> IsEqual(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  return gc::Lock<Expr>(args[0]->Equal(args[1]) ? True() : False());
+}
 
-    return ExecuteList(env, pair->cdr());
-  }
+gc::Lock<Expr> IsNumber(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(args[0]->type() == Expr::Type::NUMBER ? True()
+                                                              : False());
+}
 
-  return gc::Lock<Expr>(Nil());
+gc::Lock<Expr> IsComplex(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  // We don't support complex.
+  return gc::Lock<Expr>(True());
 }
 
-gc::Lock<Expr> Case(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgsGe(num_args, 1);
-  auto key = Eval(args[0], env);
-  for (size_t i = 1; i < num_args; ++i) {
-    auto* clause = args[i]->AsPair();
-    if (!clause) {
-      throw RuntimeException("cond: bad syntax, expected clause", args[i]);
-    }
+gc::Lock<Expr> IsReal(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  // We don't support complex.
+  return gc::Lock<Expr>(True());
+}
 
-    if (i == num_args - 1) {
-      auto* first_sym = clause->car()->AsSymbol();
-      if (first_sym && first_sym->val() == "else" &&
-          env->TryLookup(first_sym) == nullptr) {
-        return ExecuteList(env, clause->cdr());
-      }
-    }
-    auto* test_list = clause->car()->AsPair();
-    if (!test_list) {
-      throw RuntimeException("case: bad syntax (not a datum sequence)",
-                             args[i]);
-    }
+gc::Lock<Expr> IsRational(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  // We don't support rational.
+  return gc::Lock<Expr>(False());
+}
 
-    Expr* cur = test_list;
-    while (auto* pair = cur->AsPair()) {
-      if (key->Eqv(pair->car())) {
-        return ExecuteList(env, clause->cdr());
-      }
-      cur = pair->cdr();
-    }
+gc::Lock<Expr> IsInteger(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  auto* num = args[0]->AsNumber();
+  if (!num) {
+    return gc::Lock<Expr>(False());
+  }
 
-    if (cur != Nil()) {
-      throw RuntimeException("case: bad syntax (malformed clause)", cur);
-    }
+  if (num->num_type() == Number::Type::INT) {
+    return gc::Lock<Expr>(True());
   }
 
-  return gc::Lock<Expr>(Nil());
+  auto* as_float = num->AsFloat();
+  assert(as_float);
+
+  return gc::Lock<Expr>(
+      as_float->val() == std::floor(as_float->val()) ? True() : False());
 }
 
-gc::Lock<Expr> And(Env* env, Expr** args, size_t num_args) {
-  gc::Lock<Expr> e;
-  for (size_t i = 0; i < num_args; ++i) {
-    e = Eval(args[i], env);
-    if (e.get() == False()) {
-      return e;
-    }
-  }
+gc::Lock<Expr> IsExact(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(args[0]->type() == Expr::Type::NUMBER &&
+                                args[0]->AsNumber()->exact()
+                            ? True()
+                            : False());
+}
 
-  return e ? e : gc::Lock<Expr>(True());
+gc::Lock<Expr> IsInexact(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(args[0]->type() == Expr::Type::NUMBER &&
+                                args[0]->AsNumber()->exact()
+                            ? False()
+                            : True());
 }
 
-gc::Lock<Expr> Or(Env* env, Expr** args, size_t num_args) {
-  for (size_t i = 0; i < num_args; ++i) {
-    auto e = Eval(args[i], env);
-    if (e.get() != False()) {
-      return e;
-    }
-  }
+gc::Lock<Expr> Min(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 1);
+  return MostOp<std::less>(args, num_args);
+}
 
-  return gc::Lock<Expr>(False());
+gc::Lock<Expr> Max(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 1);
+  return MostOp<std::greater>(args, num_args);
 }
 
-// TODO(bcf): Named let.
-gc::Lock<Expr> Let(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgsGe(num_args, 2);
-  Expr* cur = TryPair(args[0]);
-  auto new_env = gc::make_locked<Env>(env);
-  while (auto* pair = cur->AsPair()) {
-    static const char kErrMessage[] = "let: Expected binding: (var val)";
-    auto* binding = pair->car()->AsPair();
-    if (!binding) {
-      throw RuntimeException(kErrMessage, pair->car());
-    }
-    auto* var = binding->car()->AsSymbol();
-    if (!var) {
-      throw RuntimeException("let: Expected symbol for binding",
-                             binding->car());
-    }
-    auto* second_link = binding->cdr()->AsPair();
-    if (!second_link || second_link->cdr() != Nil()) {
-      throw RuntimeException(kErrMessage, binding->cdr());
-    }
-    auto* val = second_link->car();
-    new_env->DefineVar(var, Eval(val, env).get());
-
-    cur = pair->cdr();
-  }
-  if (cur != Nil()) {
-    throw RuntimeException("let: Malformed binding list", cur);
-  }
-
-  return EvalArray(new_env.get(), args + 1, num_args - 1);
-}
-
-gc::Lock<Expr> LetStar(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgsGe(num_args, 2);
-  Expr* cur = TryPair(args[0]);
-  auto new_env = gc::make_locked<Env>(env);
-  while (auto* pair = cur->AsPair()) {
-    static const char kErrMessage[] = "let*: Expected binding: (var val)";
-    auto* binding = pair->car()->AsPair();
-    if (!binding) {
-      throw RuntimeException(kErrMessage, pair->car());
-    }
-    auto* var = binding->car()->AsSymbol();
-    if (!var) {
-      throw RuntimeException("let*: Expected symbol for binding",
-                             binding->car());
-    }
-    auto* second_link = binding->cdr()->AsPair();
-    if (!second_link || second_link->cdr() != Nil()) {
-      throw RuntimeException(kErrMessage, binding->cdr());
-    }
-    auto* val = second_link->car();
-    new_env->DefineVar(var, Eval(val, new_env.get()).get());
-
-    cur = pair->cdr();
-  }
-  if (cur != Nil()) {
-    throw RuntimeException("let: Malformed binding list", cur);
-  }
-
-  return EvalArray(new_env.get(), args + 1, num_args - 1);
-}
-
-gc::Lock<Expr> LetRec(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgsGe(num_args, 2);
-  auto new_env = gc::make_locked<Env>(env);
-  std::vector<std::pair<Symbol*, Expr*>> bindings;
-
-  Expr* cur = TryPair(args[0]);
-  for (; auto* pair = cur->AsPair(); cur = pair->cdr()) {
-    static const char kErrMessage[] = "let*: Expected binding: (var val)";
-    auto* binding = pair->car()->AsPair();
-    if (!binding) {
-      throw RuntimeException(kErrMessage, pair->car());
-    }
-    auto* var = binding->car()->AsSymbol();
-    if (!var) {
-      throw RuntimeException("let*: Expected symbol for binding",
-                             binding->car());
-    }
-    auto* second_link = binding->cdr()->AsPair();
-    if (!second_link || second_link->cdr() != Nil()) {
-      throw RuntimeException(kErrMessage, binding->cdr());
-    }
-    auto* val = second_link->car();
-    bindings.emplace_back(var, val);
-    new_env->DefineVar(var, Nil());
-  }
-  if (cur != Nil()) {
-    throw RuntimeException("let: Malformed binding list", cur);
-  }
-
-  for (const auto& binding : bindings) {
-    new_env->SetVar(binding.first, Eval(binding.second, new_env.get()).get());
-  }
-
-  return EvalArray(new_env.get(), args + 1, num_args - 1);
-}
-
-gc::Lock<Expr> Begin(Env* env, Expr** args, size_t num_args) {
-  if (num_args == 0) {
-    return gc::Lock<Expr>(Nil());
-  }
-  for (; num_args > 1; --num_args, ++args) {
-    Eval(*args, env);
-  }
-  return Eval(*args, env);
-}
-
-gc::Lock<Expr> Do(Env* env, Expr** args, size_t num_args) {
-  throw util::RuntimeException("Not implemented", nullptr);
-  assert(false && env && args && num_args);
-  return {};
-}
-
-gc::Lock<Expr> Delay(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgs(num_args, 1);
-  return gc::Lock<Expr>(new Promise(args[0], env));
-}
-
-gc::Lock<Expr> Quasiquote(Env* env, Expr** args, size_t num_args) {
-  throw util::RuntimeException("Not implemented", nullptr);
-  assert(false && env && args && num_args);
-  return {};
-}
-
-gc::Lock<Expr> LetSyntax(Env* env, Expr** args, size_t num_args) {
-  throw util::RuntimeException("Not implemented", nullptr);
-  assert(false && env && args && num_args);
-  return {};
-}
-
-gc::Lock<Expr> LetRecSyntax(Env* env, Expr** args, size_t num_args) {
-  throw util::RuntimeException("Not implemented", nullptr);
-  assert(false && env && args && num_args);
-  return {};
-}
-
-gc::Lock<Expr> SyntaxRules(Env* env, Expr** args, size_t num_args) {
-  throw util::RuntimeException("Not implemented", nullptr);
-  assert(false && env && args && num_args);
-  return {};
-}
-
-gc::Lock<Expr> Define(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgs(num_args, 2);
-  env->DefineVar(TrySymbol(args[0]), Eval(args[1], env).get());
-  // TODO(bcf): handle define lambda.
-
-  return gc::Lock<Expr>(Nil());
-}
-
-gc::Lock<Expr> DefineSyntax(Env* env, Expr** args, size_t num_args) {
-  throw util::RuntimeException("Not implemented", nullptr);
-  assert(false && env && args && num_args);
-  return {};
-}
-
-gc::Lock<Expr> IsEqv(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgs(num_args, 2);
-  return gc::Lock<Expr>(args[0]->Eqv(args[1]) ? True() : False());
-}
-
-gc::Lock<Expr> IsEq(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgs(num_args, 2);
-  return gc::Lock<Expr>(args[0]->Eq(args[1]) ? True() : False());
-}
-
-gc::Lock<Expr> IsEqual(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgs(num_args, 2);
-  return gc::Lock<Expr>(args[0]->Equal(args[1]) ? True() : False());
-}
-
-gc::Lock<Expr> IsNumber(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgs(num_args, 1);
-  return gc::Lock<Expr>(args[0]->type() == Expr::Type::NUMBER ? True()
-                                                              : False());
-}
-
-gc::Lock<Expr> IsComplex(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgs(num_args, 1);
-  // We don't support complex.
-  return gc::Lock<Expr>(True());
-}
-
-gc::Lock<Expr> IsReal(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgs(num_args, 1);
-  // We don't support complex.
-  return gc::Lock<Expr>(True());
-}
-
-gc::Lock<Expr> IsRational(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgs(num_args, 1);
-  // We don't support rational.
-  return gc::Lock<Expr>(False());
-}
-
-gc::Lock<Expr> IsInteger(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgs(num_args, 1);
-  auto* num = args[0]->AsNumber();
-  if (!num) {
-    return gc::Lock<Expr>(False());
-  }
-
-  if (num->num_type() == Number::Type::INT) {
-    return gc::Lock<Expr>(True());
-  }
-
-  auto* as_float = num->AsFloat();
-  assert(as_float);
-
-  return gc::Lock<Expr>(
-      as_float->val() == std::floor(as_float->val()) ? True() : False());
-}
-
-gc::Lock<Expr> IsExact(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgs(num_args, 1);
-  return gc::Lock<Expr>(args[0]->type() == Expr::Type::NUMBER &&
-                                args[0]->AsNumber()->exact()
-                            ? True()
-                            : False());
-}
-
-gc::Lock<Expr> IsInexact(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgs(num_args, 1);
-  return gc::Lock<Expr>(args[0]->type() == Expr::Type::NUMBER &&
-                                args[0]->AsNumber()->exact()
-                            ? False()
-                            : True());
-}
-
-gc::Lock<Expr> Min(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgsGe(num_args, 1);
-  return MostOp<std::less>(args, num_args);
-}
-
-gc::Lock<Expr> Max(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgsGe(num_args, 1);
-  return MostOp<std::greater>(args, num_args);
-}
-
-gc::Lock<Expr> OpEq(Env* env, Expr** args, size_t num_args) {
+gc::Lock<Expr> OpEq(Env* env, Expr** args, size_t num_args) {
   ExpectNumArgsGe(num_args, 2);
   return CmpOp<std::equal_to>(env, args, num_args);
 }
@@ -1972,114 +1756,1107 @@ gc::Lock<Expr> VectorFill(Env* env, Expr** args, size_t num_args) {
   return gc::Lock<Expr>(Nil());
 }
 
-gc::Lock<Expr> IsProcedure(Env* env, Expr** args, size_t num_args) {
+gc::Lock<Expr> IsF64Vector(Env* env, Expr** args, size_t num_args) {
   ExpectNumArgs(num_args, 1);
-  return gc::Lock<Expr>(args[0]->type() == Expr::Type::EVALS ? True()
-                                                             : False());
+  return gc::Lock<Expr>(args[0]->type() == Expr::Type::F64VECTOR ? True()
+                                                                 : False());
 }
 
-gc::Lock<Expr> Apply(Env* env, Expr** args, size_t num_args) {
+gc::Lock<Expr> MakeF64Vector(Env* env, Expr** args, size_t num_args) {
   ExpectNumArgsGe(num_args, 1);
-  std::vector<Expr*> new_args(args + 1, args + 1 + num_args - 2);
-  if (num_args > 1) {
-    Expr* cur = args[num_args - 1];
-    for (; auto* list = cur->AsPair(); cur = list->cdr()) {
-      new_args.push_back(list->car());
-    }
-    if (cur != Nil()) {
-      throw RuntimeException("Expected list", args[num_args - 1]);
-    }
-  }
+  ExpectNumArgsLe(num_args, 2);
 
-  return TryEvals(args[0])->DoEval(env, new_args.data(), new_args.size());
+  auto count = TryGetNonNegExactIntVal(args[0]);
+  Float::ValType init_val = num_args == 2 ? TryGetFloatVal(args[1]) : 0.0;
+  return gc::Lock<Expr>(
+      new expr::F64Vector(std::vector<double>(count, init_val)));
 }
 
-gc::Lock<Expr> Map(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgsGe(num_args, 2);
-  return MapImpl<true>(env, args, num_args);
+gc::Lock<Expr> F64Vector(Env* env, Expr** args, size_t num_args) {
+  std::vector<double> vals(num_args);
+  for (size_t i = 0; i < num_args; ++i) {
+    vals[i] = TryGetFloatVal(args[i]);
+  }
+  return gc::Lock<Expr>(new expr::F64Vector(std::move(vals)));
 }
 
-gc::Lock<Expr> ForEach(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgsGe(num_args, 2);
-  return MapImpl<false>(env, args, num_args);
+gc::Lock<Expr> F64VectorLength(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(new Int(TryF64Vector(args[0])->vals().size()));
 }
 
-gc::Lock<Expr> Force(Env* env, Expr** args, size_t num_args) {
-  ExpectNumArgs(num_args, 1);
-  return TryEvals(args[0])->DoEval(env, nullptr, 0);
+gc::Lock<Expr> F64VectorRef(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  auto& vec = TryF64Vector(args[0])->vals();
+  auto idx = TryGetNonNegExactIntVal(args[1], vec.size());
+  return gc::Lock<Expr>(new Float(vec[idx]));
 }
 
-gc::Lock<Expr> CallWithCurrentContinuation(Env* env,
-                                           Expr** args,
-                                           size_t num_args) {
-  throw util::RuntimeException("Not implemented", nullptr);
-  assert(false && env && args && num_args);
-  return {};
+gc::Lock<Expr> F64VectorSet(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 3);
+  auto& vec = TryF64Vector(args[0])->vals();
+  auto idx = TryGetNonNegExactIntVal(args[1], vec.size());
+  vec[idx] = TryGetFloatVal(args[2]);
+  return gc::Lock<Expr>(Nil());
 }
 
-gc::Lock<Expr> Values(Env* env, Expr** args, size_t num_args) {
-  throw util::RuntimeException("Not implemented", nullptr);
-  assert(false && env && args && num_args);
-  return {};
+gc::Lock<Expr> F64VectorToList(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  gc::Lock<Expr> ret(Nil());
+  auto& vec_val = TryF64Vector(args[0])->vals();
+  for (auto it = vec_val.rbegin(); it != vec_val.rend(); ++it) {
+    auto val = gc::make_locked<Float>(*it);
+    ret.reset(new Pair(val.get(), ret.get()));
+  }
+
+  return ret;
 }
 
-gc::Lock<Expr> CallWithValues(Env* env, Expr** args, size_t num_args) {
-  throw util::RuntimeException("Not implemented", nullptr);
-  assert(false && env && args && num_args);
-  return {};
+gc::Lock<Expr> ListToF64Vector(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  std::vector<double> vals;
+  for (auto* expr : ExprVecFromList(args[0])) {
+    vals.push_back(TryGetFloatVal(expr));
+  }
+  return gc::Lock<Expr>(new expr::F64Vector(std::move(vals)));
 }
 
-gc::Lock<Expr> DynamicWind(Env* env, Expr** args, size_t num_args) {
-  throw util::RuntimeException("Not implemented", nullptr);
-  assert(false && env && args && num_args);
-  return {};
+gc::Lock<Expr> VectorSum(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  auto& x = TryF64Vector(args[0])->vals();
+  return gc::Lock<Expr>(new Float(util::simd::Get().sum(x.data(), x.size())));
 }
 
-gc::Lock<Expr> EvalPrim(Env* env, Expr** args, size_t num_args) {
+gc::Lock<Expr> Dot(Env* env, Expr** args, size_t num_args) {
   ExpectNumArgs(num_args, 2);
-  return Eval(args[0], TryEnv(args[1]));
+  auto& x = TryF64Vector(args[0])->vals();
+  auto& y = TryF64VectorOfSize(args[1], x.size())->vals();
+  return gc::Lock<Expr>(
+      new Float(util::simd::Get().dot(x.data(), y.data(), x.size())));
 }
 
-gc::Lock<Expr> SchemeReportEnvironment(Env* env, Expr** args, size_t num_args) {
+gc::Lock<Expr> VectorMin(Env* env, Expr** args, size_t num_args) {
   ExpectNumArgs(num_args, 1);
-  if (TryGetNonNegExactIntVal(args[0]) != kSchemeVersion) {
-    throw RuntimeException("Unsupported version", args[0]);
-  }
-  auto ret = gc::make_locked<Env>(nullptr);
-  LoadPrimitives(ret.get());
-  return gc::Lock<Expr>(ret.get());
+  return EvalReduceNonEmpty(util::simd::Get().min, args[0]);
 }
 
-gc::Lock<Expr> NullEnvironment(Env* env, Expr** args, size_t num_args) {
+gc::Lock<Expr> VectorMax(Env* env, Expr** args, size_t num_args) {
   ExpectNumArgs(num_args, 1);
-  if (TryGetNonNegExactIntVal(args[0]) != kSchemeVersion) {
-    throw RuntimeException("Unsupported version", args[0]);
-  }
+  return EvalReduceNonEmpty(util::simd::Get().max, args[0]);
+}
 
-  auto ret = gc::make_locked<Env>(nullptr);
-  LoadSyntax(ret.get());
-  return gc::Lock<Expr>(ret.get());
+gc::Lock<Expr> Axpy(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 3);
+  auto a = TryGetFloatVal(args[0]);
+  auto& x = TryF64Vector(args[1])->vals();
+  auto& y = TryF64VectorOfSize(args[2], x.size())->vals();
+  util::simd::Get().axpy(a, x.data(), y.data(), x.size());
+  return gc::Lock<Expr>(Nil());
 }
 
-gc::Lock<Expr> InteractionEnvironment(Env* env, Expr** args, size_t num_args) {
-  throw util::RuntimeException("Not implemented", nullptr);
-  assert(false && env && args && num_args);
-  return {};
+gc::Lock<Expr> Scale(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  auto a = TryGetFloatVal(args[0]);
+  auto& x = TryF64Vector(args[1])->vals();
+  util::simd::Get().scale(a, x.data(), x.size());
+  return gc::Lock<Expr>(Nil());
 }
 
-gc::Lock<Expr> CallWithInputFile(Env* env, Expr** args, size_t num_args) {
-  throw util::RuntimeException("Not implemented", nullptr);
-  assert(false && env && args && num_args);
-  return {};
+gc::Lock<Expr> VectorAdd(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  return EvalBinaryKernel(util::simd::Get().add, args[0], args[1]);
 }
 
-gc::Lock<Expr> CallWithOutputFile(Env* env, Expr** args, size_t num_args) {
-  throw util::RuntimeException("Not implemented", nullptr);
-  assert(false && env && args && num_args);
-  return {};
+gc::Lock<Expr> VectorSub(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  return EvalBinaryKernel(util::simd::Get().sub, args[0], args[1]);
 }
 
-gc::Lock<Expr> IsInputPort(Env* env, Expr** args, size_t num_args) {
+gc::Lock<Expr> VectorMul(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  return EvalBinaryKernel(util::simd::Get().mul, args[0], args[1]);
+}
+
+gc::Lock<Expr> VectorDiv(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  return EvalBinaryKernel(util::simd::Get().div, args[0], args[1]);
+}
+
+gc::Lock<Expr> IsBytevector(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(args[0]->type() == Expr::Type::BYTEVECTOR ? True()
+                                                                  : False());
+}
+
+gc::Lock<Expr> MakeBytevector(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 1);
+  ExpectNumArgsLe(num_args, 2);
+
+  auto count = TryGetNonNegExactIntVal(args[0]);
+  auto fill = num_args == 2 ? TryGetNonNegExactIntVal(args[1], 256) : 0;
+  return gc::Lock<Expr>(
+      new expr::Bytevector(std::vector<uint8_t>(count, fill)));
+}
+
+gc::Lock<Expr> Bytevector(Env* env, Expr** args, size_t num_args) {
+  std::vector<uint8_t> vals(num_args);
+  for (size_t i = 0; i < num_args; ++i) {
+    vals[i] = TryGetNonNegExactIntVal(args[i], 256);
+  }
+  return gc::Lock<Expr>(new expr::Bytevector(std::move(vals)));
+}
+
+gc::Lock<Expr> BytevectorLength(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(new Int(TryBytevector(args[0])->size()));
+}
+
+gc::Lock<Expr> BytevectorU8Ref(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntRef<uint8_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorU8Set(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntSet<uint8_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorCopy(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 1);
+  ExpectNumArgsLe(num_args, 3);
+  auto* bv = TryBytevector(args[0]);
+  auto range = TryGetRange(args, num_args, 1, bv->size());
+  return gc::Lock<Expr>(new expr::Bytevector(std::vector<uint8_t>(
+      bv->data() + range.first, bv->data() + range.second)));
+}
+
+gc::Lock<Expr> BytevectorCopyInto(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 3);
+  ExpectNumArgsLe(num_args, 5);
+  auto* to = TryBytevector(args[0]);
+  auto at = TryGetNonNegExactIntVal(args[1], to->size() + 1);
+  auto* from = TryBytevector(args[2]);
+  auto range = TryGetRange(args, num_args, 3, from->size());
+  auto count = range.second - range.first;
+  if (count > to->size() - at) {
+    throw RuntimeException("Not enough room in destination", args[1]);
+  }
+
+  if (count > 0) {
+    // Source and destination may overlap.
+    std::memmove(TryGetWritableBytes(to) + at, from->data() + range.first,
+                 count);
+  }
+  return gc::Lock<Expr>(Nil());
+}
+
+gc::Lock<Expr> BytevectorAppend(Env* env, Expr** args, size_t num_args) {
+  std::vector<uint8_t> vals;
+  for (size_t i = 0; i < num_args; ++i) {
+    auto* bv = TryBytevector(args[i]);
+    vals.insert(vals.end(), bv->data(), bv->data() + bv->size());
+  }
+  return gc::Lock<Expr>(new expr::Bytevector(std::move(vals)));
+}
+
+gc::Lock<Expr> Utf8ToString(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 1);
+  ExpectNumArgsLe(num_args, 3);
+  auto* bv = TryBytevector(args[0]);
+  auto range = TryGetRange(args, num_args, 1, bv->size());
+  auto* begin = reinterpret_cast<const char*>(bv->data());
+  return gc::Lock<Expr>(
+      new expr::String(std::string(begin + range.first, begin + range.second)));
+}
+
+gc::Lock<Expr> StringToUtf8(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  auto& str = TryString(args[0])->val();
+  return gc::Lock<Expr>(
+      new expr::Bytevector(std::vector<uint8_t>(str.begin(), str.end())));
+}
+
+gc::Lock<Expr> BytevectorS8Ref(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntRef<int8_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorS8Set(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntSet<int8_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorU16Ref(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntRef<uint16_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorU16Set(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntSet<uint16_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorS16Ref(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntRef<int16_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorS16Set(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntSet<int16_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorU32Ref(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntRef<uint32_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorU32Set(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntSet<uint32_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorS32Ref(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntRef<int32_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorS32Set(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntSet<int32_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorU64Ref(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntRef<uint64_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorU64Set(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntSet<uint64_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorS64Ref(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntRef<int64_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorS64Set(Env* env, Expr** args, size_t num_args) {
+  return BytevectorIntSet<int64_t>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorF32Ref(Env* env, Expr** args, size_t num_args) {
+  return BytevectorFloatRef<float>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorF32Set(Env* env, Expr** args, size_t num_args) {
+  return BytevectorFloatSet<float>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorF64Ref(Env* env, Expr** args, size_t num_args) {
+  return BytevectorFloatRef<double>(args, num_args);
+}
+
+gc::Lock<Expr> BytevectorF64Set(Env* env, Expr** args, size_t num_args) {
+  return BytevectorFloatSet<double>(args, num_args);
+}
+
+gc::Lock<Expr> MmapBytevector(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 1);
+  ExpectNumArgsLe(num_args, 2);
+  auto mode = expr::Bytevector::MapMode::READ_ONLY;
+  if (num_args == 2) {
+    auto& name = TrySymbol(args[1])->val();
+    if (name == "copy-on-write") {
+      mode = expr::Bytevector::MapMode::COPY_ON_WRITE;
+    } else if (name != "read-only") {
+      throw RuntimeException("Expected 'read-only or 'copy-on-write", args[1]);
+    }
+  }
+
+  auto ret = expr::Bytevector::Map(TryString(args[0])->val(), mode);
+  return gc::Lock<Expr>(ret.get());
+}
+
+gc::Lock<Expr> MakeHashTable(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsLe(num_args, 1);
+  auto kind = num_args == 1 ? TryGetHashTableKind(env, args[0])
+                            : HashTable::Kind::EQUAL;
+  return gc::Lock<Expr>(new HashTable(kind));
+}
+
+gc::Lock<Expr> IsHashTable(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(args[0]->type() == Expr::Type::HASH_TABLE ? True()
+                                                                  : False());
+}
+
+gc::Lock<Expr> AlistToHashTable(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 1);
+  ExpectNumArgsLe(num_args, 2);
+  auto kind = num_args == 2 ? TryGetHashTableKind(env, args[1])
+                            : HashTable::Kind::EQUAL;
+  auto table = gc::make_locked<HashTable>(kind);
+  Expr* cur = args[0];
+  for (; auto* list = cur->AsPair(); cur = list->cdr()) {
+    auto* entry = TryPair(list->car());
+    // Earlier associations take precedence.
+    if (table->Lookup(entry->car()) == nullptr) {
+      table->Set(entry->car(), entry->cdr());
+    }
+  }
+  if (cur != Nil()) {
+    throw RuntimeException("Expected list", args[0]);
+  }
+
+  return gc::Lock<Expr>(table.get());
+}
+
+gc::Lock<Expr> HashTableRef(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 2);
+  ExpectNumArgsLe(num_args, 3);
+  if (auto* val = TryHashTable(args[0])->Lookup(args[1])) {
+    return gc::Lock<Expr>(val);
+  }
+  if (num_args == 3) {
+    return CallProcedure(env, args[2], {});
+  }
+
+  throw RuntimeException("Key not found", args[1]);
+}
+
+gc::Lock<Expr> HashTableRefDefault(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 3);
+  auto* val = TryHashTable(args[0])->Lookup(args[1]);
+  return gc::Lock<Expr>(val ? val : args[2]);
+}
+
+gc::Lock<Expr> HashTableSet(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 3);
+  TryHashTable(args[0])->Set(args[1], args[2]);
+  return gc::Lock<Expr>(Nil());
+}
+
+gc::Lock<Expr> HashTableDelete(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  TryHashTable(args[0])->Delete(args[1]);
+  return gc::Lock<Expr>(Nil());
+}
+
+gc::Lock<Expr> HashTableExists(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  return gc::Lock<Expr>(TryHashTable(args[0])->Lookup(args[1]) ? True()
+                                                               : False());
+}
+
+gc::Lock<Expr> HashTableContains(Env* env, Expr** args, size_t num_args) {
+  return HashTableExists(env, args, num_args);
+}
+
+gc::Lock<Expr> HashTableUpdate(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 3);
+  ExpectNumArgsLe(num_args, 4);
+  auto* table = TryHashTable(args[0]);
+  gc::Lock<Expr> val(table->Lookup(args[1]));
+  if (!val) {
+    if (num_args != 4) {
+      throw RuntimeException("Key not found", args[1]);
+    }
+    val = CallProcedure(env, args[3], {});
+  }
+
+  auto new_val = CallProcedure(env, args[2], {val.get()});
+  table->Set(args[1], new_val.get());
+  return gc::Lock<Expr>(Nil());
+}
+
+gc::Lock<Expr> HashTableUpdateDefault(Env* env,
+                                      Expr** args,
+                                      size_t num_args) {
+  ExpectNumArgs(num_args, 4);
+  auto* table = TryHashTable(args[0]);
+  auto* val = table->Lookup(args[1]);
+  auto new_val = CallProcedure(env, args[2], {val ? val : args[3]});
+  table->Set(args[1], new_val.get());
+  return gc::Lock<Expr>(Nil());
+}
+
+gc::Lock<Expr> HashTableSize(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(new Int(TryHashTable(args[0])->size()));
+}
+
+gc::Lock<Expr> HashTableKeys(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return EntriesToList(
+      TryHashTable(args[0])->Entries(),
+      [](const std::pair<Expr*, Expr*>& entry,
+         std::vector<gc::Lock<Pair>>* locks) { return entry.first; });
+}
+
+gc::Lock<Expr> HashTableValues(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return EntriesToList(
+      TryHashTable(args[0])->Entries(),
+      [](const std::pair<Expr*, Expr*>& entry,
+         std::vector<gc::Lock<Pair>>* locks) { return entry.second; });
+}
+
+gc::Lock<Expr> HashTableWalk(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  // |proc| may modify the table, so keep the entries alive while walking.
+  auto entries = TryHashTable(args[0])->Entries();
+  std::vector<gc::Lock<Expr>> locks;
+  locks.reserve(entries.size() * 2);
+  for (const auto& entry : entries) {
+    locks.emplace_back(entry.first);
+    locks.emplace_back(entry.second);
+  }
+
+  for (const auto& entry : entries) {
+    CallProcedure(env, args[1], {entry.first, entry.second});
+  }
+  return gc::Lock<Expr>(Nil());
+}
+
+gc::Lock<Expr> HashTableToAlist(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return EntriesToList(TryHashTable(args[0])->Entries(),
+                       [](const std::pair<Expr*, Expr*>& entry,
+                          std::vector<gc::Lock<Pair>>* locks) {
+                         locks->push_back(gc::make_locked<Pair>(
+                             entry.first, entry.second));
+                         return locks->back().get();
+                       });
+}
+
+gc::Lock<Expr> HashTableCopy(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 1);
+  ExpectNumArgsLe(num_args, 2);
+  return gc::Lock<Expr>(TryHashTable(args[0])->Copy().get());
+}
+
+gc::Lock<Expr> HashTableClear(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  TryHashTable(args[0])->Clear();
+  return gc::Lock<Expr>(Nil());
+}
+
+// Reduces |hash| to a non negative fixnum, or into [0, bound) if given.
+gc::Lock<Expr> HashResult(size_t hash, Expr** args, size_t num_args) {
+  size_t bound = std::numeric_limits<Int::ValType>::max();
+  if (num_args == 2) {
+    bound = TryGetNonNegExactIntVal(args[1]);
+    if (bound == 0) {
+      throw RuntimeException("Expected positive bound", args[1]);
+    }
+  }
+  return gc::Lock<Expr>(new Int(hash % bound));
+}
+
+gc::Lock<Expr> Hash(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 1);
+  ExpectNumArgsLe(num_args, 2);
+  return HashResult(EqualHash(args[0]), args, num_args);
+}
+
+gc::Lock<Expr> HashEqual(Env* env, Expr** args, size_t num_args) {
+  return Hash(env, args, num_args);
+}
+
+gc::Lock<Expr> HashString(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 1);
+  ExpectNumArgsLe(num_args, 2);
+  return HashResult(StringHash(TryString(args[0])->val()), args, num_args);
+}
+
+gc::Lock<Expr> HashByIdentity(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 1);
+  ExpectNumArgsLe(num_args, 2);
+  return HashResult(EqHash(args[0]), args, num_args);
+}
+
+gc::Lock<Expr> MakeIMap(Env* env, Expr** args, size_t num_args) {
+  if (num_args % 2 != 0) {
+    throw RuntimeException("Expected alternating keys and values", nullptr);
+  }
+
+  auto ret = gc::make_locked<IMap>(Hamt(), true /* transient */);
+  for (size_t i = 0; i < num_args; i += 2) {
+    ret->SetInPlace(args[i], args[i + 1]);
+  }
+  ret->MakePersistent();
+  return gc::Lock<Expr>(ret.get());
+}
+
+gc::Lock<Expr> IsIMap(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(args[0]->type() == Expr::Type::IMAP ? True()
+                                                            : False());
+}
+
+gc::Lock<Expr> AlistToIMap(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  auto ret = gc::make_locked<IMap>(Hamt(), true /* transient */);
+  Expr* cur = args[0];
+  for (; auto* list = cur->AsPair(); cur = list->cdr()) {
+    auto* entry = TryPair(list->car());
+    // Earlier associations take precedence.
+    if (ret->Lookup(entry->car()) == nullptr) {
+      ret->SetInPlace(entry->car(), entry->cdr());
+    }
+  }
+  if (cur != Nil()) {
+    throw RuntimeException("Expected list", args[0]);
+  }
+
+  ret->MakePersistent();
+  return gc::Lock<Expr>(ret.get());
+}
+
+gc::Lock<Expr> IMapRef(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 2);
+  ExpectNumArgsLe(num_args, 3);
+  if (auto* val = TryIMap(args[0])->Lookup(args[1])) {
+    return gc::Lock<Expr>(val);
+  }
+  if (num_args == 3) {
+    return gc::Lock<Expr>(args[2]);
+  }
+
+  throw RuntimeException("Key not found", args[1]);
+}
+
+gc::Lock<Expr> IMapContains(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  return gc::Lock<Expr>(TryIMap(args[0])->Lookup(args[1]) ? True() : False());
+}
+
+gc::Lock<Expr> IMapSet(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 3);
+  return gc::Lock<Expr>(TryIMap(args[0])->Set(args[1], args[2]).get());
+}
+
+gc::Lock<Expr> IMapDelete(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  return gc::Lock<Expr>(TryIMap(args[0])->Delete(args[1]).get());
+}
+
+gc::Lock<Expr> IMapSize(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(new Int(TryIMap(args[0])->size()));
+}
+
+// Returns a list of |func(entry)| for each entry of |collection|.
+template <typename Func>
+gc::Lock<Expr> HamtToList(HamtCollection* collection, Func func) {
+  std::vector<const Hamt::Entry*> entries;
+  entries.reserve(collection->size());
+  collection->hamt().ForEach(
+      [&entries](const Hamt::Entry& entry) { entries.push_back(&entry); });
+
+  std::vector<gc::Lock<Pair>> locks;
+  gc::Lock<Expr> ret(Nil());
+  for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+    auto* val = func(**it, &locks);
+    ret.reset(new Pair(val, ret.get()));
+  }
+  return ret;
+}
+
+gc::Lock<Expr> IMapKeys(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return HamtToList(TryIMap(args[0]), [](const Hamt::Entry& entry,
+                                         std::vector<gc::Lock<Pair>>* locks) {
+    return entry.key;
+  });
+}
+
+gc::Lock<Expr> IMapValues(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return HamtToList(TryIMap(args[0]), [](const Hamt::Entry& entry,
+                                         std::vector<gc::Lock<Pair>>* locks) {
+    return entry.val;
+  });
+}
+
+gc::Lock<Expr> IMapToAlist(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return HamtToList(TryIMap(args[0]), [](const Hamt::Entry& entry,
+                                         std::vector<gc::Lock<Pair>>* locks) {
+    locks->push_back(gc::make_locked<Pair>(entry.key, entry.val));
+    return locks->back().get();
+  });
+}
+
+gc::Lock<Expr> IMapTransient(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(TryIMap(args[0])->Transient().get());
+}
+
+gc::Lock<Expr> IMapSetInPlace(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 3);
+  TryIMap(args[0])->SetInPlace(args[1], args[2]);
+  return gc::Lock<Expr>(Nil());
+}
+
+gc::Lock<Expr> IMapDeleteInPlace(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  TryIMap(args[0])->DeleteInPlace(args[1]);
+  return gc::Lock<Expr>(Nil());
+}
+
+gc::Lock<Expr> IMapPersistent(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  auto* map = TryIMap(args[0]);
+  map->MakePersistent();
+  return gc::Lock<Expr>(map);
+}
+
+gc::Lock<Expr> MakeISet(Env* env, Expr** args, size_t num_args) {
+  auto ret = gc::make_locked<ISet>(Hamt(), true /* transient */);
+  for (size_t i = 0; i < num_args; ++i) {
+    ret->AddInPlace(args[i]);
+  }
+  ret->MakePersistent();
+  return gc::Lock<Expr>(ret.get());
+}
+
+gc::Lock<Expr> IsISet(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(args[0]->type() == Expr::Type::ISET ? True()
+                                                            : False());
+}
+
+gc::Lock<Expr> ListToISet(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  auto ret = gc::make_locked<ISet>(Hamt(), true /* transient */);
+  Expr* cur = args[0];
+  for (; auto* list = cur->AsPair(); cur = list->cdr()) {
+    ret->AddInPlace(list->car());
+  }
+  if (cur != Nil()) {
+    throw RuntimeException("Expected list", args[0]);
+  }
+
+  ret->MakePersistent();
+  return gc::Lock<Expr>(ret.get());
+}
+
+gc::Lock<Expr> ISetContains(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  return gc::Lock<Expr>(TryISet(args[0])->Contains(args[1]) ? True()
+                                                            : False());
+}
+
+gc::Lock<Expr> ISetAdd(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  return gc::Lock<Expr>(TryISet(args[0])->Add(args[1]).get());
+}
+
+gc::Lock<Expr> ISetRemove(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  return gc::Lock<Expr>(TryISet(args[0])->Remove(args[1]).get());
+}
+
+gc::Lock<Expr> ISetSize(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(new Int(TryISet(args[0])->size()));
+}
+
+gc::Lock<Expr> ISetToList(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return HamtToList(TryISet(args[0]), [](const Hamt::Entry& entry,
+                                         std::vector<gc::Lock<Pair>>* locks) {
+    return entry.key;
+  });
+}
+
+gc::Lock<Expr> ISetTransient(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(TryISet(args[0])->Transient().get());
+}
+
+gc::Lock<Expr> ISetAddInPlace(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  TryISet(args[0])->AddInPlace(args[1]);
+  return gc::Lock<Expr>(Nil());
+}
+
+gc::Lock<Expr> ISetRemoveInPlace(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  TryISet(args[0])->RemoveInPlace(args[1]);
+  return gc::Lock<Expr>(Nil());
+}
+
+gc::Lock<Expr> ISetPersistent(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  auto* set = TryISet(args[0]);
+  set->MakePersistent();
+  return gc::Lock<Expr>(set);
+}
+
+gc::Lock<Expr> IsProcedure(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(args[0]->type() == Expr::Type::EVALS ? True()
+                                                             : False());
+}
+
+gc::Lock<Expr> Apply(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 1);
+  size_t num_leading = num_args > 1 ? num_args - 2 : 0;
+  size_t num_listed = 0;
+  if (num_args > 1) {
+    Expr* cur = args[num_args - 1];
+    for (; auto* list = cur->AsPair(); cur = list->cdr()) {
+      ++num_listed;
+    }
+    if (cur != Nil()) {
+      throw RuntimeException("Expected list", args[num_args - 1]);
+    }
+  }
+
+  eval::StackSlots new_args(num_leading + num_listed);
+  std::copy(args + 1, args + 1 + num_leading, new_args.get());
+  size_t i = num_leading;
+  for (Expr* cur = num_listed ? args[num_args - 1] : Nil(); cur != Nil();
+       cur = cur->AsPair()->cdr()) {
+    new_args[i++] = cur->AsPair()->car();
+  }
+
+  return TryEvals(args[0])->DoEval(env, new_args.get(),
+                                   num_leading + num_listed);
+}
+
+gc::Lock<Expr> Map(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 2);
+  return MapImpl<true>(env, args, num_args);
+}
+
+gc::Lock<Expr> ForEach(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 2);
+  return MapImpl<false>(env, args, num_args);
+}
+
+gc::Lock<Expr> Force(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return TryEvals(args[0])->DoEval(env, nullptr, 0);
+}
+
+gc::Lock<Expr> MakePromise(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  if (dynamic_cast<eval::Promise*>(args[0])) {
+    return gc::Lock<Expr>(args[0]);
+  }
+  return eval::Promise::MakeForced(args[0]);
+}
+
+gc::Lock<Expr> IsPromise(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(dynamic_cast<eval::Promise*>(args[0]) ? True()
+                                                              : False());
+}
+
+// Streams are promises of either '() or a pair of an element and the stream
+// of the rest, as in SRFI 41.
+
+// Forces |stream|, returning '() or a pair.
+gc::Lock<Expr> ForceStream(Env* env, Expr* stream) {
+  auto* promise = dynamic_cast<eval::Promise*>(stream);
+  if (!promise) {
+    throw RuntimeException("Expected stream", stream);
+  }
+  auto ret = promise->DoEval(env, nullptr, 0);
+  if (ret.get() != Nil() && !ret->AsPair()) {
+    throw RuntimeException("Expected stream", stream);
+  }
+  return ret;
+}
+
+gc::Lock<Expr> MakeStreamPair(Expr* car, Expr* cdr) {
+  gc::Lock<Expr> pair(new Pair(car, cdr));
+  return eval::Promise::MakeForced(pair.get());
+}
+
+// The thunk of the lazy promise stream-map, stream-filter or stream-take
+// returns. Each call forces as much of |stream| as the next element needs and
+// returns the promise of the result from there, so a long run of elements
+// filtered out doesn't grow the stack.
+class StreamThunk : public Evals {
+ public:
+  enum class Op { MAP, FILTER, TAKE };
+
+  StreamThunk(Op op, Expr* proc, Expr* stream, Int::ValType count)
+      : op_(op), proc_(proc), stream_(stream), count_(count) {}
+
+  static gc::Lock<Expr> MakeStream(Op op,
+                                   Expr* proc,
+                                   Expr* stream,
+                                   Int::ValType count) {
+    gc::Lock<Expr> thunk(new StreamThunk(op, proc, stream, count));
+    return gc::Lock<Expr>(new eval::Promise(thunk.get(), true));
+  }
+
+  // Evals implementation:
+  std::ostream& AppendStream(std::ostream& stream) const override {
+    return stream << "stream-thunk";
+  }
+
+  gc::Lock<Expr> DoEval(Env* env, Expr** args, size_t num_args) override {
+    if (op_ == Op::TAKE && count_ <= 0) {
+      return eval::Promise::MakeForced(Nil());
+    }
+    gc::Lock<Expr> stream(stream_);
+    eval::StackSlots arg(1);
+    while (true) {
+      auto pair = ForceStream(env, stream.get());
+      if (pair.get() == Nil()) {
+        return eval::Promise::MakeForced(Nil());
+      }
+      arg[0] = pair->AsPair()->car();
+      Expr* rest = pair->AsPair()->cdr();
+      switch (op_) {
+        case Op::MAP: {
+          auto val = TryEvals(proc_)->DoEval(env, arg.get(), 1);
+          auto tail = MakeStream(op_, proc_, rest, 0);
+          return MakeStreamPair(val.get(), tail.get());
+        }
+        case Op::FILTER:
+          if (TryEvals(proc_)->DoEval(env, arg.get(), 1).get() != False()) {
+            auto tail = MakeStream(op_, proc_, rest, 0);
+            return MakeStreamPair(arg[0], tail.get());
+          }
+          stream.reset(rest);
+          break;
+        case Op::TAKE: {
+          auto tail = MakeStream(op_, nullptr, rest, count_ - 1);
+          return MakeStreamPair(arg[0], tail.get());
+        }
+      }
+    }
+  }
+
+  void MarkReferences() override {
+    if (proc_)
+      proc_->GcMark();
+    stream_->GcMark();
+  }
+
+ private:
+  ~StreamThunk() override = default;
+
+  const Op op_;
+  Expr* const proc_;
+  Expr* const stream_;
+  const Int::ValType count_;
+};
+
+gc::Lock<Expr> Stream(Env* env, Expr** args, size_t num_args) {
+  auto ret = eval::Promise::MakeForced(Nil());
+  for (size_t i = num_args; i > 0; --i) {
+    ret = MakeStreamPair(args[i - 1], ret.get());
+  }
+  return ret;
+}
+
+gc::Lock<Expr> StreamCar(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  auto pair = ForceStream(env, args[0]);
+  return gc::Lock<Expr>(TryPair(pair.get())->car());
+}
+
+gc::Lock<Expr> StreamCdr(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  auto pair = ForceStream(env, args[0]);
+  return gc::Lock<Expr>(TryPair(pair.get())->cdr());
+}
+
+gc::Lock<Expr> IsStreamNull(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  return gc::Lock<Expr>(ForceStream(env, args[0]).get() == Nil() ? True()
+                                                                 : False());
+}
+
+gc::Lock<Expr> IsStreamPair(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  if (!dynamic_cast<eval::Promise*>(args[0])) {
+    return gc::Lock<Expr>(False());
+  }
+  return gc::Lock<Expr>(ForceStream(env, args[0])->AsPair() ? True()
+                                                            : False());
+}
+
+gc::Lock<Expr> StreamMap(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  TryEvals(args[0]);
+  return StreamThunk::MakeStream(StreamThunk::Op::MAP, args[0], args[1], 0);
+}
+
+gc::Lock<Expr> StreamFilter(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  TryEvals(args[0]);
+  return StreamThunk::MakeStream(StreamThunk::Op::FILTER, args[0], args[1],
+                                 0);
+}
+
+gc::Lock<Expr> StreamTake(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  Int::ValType count = TryInt(args[0])->val();
+  if (count < 0) {
+    throw RuntimeException("Expected non-negative count", args[0]);
+  }
+  return StreamThunk::MakeStream(StreamThunk::Op::TAKE, nullptr, args[1],
+                                 count);
+}
+
+// (stream->list stream [count]) forces at most |count| elements.
+gc::Lock<Expr> StreamToList(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgsGe(num_args, 1);
+  ExpectNumArgsLe(num_args, 2);
+  Int::ValType count = -1;
+  if (num_args == 2) {
+    count = TryInt(args[1])->val();
+    if (count < 0) {
+      throw RuntimeException("Expected non-negative count", args[1]);
+    }
+  }
+  gc::Lock<Expr> ret(Nil());
+  Pair* prev = nullptr;
+  gc::Lock<Expr> stream(args[0]);
+  for (; count != 0; --count) {
+    auto pair = ForceStream(env, stream.get());
+    if (pair.get() == Nil()) {
+      break;
+    }
+    // Reachable from |ret| once linked in.
+    auto link = gc::make_locked<Pair>(pair->AsPair()->car(), Nil());
+    if (prev) {
+      prev->set_cdr(link.get());
+    } else {
+      ret.reset(link.get());
+    }
+    prev = link.get();
+    stream.reset(pair->AsPair()->cdr());
+  }
+  return ret;
+}
+
+// Everything this holds across the receiver is on the value stack, so its
+// stacks may be copied.
+gc::Lock<Expr> CallWithCurrentContinuation(Env* env,
+                                           Expr** args,
+                                           size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  auto* proc = TryEvals(args[0]);
+  eval::StackSlots k_arg(1);
+  auto* k = new Continuation();
+  k_arg[0] = k;
+  auto& capture = k->capture();
+  if (capture.Enter(__builtin_frame_address(0)) &&
+      __builtin_setjmp(capture.jump_buffer())) {
+    eval::StackCapture::FinishResume();
+    return static_cast<Continuation*>(k_arg[0])->TakeResumeValues();
+  }
+  try {
+    auto ret = proc->DoEval(env, k_arg.get(), 1);
+    capture.Exit();
+    return ret;
+  } catch (ContinuationThrow& e) {
+    capture.Exit();
+    if (e.target != k) {
+      throw;
+    }
+    return ReturnValues(e.val.get(), e.multiple);
+  } catch (...) {
+    capture.Exit();
+    throw;
+  }
+}
+
+gc::Lock<Expr> Values(Env* env, Expr** args, size_t num_args) {
+  return gc::Lock<Expr>(eval::MultipleValues::Get().Set(args, num_args));
+}
+
+// The values are moved to the value stack, since the consumer may return
+// values of its own.
+gc::Lock<Expr> CallWithValues(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  auto* producer = TryEvals(args[0]);
+  auto* consumer = TryEvals(args[1]);
+  eval::StackSlots val(1);
+  val[0] = producer->DoEval(env, nullptr, 0).get();
+  if (val[0] != eval::MultipleValuesMarker()) {
+    return consumer->DoEval(env, val.get(), 1);
+  }
+
+  auto& values = eval::MultipleValues::Get();
+  auto num_vals = values.num_vals();
+  eval::StackSlots vals(num_vals);
+  std::copy(values.vals(), values.vals() + num_vals, vals.get());
+  values.Clear();
+  return consumer->DoEval(env, vals.get(), num_vals);
+}
+
+// |after| runs whenever |thunk| is left, be it by returning, a continuation or
+// an error. Primitives other than a few are barriers to resuming
+// continuations, so |thunk| is never entered again.
+gc::Lock<Expr> DynamicWind(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 3);
+  auto* before = TryEvals(args[0]);
+  auto* thunk = TryEvals(args[1]);
+  auto* after = TryEvals(args[2]);
+  before->DoEval(env, nullptr, 0);
+  gc::Lock<Expr> ret;
+  try {
+    ret = thunk->DoEval(env, nullptr, 0);
+  } catch (...) {
+    after->DoEval(env, nullptr, 0);
+    throw;
+  }
+  if (ret.get() != eval::MultipleValuesMarker()) {
+    after->DoEval(env, nullptr, 0);
+    return ret;
+  }
+
+  // |after| may return values of its own.
+  auto& values = eval::MultipleValues::Get();
+  auto num_vals = values.num_vals();
+  eval::StackSlots vals(num_vals);
+  std::copy(values.vals(), values.vals() + num_vals, vals.get());
+  after->DoEval(env, nullptr, 0);
+  return gc::Lock<Expr>(values.Set(vals.get(), num_vals));
+}
+
+gc::Lock<Expr> EvalPrim(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 2);
+  return Eval(args[0], TryEnv(args[1]));
+}
+
+gc::Lock<Expr> SchemeReportEnvironment(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  if (TryGetNonNegExactIntVal(args[0]) != kSchemeVersion) {
+    throw RuntimeException("Unsupported version", args[0]);
+  }
+  auto ret = gc::make_locked<Env>(nullptr);
+  LoadPrimitives(ret.get());
+  return gc::Lock<Expr>(ret.get());
+}
+
+gc::Lock<Expr> NullEnvironment(Env* env, Expr** args, size_t num_args) {
+  ExpectNumArgs(num_args, 1);
+  if (TryGetNonNegExactIntVal(args[0]) != kSchemeVersion) {
+    throw RuntimeException("Unsupported version", args[0]);
+  }
+
+  auto ret = gc::make_locked<Env>(nullptr);
+  LoadSyntax(ret.get());
+  return gc::Lock<Expr>(ret.get());
+}
+
+gc::Lock<Expr> InteractionEnvironment(Env* env, Expr** args, size_t num_args) {
+  throw util::RuntimeException("Not implemented", nullptr);
+  assert(false && env && args && num_args);
+  return {};
+}
+
+gc::Lock<Expr> CallWithInputFile(Env* env, Expr** args, size_t num_args) {
+  throw util::RuntimeException("Not implemented", nullptr);
+  assert(false && env && args && num_args);
+  return {};
+}
+
+gc::Lock<Expr> CallWithOutputFile(Env* env, Expr** args, size_t num_args) {
+  throw util::RuntimeException("Not implemented", nullptr);
+  assert(false && env && args && num_args);
+  return {};
+}
+
+gc::Lock<Expr> IsInputPort(Env* env, Expr** args, size_t num_args) {
   ExpectNumArgs(num_args, 1);
   return gc::Lock<Expr>(args[0]->type() == Expr::Type::INPUT_PORT ? True()
                                                                   : False());
@@ -2211,15 +2988,6 @@ gc::Lock<Expr> TranscriptOff(Env* env, Expr** args, size_t num_args) {
   return {};
 }
 
-const struct {
-  PrimitiveFunc func;
-  const char* name;
-} kSyntax[] = {
-#define X(name, str) {name, #str},
-#include "expr/syntax.inc"  // NOLINT(build/include)
-#undef X
-};
-
 const struct {
   PrimitiveFunc func;
   const char* name;
@@ -2232,25 +3000,123 @@ const struct {
 }  // namespace
 
 void LoadSyntax(Env* env) {
-  for (const auto& syntax : kSyntax) {
-    env->DefineVar(Symbol::NewLock(syntax.name).get(),
-                   gc::make_locked<PrimitiveImpl>(syntax.name, syntax.func,
-                                                  false /* eval_args */)
-                       .get());
+  static const Syntax::Kind kKinds[] = {
+#define X(name, str) Syntax::Kind::name,
+#include "expr/syntax.inc"  // NOLINT(build/include)
+#undef X
+  };
+
+  for (auto kind : kKinds) {
+    auto syntax = gc::make_locked<Syntax>(kind);
+    env->DefineVar(Symbol::NewLock(syntax->name()).get(), syntax.get());
   }
 }
 
 void LoadPrimitives(Env* env) {
   LoadSyntax(env);
   for (const auto& primitive : kPrimitives) {
-    env->DefineVar(Symbol::NewLock(primitive.name).get(),
-                   gc::make_locked<PrimitiveImpl>(
-                       primitive.name, primitive.func, true /* eval_args */)
-                       .get());
+    auto impl = gc::make_locked<PrimitiveImpl>(
+        static_cast<Primitive>(&primitive - kPrimitives), primitive.name,
+        primitive.func);
+    env->DefineVar(Symbol::NewLock(primitive.name).get(), impl.get());
   }
+  // call/cc is the same procedure under its usual abbreviation.
+  auto call_cc = Symbol::NewLock("call-with-current-continuation");
+  env->DefineVar(Symbol::NewLock("call/cc").get(), env->Lookup(call_cc.get()));
 
   std::string tmp;
   LoadCr(env, kCrDepth, &tmp);
 }
 
+gc::Lock<Expr> NewPrimitive(Primitive primitive) {
+  const auto& entry = kPrimitives[static_cast<size_t>(primitive)];
+  return gc::Lock<Expr>(new PrimitiveImpl(primitive, entry.name, entry.func));
+}
+
+bool IsOpenCoded(Primitive primitive, size_t num_args) {
+  switch (primitive) {
+    case Primitive::Plus:
+    case Primitive::Minus:
+    case Primitive::OpEq:
+    case Primitive::OpLt:
+    case Primitive::OpGt:
+    case Primitive::OpLe:
+    case Primitive::OpGe:
+    case Primitive::IsEq:
+      return num_args == 2;
+    case Primitive::Car:
+    case Primitive::Cdr:
+    case Primitive::IsNull:
+    case Primitive::IsPair:
+      return num_args == 1;
+    default:
+      return false;
+  }
+}
+
+Expr* OpenCode(Primitive primitive, Expr** args, size_t num_args) {
+  assert(IsOpenCoded(primitive, num_args));
+  switch (primitive) {
+    case Primitive::IsEq:
+      return args[0] == args[1] ? True() : False();
+    case Primitive::Car:
+      return args[0]->type() == Expr::Type::PAIR ? args[0]->AsPair()->car()
+                                                 : nullptr;
+    case Primitive::Cdr:
+      return args[0]->type() == Expr::Type::PAIR ? args[0]->AsPair()->cdr()
+                                                 : nullptr;
+    case Primitive::IsNull:
+      return args[0] == Nil() ? True() : False();
+    case Primitive::IsPair:
+      return args[0]->type() == Expr::Type::PAIR ? True() : False();
+    default:
+      break;
+  }
+
+  if (args[0]->type() != Expr::Type::NUMBER ||
+      args[1]->type() != Expr::Type::NUMBER) {
+    return nullptr;
+  }
+  auto* lhs = args[0]->AsNumber()->AsInt();
+  auto* rhs = args[1]->AsNumber()->AsInt();
+  if (!lhs || !rhs) {
+    return nullptr;
+  }
+
+  // Results which overflow are left to the primitive.
+  Int::ValType res;
+  switch (primitive) {
+    case Primitive::Plus:
+      return __builtin_add_overflow(lhs->val(), rhs->val(), &res)
+                 ? nullptr
+                 : new Int(res);
+    case Primitive::Minus:
+      return __builtin_sub_overflow(lhs->val(), rhs->val(), &res)
+                 ? nullptr
+                 : new Int(res);
+    case Primitive::OpEq:
+      return lhs->val() == rhs->val() ? True() : False();
+    case Primitive::OpLt:
+      return lhs->val() < rhs->val() ? True() : False();
+    case Primitive::OpGt:
+      return lhs->val() > rhs->val() ? True() : False();
+    case Primitive::OpLe:
+      return lhs->val() <= rhs->val() ? True() : False();
+    case Primitive::OpGe:
+      return lhs->val() >= rhs->val() ? True() : False();
+    default:
+      assert(false);
+      return nullptr;
+  }
+}
+
+bool GetPrimitive(Expr* proc, Primitive* primitive) {
+  auto* impl = dynamic_cast<PrimitiveImpl*>(proc);
+  if (!impl) {
+    return false;
+  }
+  *primitive = impl->primitive();
+  return true;
+}
+
 }  // namespace expr
@@ -20,9 +20,40 @@
 #ifndef EXPR_PRIMITIVE_H_
 #define EXPR_PRIMITIVE_H_
 
+#include <cstddef>
+
+#include "gc/lock.h"
+
 namespace expr {
 
 class Env;
+class Expr;
+
+// The procedures loaded by LoadPrimitives().
+enum class Primitive {
+#define X(name, str) name,
+#include "expr/primitives.inc"  // NOLINT(build/include)
+#undef X
+};
+
+// Returns true and sets |primitive| if |proc| is one of the procedures loaded
+// by LoadPrimitives(), whatever it is bound to. Compilers use this to
+// implement calls to them inline.
+bool GetPrimitive(Expr* proc, Primitive* primitive);
+
+// Returns a new procedure for |primitive|, like the one LoadPrimitives() binds
+// to its name. Code which must call it whatever the name is bound to, such as
+// expanded quasiquotes, refers to it directly.
+gc::Lock<Expr> NewPrimitive(Primitive primitive);
+
+// Returns true if calls of |primitive| with |num_args| arguments have an open
+// coded fast path: two argument fixnum +, - and comparisons, eq?, car, cdr,
+// null? and pair?.
+bool IsOpenCoded(Primitive primitive, size_t num_args);
+
+// Computes such a call without going through the procedure. Returns null if
+// the arguments need the full primitive, which also reports errors.
+Expr* OpenCode(Primitive primitive, Expr** args, size_t num_args);
 
 // Load basic syntax (e.g lambda, if).
 void LoadSyntax(Env* env);
@@ -17,6 +17,7 @@
  * along with parp.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cstdlib>
 
 #include "expr/expr.h"
@@ -26,8 +27,11 @@ namespace gc {
 
 namespace {
 
-// Right now just run collection every |kCollectionRate| allocations.
-constexpr int kCollectionRate = 1000;
+// Run collection every |kCollectionRate| allocations, or once the number of
+// allocations reaches the number of objects which survived the last
+// collection, whichever is later. The latter keeps the cost of collection
+// proportional to allocation when the heap is large.
+constexpr size_t kCollectionRate = 1000;
 
 }  // namespace
 
@@ -59,7 +63,8 @@ void* Gc::AllocExpr(std::size_t size) {
     Collect();
   }
 
-  if (alloc_since_last_collection_ >= kCollectionRate) {
+  if (alloc_since_last_collection_ >=
+      std::max(kCollectionRate, live_after_last_collection_)) {
     Collect();
   }
   ++alloc_since_last_collection_;
@@ -77,14 +82,28 @@ void Gc::Purge() {
   symbol_name_to_symbol_.clear();
 }
 
+void Gc::RemoveRootSet(RootSet* roots) {
+  root_sets_.erase(std::remove(root_sets_.begin(), root_sets_.end(), roots),
+                   root_sets_.end());
+}
+
 void Gc::Collect() {
   alloc_since_last_collection_ = 0;
+  for (auto* roots : root_sets_) {
+    roots->MarkRoots();
+  }
   for (auto expr : exprs_) {
     if (expr->gc_lock_count_ > 0) {
       expr->GcMark();
     }
   }
 
+  while (!mark_stack_.empty()) {
+    auto* expr = mark_stack_.back();
+    mark_stack_.pop_back();
+    expr->MarkReferences();
+  }
+
   for (auto it = exprs_.begin(); it != exprs_.end();) {
     expr::Expr* expr = *it;
     if (expr->gc_mark_) {
@@ -96,6 +115,7 @@ void Gc::Collect() {
     DeleteExpr(expr);
     it = exprs_.erase(it);
   }
+  live_after_last_collection_ = exprs_.size();
 }
 
 void Gc::DeleteExpr(expr::Expr* expr) {
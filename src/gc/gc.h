@@ -21,10 +21,12 @@
 #define GC_GC_H_
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "util/macros.h"
 
@@ -35,6 +37,17 @@ class Symbol;
 
 namespace gc {
 
+// Memory outside the heap holding references which are not locked, such as
+// the VM's value stack. Registered sets are marked at the start of each
+// collection.
+class RootSet {
+ public:
+  virtual void MarkRoots() = 0;
+
+ protected:
+  ~RootSet() = default;
+};
+
 // TODO(bcf): Implement garbage collection for real
 class Gc {
  public:
@@ -46,6 +59,18 @@ class Gc {
   void Collect();
   size_t NumObjects() { return exprs_.size(); }
 
+  void AddRootSet(RootSet* roots) { root_sets_.push_back(roots); }
+  void RemoveRootSet(RootSet* roots);
+
+  // Called when |expr| is marked. Its references are marked during collection.
+  void PushMarked(expr::Expr* expr) { mark_stack_.push_back(expr); }
+
+  // Incremented whenever objects are relocated. Containers which hash object
+  // addresses must rehash when this changes. The current collector never moves
+  // objects, but a compacting collector must call NotifyObjectsMoved().
+  uint64_t move_epoch() const { return move_epoch_; }
+  void NotifyObjectsMoved() { ++move_epoch_; }
+
   // If true, will collect on every single allocation.
   void set_debug_mode(bool debug_mode) { debug_mode_ = debug_mode; }
 
@@ -56,12 +81,18 @@ class Gc {
   void DeleteExpr(expr::Expr* expr);
 
   bool debug_mode_ = false;
+  uint64_t move_epoch_ = 0;
 
   // Number of allocations since last collection.
   size_t alloc_since_last_collection_ = 0;
+  size_t live_after_last_collection_ = 0;
 
   std::unordered_map<std::string, expr::Symbol*> symbol_name_to_symbol_;
   std::unordered_set<expr::Expr*> exprs_;
+  std::vector<RootSet*> root_sets_;
+
+  // Marked objects whose references have not been marked yet.
+  std::vector<expr::Expr*> mark_stack_;
 
   DISALLOW_MOVE_COPY_AND_ASSIGN(Gc);
 };
@@ -22,32 +22,72 @@
 #include <cstring>
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <vector>
 
 #include "repl.h"  // NOLINT(build/include)
 #include "expr/expr.h"
+#include "eval/emit_cxx.h"
 #include "eval/eval.h"
 #include "parse/parse.h"
 #include "util/flags.h"
 #include "util/text_stream.h"
 
+namespace {
+
+// Writes |files| to standard output as one C++ program.
+int EmitCxx(const std::vector<std::string>& files) {
+  auto env = eval::GetDefaultEnv();
+  std::vector<gc::Lock<eval::Node>> locks;
+  std::vector<eval::Node*> forms;
+  try {
+    for (const auto& file : files) {
+      std::ifstream ifs(file);
+      if (!ifs) {
+        std::cerr << "Failed to read " << file << ": " << strerror(errno);
+        return EXIT_FAILURE;
+      }
+
+      util::TextStream ts(&ifs, file);
+      for (const auto& expr : parse::Read(ts)) {
+        auto node = eval::Analyze(expr.get(), env.get());
+        locks.push_back(eval::Optimize(node.get(), env.get()));
+        forms.push_back(locks.back().get());
+      }
+    }
+    eval::EmitCxx(forms, std::cout);
+  } catch (std::exception& e) {
+    std::cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+}  // namespace
+
 int main(int argc, char** argv) {
   util::Flags::Init(argc, argv);
-  if (argc <= 1) {
+  const auto& files = util::Flags::Args();
+  if (util::Flags::IsSet(util::Flags::kEmitCxx)) {
+    return EmitCxx(files);
+  }
+  if (files.empty()) {
     repl::Start();
     return EXIT_SUCCESS;
   }
 
   auto env = eval::GetDefaultEnv();
 
-  for (int i = 1; i < argc; ++i) {
-    std::ifstream ifs(argv[i]);
+  for (const auto& file : files) {
+    std::ifstream ifs(file);
     if (!ifs) {
-      std::cerr << "Failed to read " << argv[i] << ": " << strerror(errno);
+      std::cerr << "Failed to read " << file << ": " << strerror(errno);
       return EXIT_FAILURE;
     }
 
     try {
-      util::TextStream ts(&ifs, argv[i]);
+      util::TextStream ts(&ifs, file);
       for (const auto& expr : parse::Read(ts)) {
         eval::Eval(expr.get(), env.get());
       }
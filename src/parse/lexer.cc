@@ -313,6 +313,9 @@ std::ostream& Token::PrettyPrint(std::ostream& stream) const {
     case Token::Type::POUND_PAREN:
       stream << "#(";
       break;
+    case Token::Type::POUND_U8_PAREN:
+      stream << "#u8(";
+      break;
     case Token::Type::QUOTE:
       stream << "'";
       break;
@@ -368,6 +371,7 @@ std::ostream& operator<<(std::ostream& stream, Token::Type type) {
     CASE_TYPE(LPAREN);
     CASE_TYPE(RPAREN);
     CASE_TYPE(POUND_PAREN);
+    CASE_TYPE(POUND_U8_PAREN);
     CASE_TYPE(QUOTE);
     CASE_TYPE(BACKTICK);
     CASE_TYPE(COMMA);
@@ -569,6 +573,14 @@ const Token& Lexer::NextToken() {
           stream_.Get();  // Consume the (
           token_.type = Token::Type::POUND_PAREN;
           break;
+        case 'u':
+          stream_.Get();  // Consume the u
+          if (stream_.Get() != '8' || stream_.Get() != '(') {
+            throw util::SyntaxException("Invalid token: expected #u8(",
+                                        &token_.mark);
+          }
+          token_.type = Token::Type::POUND_U8_PAREN;
+          break;
         default:
           std::string msg = std::string("Invalid token: ") + '#' +
                             static_cast<char>(stream_.Peek());
@@ -48,14 +48,15 @@ struct Token {
     CHAR,    // character
     STRING,  // string
 
-    LPAREN,       // (
-    RPAREN,       // )
-    POUND_PAREN,  // #(
-    QUOTE,        // '
-    BACKTICK,     // `
-    COMMA,        // ,
-    COMMA_AT,     // ,@
-    DOT,          // .
+    LPAREN,          // (
+    RPAREN,          // )
+    POUND_PAREN,     // #(
+    POUND_U8_PAREN,  // #u8(
+    QUOTE,           // '
+    BACKTICK,        // `
+    COMMA,           // ,
+    COMMA_AT,        // ,@
+    DOT,             // .
   };
 
   Token() = default;
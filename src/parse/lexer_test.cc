@@ -419,7 +419,8 @@ TEST_F(LexerTest, OtherTest) {
       "`\n"
       ",\n"
       ",@\n"
-      ".\n";
+      ".\n"
+      "#u8(\n";
 
   const std::string kFilename = "foo";
 
@@ -432,6 +433,7 @@ TEST_F(LexerTest, OtherTest) {
       {Token::Type::COMMA, {&kFilename, 6, 1}, nullptr},
       {Token::Type::COMMA_AT, {&kFilename, 7, 1}, nullptr},
       {Token::Type::DOT, {&kFilename, 8, 1}, nullptr},
+      {Token::Type::POUND_U8_PAREN, {&kFilename, 9, 1}, nullptr},
   };
 
   std::istringstream s(kStr);
@@ -25,6 +25,8 @@
 #include <vector>
 #include <utility>
 
+#include "expr/bytevector.h"
+#include "expr/number.h"
 #include "parse/lexer.h"
 #include "util/exceptions.h"
 
@@ -50,6 +52,7 @@ class DatumParser {
   gc::Lock<expr::Expr> ParseExpr();
   gc::Lock<expr::Expr> ParseList();
   gc::Lock<expr::Expr> ParseVector();
+  gc::Lock<expr::Expr> ParseBytevector();
 
   Lexer lexer_;
   const Token* cur_token_ = nullptr;
@@ -89,6 +92,9 @@ gc::Lock<expr::Expr> DatumParser::ParseExpr() {
     case Token::Type::POUND_PAREN:
       return ParseVector();
 
+    case Token::Type::POUND_U8_PAREN:
+      return ParseBytevector();
+
     default: {
       std::ostringstream ss;
       Tok().PrettyPrint(ss);
@@ -199,6 +205,26 @@ gc::Lock<expr::Expr> DatumParser::ParseVector() {
   return gc::Lock<expr::Expr>(new Vector(std::move(exprs)));
 }
 
+gc::Lock<expr::Expr> DatumParser::ParseBytevector() {
+  assert(Tok().type == Token::Type::POUND_U8_PAREN);
+  AdvTok();
+  std::vector<uint8_t> vals;
+  while (Tok().type != Token::Type::RPAREN) {
+    if (Tok().type != Token::Type::NUMBER) {
+      ThrowException("Expected byte in bytevector");
+    }
+    auto* num = Tok().expr->AsNumber()->AsInt();
+    if (num == nullptr || num->val() < 0 || num->val() > 255) {
+      ThrowException("Expected byte in bytevector");
+    }
+    vals.push_back(num->val());
+    AdvTok();
+  }
+  AdvTok();  // Skip RPAREN
+
+  return gc::Lock<expr::Expr>(new expr::Bytevector(std::move(vals)));
+}
+
 }  // namespace
 
 ExprVec Read(util::TextStream& stream) {  // NOLINT(runtime/references)
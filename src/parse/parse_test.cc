@@ -18,7 +18,9 @@
  */
 
 #include <string>
+#include <vector>
 
+#include "expr/bytevector.h"
 #include "expr/number.h"
 #include "parse/parse.h"
 #include "test/util.h"
@@ -96,6 +98,19 @@ TEST_F(ParserTest, ReadVector) {
   VerifyExprs(expected, Read(kStr));
 }
 
+TEST_F(ParserTest, ReadBytevector) {
+  const std::string kStr = "#u8(0 1 255) #u8()";
+  ExprVec expected = {
+      gc::Lock<Expr>(new expr::Bytevector(std::vector<uint8_t>{0, 1, 255})),
+      gc::Lock<Expr>(new expr::Bytevector(std::vector<uint8_t>())),
+  };
+  VerifyExprs(expected, Read(kStr));
+
+  EXPECT_THROW(Read("#u8(256)"), util::SyntaxException);
+  EXPECT_THROW(Read("#u8(a)"), util::SyntaxException);
+  EXPECT_THROW(Read("#u8 (1)"), util::SyntaxException);
+}
+
 TEST_F(ParserTest, ReadListAbbreviation) {
   const std::string kStr =
       "'a\n"
@@ -51,7 +51,7 @@ void Start() {
     try {
       auto exprs = eval::EvalString(input, env.get(), "repl");
       if (!exprs.empty()) {
-        std::cout << *exprs.back() << "\n";
+        eval::WriteResult(std::cout, exprs.back().get());
       }
     } catch (std::exception& e) {
       std::cout << e.what() << "\n";
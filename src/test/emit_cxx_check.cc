@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "eval/compiled.h"
+#include "eval/eval.h"
+#include "parse/parse.h"
+#include "util/flags.h"
+#include "util/text_stream.h"
+
+// The main() of a program written by parp --emit-cxx and built with
+// PARP_NO_MAIN, which checks it against the interpreter: each top level form
+// of the file the program was written from is evaluated, and its value
+// compared with the compiled form's.
+int main(int argc, char** argv) {
+  util::Flags::Init(argc, argv);
+  const auto& files = util::Flags::Args();
+  if (files.size() != 1) {
+    std::cerr << "Usage: " << argv[0] << " FILE\n";
+    return EXIT_FAILURE;
+  }
+  const auto& file = files[0];
+  std::ifstream ifs(file);
+  if (!ifs) {
+    std::cerr << "Failed to read " << file << ": " << strerror(errno) << "\n";
+    return EXIT_FAILURE;
+  }
+
+  try {
+    util::TextStream ts(&ifs, file);
+    auto forms = parse::Read(ts);
+    auto env = eval::GetDefaultEnv();
+    std::vector<gc::Lock<expr::Expr>> expected;
+    for (const auto& form : forms) {
+      expected.push_back(eval::Eval(form.get(), env.get()));
+    }
+
+    auto compiled_env = eval::GetDefaultEnv();
+    auto actual = eval::compiled::RunProgram(compiled_env.get());
+    if (actual.size() != expected.size()) {
+      std::cerr << file << ": " << expected.size() << " forms, "
+                << actual.size() << " compiled\n";
+      return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    for (size_t i = 0; i < forms.size(); ++i) {
+      if (!expected[i]->Equal(actual[i].get())) {
+        std::cerr << file << ": " << *forms[i] << "\n"
+                  << "  interpreted: " << *expected[i] << "\n"
+                  << "  compiled: " << *actual[i] << "\n";
+        status = EXIT_FAILURE;
+      }
+    }
+    return status;
+  } catch (std::exception& e) {
+    std::cerr << file << ": " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+}
@@ -52,6 +52,19 @@ class RuntimeException : public std::exception {
   std::string full_msg_;
 };
 
+// Thrown when an evaluation uses up the fuel or time eval::SetFuel() and
+// eval::SetTimeout() allow it. It isn't a RuntimeException, so handlers of
+// the program's errors don't mistake it for one.
+class LimitException : public std::exception {
+ public:
+  explicit LimitException(const std::string& msg) : msg_(msg) {}
+
+  const char* what() const throw() override { return msg_.c_str(); }
+
+ private:
+  std::string msg_;
+};
+
 }  // namespace util
 
 #endif  // UTIL_EXCEPTIONS_H_
@@ -21,18 +21,25 @@
 
 #include <getopt.h>
 
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <map>
 
+#include "eval/eval.h"
 #include "gc/gc.h"
 
 namespace util {
 namespace {
 
 constexpr char kOptionHeader[] = "--";
+constexpr size_t kDefaultJitThreshold = 1000;
 
 std::vector<std::string> g_argv;
+std::vector<std::string> g_args;
 std::map<std::string, std::string> g_arg_map;
 
 void PrintFlags() {
@@ -40,6 +47,40 @@ void PrintFlags() {
   std::cout << "  -h\t\t\t Display this message\n";
   std::cout << "  " << kOptionHeader << Flags::kDebugMemory
             << "\t Enable strict memory checking\n";
+  std::cout << "  " << kOptionHeader << Flags::kDumpOptimized
+            << "\t Print each form to standard error once optimized\n";
+  std::cout << "  " << kOptionHeader << Flags::kEmitCxx
+            << "\t\t Write the files as a C++ program to standard output\n";
+  std::cout << "  " << kOptionHeader << Flags::kEngine
+            << "=ENGINE\t Execution engine: tree (default) or vm\n";
+  std::cout << "  " << kOptionHeader << Flags::kFuel
+            << "=STEPS\t Stop each top level form after STEPS calls and loop"
+            << " iterations\n";
+  std::cout << "  " << kOptionHeader << Flags::kJit
+            << "[=CALLS]\t Compile lambdas the tree walker calls CALLS times"
+            << " (default " << kDefaultJitThreshold << ") to native code\n";
+  std::cout << "  " << kOptionHeader << Flags::kMaxStack
+            << "=MB\t Allow recursion to use MB megabytes of stack (default "
+            << (eval::GetMaxStack() >> 20) << ")\n";
+  std::cout << "  " << kOptionHeader << Flags::kTimeout
+            << "=MS\t Stop each top level form after MS milliseconds\n";
+}
+
+// Returns the positive number |value| of |flag|, at most |max|, or exits.
+uint64_t ParseCount(const char* flag,
+                    const std::string& value,
+                    uint64_t max = UINT64_MAX) {
+  // strtoull() skips leading space and accepts a sign, negating the result for
+  // "-", so the number must start with a digit.
+  char* end;
+  errno = 0;
+  uint64_t count = std::strtoull(value.c_str(), &end, 10);
+  if (value.empty() || !std::isdigit(static_cast<unsigned char>(value[0])) ||
+      *end != '\0' || errno == ERANGE || count == 0 || count > max) {
+    std::cerr << "Invalid " << flag << ": " << value << "\n";
+    exit(EXIT_FAILURE);
+  }
+  return count;
 }
 
 void PrintHelp() {
@@ -57,6 +98,20 @@ void PrintTestHelp() {
 
 // static
 constexpr char Flags::kDebugMemory[];
+// static
+constexpr char Flags::kDumpOptimized[];
+// static
+constexpr char Flags::kEmitCxx[];
+// static
+constexpr char Flags::kEngine[];
+// static
+constexpr char Flags::kFuel[];
+// static
+constexpr char Flags::kJit[];
+// static
+constexpr char Flags::kMaxStack[];
+// static
+constexpr char Flags::kTimeout[];
 
 // static
 void Flags::Init(int argc, char** argv, bool test_mode) {
@@ -67,6 +122,13 @@ void Flags::Init(int argc, char** argv, bool test_mode) {
 
   while (true) {
     static struct option kOptions[] = {{kDebugMemory, no_argument, 0, 0},
+                                       {kDumpOptimized, no_argument, 0, 0},
+                                       {kEmitCxx, no_argument, 0, 0},
+                                       {kEngine, required_argument, 0, 0},
+                                       {kFuel, required_argument, 0, 0},
+                                       {kJit, optional_argument, 0, 0},
+                                       {kMaxStack, required_argument, 0, 0},
+                                       {kTimeout, required_argument, 0, 0},
                                        {0, 0, 0, 0}};
 
     // Supress error messages
@@ -99,9 +161,60 @@ void Flags::Init(int argc, char** argv, bool test_mode) {
     }
   }
 
+  // getopt moves the arguments which aren't flags to the end.
+  for (int i = optind; i < argc; ++i) {
+    g_args.push_back(argv[i]);
+  }
+
   if (IsSet(kDebugMemory)) {
     gc::Gc::Get().set_debug_mode(true);
   }
+
+  if (IsSet(kDumpOptimized)) {
+    eval::SetDumpOptimized(true);
+  }
+
+  auto engine = g_arg_map.find(kEngine);
+  if (engine != g_arg_map.end()) {
+    if (engine->second == "vm") {
+      eval::SetEngine(eval::Engine::VM);
+    } else if (engine->second != "tree") {
+      std::cerr << "Unknown engine: " << engine->second << "\n";
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  auto jit = g_arg_map.find(kJit);
+  if (jit != g_arg_map.end()) {
+    size_t threshold = kDefaultJitThreshold;
+    if (!jit->second.empty()) {
+      char* end;
+      threshold = std::strtoul(jit->second.c_str(), &end, 10);
+      if (*end != '\0' || threshold == 0) {
+        std::cerr << "Invalid jit threshold: " << jit->second << "\n";
+        exit(EXIT_FAILURE);
+      }
+    }
+    eval::SetJitThreshold(threshold);
+  }
+
+  auto fuel = g_arg_map.find(kFuel);
+  if (fuel != g_arg_map.end()) {
+    eval::SetFuel(ParseCount(kFuel, fuel->second));
+  }
+
+  auto max_stack = g_arg_map.find(kMaxStack);
+  if (max_stack != g_arg_map.end()) {
+    // The size is in MiB, limited so it can be converted to bytes.
+    auto mib = ParseCount(kMaxStack, max_stack->second, SIZE_MAX >> 20);
+    eval::SetMaxStack(mib << 20);
+  }
+
+  auto timeout = g_arg_map.find(kTimeout);
+  if (timeout != g_arg_map.end()) {
+    eval::SetTimeout(
+        std::chrono::milliseconds(ParseCount(kTimeout, timeout->second)));
+  }
 }
 
 // static
@@ -109,6 +222,11 @@ const std::vector<std::string>& Flags::Argv() {
   return g_argv;
 }
 
+// static
+const std::vector<std::string>& Flags::Args() {
+  return g_args;
+}
+
 // static
 bool Flags::IsSet(const std::string& value) {
   return g_arg_map.find(value) != g_arg_map.end();
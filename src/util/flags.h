@@ -28,10 +28,19 @@ namespace util {
 class Flags {
  public:
   static constexpr char kDebugMemory[] = "debug-memory";
+  static constexpr char kDumpOptimized[] = "dump-optimized";
+  static constexpr char kEmitCxx[] = "emit-cxx";
+  static constexpr char kEngine[] = "engine";
+  static constexpr char kFuel[] = "fuel";
+  static constexpr char kJit[] = "jit";
+  static constexpr char kMaxStack[] = "max-stack";
+  static constexpr char kTimeout[] = "timeout";
 
   // Test mode ignores unrecognized flags
   static void Init(int argc, char** argv, bool test_mode = false);
   static const std::vector<std::string>& Argv();
+  // The arguments which aren't flags, in order.
+  static const std::vector<std::string>& Args();
   static bool IsSet(const std::string& value);
 
  private:
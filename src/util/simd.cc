@@ -0,0 +1,424 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PARP_SIMD_X86 1
+#endif
+
+#include <cassert>
+#include <limits>
+
+namespace util {
+namespace simd {
+
+namespace {
+
+// Number of interleaved accumulators used by reductions. Every implementation
+// must combine them in the same order so results are bit identical:
+//   b[j] = op(acc[j], acc[j + 4])
+//   c[j] = op(b[j], b[j + 2])
+//   result = op(c[0], c[1]), then the remaining tail elements in order.
+constexpr size_t kLanes = 8;
+
+constexpr double kInf = std::numeric_limits<double>::infinity();
+
+// Comparisons match the semantics of minpd/maxpd, which return the second
+// operand if either operand is NaN.
+inline double MinOp(double a, double b) {
+  return a < b ? a : b;
+}
+
+inline double MaxOp(double a, double b) {
+  return a > b ? a : b;
+}
+
+inline double AddOp(double a, double b) {
+  return a + b;
+}
+
+template <double (*Op)(double, double)>
+double Combine(const double* acc) {
+  double b[4];
+  for (size_t j = 0; j < 4; ++j) {
+    b[j] = Op(acc[j], acc[j + 4]);
+  }
+  return Op(Op(b[0], b[2]), Op(b[1], b[3]));
+}
+
+template <double (*Op)(double, double)>
+double ReduceScalar(const double* x, size_t n, double init) {
+  double acc[kLanes];
+  for (auto& a : acc) {
+    a = init;
+  }
+
+  size_t i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    for (size_t j = 0; j < kLanes; ++j) {
+      acc[j] = Op(acc[j], x[i + j]);
+    }
+  }
+
+  double ret = Combine<Op>(acc);
+  for (; i < n; ++i) {
+    ret = Op(ret, x[i]);
+  }
+  return ret;
+}
+
+double SumScalar(const double* x, size_t n) {
+  return ReduceScalar<AddOp>(x, n, 0.0);
+}
+
+double MinScalar(const double* x, size_t n) {
+  assert(n > 0);
+  return ReduceScalar<MinOp>(x, n, kInf);
+}
+
+double MaxScalar(const double* x, size_t n) {
+  assert(n > 0);
+  return ReduceScalar<MaxOp>(x, n, -kInf);
+}
+
+double DotScalar(const double* x, const double* y, size_t n) {
+  double acc[kLanes] = {};
+  size_t i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    for (size_t j = 0; j < kLanes; ++j) {
+      acc[j] += x[i + j] * y[i + j];
+    }
+  }
+
+  double ret = Combine<AddOp>(acc);
+  for (; i < n; ++i) {
+    ret += x[i] * y[i];
+  }
+  return ret;
+}
+
+void AxpyScalar(double a, const double* x, double* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    y[i] += a * x[i];
+  }
+}
+
+void ScaleScalar(double a, double* x, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    x[i] *= a;
+  }
+}
+
+#define DEFINE_SCALAR_BINARY(name, op)                                 \
+  void name##Scalar(const double* x, const double* y, double* out,    \
+                    size_t n) {                                        \
+    for (size_t i = 0; i < n; ++i) {                                   \
+      out[i] = x[i] op y[i];                                           \
+    }                                                                  \
+  }
+
+DEFINE_SCALAR_BINARY(Add, +)
+DEFINE_SCALAR_BINARY(Sub, -)
+DEFINE_SCALAR_BINARY(Mul, *)
+DEFINE_SCALAR_BINARY(Div, /)
+
+#undef DEFINE_SCALAR_BINARY
+
+const Kernels kScalarKernels = {
+    SumScalar,  DotScalar, MinScalar, MaxScalar, AxpyScalar, ScaleScalar,
+    AddScalar,  SubScalar, MulScalar, DivScalar,
+};
+
+#ifdef PARP_SIMD_X86
+
+// SSE2 is part of the x86-64 baseline so these need no target attribute. Four
+// 128 bit registers hold accumulators (0, 1), (2, 3), (4, 5) and (6, 7).
+
+#define DEFINE_SSE2_REDUCE(name, vop, sop, init)                           \
+  double name##Sse2(const double* x, size_t n) {                           \
+    __m128d r0 = _mm_set1_pd(init);                                        \
+    __m128d r1 = r0, r2 = r0, r3 = r0;                                     \
+    size_t i = 0;                                                          \
+    for (; i + kLanes <= n; i += kLanes) {                                 \
+      r0 = vop(r0, _mm_loadu_pd(x + i));                                   \
+      r1 = vop(r1, _mm_loadu_pd(x + i + 2));                               \
+      r2 = vop(r2, _mm_loadu_pd(x + i + 4));                               \
+      r3 = vop(r3, _mm_loadu_pd(x + i + 6));                               \
+    }                                                                      \
+    __m128d c = vop(vop(r0, r2), vop(r1, r3));                             \
+    double ret = sop(_mm_cvtsd_f64(c), _mm_cvtsd_f64(_mm_unpackhi_pd(c, c))); \
+    for (; i < n; ++i) {                                                   \
+      ret = sop(ret, x[i]);                                                \
+    }                                                                      \
+    return ret;                                                            \
+  }
+
+DEFINE_SSE2_REDUCE(Sum, _mm_add_pd, AddOp, 0.0)
+DEFINE_SSE2_REDUCE(Min, _mm_min_pd, MinOp, kInf)
+DEFINE_SSE2_REDUCE(Max, _mm_max_pd, MaxOp, -kInf)
+
+#undef DEFINE_SSE2_REDUCE
+
+double DotSse2(const double* x, const double* y, size_t n) {
+  __m128d r0 = _mm_setzero_pd();
+  __m128d r1 = r0, r2 = r0, r3 = r0;
+  size_t i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    r0 = _mm_add_pd(r0, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+    r1 = _mm_add_pd(
+        r1, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+    r2 = _mm_add_pd(
+        r2, _mm_mul_pd(_mm_loadu_pd(x + i + 4), _mm_loadu_pd(y + i + 4)));
+    r3 = _mm_add_pd(
+        r3, _mm_mul_pd(_mm_loadu_pd(x + i + 6), _mm_loadu_pd(y + i + 6)));
+  }
+  __m128d c = _mm_add_pd(_mm_add_pd(r0, r2), _mm_add_pd(r1, r3));
+  double ret = _mm_cvtsd_f64(c) + _mm_cvtsd_f64(_mm_unpackhi_pd(c, c));
+  for (; i < n; ++i) {
+    ret += x[i] * y[i];
+  }
+  return ret;
+}
+
+void AxpySse2(double a, const double* x, double* y, size_t n) {
+  __m128d va = _mm_set1_pd(a);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d prod = _mm_mul_pd(va, _mm_loadu_pd(x + i));
+    _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), prod));
+  }
+  for (; i < n; ++i) {
+    y[i] += a * x[i];
+  }
+}
+
+void ScaleSse2(double a, double* x, size_t n) {
+  __m128d va = _mm_set1_pd(a);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    _mm_storeu_pd(x + i, _mm_mul_pd(_mm_loadu_pd(x + i), va));
+  }
+  for (; i < n; ++i) {
+    x[i] *= a;
+  }
+}
+
+#define DEFINE_SSE2_BINARY(name, vop, op)                                     \
+  void name##Sse2(const double* x, const double* y, double* out, size_t n) { \
+    size_t i = 0;                                                             \
+    for (; i + 2 <= n; i += 2) {                                              \
+      _mm_storeu_pd(out + i, vop(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));  \
+    }                                                                         \
+    for (; i < n; ++i) {                                                      \
+      out[i] = x[i] op y[i];                                                  \
+    }                                                                         \
+  }
+
+DEFINE_SSE2_BINARY(Add, _mm_add_pd, +)
+DEFINE_SSE2_BINARY(Sub, _mm_sub_pd, -)
+DEFINE_SSE2_BINARY(Mul, _mm_mul_pd, *)
+DEFINE_SSE2_BINARY(Div, _mm_div_pd, /)
+
+#undef DEFINE_SSE2_BINARY
+
+const Kernels kSse2Kernels = {
+    SumSse2, DotSse2, MinSse2, MaxSse2, AxpySse2,
+    ScaleSse2, AddSse2, SubSse2, MulSse2, DivSse2,
+};
+
+// AVX2 kernels. Two 256 bit registers hold accumulators (0..3) and (4..7).
+// FMA is deliberately not used so results match the other implementations.
+#define AVX2_FUNC __attribute__((target("avx2")))
+
+// Reduces the two accumulator registers to a scalar in the canonical order.
+#define AVX2_COMBINE(v0, v1, vop, sop)                                  \
+  __m256d b = _mm256_##vop(v0, v1);                                     \
+  __m128d c = _mm_##vop(_mm256_castpd256_pd128(b),                      \
+                        _mm256_extractf128_pd(b, 1));                   \
+  double ret = sop(_mm_cvtsd_f64(c), _mm_cvtsd_f64(_mm_unpackhi_pd(c, c)))
+
+#define DEFINE_AVX2_REDUCE(name, vop, sop, init)                      \
+  AVX2_FUNC double name##Avx2(const double* x, size_t n) {            \
+    __m256d v0 = _mm256_set1_pd(init);                                \
+    __m256d v1 = v0;                                                  \
+    size_t i = 0;                                                     \
+    for (; i + kLanes <= n; i += kLanes) {                            \
+      v0 = _mm256_##vop(v0, _mm256_loadu_pd(x + i));                  \
+      v1 = _mm256_##vop(v1, _mm256_loadu_pd(x + i + 4));              \
+    }                                                                 \
+    AVX2_COMBINE(v0, v1, vop, sop);                                   \
+    for (; i < n; ++i) {                                              \
+      ret = sop(ret, x[i]);                                           \
+    }                                                                 \
+    return ret;                                                       \
+  }
+
+DEFINE_AVX2_REDUCE(Sum, add_pd, AddOp, 0.0)
+DEFINE_AVX2_REDUCE(Min, min_pd, MinOp, kInf)
+DEFINE_AVX2_REDUCE(Max, max_pd, MaxOp, -kInf)
+
+#undef DEFINE_AVX2_REDUCE
+
+AVX2_FUNC double DotAvx2(const double* x, const double* y, size_t n) {
+  __m256d v0 = _mm256_setzero_pd();
+  __m256d v1 = v0;
+  size_t i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    v0 = _mm256_add_pd(
+        v0, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    v1 = _mm256_add_pd(v1, _mm256_mul_pd(_mm256_loadu_pd(x + i + 4),
+                                         _mm256_loadu_pd(y + i + 4)));
+  }
+  AVX2_COMBINE(v0, v1, add_pd, AddOp);
+  for (; i < n; ++i) {
+    ret += x[i] * y[i];
+  }
+  return ret;
+}
+
+#undef AVX2_COMBINE
+
+AVX2_FUNC void AxpyAvx2(double a, const double* x, double* y, size_t n) {
+  __m256d va = _mm256_set1_pd(a);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d prod = _mm256_mul_pd(va, _mm256_loadu_pd(x + i));
+    _mm256_storeu_pd(y + i, _mm256_add_pd(_mm256_loadu_pd(y + i), prod));
+  }
+  for (; i < n; ++i) {
+    y[i] += a * x[i];
+  }
+}
+
+AVX2_FUNC void ScaleAvx2(double a, double* x, size_t n) {
+  __m256d va = _mm256_set1_pd(a);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(x + i, _mm256_mul_pd(_mm256_loadu_pd(x + i), va));
+  }
+  for (; i < n; ++i) {
+    x[i] *= a;
+  }
+}
+
+#define DEFINE_AVX2_BINARY(name, vop, op)                                  \
+  AVX2_FUNC void name##Avx2(const double* x, const double* y, double* out, \
+                            size_t n) {                                    \
+    size_t i = 0;                                                          \
+    for (; i + 4 <= n; i += 4) {                                           \
+      _mm256_storeu_pd(out + i, _mm256_##vop(_mm256_loadu_pd(x + i),       \
+                                             _mm256_loadu_pd(y + i)));     \
+    }                                                                      \
+    for (; i < n; ++i) {                                                   \
+      out[i] = x[i] op y[i];                                               \
+    }                                                                      \
+  }
+
+DEFINE_AVX2_BINARY(Add, add_pd, +)
+DEFINE_AVX2_BINARY(Sub, sub_pd, -)
+DEFINE_AVX2_BINARY(Mul, mul_pd, *)
+DEFINE_AVX2_BINARY(Div, div_pd, /)
+
+#undef DEFINE_AVX2_BINARY
+#undef AVX2_FUNC
+
+const Kernels kAvx2Kernels = {
+    SumAvx2, DotAvx2, MinAvx2, MaxAvx2, AxpyAvx2,
+    ScaleAvx2, AddAvx2, SubAvx2, MulAvx2, DivAvx2,
+};
+
+#endif  // PARP_SIMD_X86
+
+bool IsSupported(Isa isa) {
+  switch (isa) {
+    case Isa::SCALAR:
+      return true;
+#ifdef PARP_SIMD_X86
+    case Isa::SSE2:
+      return __builtin_cpu_supports("sse2");
+    case Isa::AVX2:
+      return __builtin_cpu_supports("avx2");
+#else
+    case Isa::SSE2:
+    case Isa::AVX2:
+      return false;
+#endif
+  }
+
+  assert(false);
+  return false;
+}
+
+}  // namespace
+
+const char* IsaToString(Isa isa) {
+  switch (isa) {
+    case Isa::SCALAR:
+      return "scalar";
+    case Isa::SSE2:
+      return "sse2";
+    case Isa::AVX2:
+      return "avx2";
+  }
+
+  assert(false);
+  return nullptr;
+}
+
+Isa BestIsa() {
+  if (IsSupported(Isa::AVX2)) {
+    return Isa::AVX2;
+  }
+  if (IsSupported(Isa::SSE2)) {
+    return Isa::SSE2;
+  }
+  return Isa::SCALAR;
+}
+
+const Kernels& Get() {
+  static const Kernels* kernels = GetForIsa(BestIsa());
+  return *kernels;
+}
+
+const Kernels* GetForIsa(Isa isa) {
+  if (!IsSupported(isa)) {
+    return nullptr;
+  }
+
+  switch (isa) {
+    case Isa::SCALAR:
+      return &kScalarKernels;
+#ifdef PARP_SIMD_X86
+    case Isa::SSE2:
+      return &kSse2Kernels;
+    case Isa::AVX2:
+      return &kAvx2Kernels;
+#else
+    default:
+      break;
+#endif
+  }
+
+  return nullptr;
+}
+
+}  // namespace simd
+}  // namespace util
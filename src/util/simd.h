@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UTIL_SIMD_H_
+#define UTIL_SIMD_H_
+
+#include <cstddef>
+
+namespace util {
+namespace simd {
+
+// Instruction sets kernels are available for, in order of preference.
+enum class Isa {
+  SCALAR,
+  SSE2,
+  AVX2,
+};
+
+const char* IsaToString(Isa isa);
+
+// Table of numeric kernels over unboxed doubles.
+//
+// Reductions (sum, dot, min, max) use eight interleaved accumulators which are
+// combined in a fixed order, so every implementation produces bit identical
+// results. min and max require n > 0.
+struct Kernels {
+  double (*sum)(const double* x, size_t n);
+  double (*dot)(const double* x, const double* y, size_t n);
+  double (*min)(const double* x, size_t n);
+  double (*max)(const double* x, size_t n);
+
+  // y = a * x + y
+  void (*axpy)(double a, const double* x, double* y, size_t n);
+  // x = a * x
+  void (*scale)(double a, double* x, size_t n);
+
+  // out = x op y. |out| may alias |x| or |y|.
+  void (*add)(const double* x, const double* y, double* out, size_t n);
+  void (*sub)(const double* x, const double* y, double* out, size_t n);
+  void (*mul)(const double* x, const double* y, double* out, size_t n);
+  void (*div)(const double* x, const double* y, double* out, size_t n);
+};
+
+// Best instruction set supported by the running CPU.
+Isa BestIsa();
+
+// Kernels for the best instruction set supported by the running CPU.
+const Kernels& Get();
+
+// Kernels for |isa|, or nullptr if the running CPU doesn't support it.
+const Kernels* GetForIsa(Isa isa);
+
+}  // namespace simd
+}  // namespace util
+
+#endif  // UTIL_SIMD_H_
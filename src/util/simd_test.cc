@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2015 Bailey Forrest <baileycforrest@gmail.com>
+ *
+ * This file is part of parp.
+ *
+ * parp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * parp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with parp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "util/simd.h"
+
+namespace util {
+namespace simd {
+
+namespace {
+
+// Lengths covering empty input, partial and full accumulator blocks and tails.
+const size_t kLengths[] = {0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 63, 1000};
+
+std::vector<double> RandomVals(size_t n, std::mt19937* gen) {
+  std::uniform_real_distribution<double> dist(-1000.0, 1000.0);
+  std::vector<double> ret(n);
+  for (auto& val : ret) {
+    val = dist(*gen);
+  }
+  return ret;
+}
+
+std::vector<double> IntegralVals(size_t n, std::mt19937* gen) {
+  std::uniform_int_distribution<int> dist(-1000, 1000);
+  std::vector<double> ret(n);
+  for (auto& val : ret) {
+    val = dist(*gen);
+  }
+  return ret;
+}
+
+// Compares bit patterns so -0.0 vs 0.0 and NaN payloads are distinguished.
+void ExpectBitEq(double expected, double actual) {
+  EXPECT_EQ(0, std::memcmp(&expected, &actual, sizeof(double)))
+      << expected << " vs " << actual;
+}
+
+void ExpectBitEq(const std::vector<double>& expected,
+                 const std::vector<double>& actual) {
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    ExpectBitEq(expected[i], actual[i]);
+  }
+}
+
+// Kernels for every instruction set the running CPU supports.
+std::vector<const Kernels*> SupportedKernels() {
+  std::vector<const Kernels*> ret;
+  for (auto isa : {Isa::SCALAR, Isa::SSE2, Isa::AVX2}) {
+    if (auto* kernels = GetForIsa(isa)) {
+      ret.push_back(kernels);
+    }
+  }
+  return ret;
+}
+
+class SimdTest : public testing::Test {
+ protected:
+  const Kernels& scalar_ = *GetForIsa(Isa::SCALAR);
+  std::mt19937 gen_{42};
+};
+
+}  // namespace
+
+TEST_F(SimdTest, ReductionsMatchScalar) {
+  for (auto* kernels : SupportedKernels()) {
+    for (auto n : kLengths) {
+      auto x = RandomVals(n, &gen_);
+      auto y = RandomVals(n, &gen_);
+      ExpectBitEq(scalar_.sum(x.data(), n), kernels->sum(x.data(), n));
+      ExpectBitEq(scalar_.dot(x.data(), y.data(), n),
+                  kernels->dot(x.data(), y.data(), n));
+      if (n > 0) {
+        ExpectBitEq(scalar_.min(x.data(), n), kernels->min(x.data(), n));
+        ExpectBitEq(scalar_.max(x.data(), n), kernels->max(x.data(), n));
+      }
+    }
+  }
+}
+
+TEST_F(SimdTest, ReductionsMatchNaiveLoop) {
+  // Integral values keep every partial sum exact so the result can't depend on
+  // summation order.
+  for (auto* kernels : SupportedKernels()) {
+    for (auto n : kLengths) {
+      auto x = IntegralVals(n, &gen_);
+      auto y = IntegralVals(n, &gen_);
+      double sum = 0.0;
+      double dot = 0.0;
+      for (size_t i = 0; i < n; ++i) {
+        sum += x[i];
+        dot += x[i] * y[i];
+      }
+      EXPECT_EQ(sum, kernels->sum(x.data(), n));
+      EXPECT_EQ(dot, kernels->dot(x.data(), y.data(), n));
+
+      if (n > 0) {
+        EXPECT_EQ(*std::min_element(x.begin(), x.end()),
+                  kernels->min(x.data(), n));
+        EXPECT_EQ(*std::max_element(x.begin(), x.end()),
+                  kernels->max(x.data(), n));
+      }
+    }
+  }
+}
+
+TEST_F(SimdTest, ElementwiseMatchScalar) {
+  using Binary = void (*)(const double*, const double*, double*, size_t);
+
+  for (auto* kernels : SupportedKernels()) {
+    const struct {
+      Binary actual;
+      Binary expected;
+    } kBinaries[] = {
+        {kernels->add, scalar_.add},
+        {kernels->sub, scalar_.sub},
+        {kernels->mul, scalar_.mul},
+        {kernels->div, scalar_.div},
+    };
+
+    for (auto n : kLengths) {
+      auto x = RandomVals(n, &gen_);
+      auto y = RandomVals(n, &gen_);
+      for (const auto& binary : kBinaries) {
+        std::vector<double> expected(n);
+        std::vector<double> actual(n);
+        binary.expected(x.data(), y.data(), expected.data(), n);
+        binary.actual(x.data(), y.data(), actual.data(), n);
+        ExpectBitEq(expected, actual);
+      }
+
+      auto expected = y;
+      auto actual = y;
+      scalar_.axpy(1.5, x.data(), expected.data(), n);
+      kernels->axpy(1.5, x.data(), actual.data(), n);
+      ExpectBitEq(expected, actual);
+
+      scalar_.scale(-3.25, expected.data(), n);
+      kernels->scale(-3.25, actual.data(), n);
+      ExpectBitEq(expected, actual);
+    }
+  }
+}
+
+TEST_F(SimdTest, OutputMayAliasInput) {
+  for (auto* kernels : SupportedKernels()) {
+    std::vector<double> x = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+    kernels->add(x.data(), x.data(), x.data(), x.size());
+    ExpectBitEq({2, 4, 6, 8, 10, 12, 14, 16, 18}, x);
+  }
+}
+
+TEST_F(SimdTest, BestIsaIsSupported) {
+  ASSERT_NE(nullptr, GetForIsa(BestIsa()));
+  EXPECT_EQ(GetForIsa(BestIsa()), &Get());
+}
+
+}  // namespace simd
+}  // namespace util
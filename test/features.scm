@@ -0,0 +1,71 @@
+; Exercises the forms parp --emit-cxx translates. make test compiles this
+; file and checks each top level value against the interpreter's.
+
+(define (count-up n)
+  (do ((i 0 (+ i 1))
+       (acc '() (cons i acc)))
+      ((= i n) (reverse acc))))
+(count-up 5)
+
+(let loop ((i 0) (sum 0))
+  (if (> i 100) sum (loop (+ i 1) (+ sum i))))
+
+(define (div-mod a b) (values (quotient a b) (remainder a b)))
+(receive (q r) (div-mod 17 5) (list q r))
+(receive (a . rest) (values 1 2 3) (list a rest))
+
+(define (find-first pred lst)
+  (call/cc
+    (lambda (return)
+      (for-each (lambda (x) (if (pred x) (return x))) lst)
+      #f)))
+(find-first negative? '(3 1 -4 1 -5))
+(find-first negative? '(1 2))
+
+(define path '())
+(define (note x) (set! path (cons x path)))
+(call/cc
+  (lambda (k)
+    (dynamic-wind
+      (lambda () (note 'before))
+      (lambda () (k 'escaped))
+      (lambda () (note 'after)))))
+(reverse path)
+
+(define-syntax swap!
+  (syntax-rules ()
+    ((_ a b) (let ((tmp a)) (set! a b) (set! b tmp)))))
+(define-syntax my-or
+  (syntax-rules ()
+    ((_) #f)
+    ((_ e) e)
+    ((_ e r ...) (let ((t e)) (if t t (my-or r ...))))))
+(let ((x 1) (y 2) (tmp 3)) (swap! x y) (list x y tmp))
+(let ((t 5)) (my-or #f t))
+
+(define n 3)
+`(1 ,n ,@(count-up n) #(a ,(* n n)) (x . ,n))
+
+(define (integers-from k) (stream-cons k (integers-from (+ k 1))))
+(define (stream-ref s k)
+  (if (= k 0) (stream-car s) (stream-ref (stream-cdr s) (- k 1))))
+(stream-ref (integers-from 0) 50)
+(stream->list
+  (stream-take 4 (stream-filter odd? (stream-map (lambda (x) (* x x)) (integers-from 1)))))
+(define p (delay (begin (note 'forced) 42)))
+(list (force p) (force p) (length path))
+(force (make-promise 7))
+(define (lazy-loop k) (if (= k 0) (delay 'done) (delay-force (lazy-loop (- k 1)))))
+(force (lazy-loop 10000))
+
+(case (* 2 3)
+  ((2 3 5 7) 'prime)
+  ((1 4 6 8 9) 'composite))
+(let* ((x 2) (y (* x x))) (letrec ((even? (lambda (n) (if (= n 0) #t (odd? (- n 1)))))
+                                  (odd? (lambda (n) (if (= n 0) #f (even? (- n 1))))))
+                           (list y (even? 100))))
+
+'("a\"b
+" #\c 2.5 #(x (y . z)) -9223372036854775808 #t ())
+(string-append "foo" (number->string 1.5))
+(apply + (map (lambda (x) (* x x)) (vector->list #(1 2 3))))
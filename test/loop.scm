@@ -0,0 +1,2 @@
+(define loop (lambda (n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1)))))
+(loop 100000000 0)